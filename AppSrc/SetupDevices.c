@@ -9,6 +9,20 @@
 
 #define DEV_ADDR 0x04
 
+#if defined( PHY_PROFILE )
+LoRaLinkPhyProfile_t phyProfile = PHY_PROFILE;
+#define PHY_PROFILE_PTR  &phyProfile
+#else
+#define PHY_PROFILE_PTR  NULL
+#endif
+
+#if defined( CARRIER_SENSE )
+LoRaLinkCarrierSense_t carrierSense = CARRIER_SENSE;
+#define CARRIER_SENSE_PTR  &carrierSense
+#else
+#define CARRIER_SENSE_PTR  NULL
+#endif
+
 #if defined( CLIENT )
 
 MQTTSNConf_t conf =
@@ -37,7 +51,7 @@ void start(void)
 	SetUartBaudrate(115200);
 	printf("\r\n\r\nStart\r\n");
 
-	LoRaLinkDeviceInit( CRYPTO_KEY, PANID, DEV_ADDR, SYNCWORD, UPLINK_CH, DWNLINK_CH, SF_VALUE, POWER_IN_DBM );
+	LoRaLinkDeviceInit( CRYPTO_KEY, PANID, DEV_ADDR, SYNCWORD, UPLINK_CH, DWNLINK_CH, SF_VALUE, POWER_IN_DBM, CARRIER_SENSE_PTR, PHY_PROFILE_PTR );
 	MQTTSNClientInit( &conf );
 	printf("ClientId: %s\r\n", GetClientId() );
 	Connect();
@@ -102,7 +116,14 @@ void start(void)
 	type = LORALINK_UART_TX;
 #endif
 
-	LoRaLinkUart( CRYPTO_KEY, PANID, UART_DEVADDR, type, SYNCWORD, UPLINK_CH, DWNLINK_CH, SF_VALUE );
+#if defined( RXMODEM ) && defined( RX_SCAN_SF )
+	uint8_t scanSf[] = RX_SCAN_SF;
+	LoRaLinkSetRxScan( scanSf, sizeof(scanSf) );
+#endif
+
+	LoRaLinkSetCarrierSense( CARRIER_SENSE_PTR );
+
+	LoRaLinkUart( CRYPTO_KEY, PANID, UART_DEVADDR, type, SYNCWORD, UPLINK_CH, DWNLINK_CH, SF_VALUE, PHY_PROFILE_PTR );
 }
 
 /*===============================================================*/
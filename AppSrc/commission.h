@@ -15,12 +15,15 @@
 #define UPLINK_CH       40
 #define DWNLINK_CH      46
 #define SF_VALUE        SF_9
+//#define RX_SCAN_SF      { SF_7, SF_8, SF_9 }   // SFs the Rx modem scans by CAD, replaces SF_VALUE
 #define POWER_IN_DBM    13
+//#define CARRIER_SENSE   { LORALINK_CS_CAD_RSSI, -83, 5 }   // Method, dBm, ms before each Tx, { LORALINK_CS_RSSI, -83, 5 } if not defined
 
 #define PANID           0x0102
 #define UART_DEVADDR    0xFE
 
 #define SYNCWORD        0x55
+//#define PHY_PROFILE     LORALINK_PHY_NO_CRC   // Same for all devices of the PAN, LORALINK_PHY_STANDARD if not defined
 
 uint8_t CRYPTO_KEY[] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
 
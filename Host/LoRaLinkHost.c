@@ -0,0 +1,711 @@
+/**************************************************************************************
+ *
+ * LoRaLinkHost.c
+ *
+ * Reference implementation of the modem UART link for a POSIX host.
+ * It is not part of the firmware build.
+ *
+ *    cc -O2 -c LoRaLinkHost.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#define _DEFAULT_SOURCE
+#include "LoRaLinkHost.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+
+#define FRAME_DLMT   0x7E
+#define ESCAPE       0x7D
+#define XON          0x11
+#define XOFF         0x13
+#define PAD          0x20
+
+#define SEQ_HDR_LEN  3      // Seq Ack Window
+#define WINDOW_BASE  0x80   // in the Window of a modem frame, Seq is the oldest frame the modem keeps
+#define WINDOW_RESEND 0x40  // in the Window of a host frame, the modem goes back to Ack
+#define CRC_LEN      2
+#define RSP_HDR_LEN  6      // SrcAddr Rssi(2) Snr(2) PayloadType
+
+static uint64_t Now( void );
+static speed_t Speed( uint32_t baudrate );
+static int SetTermios( int fd, uint32_t baudrate, bool rtscts );
+static uint16_t Crc16Update( uint16_t crc, uint8_t c );
+static int WriteFrame( LoRaLinkHost_t* host, uint8_t seq, LoRaLinkHostMsg_t* msg );
+static int WriteAck( LoRaLinkHost_t* host, bool resend );
+static void Pump( LoRaLinkHost_t* host );
+static void Acknowledged( LoRaLinkHost_t* host, uint8_t ack, uint8_t window, bool ackOnly );
+static bool ParseByte( LoRaLinkHost_t* host, uint8_t byte );
+static bool Decode( LoRaLinkHost_t* host, LoRaLinkHostFrame_t* frame );
+static bool DecodeRxExt( LoRaLinkHostFrame_t* frame, uint8_t* body, uint16_t len );
+static uint32_t GetUint32( uint8_t* pos );
+static int Request( LoRaLinkHost_t* host, uint8_t type, uint8_t* payload, uint16_t len, uint8_t rspType, LoRaLinkHostFrame_t* rsp, uint32_t timeout );
+
+
+int LoRaLinkHostOpen( LoRaLinkHost_t* host, const char* device, uint32_t baudrate )
+{
+	memset( host, 0, sizeof(LoRaLinkHost_t) );
+
+	host->Fd = open( device, O_RDWR | O_NOCTTY );
+	if ( host->Fd < 0 )
+	{
+		return -1;
+	}
+	if ( SetTermios( host->Fd, baudrate, false ) < 0 )
+	{
+		close( host->Fd );
+		return -1;
+	}
+	return 0;
+}
+
+void LoRaLinkHostClose( LoRaLinkHost_t* host )
+{
+	close( host->Fd );
+	host->Fd = -1;
+}
+
+bool LoRaLinkHostIsIdle( LoRaLinkHost_t* host )
+{
+	return host->TxBase == host->TxTail;
+}
+
+int LoRaLinkHostSetMode( LoRaLinkHost_t* host, uint32_t baudrate, uint8_t flags, uint32_t timeout )
+{
+	LoRaLinkHostFrame_t rsp = { 0 };
+	uint8_t req[5] = { 0 };
+	uint64_t limit = Now() + timeout;
+
+	// The modem switches right after its response, nothing may be in flight.
+	// Frames received meanwhile are discarded.
+	while ( LoRaLinkHostIsIdle( host ) == false )
+	{
+		if ( Now() > limit || LoRaLinkHostPoll( host, &rsp, 10 ) < 0 )
+		{
+			return -1;
+		}
+	}
+
+	req[0] = baudrate >> 24;
+	req[1] = baudrate >> 16;
+	req[2] = baudrate >> 8;
+	req[3] = baudrate;
+	req[4] = flags;
+
+	if ( LoRaLinkHostSend( host, 0, LORALINK_HOST_API_REQ_LINK_MODE, req, sizeof(req) ) != 0 )
+	{
+		return -1;
+	}
+
+	while ( Now() < limit )
+	{
+		if ( LoRaLinkHostPoll( host, &rsp, 10 ) == 1 && rsp.PayloadType == LORALINK_HOST_API_RSP_LINK_MODE )
+		{
+			if ( rsp.PayloadLen < 6 || ( rsp.Payload[0] | rsp.Payload[1] | rsp.Payload[2] | rsp.Payload[3] ) == 0 )
+			{
+				return -1;   // rejected
+			}
+			tcdrain( host->Fd );
+			if ( SetTermios( host->Fd, baudrate, ( flags & LORALINK_HOST_MODE_RTSCTS ) != 0 ) < 0 )
+			{
+				return -1;
+			}
+			host->Sequenced = ( flags & LORALINK_HOST_MODE_SEQUENCED ) != 0;
+			host->TxBase = host->TxNext = host->TxTail = 0;
+			host->RxSeq = 0;
+			host->Window = rsp.Payload[5];
+			host->RxPos = 0;
+			host->Recovering = false;
+			host->Retry = 0;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int LoRaLinkHostSetRxFormat( LoRaLinkHost_t* host, uint8_t version, uint32_t timeout )
+{
+	LoRaLinkHostFrame_t rsp = { 0 };
+
+	if ( Request( host, LORALINK_HOST_API_REQ_RX_FORMAT, &version, 1, LORALINK_HOST_API_RSP_RX_FORMAT, &rsp, timeout ) < 0 || rsp.PayloadLen < 1 )
+	{
+		return -1;
+	}
+	return rsp.Payload[0];
+}
+
+int LoRaLinkHostGetStats( LoRaLinkHost_t* host, uint8_t index, uint8_t flags, LoRaLinkHostFrame_t* rsp, uint32_t timeout )
+{
+	uint8_t req[2] = { index, flags };
+
+	return Request( host, LORALINK_HOST_API_REQ_STATS, req, sizeof(req), LORALINK_HOST_API_RSP_STATS, rsp, timeout );
+}
+
+int LoRaLinkHostSetDupFilter( LoRaLinkHost_t* host, uint8_t mode, uint32_t window, uint32_t timeout )
+{
+	LoRaLinkHostFrame_t rsp = { 0 };
+	uint8_t req[5] = { 0 };
+
+	req[0] = mode;
+	req[1] = window >> 24;
+	req[2] = window >> 16;
+	req[3] = window >> 8;
+	req[4] = window;
+	if ( Request( host, LORALINK_HOST_API_REQ_DUP_FILTER, req, sizeof(req), LORALINK_HOST_API_RSP_DUP_FILTER, &rsp, timeout ) < 0 || rsp.PayloadLen < 1 )
+	{
+		return -1;
+	}
+	return rsp.Payload[0];
+}
+
+int LoRaLinkHostSetFec( LoRaLinkHost_t* host, uint8_t destAddr, uint8_t group, uint32_t timeout )
+{
+	LoRaLinkHostFrame_t rsp = { 0 };
+	uint8_t req[2] = { destAddr, group };
+
+	if ( Request( host, LORALINK_HOST_API_REQ_FEC, req, sizeof(req), LORALINK_HOST_API_RSP_FEC, &rsp, timeout ) < 0 || rsp.PayloadLen < 2 )
+	{
+		return -1;
+	}
+	return rsp.Payload[1];
+}
+
+int LoRaLinkHostSendUtc( LoRaLinkHost_t* host )
+{
+	struct timespec ts;
+	uint8_t utc[6] = { 0 };
+	uint16_t ms = 0;
+
+	clock_gettime( CLOCK_REALTIME, &ts );
+	ms = ts.tv_nsec / 1000000;
+	utc[0] = ts.tv_sec >> 24;
+	utc[1] = ts.tv_sec >> 16;
+	utc[2] = ts.tv_sec >> 8;
+	utc[3] = ts.tv_sec;
+	utc[4] = ms >> 8;
+	utc[5] = ms;
+	return LoRaLinkHostSend( host, 0, LORALINK_HOST_API_RSP_UTC, utc, sizeof(utc) );
+}
+
+int LoRaLinkHostSend( LoRaLinkHost_t* host, uint8_t destAddr, uint8_t payloadType, const uint8_t* payload, uint16_t len )
+{
+	LoRaLinkHostMsg_t* msg = NULL;
+
+	if ( len > LORALINK_HOST_MAXPAYLOAD )
+	{
+		return -1;
+	}
+	if ( (uint8_t)( host->TxTail - host->TxBase ) >= LORALINK_HOST_WINDOW )
+	{
+		return 1;
+	}
+
+	msg = &host->Queue[host->TxTail % LORALINK_HOST_WINDOW];
+	msg->DestAddr = destAddr;
+	msg->PayloadType = payloadType;
+	msg->PayloadLen = len;
+	memcpy( msg->Payload, payload, len );
+
+	if ( host->Sequenced == false )
+	{
+		// Nothing to wait for, the old framing has no acknowledgement
+		return WriteFrame( host, 0, msg );
+	}
+
+	host->TxTail++;
+	Pump( host );
+	return 0;
+}
+
+int LoRaLinkHostSendQueued( LoRaLinkHost_t* host, uint8_t destAddr, uint8_t payloadType, const uint8_t* payload, uint16_t len,
+                            uint8_t frameId, uint8_t priority, uint32_t lifetime )
+{
+	uint8_t buf[LORALINK_HOST_MAXPAYLOAD];
+	uint32_t units = ( lifetime + LORALINK_HOST_LIFETIME_UNIT - 1 ) / LORALINK_HOST_LIFETIME_UNIT;
+
+	if ( len > LORALINK_HOST_MAXPAYLOAD - LORALINK_HOST_QUEUE_HDR_LEN )
+	{
+		return -1;
+	}
+	if ( units > 0xFFFF )
+	{
+		units = 0xFFFF;
+	}
+	buf[0] = frameId;
+	buf[1] = priority;
+	buf[2] = units >> 8;
+	buf[3] = units;
+	buf[4] = payloadType;
+	memcpy( buf + LORALINK_HOST_QUEUE_HDR_LEN, payload, len );
+
+	return LoRaLinkHostSend( host, destAddr, LORALINK_HOST_API_REQ_QUEUE_TX, buf, len + LORALINK_HOST_QUEUE_HDR_LEN );
+}
+
+int LoRaLinkHostPoll( LoRaLinkHost_t* host, LoRaLinkHostFrame_t* frame, uint32_t timeout )
+{
+	struct pollfd pfd = { host->Fd, POLLIN, 0 };
+	uint64_t limit = Now() + timeout;
+	uint64_t now = 0;
+	ssize_t n = 0;
+	int wait = 0;
+
+	while ( true )
+	{
+		now = Now();
+		if ( host->Sequenced == true && host->TxBase != host->TxTail && now >= host->RetxTime )
+		{
+			if ( ++host->Retry > LORALINK_HOST_MAX_RETRY )
+			{
+				return -1;
+			}
+			// Go back, or probe a closed window with the next frame
+			host->TxNext = host->TxBase;
+			host->Retransmits++;
+			host->RetxTime = now + LORALINK_HOST_RETX_TIME;
+			if ( host->Window == 0 )
+			{
+				WriteFrame( host, host->TxNext, &host->Queue[host->TxNext % LORALINK_HOST_WINDOW] );
+				host->TxNext++;
+			}
+			Pump( host );
+		}
+
+		// Bytes after a frame stay in RxBuf for the next call
+		while ( host->RxBufPos < host->RxBufLen )
+		{
+			if ( ParseByte( host, host->RxBuf[host->RxBufPos++] ) == true && Decode( host, frame ) == true )
+			{
+				return 1;
+			}
+		}
+		n = read( host->Fd, host->RxBuf, sizeof(host->RxBuf) );
+		if ( n > 0 )
+		{
+			host->RxBufLen = n;
+			host->RxBufPos = 0;
+			continue;
+		}
+
+		if ( now >= limit )
+		{
+			return 0;
+		}
+		wait = limit - now;
+		if ( host->Sequenced == true && host->TxBase != host->TxTail )
+		{
+			wait = host->RetxTime <= now ? 0 : ( host->RetxTime - now < (uint64_t)wait ? (int)( host->RetxTime - now ) : wait );
+		}
+		poll( &pfd, 1, wait );
+	}
+}
+
+/*
+ * Send the queued frames the window allows
+ */
+static void Pump( LoRaLinkHost_t* host )
+{
+	while ( host->TxNext != host->TxTail && (uint8_t)( host->TxNext - host->TxBase ) < host->Window )
+	{
+		WriteFrame( host, host->TxNext, &host->Queue[host->TxNext % LORALINK_HOST_WINDOW] );
+		host->TxNext++;
+		host->RetxTime = Now() + LORALINK_HOST_RETX_TIME;
+	}
+}
+
+static void Acknowledged( LoRaLinkHost_t* host, uint8_t ack, uint8_t window, bool ackOnly )
+{
+	// The modem is alive, a closed window is not a failure
+	host->Retry = 0;
+	host->Window = window;
+
+	if ( ack != host->TxBase && (uint8_t)( ack - host->TxBase ) <= (uint8_t)( host->TxNext - host->TxBase ) )
+	{
+		host->TxBase = ack;
+		host->Recovering = false;
+		host->RetxTime = Now() + LORALINK_HOST_RETX_TIME;
+	}
+	else if ( ackOnly == true && ack == host->TxBase && host->TxNext != host->TxBase && host->Recovering == false )
+	{
+		// Duplicate acknowledgement, a frame was lost or corrupted
+		host->TxNext = host->TxBase;
+		host->Recovering = true;
+		host->Retransmits++;
+	}
+	Pump( host );
+}
+
+static int WriteFrame( LoRaLinkHost_t* host, uint8_t seq, LoRaLinkHostMsg_t* msg )
+{
+	uint8_t raw[LORALINK_HOST_FRAME_LEN];
+	uint8_t out[1 + LORALINK_HOST_FRAME_LEN * 2];
+	uint16_t rawLen = 0;
+	uint16_t outLen = 0;
+	uint16_t len = 0;
+	uint16_t crc = 0xFFFF;
+	uint8_t chks = 0;
+	ssize_t n = 0;
+
+	if ( host->Sequenced == true )
+	{
+		// Without msg the frame only acknowledges
+		len = SEQ_HDR_LEN + ( msg != NULL ? 2 + msg->PayloadLen : 0 ) + CRC_LEN;
+		raw[rawLen++] = len >> 8;
+		raw[rawLen++] = len;
+		raw[rawLen++] = seq;
+		raw[rawLen++] = host->RxSeq;
+		raw[rawLen++] = host->Resend ? WINDOW_RESEND : 0;  // the modem does not use the window of the host
+	}
+	else
+	{
+		len = 2 + msg->PayloadLen + 1;
+		raw[rawLen++] = len >> 8;
+		raw[rawLen++] = len;
+	}
+	if ( msg != NULL )
+	{
+		raw[rawLen++] = msg->DestAddr;
+		raw[rawLen++] = msg->PayloadType;
+		memcpy( raw + rawLen, msg->Payload, msg->PayloadLen );
+		rawLen += msg->PayloadLen;
+	}
+
+	if ( host->Sequenced == true )
+	{
+		for ( uint16_t i = 0; i < rawLen; i++ )
+		{
+			crc = Crc16Update( crc, raw[i] );
+		}
+		raw[rawLen++] = crc >> 8;
+		raw[rawLen++] = crc;
+	}
+	else
+	{
+		for ( uint16_t i = 2; i < rawLen; i++ )
+		{
+			chks += raw[i];
+		}
+		raw[rawLen++] = 0xff - chks;
+	}
+
+	out[outLen++] = FRAME_DLMT;
+	for ( uint16_t i = 0; i < rawLen; i++ )
+	{
+		if ( raw[i] == FRAME_DLMT || raw[i] == ESCAPE || raw[i] == XON || raw[i] == XOFF )
+		{
+			out[outLen++] = ESCAPE;
+			out[outLen++] = raw[i] ^ PAD;
+		}
+		else
+		{
+			out[outLen++] = raw[i];
+		}
+	}
+
+	for ( uint16_t pos = 0; pos < outLen; pos += n )
+	{
+		n = write( host->Fd, out + pos, outLen - pos );
+		if ( n < 0 )
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Acknowledgement only, resend asks the modem to go back to RxSeq
+ */
+static int WriteAck( LoRaLinkHost_t* host, bool resend )
+{
+	int rc = 0;
+
+	host->Resend = resend;
+	rc = WriteFrame( host, host->TxNext, NULL );
+	host->Resend = false;
+	return rc;
+}
+
+/*
+ * Deframer, returns true when RxFrame holds a whole frame
+ */
+static bool ParseByte( LoRaLinkHost_t* host, uint8_t byte )
+{
+	uint16_t len = 0;
+
+	if ( byte == FRAME_DLMT )
+	{
+		host->RxPos = 1;
+		host->Escape = false;
+		return false;
+	}
+	if ( host->RxPos == 0 )
+	{
+		return false;
+	}
+	if ( byte == ESCAPE )
+	{
+		host->Escape = true;
+		return false;
+	}
+	if ( host->Escape == true )
+	{
+		byte ^= PAD;
+		host->Escape = false;
+	}
+
+	host->RxFrame[host->RxPos++ - 1] = byte;
+	if ( host->RxPos <= 2 )
+	{
+		return false;
+	}
+	len = ( host->RxFrame[0] << 8 ) | host->RxFrame[1];
+	if ( len + 2 > LORALINK_HOST_FRAME_LEN )
+	{
+		host->RxPos = 0;
+		host->RxErrors++;
+		return false;
+	}
+	if ( host->RxPos - 1 == len + 2 )
+	{
+		host->RxPos = 0;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Check RxFrame, returns true with a message for the application
+ */
+static bool Decode( LoRaLinkHost_t* host, LoRaLinkHostFrame_t* frame )
+{
+	uint8_t* f = host->RxFrame;
+	uint16_t len = ( f[0] << 8 ) | f[1];
+	uint8_t* body = f + 2;
+	uint16_t bodyLen = 0;
+	uint16_t crc = 0xFFFF;
+	uint8_t chks = 0;
+	int8_t gap = 0;
+
+	if ( host->Sequenced == true )
+	{
+		if ( len < SEQ_HDR_LEN + CRC_LEN )
+		{
+			host->RxErrors++;
+			WriteAck( host, true );
+			return false;
+		}
+		for ( uint16_t i = 0; i < len; i++ )
+		{
+			crc = Crc16Update( crc, f[i] );
+		}
+		if ( crc != ( ( f[len] << 8 ) | f[len + 1] ) )
+		{
+			host->RxErrors++;
+			WriteAck( host, true );
+			return false;
+		}
+		bodyLen = len - SEQ_HDR_LEN - CRC_LEN;
+		Acknowledged( host, f[3], f[4] & ~WINDOW_BASE, bodyLen == 0 );
+		if ( bodyLen == 0 )
+		{
+			return false;
+		}
+		gap = (int8_t)( f[2] - host->RxSeq );
+		if ( gap < 0 )
+		{
+			// Resent after the ack was lost
+			host->RxDiscarded++;
+			WriteAck( host, false );
+			return false;
+		}
+		if ( gap > 0 && ( f[4] & WINDOW_BASE ) == 0 )
+		{
+			// A frame before it is missing
+			host->RxDiscarded++;
+			WriteAck( host, true );
+			return false;
+		}
+		// A gap before the oldest frame of the modem was given up
+		host->RxLost += gap;
+		host->RxSeq = f[2] + 1;
+		WriteAck( host, false );
+		body += SEQ_HDR_LEN;
+	}
+	else
+	{
+		if ( len < RSP_HDR_LEN + 1 )
+		{
+			host->RxErrors++;
+			return false;
+		}
+		bodyLen = len - 1;
+		for ( uint16_t i = 0; i < bodyLen; i++ )
+		{
+			chks += body[i];
+		}
+		if ( (uint8_t)( chks + body[bodyLen] ) != 0xff )
+		{
+			host->RxErrors++;
+			return false;
+		}
+	}
+
+	if ( bodyLen < RSP_HDR_LEN )
+	{
+		host->RxErrors++;
+		return false;
+	}
+	frame->SourceAddr = body[0];
+	frame->Rssi = ( body[1] << 8 ) | body[2];
+	frame->Snr = ( body[3] << 8 ) | body[4];
+	frame->PayloadType = body[5];
+	frame->Extended = false;
+	body += RSP_HDR_LEN;
+	bodyLen -= RSP_HDR_LEN;
+
+	if ( frame->PayloadType == LORALINK_HOST_API_RX_EXT )
+	{
+		if ( DecodeRxExt( frame, body, bodyLen ) == false )
+		{
+			host->RxErrors++;
+			return false;
+		}
+		bodyLen -= 2 + body[1] + 1;
+		body += 2 + body[1] + 1;
+	}
+
+	if ( bodyLen > LORALINK_HOST_MAXPAYLOAD )
+	{
+		host->RxErrors++;
+		return false;
+	}
+	frame->PayloadLen = bodyLen;
+	memcpy( frame->Payload, body, frame->PayloadLen );
+	return true;
+}
+
+/*
+ * Send a request the modem answers at once and wait for its response.
+ * Other frames received meanwhile are discarded.
+ */
+static int Request( LoRaLinkHost_t* host, uint8_t type, uint8_t* payload, uint16_t len, uint8_t rspType, LoRaLinkHostFrame_t* rsp, uint32_t timeout )
+{
+	uint64_t limit = Now() + timeout;
+	int rc = 0;
+
+	while ( ( rc = LoRaLinkHostSend( host, 0, type, payload, len ) ) == 1 )
+	{
+		if ( Now() > limit || LoRaLinkHostPoll( host, rsp, 10 ) < 0 )
+		{
+			return -1;
+		}
+	}
+	if ( rc < 0 )
+	{
+		return -1;
+	}
+
+	while ( Now() < limit )
+	{
+		if ( LoRaLinkHostPoll( host, rsp, 10 ) == 1 && rsp->PayloadType == rspType )
+		{
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Version(1) MetaLen(1) Meta PayloadType(1), fields after the known ones are skipped
+ */
+static bool DecodeRxExt( LoRaLinkHostFrame_t* frame, uint8_t* body, uint16_t len )
+{
+	uint8_t* pos = body + 2;
+
+	if ( len < 2 || body[0] < LORALINK_HOST_RX_FORMAT_EXT || body[1] < LORALINK_HOST_RX_META_LEN || len < 2 + body[1] + 1 )
+	{
+		return false;
+	}
+	frame->Extended = true;
+	frame->Counter = GetUint32( pos );
+	frame->Timestamp = GetUint32( pos + 4 );
+	frame->UtcSeconds = GetUint32( pos + 8 );
+	frame->UtcSubSeconds = ( pos[12] << 8 ) | pos[13];
+	frame->Frequency = GetUint32( pos + 14 );
+	frame->SF = pos[18];
+	frame->Bandwidth = pos[19];
+	frame->Fei = (int32_t)GetUint32( pos + 20 );
+	frame->PanId = ( pos[24] << 8 ) | pos[25];
+	frame->DestAddr = pos[26];
+	frame->Flags = ( body[1] > LORALINK_HOST_RX_META_LEN ) ? pos[27] : 0;
+	frame->PayloadType = body[2 + body[1]];
+	return true;
+}
+
+static uint32_t GetUint32( uint8_t* pos )
+{
+	return ( (uint32_t)pos[0] << 24 ) | ( (uint32_t)pos[1] << 16 ) | ( (uint32_t)pos[2] << 8 ) | pos[3];
+}
+
+/*
+ * CRC-16/CCITT-FALSE, polynomial 0x1021, same as the modem
+ */
+static uint16_t Crc16Update( uint16_t crc, uint8_t c )
+{
+	uint8_t x = ( crc >> 8 ) ^ c;
+
+	x ^= x >> 4;
+	return ( crc << 8 ) ^ ( (uint16_t)x << 12 ) ^ ( (uint16_t)x << 5 ) ^ x;
+}
+
+static int SetTermios( int fd, uint32_t baudrate, bool rtscts )
+{
+	struct termios tio;
+
+	if ( tcgetattr( fd, &tio ) < 0 )
+	{
+		return -1;
+	}
+	cfmakeraw( &tio );
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~( CSTOPB | PARENB | CRTSCTS );
+	if ( rtscts == true )
+	{
+		tio.c_cflag |= CRTSCTS;
+	}
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed( &tio, Speed( baudrate ) );
+	cfsetospeed( &tio, Speed( baudrate ) );
+	return tcsetattr( fd, TCSANOW, &tio );
+}
+
+static speed_t Speed( uint32_t baudrate )
+{
+	switch ( baudrate )
+	{
+	case 9600:   return B9600;
+	case 19200:  return B19200;
+	case 38400:  return B38400;
+	case 57600:  return B57600;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	case 115200:
+	default:     return B115200;
+	}
+}
+
+static uint64_t Now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,197 @@
+/**************************************************************************************
+ *
+ * LoRaLinkHost.h
+ *
+ * Reference implementation of the modem UART link for a POSIX host.
+ * It is not part of the firmware build.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef LORALINKHOST_H_
+#define LORALINKHOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LORALINK_HOST_MAXPAYLOAD    255
+#define LORALINK_HOST_WINDOW        8       // Frames kept for retransmission, the modem window is smaller
+#define LORALINK_HOST_RETX_TIME     100     // ms without acknowledgement before going back
+#define LORALINK_HOST_MAX_RETRY     10
+
+#define LORALINK_HOST_MODE_RTSCTS     0x01    // rejected by a modem without UART1_RTS and UART1_CTS in device-config.h
+#define LORALINK_HOST_MODE_SEQUENCED  0x02
+
+#define LORALINK_HOST_API_RSP_ACK        0x80
+#define LORALINK_HOST_API_RSP_NFC        0x81
+#define LORALINK_HOST_API_RSP_TOT        0x82
+#define LORALINK_HOST_API_RSP_UTC        0x84
+#define LORALINK_HOST_API_REQ_LINK_MODE  0x87
+#define LORALINK_HOST_API_RSP_LINK_MODE  0x88
+#define LORALINK_HOST_API_REQ_QUEUE_TX   0x89
+#define LORALINK_HOST_API_REQ_RX_FORMAT  0x8A
+#define LORALINK_HOST_API_RSP_RX_FORMAT  0x8B
+#define LORALINK_HOST_API_RX_EXT         0x8C
+#define LORALINK_HOST_API_REQ_STATS      0x8D
+#define LORALINK_HOST_API_RSP_STATS      0x8E
+#define LORALINK_HOST_API_REQ_DUP_FILTER 0x8F
+#define LORALINK_HOST_API_RSP_DUP_FILTER 0x90
+#define LORALINK_HOST_API_REQ_FEC        0x91
+#define LORALINK_HOST_API_RSP_FEC        0x92
+
+#define LORALINK_HOST_QUEUE_HDR_LEN      5       // FrameId Priority Lifetime(2) PayloadType
+#define LORALINK_HOST_LIFETIME_UNIT      100     // ms
+
+#define LORALINK_HOST_RX_FORMAT_PLAIN    0
+#define LORALINK_HOST_RX_FORMAT_EXT      1
+#define LORALINK_HOST_RX_META_LEN        27      // Counter to DestAddr of version 1, Flags follows
+#define LORALINK_HOST_RX_META_MAX_LEN    28      // Counter to Flags, sent by the modem
+#define LORALINK_HOST_RX_FLAG_DUPLICATE  0x01
+#define LORALINK_HOST_RX_EXT_LEN         ( 2 + LORALINK_HOST_RX_META_MAX_LEN + 1 )  // Version MetaLen Meta PayloadType
+
+// Len(2) Seq(1) Ack(1) Window(1) SrcAddr(1) Rssi(2) Snr(2) PayloadType(1) [Rx ext] Payload Crc(2), 299 bytes
+#define LORALINK_HOST_FRAME_LEN     ( 2 + 3 + 6 + LORALINK_HOST_RX_EXT_LEN + LORALINK_HOST_MAXPAYLOAD + 2 )
+
+/*!
+ * Message to the modem
+ */
+typedef struct
+{
+	uint8_t  DestAddr;
+	uint8_t  PayloadType;
+	uint8_t  Payload[LORALINK_HOST_MAXPAYLOAD];
+	uint16_t PayloadLen;
+}LoRaLinkHostMsg_t;
+
+/*!
+ * Frame from the modem
+ */
+typedef struct
+{
+	uint8_t  SourceAddr;
+	int16_t  Rssi;
+	int16_t  Snr;
+	uint8_t  PayloadType;
+	uint8_t  Payload[LORALINK_HOST_MAXPAYLOAD];
+	uint16_t PayloadLen;
+
+	// Filled from an API_RX_EXT frame, PayloadType is the one of the message
+	bool     Extended;
+	uint32_t Counter;       // modem reception count
+	uint32_t Timestamp;     // modem time of RxDone [ms]
+	uint32_t UtcSeconds;    // 0 when the modem has no UTC
+	uint16_t UtcSubSeconds;
+	uint32_t Frequency;     // [Hz]
+	uint8_t  SF;
+	uint8_t  Bandwidth;     // 0: 125 kHz, 1: 250 kHz, 2: 500 kHz
+	int32_t  Fei;           // [Hz]
+	uint16_t PanId;
+	uint8_t  DestAddr;
+	uint8_t  Flags;         // LORALINK_HOST_RX_FLAG_xxx
+}LoRaLinkHostFrame_t;
+
+typedef struct
+{
+	int      Fd;
+	bool     Sequenced;
+
+	uint8_t  TxBase;       // oldest frame not acknowledged
+	uint8_t  TxNext;       // next frame to send
+	uint8_t  TxTail;       // next frame to queue
+	uint8_t  Window;       // frames the modem accepts after TxBase
+	bool     Recovering;   // went back once for this TxBase
+	uint16_t Retry;
+	uint64_t RetxTime;
+	LoRaLinkHostMsg_t Queue[LORALINK_HOST_WINDOW];
+
+	uint8_t  RxSeq;        // next frame expected from the modem
+	bool     Resend;       // the ack being written asks the modem to go back
+	uint8_t  RxBuf[256];
+	uint16_t RxBufLen;
+	uint16_t RxBufPos;
+	uint8_t  RxFrame[LORALINK_HOST_FRAME_LEN];
+	uint16_t RxPos;
+	bool     Escape;
+
+	uint32_t Retransmits;
+	uint32_t RxLost;       // given up by the modem
+	uint32_t RxErrors;
+	uint32_t RxDiscarded;  // out of sequence, the modem resends them
+}LoRaLinkHost_t;
+
+
+int  LoRaLinkHostOpen( LoRaLinkHost_t* host, const char* device, uint32_t baudrate );
+void LoRaLinkHostClose( LoRaLinkHost_t* host );
+
+/*
+ * Negotiate baudrate and framing, returns 0 when the modem accepted.
+ * The frames in flight are flushed first.
+ */
+int  LoRaLinkHostSetMode( LoRaLinkHost_t* host, uint32_t baudrate, uint8_t flags, uint32_t timeout );
+
+/*
+ * Ask for the Rx frame version, returns the version the modem uses or -1.
+ * Received frames are discarded meanwhile.
+ */
+int  LoRaLinkHostSetRxFormat( LoRaLinkHost_t* host, uint8_t version, uint32_t timeout );
+
+/*
+ * Read the link statistics of the modem, index 0 for the counters and n for the peers
+ * from the n-th, LORALINK_HOST_STATS_RESET in flags clears them after the response.
+ * rsp gets the API_RSP_STATS payload, see LoRaLinkStats.h. Returns 0 or -1.
+ */
+#define LORALINK_HOST_STATS_RESET        0x01
+int  LoRaLinkHostGetStats( LoRaLinkHost_t* host, uint8_t index, uint8_t flags, LoRaLinkHostFrame_t* rsp, uint32_t timeout );
+
+/*
+ * Set the duplicate filter of the modem, window in ms (0 for the modem default).
+ * Returns the mode in use or -1, an unknown mode only reads it.
+ */
+#define LORALINK_HOST_DUP_OFF            0
+#define LORALINK_HOST_DUP_DROP           1
+#define LORALINK_HOST_DUP_FLAG           2
+int  LoRaLinkHostSetDupFilter( LoRaLinkHost_t* host, uint8_t mode, uint32_t window, uint32_t timeout );
+
+/*
+ * Set the FEC parity group of a destination of the TX modem, 0xFF for the destinations
+ * without their own group. Group 0 turns FEC off, a group above 32 only reads it.
+ * Returns the group in use or -1.
+ */
+#define LORALINK_HOST_FEC_READ           0xFF
+int  LoRaLinkHostSetFec( LoRaLinkHost_t* host, uint8_t destAddr, uint8_t group, uint32_t timeout );
+
+/*
+ * Send the UTC of the host to stamp the extended Rx frames. Returns like LoRaLinkHostSend.
+ */
+int  LoRaLinkHostSendUtc( LoRaLinkHost_t* host );
+
+/*
+ * Queue a message. Returns 0, 1 when the window is full (call LoRaLinkHostPoll and retry) or -1.
+ */
+int  LoRaLinkHostSend( LoRaLinkHost_t* host, uint8_t destAddr, uint8_t payloadType, const uint8_t* payload, uint16_t len );
+
+/*
+ * Queue a message in the modem with an id echoed in its API_RSP_ACK, NFC or TOT,
+ * a priority (higher goes first) and a lifetime in ms (0 for none).
+ * The payload is up to LORALINK_HOST_MAXPAYLOAD - LORALINK_HOST_QUEUE_HDR_LEN bytes.
+ * Returns like LoRaLinkHostSend.
+ */
+int  LoRaLinkHostSendQueued( LoRaLinkHost_t* host, uint8_t destAddr, uint8_t payloadType, const uint8_t* payload, uint16_t len,
+                             uint8_t frameId, uint8_t priority, uint32_t lifetime );
+
+/*
+ * Receive, acknowledge and retransmit for up to timeout ms. In the sequenced mode each
+ * frame of the modem is acknowledged and the frames come in order, the modem resends
+ * the ones lost or corrupted.
+ * Returns 1 with a frame, 0 on timeout, -1 when the modem stopped answering.
+ */
+int  LoRaLinkHostPoll( LoRaLinkHost_t* host, LoRaLinkHostFrame_t* frame, uint32_t timeout );
+
+/*
+ * true when every queued message is acknowledged
+ */
+bool LoRaLinkHostIsIdle( LoRaLinkHost_t* host );
+
+#endif /* LORALINKHOST_H_ */
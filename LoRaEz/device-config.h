@@ -86,6 +86,12 @@
 
 #define UART1_TX                                    PA_9
 #define UART1_RX                                    PA_10
+/*!
+ * USART1 hardware flow control, PA_11 and PA_12 are INT_1 and RADIO_TCXO_POWER
+ * on this module. Define them on a board that routes them to the host.
+ */
+//#define UART1_CTS                                   PA_11
+//#define UART1_RTS                                   PA_12
 
 #define ADC_0                                       PA_2
 #define ADC_1                                       PA_3
@@ -21,6 +21,7 @@
  * \author    Gregory Cristian ( Semtech )
  */
 #include "fifo.h"
+#include "utilities.h"
 
 static uint16_t FifoNext( Fifo_t *fifo, uint16_t index )
 {
@@ -64,3 +65,27 @@ bool IsFifoFull( Fifo_t *fifo )
 {
     return ( FifoNext( fifo, fifo->End ) == fifo->Begin );
 }
+
+uint16_t FifoFreeSpace( Fifo_t *fifo )
+{
+    return ( fifo->Begin + fifo->Size - fifo->End - 1 ) % fifo->Size;
+}
+
+void FifoPushBuffer( Fifo_t *fifo, uint8_t *buffer, uint16_t size )
+{
+    uint16_t start = FifoNext( fifo, fifo->End );
+    uint16_t chunk = fifo->Size - start;
+
+    if( size == 0 )
+    {
+        return;
+    }
+    if( chunk > size )
+    {
+        chunk = size;
+    }
+    // At most two copies when the data wraps around the end of the buffer
+    memcpy1( fifo->Data + start, buffer, chunk );
+    memcpy1( fifo->Data, buffer + chunk, size - chunk );
+    fifo->End = ( start + size - 1 ) % fifo->Size;
+}
@@ -85,4 +85,21 @@ bool IsFifoEmpty( Fifo_t *fifo );
  */
 bool IsFifoFull( Fifo_t *fifo );
 
+/*!
+ * Gets the number of bytes that can be pushed
+ *
+ * \param [IN] fifo   Pointer to the FIFO object
+ * \retval size       Free space of the FIFO
+ */
+uint16_t FifoFreeSpace( Fifo_t *fifo );
+
+/*!
+ * Pushes a buffer to the FIFO, the caller checks the free space
+ *
+ * \param [IN] fifo   Pointer to the FIFO object
+ * \param [IN] buffer Data to be pushed into the FIFO
+ * \param [IN] size   Size of the data
+ */
+void FifoPushBuffer( Fifo_t *fifo, uint8_t *buffer, uint16_t size );
+
 #endif // __FIFO_H__
@@ -151,6 +151,11 @@ const RadioRegisters_t RadioRegsInit[] = RADIO_INIT_REGISTERS_VALUE;
 #define RSSI_OFFSET_LF                              -164
 #define RSSI_OFFSET_HF                              -157
 
+/*!
+ * Upper bound of a CAD, 2 symbols at SF12 125kHz take 66ms
+ */
+#define CAD_TIMEOUT                                 100
+
 /*!
  * Precomputed FSK bandwidth registers values
  */
@@ -338,6 +343,64 @@ bool SX1276IsChannelFree( uint32_t freq, int16_t rssiThresh, uint32_t maxCarrier
     return status;
 }
 
+bool SX1276IsChannelFreeCad( uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime )
+{
+    bool status = true;
+    uint8_t irqFlags = 0;
+    uint32_t carrierSenseTime = 0;
+
+    if( SX1276.Settings.Channel != freq )
+    {
+        SX1276SetChannel( freq );
+    }
+    SX1276SetOpMode( RF_OPMODE_STANDBY );
+
+    // Only CAD flags, DIO3 is moved off CadDone so that the flags are polled here
+    SX1276Write( REG_LR_IRQFLAGSMASK, RFLR_IRQFLAGS_RXTIMEOUT |
+                                      RFLR_IRQFLAGS_RXDONE |
+                                      RFLR_IRQFLAGS_PAYLOADCRCERROR |
+                                      RFLR_IRQFLAGS_VALIDHEADER |
+                                      RFLR_IRQFLAGS_TXDONE |
+                                      RFLR_IRQFLAGS_FHSSCHANGEDCHANNEL );
+    SX1276Write( REG_DIOMAPPING1, ( SX1276Read( REG_DIOMAPPING1 ) & RFLR_DIOMAPPING1_DIO3_MASK ) | RFLR_DIOMAPPING1_DIO3_01 );
+    SX1276Write( REG_LR_IRQFLAGS, RFLR_IRQFLAGS_CADDETECTED | RFLR_IRQFLAGS_CADDONE );
+
+    carrierSenseTime = TimerGetCurrentTime( );
+    SX1276SetOpMode( RFLR_OPMODE_CAD );
+
+    do
+    {
+        irqFlags = SX1276Read( REG_LR_IRQFLAGS );
+    }
+    while( ( ( irqFlags & RFLR_IRQFLAGS_CADDONE ) == 0 ) && ( TimerGetElapsedTime( carrierSenseTime ) < CAD_TIMEOUT ) );
+
+    SX1276Write( REG_LR_IRQFLAGS, RFLR_IRQFLAGS_CADDETECTED | RFLR_IRQFLAGS_CADDONE );
+
+    if( ( irqFlags & ( RFLR_IRQFLAGS_CADDONE | RFLR_IRQFLAGS_CADDETECTED ) ) != RFLR_IRQFLAGS_CADDONE )
+    {
+        // LoRa preamble detected or CAD did not complete
+        status = false;
+    }
+    else
+    {
+        // Sample RSSI for the rest of the carrier sense time to catch non LoRa signals
+        SX1276SetOpMode( RFLR_OPMODE_RECEIVER );
+        do
+        {
+            if( SX1276ReadRssi( MODEM_LORA ) > rssiThresh )
+            {
+                status = false;
+                break;
+            }
+        }
+        while( TimerGetElapsedTime( carrierSenseTime ) < maxCarrierSenseTime );
+    }
+
+    // Stay in standby, the LoRa configuration is kept for the transmission
+    SX1276SetOpMode( RF_OPMODE_STANDBY );
+    return status;
+}
+
 uint32_t SX1276Random( void )
 {
     uint8_t i;
@@ -736,66 +799,61 @@ uint32_t SX1276GetTimeOnAir( RadioModems_t modem, uint8_t pktLen )
         break;
     case MODEM_LORA:
         {
-            double bw = 0.0;
             // REMARK: When using LoRa modem only bandwidths 125, 250 and 500 kHz are supported
-            switch( SX1276.Settings.LoRa.Bandwidth )
+            if( ( SX1276.Settings.LoRa.Bandwidth >= 7 ) && ( SX1276.Settings.LoRa.Bandwidth <= 9 ) )
             {
-            //case 0: // 7.8 kHz
-            //    bw = 7800;
-            //    break;
-            //case 1: // 10.4 kHz
-            //    bw = 10400;
-            //    break;
-            //case 2: // 15.6 kHz
-            //    bw = 15600;
-            //    break;
-            //case 3: // 20.8 kHz
-            //    bw = 20800;
-            //    break;
-            //case 4: // 31.2 kHz
-            //    bw = 31200;
-            //    break;
-            //case 5: // 41.4 kHz
-            //    bw = 41400;
-            //    break;
-            //case 6: // 62.5 kHz
-            //    bw = 62500;
-            //    break;
-            case 7: // 125 kHz
-                bw = 125000;
-                break;
-            case 8: // 250 kHz
-                bw = 250000;
-                break;
-            case 9: // 500 kHz
-                bw = 500000;
-                break;
+                airTime = SX1276GetLoRaTimeOnAir( SX1276.Settings.LoRa.Bandwidth - 7, SX1276.Settings.LoRa.Datarate,
+                                                  SX1276.Settings.LoRa.Coderate, SX1276.Settings.LoRa.PreambleLen,
+                                                  SX1276.Settings.LoRa.FixLen, SX1276.Settings.LoRa.CrcOn, pktLen );
             }
-
-            // Symbol rate : time for one symbol (secs)
-            double rs = bw / ( 1 << SX1276.Settings.LoRa.Datarate );
-            double ts = 1 / rs;
-            // time of preamble
-            double tPreamble = ( SX1276.Settings.LoRa.PreambleLen + 4.25 ) * ts;
-            // Symbol length of payload and time
-            double tmp = ceil( ( 8 * pktLen - 4 * SX1276.Settings.LoRa.Datarate +
-                                 28 + 16 * SX1276.Settings.LoRa.CrcOn -
-                                 ( SX1276.Settings.LoRa.FixLen ? 20 : 0 ) ) /
-                                 ( double )( 4 * ( SX1276.Settings.LoRa.Datarate -
-                                 ( ( SX1276.Settings.LoRa.LowDatarateOptimize > 0 ) ? 2 : 0 ) ) ) ) *
-                                 ( SX1276.Settings.LoRa.Coderate + 4 );
-            double nPayload = 8 + ( ( tmp > 0 ) ? tmp : 0 );
-            double tPayload = nPayload * ts;
-            // Time on air
-            double tOnAir = tPreamble + tPayload;
-            // return ms secs
-            airTime = floor( tOnAir * 1000 + 0.999 );
         }
         break;
     }
     return airTime;
 }
 
+uint32_t SX1276GetLoRaTimeOnAir( uint32_t bandwidth, uint32_t datarate, uint8_t coderate, uint16_t preambleLen,
+                                 bool fixLen, bool crcOn, uint8_t pktLen )
+{
+    int32_t num = 0;
+    int32_t den = 0;
+    uint32_t nSymbols4 = 0;
+    uint32_t ticks = 0;
+    uint32_t div = 0;
+
+    if( bandwidth > 2 )
+    {
+        return 0;
+    }
+    if( datarate > 12 )
+    {
+        datarate = 12;
+    }
+    else if( datarate < 6 )
+    {
+        datarate = 6;
+    }
+
+    // Payload symbols: 8 + max( ceil( ( 8PL - 4SF + 28 + 16CRC - 20IH ) / ( 4( SF - 2DE ) ) ) * ( CR + 4 ), 0 )
+    num = 8 * pktLen - 4 * ( int32_t )datarate + 28 + ( crcOn ? 16 : 0 ) - ( fixLen ? 20 : 0 );
+    den = 4 * ( ( int32_t )datarate - ( ( ( bandwidth == 0 ) && ( datarate >= 11 ) ) ||
+                                       ( ( bandwidth == 1 ) && ( datarate == 12 ) ) ? 2 : 0 ) );
+
+    // Count in quarter symbols to keep the 4.25 symbols of the sync word integer
+    nSymbols4 = 4 * ( uint32_t )preambleLen + 17 + 4 * 8;
+    if( num > 0 )
+    {
+        nSymbols4 += 4 * ( uint32_t )( ( num + den - 1 ) / den ) * ( coderate + 4 );
+    }
+
+    // Time on air in ms = nSymbols4 * 2^SF / ( 4 * BW / 1000 ), BW = 125kHz << bandwidth
+    ticks = nSymbols4 << datarate;
+    div = ( uint32_t )500 << bandwidth;
+
+    // Round up, fractions below 1/1000 ms are dropped
+    return ticks / div + ( ( ( ticks % div ) * 1000 >= div ) ? 1 : 0 );
+}
+
 void SX1276Send( uint8_t *buffer, uint8_t size )
 {
     uint32_t txTimeout = 0;
@@ -1146,6 +1204,39 @@ int16_t SX1276ReadRssi( RadioModems_t modem )
     return rssi;
 }
 
+int32_t SX1276GetFrequencyError( void )
+{
+    int32_t fei = 0;
+    int32_t bandwidth = 0;
+
+    switch( SX1276.Settings.LoRa.Bandwidth )
+    {
+    case 9:
+        bandwidth = 500;
+        break;
+    case 8:
+        bandwidth = 250;
+        break;
+    case 7:
+    default:
+        bandwidth = 125;
+        break;
+    }
+
+    fei = ( ( int32_t )( SX1276Read( REG_LR_FEIMSB ) & 0x0F ) << 16 ) |
+          ( ( int32_t )SX1276Read( REG_LR_FEIMID ) << 8 ) |
+          ( int32_t )SX1276Read( REG_LR_FEILSB );
+
+    // 20 bit two's complement
+    if( fei & 0x80000 )
+    {
+        fei -= 0x100000;
+    }
+
+    // FreqError = FEI * 2^24 / XTAL_FREQ * BW[kHz] / 500
+    return ( int32_t )( ( ( int64_t )fei * ( 1 << 24 ) * bandwidth ) / ( ( int64_t )XTAL_FREQ * 500 ) );
+}
+
 void SX1276SetOpMode( uint8_t opMode )
 {
 #if defined( USE_RADIO_DEBUG )
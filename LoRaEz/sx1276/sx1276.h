@@ -203,6 +203,19 @@ void SX1276SetChannel( uint32_t freq );
  */
 bool SX1276IsChannelFree( uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime );
 
+/*!
+ * \brief Checks if the channel is free with a LoRa CAD followed by RSSI sampling
+ *
+ * \Remark The LoRa modem must be configured with the Tx parameters, it is left in standby
+ *
+ * \param [IN] freq       Channel RF frequency
+ * \param [IN] rssiThresh RSSI threshold
+ * \param [IN] maxCarrierSenseTime Total time of the CAD and the RSSI measurement
+ *
+ * \retval isFree         [true: Channel is free, false: Channel is not free]
+ */
+bool SX1276IsChannelFreeCad( uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime );
+
 /*!
  * \brief Generates a 32 bits random value based on the RSSI readings
  *
@@ -319,6 +332,24 @@ void SX1276SetTxConfig( RadioModems_t modem, int8_t power, uint32_t fdev,
  */
 uint32_t SX1276GetTimeOnAir( RadioModems_t modem, uint8_t pktLen );
 
+/*!
+ * \brief Computes the LoRa packet time on air in ms with integer arithmetic
+ *
+ * \Remark Does not depend on the current radio settings
+ *
+ * \param [IN] bandwidth    Sets the bandwidth [0: 125 kHz, 1: 250 kHz, 2: 500 kHz]
+ * \param [IN] datarate     Sets the spreading factor [6: 64, 7: 128, ... 12: 4096 chips]
+ * \param [IN] coderate     Sets the coding rate [1: 4/5, 2: 4/6, 3: 4/7, 4: 4/8]
+ * \param [IN] preambleLen  Sets the preamble length in symbols
+ * \param [IN] fixLen       Fixed length packets [0: variable, 1: fixed]
+ * \param [IN] crcOn        Enables disables the CRC [0: OFF, 1: ON]
+ * \param [IN] pktLen       Packet payload length
+ *
+ * \retval airTime          Computed airTime (ms) for the given packet payload length
+ */
+uint32_t SX1276GetLoRaTimeOnAir( uint32_t bandwidth, uint32_t datarate, uint8_t coderate, uint16_t preambleLen,
+                                 bool fixLen, bool crcOn, uint8_t pktLen );
+
 /*!
  * \brief Sends the buffer of size. Prepares the packet to be sent and sets
  *        the radio in transmission
@@ -365,6 +396,13 @@ void SX1276SetTxContinuousWave( uint32_t freq, int8_t power, uint16_t time );
  */
 int16_t SX1276ReadRssi( RadioModems_t modem );
 
+/*!
+ * \brief Reads the frequency error of the last LoRa packet
+ *
+ * \retval fei  Frequency error [Hz]
+ */
+int32_t SX1276GetFrequencyError( void );
+
 /*!
  * \brief Writes the radio register at the specified address
  *
@@ -1,364 +1,789 @@
-/*!
- * \file      uart.c
- *
- * \brief     UART driver implementation
- *
- * \copyright Revised BSD License, see section \ref LICENSE.
- *
- * \code
- *                ______                              _
- *               / _____)             _              | |
- *              ( (____  _____ ____ _| |_ _____  ____| |__
- *               \____ \| ___ |    (_   _) ___ |/ ___)  _ \
- *               _____) ) ____| | | || |_| ____( (___| | | |
- *              (______/|_____)_|_|_| \__)_____)\____)_| |_|
- *              (C)2013-2017 Semtech
- *
- * \endcode
- *
- * \author    Miguel Luis ( Semtech )
- *
- * \author    Gregory Cristian ( Semtech )
- */
-#include "uart.h"
-
-#include "utilities.h"
-#include "stm32l0xx.h"
-
-/*!
- * Number of times the UartPutBuffer will try to send the buffer before
- * returning ERROR
- */
-#define TX_BUFFER_RETRY_COUNT                       10
-
-static UART_HandleTypeDef UartHandle;
-uint8_t RxData = 0;
-uint8_t TxData = 0;
-
-extern Uart_t Uart;
-
-void UartMcuInit( Uart_t *obj, UartId_t uartId, PinNames tx, PinNames rx )
-{
-    obj->UartId = uartId;
-
-	__HAL_RCC_USART1_FORCE_RESET( );
-	__HAL_RCC_USART1_RELEASE_RESET( );
-	__HAL_RCC_USART1_CLK_ENABLE( );
-
-	GpioInit( &obj->Tx, tx, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_PULL_UP, GPIO_AF4_USART1 );
-	GpioInit( &obj->Rx, rx, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_PULL_UP, GPIO_AF4_USART1 );
-}
-
-void UartMcuConfig( Uart_t *obj, UartMode_t mode, uint32_t baudrate, WordLength_t wordLength, StopBits_t stopBits, Parity_t parity, FlowCtrl_t flowCtrl )
-{
-        UartHandle.Instance = USART1;
-        UartHandle.Init.BaudRate = baudrate;
-
-        if( mode == TX_ONLY )
-        {
-            if( obj->FifoTx.Data == NULL )
-            {
-                assert_param( FAIL );
-            }
-            UartHandle.Init.Mode = UART_MODE_TX;
-        }
-        else if( mode == RX_ONLY )
-        {
-            if( obj->FifoRx.Data == NULL )
-            {
-                assert_param( FAIL );
-            }
-            UartHandle.Init.Mode = UART_MODE_RX;
-        }
-        else if( mode == RX_TX )
-        {
-            if( ( obj->FifoTx.Data == NULL ) || ( obj->FifoRx.Data == NULL ) )
-            {
-                assert_param( FAIL );
-            }
-            UartHandle.Init.Mode = UART_MODE_TX_RX;
-        }
-        else
-        {
-            assert_param( FAIL );
-        }
-
-        if( wordLength == UART_8_BIT )
-        {
-            UartHandle.Init.WordLength = UART_WORDLENGTH_8B;
-        }
-        else if( wordLength == UART_9_BIT )
-        {
-            UartHandle.Init.WordLength = UART_WORDLENGTH_9B;
-        }
-
-        switch( stopBits )
-        {
-        case UART_2_STOP_BIT:
-            UartHandle.Init.StopBits = UART_STOPBITS_2;
-            break;
-        case UART_1_5_STOP_BIT:
-            UartHandle.Init.StopBits = UART_STOPBITS_1_5;
-            break;
-        case UART_1_STOP_BIT:
-        default:
-            UartHandle.Init.StopBits = UART_STOPBITS_1;
-            break;
-        }
-
-        if( parity == NO_PARITY )
-        {
-            UartHandle.Init.Parity = UART_PARITY_NONE;
-        }
-        else if( parity == EVEN_PARITY )
-        {
-            UartHandle.Init.Parity = UART_PARITY_EVEN;
-        }
-        else
-        {
-            UartHandle.Init.Parity = UART_PARITY_ODD;
-        }
-
-        if( flowCtrl == NO_FLOW_CTRL )
-        {
-            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-        }
-        else if( flowCtrl == RTS_FLOW_CTRL )
-        {
-            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_RTS;
-        }
-        else if( flowCtrl == CTS_FLOW_CTRL )
-        {
-            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_CTS;
-        }
-        else if( flowCtrl == RTS_CTS_FLOW_CTRL )
-        {
-            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
-        }
-
-        UartHandle.Init.OverSampling = UART_OVERSAMPLING_16;
-
-        if( HAL_UART_Init( &UartHandle ) != HAL_OK )
-        {
-            assert_param( FAIL );
-        }
-
-        HAL_NVIC_SetPriority( USART1_IRQn, 1, 0 );
-        HAL_NVIC_EnableIRQ( USART1_IRQn );
-
-        /* Enable the UART Data Register not empty Interrupt */
-        HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
-}
-
-void UartMcuDeInit( Uart_t *obj )
-{
-    if( obj->UartId == UART_USB_CDC )
-    {
-#if defined( USE_USB_CDC )
-        UartUsbDeInit( obj );
-#endif
-    }
-    else
-    {
-        __HAL_RCC_USART1_FORCE_RESET( );
-        __HAL_RCC_USART1_RELEASE_RESET( );
-        __HAL_RCC_USART1_CLK_DISABLE( );
-
-        GpioInit( &obj->Tx, obj->Tx.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0 );
-        GpioInit( &obj->Rx, obj->Rx.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0 );
-    }
-}
-
-uint8_t UartMcuPutChar( Uart_t *obj, uint8_t data )
-{
-    if( obj->UartId == UART_USB_CDC )
-    {
-#if defined( USE_USB_CDC )
-        return UartUsbPutChar( obj, data );
-#else
-        return 255; // Not supported
-#endif
-    }
-    else
-    {
-        CRITICAL_SECTION_BEGIN( );
-        TxData = data;
-
-        if( IsFifoFull( &obj->FifoTx ) == false )
-        {
-            FifoPush( &obj->FifoTx, TxData );
-
-            // Trig UART Tx interrupt to start sending the FIFO contents.
-            __HAL_UART_ENABLE_IT( &UartHandle, UART_IT_TC );
-
-            CRITICAL_SECTION_END( );
-            return 0; // OK
-        }
-        CRITICAL_SECTION_END( );
-        return 1; // Busy
-    }
-}
-
-uint8_t UartMcuGetChar( Uart_t *obj, uint8_t *data )
-{
-    if( obj->UartId == UART_USB_CDC )
-    {
-#if defined( USE_USB_CDC )
-        return UartUsbGetChar( obj, data );
-#else
-        return 255; // Not supported
-#endif
-    }
-    else
-    {
-        CRITICAL_SECTION_BEGIN( );
-
-        if( IsFifoEmpty( &obj->FifoRx ) == false )
-        {
-            *data = FifoPop( &obj->FifoRx );
-            CRITICAL_SECTION_END( );
-            return 0;
-        }
-        CRITICAL_SECTION_END( );
-        return 1;
-    }
-}
-
-uint8_t UartMcuPutBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size )
-{
-    if( obj->UartId == UART_USB_CDC )
-    {
-#if defined( USE_USB_CDC )
-        return UartUsbPutBuffer( obj, buffer, size );
-#else
-        return 255; // Not supported
-#endif
-    }
-    else
-    {
-        uint8_t retryCount;
-        uint16_t i;
-
-        for( i = 0; i < size; i++ )
-        {
-            retryCount = 0;
-            while( UartMcuPutChar( obj, buffer[i] ) != 0 )
-            {
-                retryCount++;
-
-                // Exit if something goes terribly wrong
-                if( retryCount > TX_BUFFER_RETRY_COUNT )
-                {
-                    return 1; // Error
-                }
-            }
-        }
-        return 0; // OK
-    }
-}
-
-uint8_t UartMcuGetBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes )
-{
-    uint16_t localSize = 0;
-
-    while( localSize < size )
-    {
-        if( UartMcuGetChar( obj, buffer + localSize ) == 0 )
-        {
-            localSize++;
-        }
-        else
-        {
-            break;
-        }
-    }
-
-    *nbReadBytes = localSize;
-
-    if( localSize == 0 )
-    {
-        return 1; // Empty
-    }
-    return 0; // OK
-}
-
-void HAL_UART_TxCpltCallback( UART_HandleTypeDef *handle )
-{
-    if( IsFifoEmpty( &Uart.FifoTx ) == false )
-    {
-        TxData = FifoPop( &Uart.FifoTx );
-        //  Write one byte to the transmit data register
-        HAL_UART_Transmit_IT( &UartHandle, &TxData, 1 );
-    }
-
-    if( Uart.IrqNotify != NULL )
-    {
-        Uart.IrqNotify( UART_NOTIFY_TX );
-    }
-}
-
-void HAL_UART_RxCpltCallback( UART_HandleTypeDef *handle )
-{
-    if( IsFifoFull( &Uart.FifoRx ) == false )
-    {
-        // Read one byte from the receive data register
-        FifoPush( &Uart.FifoRx, RxData );
-    }
-
-    if( Uart.IrqNotify != NULL )
-    {
-        Uart.IrqNotify( UART_NOTIFY_RX );
-    }
-
-    HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
-}
-
-void HAL_UART_ErrorCallback( UART_HandleTypeDef *handle )
-{
-    HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
-}
-
-void USART1_IRQHandler( void )
-{
-    HAL_UART_IRQHandler( &UartHandle );
-}
-
-void UartInit( Uart_t *obj, UartId_t uartId, PinNames tx, PinNames rx )
-{
-    if( obj->IsInitialized == false )
-    {
-        obj->IsInitialized = true;
-        UartMcuInit( obj, uartId, tx, rx );
-    }
-}
-
-void UartConfig( Uart_t *obj, UartMode_t mode, uint32_t baudrate, WordLength_t wordLength, StopBits_t stopBits, Parity_t parity, FlowCtrl_t flowCtrl )
-{
-    UartMcuConfig( obj, mode, baudrate, wordLength, stopBits, parity, flowCtrl );
-}
-
-void UartDeInit( Uart_t *obj )
-{
-	Uart.IsInitialized = false;
-    UartMcuDeInit( obj );
-}
-
-uint8_t UartPutChar( uint8_t data )
-{
-     return UartMcuPutChar( &Uart, data );
-}
-
-uint8_t UartGetChar( uint8_t *data )
-{
-    return UartMcuGetChar( &Uart, data );
-}
-
-uint8_t UartPutBuffer( uint8_t *buffer, uint16_t size )
-{
-    return UartMcuPutBuffer( &Uart, buffer, size );
-}
-
-uint8_t UartGetBuffer( uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes )
-{
-    return UartMcuGetBuffer( &Uart, buffer, size, nbReadBytes );
-}
+/*!
+ * \file      uart.c
+ *
+ * \brief     UART driver implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \code
+ *                ______                              _
+ *               / _____)             _              | |
+ *              ( (____  _____ ____ _| |_ _____  ____| |__
+ *               \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ *               _____) ) ____| | | || |_| ____( (___| | | |
+ *              (______/|_____)_|_|_| \__)_____)\____)_| |_|
+ *              (C)2013-2017 Semtech
+ *
+ * \endcode
+ *
+ * \author    Miguel Luis ( Semtech )
+ *
+ * \author    Gregory Cristian ( Semtech )
+ */
+#include "uart.h"
+
+#include "utilities.h"
+#include "device-config.h"
+#include "stm32l0xx.h"
+
+/*!
+ * Number of times the UartPutBuffer will try to send the buffer before
+ * returning ERROR
+ */
+#define TX_BUFFER_RETRY_COUNT                       10
+
+static UART_HandleTypeDef UartHandle;
+static DMA_HandleTypeDef DmaRxHandle;
+static DMA_HandleTypeDef DmaTxHandle;
+uint8_t RxData = 0;
+uint8_t TxData = 0;
+
+/*!
+ * FifoRx.Data is the circular DMA buffer, RxDmaRead is the read index.
+ * RxDmaLaps counts the wraps of the DMA, RxDmaConsumed the bytes read since the restart,
+ * so that a write index lapping the read index is found.
+ */
+static bool RxDma = false;
+static uint16_t RxDmaRead = 0;
+static volatile uint32_t RxDmaLaps = 0;
+static uint32_t RxDmaConsumed = 0;
+static bool RxDmaOverrun = false;
+
+/*!
+ * The DMA sends TxDmaLen bytes from the head of FifoTx, they leave the FIFO
+ * when the transfer is complete.
+ */
+static bool TxDma = false;
+static volatile uint16_t TxDmaLen = 0;
+
+static uint16_t RxDmaWriteIndex( Uart_t *obj );
+static uint16_t RxDmaCheckOverrun( Uart_t *obj );
+static void RxDmaRestart( Uart_t *obj );
+static void TxDmaSend( Uart_t *obj );
+
+#if defined( UART1_RTS ) && defined( UART1_CTS )
+static Gpio_t Rts;
+static Gpio_t Cts;
+#endif
+
+extern Uart_t Uart;
+
+void UartMcuInit( Uart_t *obj, UartId_t uartId, PinNames tx, PinNames rx )
+{
+    obj->UartId = uartId;
+
+	__HAL_RCC_USART1_FORCE_RESET( );
+	__HAL_RCC_USART1_RELEASE_RESET( );
+	__HAL_RCC_USART1_CLK_ENABLE( );
+
+	GpioInit( &obj->Tx, tx, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_PULL_UP, GPIO_AF4_USART1 );
+	GpioInit( &obj->Rx, rx, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_PULL_UP, GPIO_AF4_USART1 );
+}
+
+void UartMcuConfig( Uart_t *obj, UartMode_t mode, uint32_t baudrate, WordLength_t wordLength, StopBits_t stopBits, Parity_t parity, FlowCtrl_t flowCtrl )
+{
+        UartHandle.Instance = USART1;
+        UartHandle.Init.BaudRate = baudrate;
+
+        if( mode == TX_ONLY )
+        {
+            if( obj->FifoTx.Data == NULL )
+            {
+                assert_param( FAIL );
+            }
+            UartHandle.Init.Mode = UART_MODE_TX;
+        }
+        else if( mode == RX_ONLY )
+        {
+            if( obj->FifoRx.Data == NULL )
+            {
+                assert_param( FAIL );
+            }
+            UartHandle.Init.Mode = UART_MODE_RX;
+        }
+        else if( mode == RX_TX )
+        {
+            if( ( obj->FifoTx.Data == NULL ) || ( obj->FifoRx.Data == NULL ) )
+            {
+                assert_param( FAIL );
+            }
+            UartHandle.Init.Mode = UART_MODE_TX_RX;
+        }
+        else
+        {
+            assert_param( FAIL );
+        }
+
+        if( wordLength == UART_8_BIT )
+        {
+            UartHandle.Init.WordLength = UART_WORDLENGTH_8B;
+        }
+        else if( wordLength == UART_9_BIT )
+        {
+            UartHandle.Init.WordLength = UART_WORDLENGTH_9B;
+        }
+
+        switch( stopBits )
+        {
+        case UART_2_STOP_BIT:
+            UartHandle.Init.StopBits = UART_STOPBITS_2;
+            break;
+        case UART_1_5_STOP_BIT:
+            UartHandle.Init.StopBits = UART_STOPBITS_1_5;
+            break;
+        case UART_1_STOP_BIT:
+        default:
+            UartHandle.Init.StopBits = UART_STOPBITS_1;
+            break;
+        }
+
+        if( parity == NO_PARITY )
+        {
+            UartHandle.Init.Parity = UART_PARITY_NONE;
+        }
+        else if( parity == EVEN_PARITY )
+        {
+            UartHandle.Init.Parity = UART_PARITY_EVEN;
+        }
+        else
+        {
+            UartHandle.Init.Parity = UART_PARITY_ODD;
+        }
+
+        if( flowCtrl == NO_FLOW_CTRL )
+        {
+            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+        }
+        else if( flowCtrl == RTS_FLOW_CTRL )
+        {
+            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_RTS;
+        }
+        else if( flowCtrl == CTS_FLOW_CTRL )
+        {
+            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_CTS;
+        }
+        else if( flowCtrl == RTS_CTS_FLOW_CTRL )
+        {
+            UartHandle.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
+        }
+
+        UartHandle.Init.OverSampling = UART_OVERSAMPLING_16;
+
+        if( HAL_UART_Init( &UartHandle ) != HAL_OK )
+        {
+            assert_param( FAIL );
+        }
+
+        HAL_NVIC_SetPriority( USART1_IRQn, 1, 0 );
+        HAL_NVIC_EnableIRQ( USART1_IRQn );
+
+        /* Enable the UART Data Register not empty Interrupt */
+        HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
+}
+
+void UartMcuDeInit( Uart_t *obj )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+#if defined( USE_USB_CDC )
+        UartUsbDeInit( obj );
+#endif
+    }
+    else
+    {
+        __HAL_RCC_USART1_FORCE_RESET( );
+        __HAL_RCC_USART1_RELEASE_RESET( );
+        __HAL_RCC_USART1_CLK_DISABLE( );
+
+        GpioInit( &obj->Tx, obj->Tx.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0 );
+        GpioInit( &obj->Rx, obj->Rx.pin, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0 );
+
+        // Byte by byte again after the next UartConfig()
+        RxDma = false;
+        TxDma = false;
+        TxDmaLen = 0;
+    }
+}
+
+uint8_t UartMcuPutChar( Uart_t *obj, uint8_t data )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+#if defined( USE_USB_CDC )
+        return UartUsbPutChar( obj, data );
+#else
+        return 255; // Not supported
+#endif
+    }
+    else
+    {
+        CRITICAL_SECTION_BEGIN( );
+        TxData = data;
+
+        if( IsFifoFull( &obj->FifoTx ) == false )
+        {
+            FifoPush( &obj->FifoTx, TxData );
+
+            if( TxDma == true )
+            {
+                TxDmaSend( obj );
+            }
+            else
+            {
+                // Trig UART Tx interrupt to start sending the FIFO contents.
+                __HAL_UART_ENABLE_IT( &UartHandle, UART_IT_TC );
+            }
+
+            CRITICAL_SECTION_END( );
+            return 0; // OK
+        }
+        CRITICAL_SECTION_END( );
+        return 1; // Busy
+    }
+}
+
+uint8_t UartMcuGetChar( Uart_t *obj, uint8_t *data )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+#if defined( USE_USB_CDC )
+        return UartUsbGetChar( obj, data );
+#else
+        return 255; // Not supported
+#endif
+    }
+    else if( RxDma == true )
+    {
+        // Single reader, the DMA only moves the write index
+        if( RxDmaRead != RxDmaCheckOverrun( obj ) )
+        {
+            *data = obj->FifoRx.Data[RxDmaRead];
+            RxDmaRead = ( RxDmaRead + 1 ) % obj->FifoRx.Size;
+            RxDmaConsumed++;
+            return 0;
+        }
+        return 1;
+    }
+    else
+    {
+        CRITICAL_SECTION_BEGIN( );
+
+        if( IsFifoEmpty( &obj->FifoRx ) == false )
+        {
+            *data = FifoPop( &obj->FifoRx );
+            CRITICAL_SECTION_END( );
+            return 0;
+        }
+        CRITICAL_SECTION_END( );
+        return 1;
+    }
+}
+
+uint8_t UartMcuPutBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+#if defined( USE_USB_CDC )
+        return UartUsbPutBuffer( obj, buffer, size );
+#else
+        return 255; // Not supported
+#endif
+    }
+    else
+    {
+        uint8_t retryCount;
+        uint16_t i;
+
+        for( i = 0; i < size; i++ )
+        {
+            retryCount = 0;
+            while( UartMcuPutChar( obj, buffer[i] ) != 0 )
+            {
+                retryCount++;
+
+                // Exit if something goes terribly wrong
+                if( retryCount > TX_BUFFER_RETRY_COUNT )
+                {
+                    return 1; // Error
+                }
+            }
+        }
+        return 0; // OK
+    }
+}
+
+uint8_t UartMcuPutBlock( Uart_t *obj, uint8_t *buffer, uint16_t size )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+        return UartMcuPutBuffer( obj, buffer, size );
+    }
+    else
+    {
+        CRITICAL_SECTION_BEGIN( );
+
+        if( FifoFreeSpace( &obj->FifoTx ) >= size )
+        {
+            FifoPushBuffer( &obj->FifoTx, buffer, size );
+
+            if( TxDma == true )
+            {
+                // Starts unless a span of the FIFO is on the way
+                TxDmaSend( obj );
+            }
+            else
+            {
+                // One trigger for the whole buffer
+                __HAL_UART_ENABLE_IT( &UartHandle, UART_IT_TC );
+            }
+
+            CRITICAL_SECTION_END( );
+            return 0; // OK
+        }
+        CRITICAL_SECTION_END( );
+        return 1; // Busy
+    }
+}
+
+uint8_t UartMcuStartRxDma( Uart_t *obj )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+        return 255; // Not supported
+    }
+
+    __HAL_RCC_DMA1_CLK_ENABLE( );
+
+    DmaRxHandle.Instance = DMA1_Channel3;
+    DmaRxHandle.Init.Request = DMA_REQUEST_3;
+    DmaRxHandle.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    DmaRxHandle.Init.PeriphInc = DMA_PINC_DISABLE;
+    DmaRxHandle.Init.MemInc = DMA_MINC_ENABLE;
+    DmaRxHandle.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    DmaRxHandle.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    DmaRxHandle.Init.Mode = DMA_CIRCULAR;
+    DmaRxHandle.Init.Priority = DMA_PRIORITY_HIGH;
+
+    if( HAL_DMA_Init( &DmaRxHandle ) != HAL_OK )
+    {
+        return 1;
+    }
+    __HAL_LINKDMA( &UartHandle, hdmarx, DmaRxHandle );
+
+    HAL_NVIC_SetPriority( DMA1_Channel2_3_IRQn, 1, 0 );
+    HAL_NVIC_EnableIRQ( DMA1_Channel2_3_IRQn );
+
+    // Stop the byte by byte reception, unread bytes of the FIFO are dropped
+    HAL_UART_AbortReceive( &UartHandle );
+    RxDma = true;
+    RxDmaRestart( obj );
+
+    // Idle line tells that a burst has landed in the buffer
+    __HAL_UART_CLEAR_IDLEFLAG( &UartHandle );
+    __HAL_UART_ENABLE_IT( &UartHandle, UART_IT_IDLE );
+    return 0;
+}
+
+uint8_t UartMcuStartTxDma( Uart_t *obj )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+        return 255; // Not supported
+    }
+
+    __HAL_RCC_DMA1_CLK_ENABLE( );
+
+    DmaTxHandle.Instance = DMA1_Channel2;
+    DmaTxHandle.Init.Request = DMA_REQUEST_3;
+    DmaTxHandle.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    DmaTxHandle.Init.PeriphInc = DMA_PINC_DISABLE;
+    DmaTxHandle.Init.MemInc = DMA_MINC_ENABLE;
+    DmaTxHandle.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    DmaTxHandle.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    DmaTxHandle.Init.Mode = DMA_NORMAL;
+    DmaTxHandle.Init.Priority = DMA_PRIORITY_MEDIUM;
+
+    if( HAL_DMA_Init( &DmaTxHandle ) != HAL_OK )
+    {
+        return 1;
+    }
+    __HAL_LINKDMA( &UartHandle, hdmatx, DmaTxHandle );
+
+    HAL_NVIC_SetPriority( DMA1_Channel2_3_IRQn, 1, 0 );
+    HAL_NVIC_EnableIRQ( DMA1_Channel2_3_IRQn );
+
+    // Bytes queued so far go out by the TC interrupt, the next ones by DMA
+    CRITICAL_SECTION_BEGIN( );
+    TxDma = true;
+    if( UartHandle.gState == HAL_UART_STATE_READY )
+    {
+        TxDmaSend( obj );
+    }
+    CRITICAL_SECTION_END( );
+    return 0;
+}
+
+uint8_t UartMcuSetBaudrate( Uart_t *obj, uint32_t baudrate, FlowCtrl_t flowCtrl )
+{
+    if( obj->UartId == UART_USB_CDC )
+    {
+        return 255; // Not supported
+    }
+    if( flowCtrl != NO_FLOW_CTRL && UartMcuIsFlowCtrlSupported( obj ) == false )
+    {
+        return 1;
+    }
+
+    // Let the FIFO and the last byte go out at the current baudrate
+    while( IsFifoEmpty( &obj->FifoTx ) == false || UartHandle.gState != HAL_UART_STATE_READY )
+    {
+    }
+
+    HAL_UART_AbortReceive( &UartHandle );
+
+#if defined( UART1_RTS ) && defined( UART1_CTS )
+    if( flowCtrl != NO_FLOW_CTRL )
+    {
+        GpioInit( &Rts, UART1_RTS, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_NO_PULL, GPIO_AF4_USART1 );
+        GpioInit( &Cts, UART1_CTS, PIN_ALTERNATE_FCT, PIN_PUSH_PULL, PIN_PULL_DOWN, GPIO_AF4_USART1 );
+    }
+#endif
+
+    UartHandle.Init.BaudRate = baudrate;
+    switch( flowCtrl )
+    {
+    case RTS_FLOW_CTRL:
+        UartHandle.Init.HwFlowCtl = UART_HWCONTROL_RTS;
+        break;
+    case CTS_FLOW_CTRL:
+        UartHandle.Init.HwFlowCtl = UART_HWCONTROL_CTS;
+        break;
+    case RTS_CTS_FLOW_CTRL:
+        UartHandle.Init.HwFlowCtl = UART_HWCONTROL_RTS_CTS;
+        break;
+    case NO_FLOW_CTRL:
+    default:
+        UartHandle.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+        break;
+    }
+
+    if( HAL_UART_Init( &UartHandle ) != HAL_OK )
+    {
+        assert_param( FAIL );
+    }
+
+    if( RxDma == true )
+    {
+        RxDmaRestart( obj );
+        __HAL_UART_CLEAR_IDLEFLAG( &UartHandle );
+        __HAL_UART_ENABLE_IT( &UartHandle, UART_IT_IDLE );
+    }
+    else
+    {
+        HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
+    }
+    return 0;
+}
+
+bool UartMcuIsFlowCtrlSupported( Uart_t *obj )
+{
+#if defined( UART1_RTS ) && defined( UART1_CTS )
+    return obj->UartId != UART_USB_CDC;
+#else
+    return false;
+#endif
+}
+
+uint16_t UartMcuPeekBuffer( Uart_t *obj, uint8_t **data )
+{
+    uint16_t write = 0;
+
+    if( RxDma == false )
+    {
+        return 0;
+    }
+
+    write = RxDmaCheckOverrun( obj );
+    *data = obj->FifoRx.Data + RxDmaRead;
+
+    // Contiguous part only, the rest follows from the top of the buffer
+    if( write >= RxDmaRead )
+    {
+        return write - RxDmaRead;
+    }
+    return obj->FifoRx.Size - RxDmaRead;
+}
+
+void UartMcuSkipBuffer( Uart_t *obj, uint16_t size )
+{
+    RxDmaRead = ( RxDmaRead + size ) % obj->FifoRx.Size;
+    RxDmaConsumed += size;
+}
+
+bool UartMcuIsRxOverrun( Uart_t *obj )
+{
+    bool overrun = RxDmaOverrun;
+
+    RxDmaOverrun = false;
+    return overrun;
+}
+
+uint8_t UartMcuGetBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes )
+{
+    uint16_t localSize = 0;
+
+    while( localSize < size )
+    {
+        if( UartMcuGetChar( obj, buffer + localSize ) == 0 )
+        {
+            localSize++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    *nbReadBytes = localSize;
+
+    if( localSize == 0 )
+    {
+        return 1; // Empty
+    }
+    return 0; // OK
+}
+
+void HAL_UART_TxCpltCallback( UART_HandleTypeDef *handle )
+{
+    if( TxDma == true )
+    {
+        // The span has been sent, the rest of the FIFO follows at once
+        Uart.FifoTx.Begin = ( Uart.FifoTx.Begin + TxDmaLen ) % Uart.FifoTx.Size;
+        TxDmaLen = 0;
+        TxDmaSend( &Uart );
+    }
+    else if( IsFifoEmpty( &Uart.FifoTx ) == false )
+    {
+        TxData = FifoPop( &Uart.FifoTx );
+        //  Write one byte to the transmit data register
+        HAL_UART_Transmit_IT( &UartHandle, &TxData, 1 );
+    }
+
+    if( Uart.IrqNotify != NULL )
+    {
+        Uart.IrqNotify( UART_NOTIFY_TX );
+    }
+}
+
+void HAL_UART_RxCpltCallback( UART_HandleTypeDef *handle )
+{
+    if( RxDma == true )
+    {
+        // Transfer complete of the circular DMA, the write index wraps
+        RxDmaLaps++;
+        return;
+    }
+
+    if( IsFifoFull( &Uart.FifoRx ) == false )
+    {
+        // Read one byte from the receive data register
+        FifoPush( &Uart.FifoRx, RxData );
+    }
+
+    if( Uart.IrqNotify != NULL )
+    {
+        Uart.IrqNotify( UART_NOTIFY_RX );
+    }
+
+    HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
+}
+
+void HAL_UART_ErrorCallback( UART_HandleTypeDef *handle )
+{
+    if( TxDmaLen != 0 && handle->gState == HAL_UART_STATE_READY )
+    {
+        // Tx DMA error, the span is still in the FIFO and goes out again
+        TxDmaLen = 0;
+        TxDmaSend( &Uart );
+    }
+
+    if( RxDma == true )
+    {
+        // Reception was aborted, the parser resyncs on the next frame delimiter
+        if( handle->RxState == HAL_UART_STATE_READY )
+        {
+            RxDmaRestart( &Uart );
+        }
+        return;
+    }
+    HAL_UART_Receive_IT( &UartHandle, &RxData, 1 );
+}
+
+void USART1_IRQHandler( void )
+{
+    if( RxDma == true && __HAL_UART_GET_FLAG( &UartHandle, UART_FLAG_IDLE ) )
+    {
+        __HAL_UART_CLEAR_IDLEFLAG( &UartHandle );
+
+        if( Uart.IrqNotify != NULL )
+        {
+            Uart.IrqNotify( UART_NOTIFY_RX );
+        }
+    }
+    HAL_UART_IRQHandler( &UartHandle );
+}
+
+void DMA1_Channel2_3_IRQHandler( void )
+{
+    if( TxDma == true )
+    {
+        HAL_DMA_IRQHandler( &DmaTxHandle );
+    }
+    if( RxDma == true )
+    {
+        HAL_DMA_IRQHandler( &DmaRxHandle );
+    }
+}
+
+static uint16_t RxDmaWriteIndex( Uart_t *obj )
+{
+    return ( obj->FifoRx.Size - __HAL_DMA_GET_COUNTER( &DmaRxHandle ) ) % obj->FifoRx.Size;
+}
+
+/*
+ * Write index of the DMA. When the bytes not read yet fill the buffer, the DMA has written
+ * over them: they are dropped up to the write index and RxDmaOverrun is set.
+ */
+static uint16_t RxDmaCheckOverrun( Uart_t *obj )
+{
+    uint32_t laps = 0;
+    uint16_t write = 0;
+
+    // The transfer complete interrupt may come between the two reads
+    do
+    {
+        laps = RxDmaLaps;
+        write = RxDmaWriteIndex( obj );
+    } while( laps != RxDmaLaps );
+
+    if( (int32_t)( laps * obj->FifoRx.Size + write - RxDmaConsumed ) >= (int32_t)obj->FifoRx.Size )
+    {
+        RxDmaRead = write;
+        RxDmaConsumed = laps * obj->FifoRx.Size + write;
+        RxDmaOverrun = true;
+    }
+    return write;
+}
+
+/*
+ * Sends the bytes from the head of the FIFO up to its end or to the end of the buffer,
+ * called with the interrupts masked or from the UART interrupt
+ */
+static void TxDmaSend( Uart_t *obj )
+{
+    uint16_t start = 0;
+
+    if( TxDmaLen != 0 || IsFifoEmpty( &obj->FifoTx ) == true )
+    {
+        return;
+    }
+
+    start = ( obj->FifoTx.Begin + 1 ) % obj->FifoTx.Size;
+    TxDmaLen = ( obj->FifoTx.End >= start ) ? obj->FifoTx.End - start + 1 : obj->FifoTx.Size - start;
+    if( HAL_UART_Transmit_DMA( &UartHandle, obj->FifoTx.Data + start, TxDmaLen ) != HAL_OK )
+    {
+        // A byte still goes out by the TC interrupt, its callback starts the DMA
+        TxDmaLen = 0;
+    }
+}
+
+static void RxDmaRestart( Uart_t *obj )
+{
+    RxDmaRead = 0;
+    RxDmaLaps = 0;
+    RxDmaConsumed = 0;
+    HAL_UART_Receive_DMA( &UartHandle, obj->FifoRx.Data, obj->FifoRx.Size );
+
+    // Circular buffer, the transfer complete interrupt counts the laps
+    __HAL_DMA_DISABLE_IT( &DmaRxHandle, DMA_IT_HT );
+}
+
+void UartInit( Uart_t *obj, UartId_t uartId, PinNames tx, PinNames rx )
+{
+    if( obj->IsInitialized == false )
+    {
+        obj->IsInitialized = true;
+        UartMcuInit( obj, uartId, tx, rx );
+    }
+}
+
+void UartConfig( Uart_t *obj, UartMode_t mode, uint32_t baudrate, WordLength_t wordLength, StopBits_t stopBits, Parity_t parity, FlowCtrl_t flowCtrl )
+{
+    UartMcuConfig( obj, mode, baudrate, wordLength, stopBits, parity, flowCtrl );
+}
+
+void UartDeInit( Uart_t *obj )
+{
+	Uart.IsInitialized = false;
+    UartMcuDeInit( obj );
+}
+
+uint8_t UartPutChar( uint8_t data )
+{
+     return UartMcuPutChar( &Uart, data );
+}
+
+uint8_t UartGetChar( uint8_t *data )
+{
+    return UartMcuGetChar( &Uart, data );
+}
+
+uint8_t UartPutBuffer( uint8_t *buffer, uint16_t size )
+{
+    return UartMcuPutBuffer( &Uart, buffer, size );
+}
+
+uint8_t UartPutBlock( uint8_t *buffer, uint16_t size )
+{
+    return UartMcuPutBlock( &Uart, buffer, size );
+}
+
+uint8_t UartStartRxDma( void )
+{
+    return UartMcuStartRxDma( &Uart );
+}
+
+uint8_t UartStartTxDma( void )
+{
+    return UartMcuStartTxDma( &Uart );
+}
+
+uint16_t UartPeekBuffer( uint8_t **data )
+{
+    return UartMcuPeekBuffer( &Uart, data );
+}
+
+void UartSkipBuffer( uint16_t size )
+{
+    UartMcuSkipBuffer( &Uart, size );
+}
+
+bool UartIsRxOverrun( void )
+{
+    return UartMcuIsRxOverrun( &Uart );
+}
+
+uint8_t UartSetBaudrate( uint32_t baudrate, FlowCtrl_t flowCtrl )
+{
+    return UartMcuSetBaudrate( &Uart, baudrate, flowCtrl );
+}
+
+bool UartIsFlowCtrlSupported( void )
+{
+    return UartMcuIsFlowCtrlSupported( &Uart );
+}
+
+uint8_t UartGetBuffer( uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes )
+{
+    return UartMcuGetBuffer( &Uart, buffer, size, nbReadBytes );
+}
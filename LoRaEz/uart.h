@@ -1,221 +1,345 @@
-/*!
- * \file      uart.h
- *
- * \brief     UART driver implementation
- *
- * \copyright Revised BSD License, see section \ref LICENSE.
- *
- * \code
- *                ______                              _
- *               / _____)             _              | |
- *              ( (____  _____ ____ _| |_ _____  ____| |__
- *               \____ \| ___ |    (_   _) ___ |/ ___)  _ \
- *               _____) ) ____| | | || |_| ____( (___| | | |
- *              (______/|_____)_|_|_| \__)_____)\____)_| |_|
- *              (C)2013-2017 Semtech
- *
- * \endcode
- *
- * \author    Miguel Luis ( Semtech )
- *
- * \author    Gregory Cristian ( Semtech )
- */
-#ifndef __UART_H__
-#define __UART_H__
-
-#include <stdint.h>
-
-#include "fifo.h"
-#include "gpio.h"
-
-/*!
- * UART peripheral ID
- */
-typedef enum
-{
-    UART_1,
-    UART_2,
-    UART_USB_CDC = 255,
-}UartId_t;
-
-/*!
- * UART notification identifier
- */
-typedef enum
-{
-    UART_NOTIFY_TX,
-    UART_NOTIFY_RX
-}UartNotifyId_t;
-
-/*!
- * UART object type definition
- */
-typedef struct
-{
-    UartId_t UartId;
-    bool IsInitialized;
-    Gpio_t Tx;
-    Gpio_t Rx;
-    Fifo_t FifoTx;
-    Fifo_t FifoRx;
-    /*!
-     * IRQ user notification callback prototype.
-     */
-    void ( *IrqNotify )( UartNotifyId_t id );
-}Uart_t;
-
-/*!
- * Operation Mode for the UART
- */
-typedef enum
-{
-    TX_ONLY = 0,
-    RX_ONLY,
-    RX_TX
-}UartMode_t;
-
-/*!
- * UART word length
- */
-typedef enum
-{
-    UART_8_BIT = 0,
-    UART_9_BIT
-}WordLength_t;
-
-/*!
- * UART stop bits
- */
-typedef enum
-{
-    UART_1_STOP_BIT = 0,
-    UART_0_5_STOP_BIT,
-    UART_2_STOP_BIT,
-    UART_1_5_STOP_BIT
-}StopBits_t;
-
-/*!
- * UART parity
- */
-typedef enum
-{
-    NO_PARITY = 0,
-    EVEN_PARITY,
-    ODD_PARITY
-}Parity_t;
-
-/*!
- * UART flow control
- */
-typedef enum
-{
-    NO_FLOW_CTRL = 0,
-    RTS_FLOW_CTRL,
-    CTS_FLOW_CTRL,
-    RTS_CTS_FLOW_CTRL
-}FlowCtrl_t;
-
-/*!
- * \brief Initializes the UART object and MCU peripheral
- *
- * \param [IN] obj  UART object
- * \param [IN] tx   UART Tx pin name to be used
- * \param [IN] rx   UART Rx pin name to be used
- */
-void UartInit( Uart_t *obj, UartId_t uartId, PinNames tx, PinNames rx );
-
-/*!
- * \brief Configures the UART object and MCU peripheral
- *
- * \remark UartInit function must be called first.
- *
- * \param [IN] obj          UART object
- * \param [IN] mode         Mode of operation for the UART
- * \param [IN] baudrate     UART baudrate
- * \param [IN] wordLength   packet length
- * \param [IN] stopBits     stop bits setup
- * \param [IN] parity       packet parity
- * \param [IN] flowCtrl     UART flow control
- */
-void UartConfig( Uart_t *obj, UartMode_t mode, uint32_t baudrate, WordLength_t wordLength, StopBits_t stopBits, Parity_t parity, FlowCtrl_t flowCtrl );
-
-/*!
- * \brief DeInitializes the UART object and MCU pins
- *
- * \param [IN] obj  UART object
- */
-void UartDeInit( Uart_t *obj );
-
-/*!
- * \brief Sends a character to the UART
- *
- * \param [IN] data  Character to be sent
- * \retval status    [0: OK, 1: Busy]
- */
-uint8_t UartPutChar( uint8_t data );
-
-/*!
- * \brief Sends a buffer to the UART
- *
- * \param [IN] buffer Buffer to be sent
- * \param [IN] size   Buffer size
- * \retval status     [0: OK, 1: Busy]
- */
-uint8_t UartPutBuffer( uint8_t *buffer, uint16_t size );
-/*!
- * \brief Sends a character to the UART
- *
- * \param [IN] obj  UART object
- * \param [IN] data  Received character
- * \retval status    [0: OK, 1: Busy]
- */
-uint8_t UartMcuPutChar( Uart_t *obj, uint8_t data );
-/*!
- * \brief Sends a buffer to the UART
- *
- * \param [IN] obj    UART object
- * \param [IN] buffer Buffer to be sent
- * \param [IN] size   Buffer size
- * \retval status     [0: OK, 1: Busy]
- */
-uint8_t UartMcuPutBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size );
-
-/*!
- * \brief Gets a character from the UART
- *
- * \param [IN] data  Received character
- * \retval status    [0: OK, 1: Busy]
- */
-uint8_t UartGetChar( uint8_t *data );
-
-/*!
- * \brief Gets a character from the UART
- *
- * \param [IN] obj  UART object
- * \param [IN] data  Received character
- * \retval status    [0: OK, 1: Busy]
- */
-uint8_t UartMcuGetChar( Uart_t *obj, uint8_t *data );
-
-/*!
- * \brief Gets a character from the UART
- *
- * \param [IN] buffer       Received buffer
- * \param [IN] size         Number of bytes to be received
- * \param [OUT] nbReadBytes Number of bytes really read
- * \retval status           [0: OK, 1: Busy]
- */
-uint8_t UartGetBuffer( uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes );
-
-/*!
- * \brief Gets a character from the UART
- *
- * \param [IN] obj          UART object
- * \param [IN] buffer       Received buffer
- * \param [IN] size         Number of bytes to be received
- * \param [OUT] nbReadBytes Number of bytes really read
- * \retval status           [0: OK, 1: Busy]
- */
-uint8_t UartMcuGetBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes );
-
-#endif // __UART_H__
+/*!
+ * \file      uart.h
+ *
+ * \brief     UART driver implementation
+ *
+ * \copyright Revised BSD License, see section \ref LICENSE.
+ *
+ * \code
+ *                ______                              _
+ *               / _____)             _              | |
+ *              ( (____  _____ ____ _| |_ _____  ____| |__
+ *               \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ *               _____) ) ____| | | || |_| ____( (___| | | |
+ *              (______/|_____)_|_|_| \__)_____)\____)_| |_|
+ *              (C)2013-2017 Semtech
+ *
+ * \endcode
+ *
+ * \author    Miguel Luis ( Semtech )
+ *
+ * \author    Gregory Cristian ( Semtech )
+ */
+#ifndef __UART_H__
+#define __UART_H__
+
+#include <stdint.h>
+
+#include "fifo.h"
+#include "gpio.h"
+
+/*!
+ * UART peripheral ID
+ */
+typedef enum
+{
+    UART_1,
+    UART_2,
+    UART_USB_CDC = 255,
+}UartId_t;
+
+/*!
+ * UART notification identifier
+ */
+typedef enum
+{
+    UART_NOTIFY_TX,
+    UART_NOTIFY_RX
+}UartNotifyId_t;
+
+/*!
+ * UART object type definition
+ */
+typedef struct
+{
+    UartId_t UartId;
+    bool IsInitialized;
+    Gpio_t Tx;
+    Gpio_t Rx;
+    Fifo_t FifoTx;
+    Fifo_t FifoRx;
+    /*!
+     * IRQ user notification callback prototype.
+     */
+    void ( *IrqNotify )( UartNotifyId_t id );
+}Uart_t;
+
+/*!
+ * Operation Mode for the UART
+ */
+typedef enum
+{
+    TX_ONLY = 0,
+    RX_ONLY,
+    RX_TX
+}UartMode_t;
+
+/*!
+ * UART word length
+ */
+typedef enum
+{
+    UART_8_BIT = 0,
+    UART_9_BIT
+}WordLength_t;
+
+/*!
+ * UART stop bits
+ */
+typedef enum
+{
+    UART_1_STOP_BIT = 0,
+    UART_0_5_STOP_BIT,
+    UART_2_STOP_BIT,
+    UART_1_5_STOP_BIT
+}StopBits_t;
+
+/*!
+ * UART parity
+ */
+typedef enum
+{
+    NO_PARITY = 0,
+    EVEN_PARITY,
+    ODD_PARITY
+}Parity_t;
+
+/*!
+ * UART flow control
+ */
+typedef enum
+{
+    NO_FLOW_CTRL = 0,
+    RTS_FLOW_CTRL,
+    CTS_FLOW_CTRL,
+    RTS_CTS_FLOW_CTRL
+}FlowCtrl_t;
+
+/*!
+ * \brief Initializes the UART object and MCU peripheral
+ *
+ * \param [IN] obj  UART object
+ * \param [IN] tx   UART Tx pin name to be used
+ * \param [IN] rx   UART Rx pin name to be used
+ */
+void UartInit( Uart_t *obj, UartId_t uartId, PinNames tx, PinNames rx );
+
+/*!
+ * \brief Configures the UART object and MCU peripheral
+ *
+ * \remark UartInit function must be called first.
+ *
+ * \param [IN] obj          UART object
+ * \param [IN] mode         Mode of operation for the UART
+ * \param [IN] baudrate     UART baudrate
+ * \param [IN] wordLength   packet length
+ * \param [IN] stopBits     stop bits setup
+ * \param [IN] parity       packet parity
+ * \param [IN] flowCtrl     UART flow control
+ */
+void UartConfig( Uart_t *obj, UartMode_t mode, uint32_t baudrate, WordLength_t wordLength, StopBits_t stopBits, Parity_t parity, FlowCtrl_t flowCtrl );
+
+/*!
+ * \brief DeInitializes the UART object and MCU pins
+ *
+ * \param [IN] obj  UART object
+ */
+void UartDeInit( Uart_t *obj );
+
+/*!
+ * \brief Sends a character to the UART
+ *
+ * \param [IN] data  Character to be sent
+ * \retval status    [0: OK, 1: Busy]
+ */
+uint8_t UartPutChar( uint8_t data );
+
+/*!
+ * \brief Sends a buffer to the UART
+ *
+ * \param [IN] buffer Buffer to be sent
+ * \param [IN] size   Buffer size
+ * \retval status     [0: OK, 1: Busy]
+ */
+uint8_t UartPutBuffer( uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Queues a whole buffer to the UART at once, it is sent in the background
+ *
+ * \param [IN] buffer Buffer to be sent
+ * \param [IN] size   Buffer size
+ * \retval status     [0: OK, 1: Busy, nothing queued]
+ */
+uint8_t UartPutBlock( uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Receives into the Rx FIFO buffer by circular DMA instead of an interrupt per byte.
+ *        IrqNotify gets UART_NOTIFY_RX when the line goes idle.
+ *
+ * \retval status     [0: OK, 1: Error]
+ */
+uint8_t UartStartRxDma( void );
+
+/*!
+ * \brief Sends the Tx FIFO by DMA, a contiguous span of the FIFO at a time,
+ *        instead of a byte by each TC interrupt.
+ *
+ * \retval status     [0: OK, 1: Error]
+ */
+uint8_t UartStartTxDma( void );
+
+/*!
+ * \brief Gets the received bytes in place in the DMA buffer
+ *
+ * \param [OUT] data  Pointer to the first byte
+ * \retval size       Number of contiguous bytes, 0 if none or not in DMA mode
+ */
+uint16_t UartPeekBuffer( uint8_t **data );
+
+/*!
+ * \brief Releases the bytes got by UartPeekBuffer
+ *
+ * \param [IN] size   Number of bytes consumed
+ */
+void UartSkipBuffer( uint16_t size );
+
+/*!
+ * \brief Tells if received bytes were overwritten before they were read, and clears it.
+ *        The bytes not read were dropped, the next ones start at any point of a frame.
+ *
+ * \retval overrun    true if bytes were lost since the last call
+ */
+bool UartIsRxOverrun( void );
+
+/*!
+ * \brief Changes the baudrate and the flow control after the pending Tx bytes are sent
+ *
+ * \param [IN] baudrate  UART baudrate
+ * \param [IN] flowCtrl  UART flow control
+ * \retval status        [0: OK, 1: Flow control not available]
+ */
+uint8_t UartSetBaudrate( uint32_t baudrate, FlowCtrl_t flowCtrl );
+
+/*!
+ * \brief Tells if the board routes the RTS and CTS pins
+ */
+bool UartIsFlowCtrlSupported( void );
+/*!
+ * \brief Sends a character to the UART
+ *
+ * \param [IN] obj  UART object
+ * \param [IN] data  Received character
+ * \retval status    [0: OK, 1: Busy]
+ */
+uint8_t UartMcuPutChar( Uart_t *obj, uint8_t data );
+/*!
+ * \brief Sends a buffer to the UART
+ *
+ * \param [IN] obj    UART object
+ * \param [IN] buffer Buffer to be sent
+ * \param [IN] size   Buffer size
+ * \retval status     [0: OK, 1: Busy]
+ */
+uint8_t UartMcuPutBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size );
+/*!
+ * \brief Queues a whole buffer to the UART in one critical section
+ *
+ * \param [IN] obj    UART object
+ * \param [IN] buffer Buffer to be sent
+ * \param [IN] size   Buffer size
+ * \retval status     [0: OK, 1: Busy, nothing queued]
+ */
+uint8_t UartMcuPutBlock( Uart_t *obj, uint8_t *buffer, uint16_t size );
+/*!
+ * \brief Starts the circular DMA reception into the Rx FIFO buffer
+ *
+ * \param [IN] obj    UART object
+ * \retval status     [0: OK, 1: Error, 255: Not supported]
+ */
+uint8_t UartMcuStartRxDma( Uart_t *obj );
+/*!
+ * \brief Starts sending the Tx FIFO by DMA
+ *
+ * \param [IN] obj    UART object
+ * \retval status     [0: OK, 1: Error, 255: Not supported]
+ */
+uint8_t UartMcuStartTxDma( Uart_t *obj );
+/*!
+ * \brief Gets the received bytes in place in the DMA buffer
+ *
+ * \param [IN]  obj   UART object
+ * \param [OUT] data  Pointer to the first byte
+ * \retval size       Number of contiguous bytes
+ */
+uint16_t UartMcuPeekBuffer( Uart_t *obj, uint8_t **data );
+/*!
+ * \brief Releases the bytes got by UartMcuPeekBuffer
+ *
+ * \param [IN] obj    UART object
+ * \param [IN] size   Number of bytes consumed
+ */
+void UartMcuSkipBuffer( Uart_t *obj, uint16_t size );
+/*!
+ * \brief Tells if received bytes were overwritten before they were read, and clears it
+ *
+ * \param [IN] obj    UART object
+ * \retval overrun    true if bytes were lost since the last call
+ */
+bool UartMcuIsRxOverrun( Uart_t *obj );
+
+/*!
+ * \brief Changes the baudrate and the flow control after the pending Tx bytes are sent
+ *
+ * \param [IN] obj       UART object
+ * \param [IN] baudrate  UART baudrate
+ * \param [IN] flowCtrl  UART flow control
+ * \retval status        [0: OK, 1: Flow control not available]
+ */
+uint8_t UartMcuSetBaudrate( Uart_t *obj, uint32_t baudrate, FlowCtrl_t flowCtrl );
+
+/*!
+ * \brief Tells if the board routes the RTS and CTS pins
+ *
+ * \param [IN] obj  UART object
+ */
+bool UartMcuIsFlowCtrlSupported( Uart_t *obj );
+
+/*!
+ * \brief Gets a character from the UART
+ *
+ * \param [IN] data  Received character
+ * \retval status    [0: OK, 1: Busy]
+ */
+uint8_t UartGetChar( uint8_t *data );
+
+/*!
+ * \brief Gets a character from the UART
+ *
+ * \param [IN] obj  UART object
+ * \param [IN] data  Received character
+ * \retval status    [0: OK, 1: Busy]
+ */
+uint8_t UartMcuGetChar( Uart_t *obj, uint8_t *data );
+
+/*!
+ * \brief Gets a character from the UART
+ *
+ * \param [IN] buffer       Received buffer
+ * \param [IN] size         Number of bytes to be received
+ * \param [OUT] nbReadBytes Number of bytes really read
+ * \retval status           [0: OK, 1: Busy]
+ */
+uint8_t UartGetBuffer( uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes );
+
+/*!
+ * \brief Gets a character from the UART
+ *
+ * \param [IN] obj          UART object
+ * \param [IN] buffer       Received buffer
+ * \param [IN] size         Number of bytes to be received
+ * \param [OUT] nbReadBytes Number of bytes really read
+ * \retval status           [0: OK, 1: Busy]
+ */
+uint8_t UartMcuGetBuffer( Uart_t *obj, uint8_t *buffer, uint16_t size, uint16_t *nbReadBytes );
+
+#endif // __UART_H__
@@ -15,7 +15,13 @@
 #include "timer.h"
 #include "delay.h"
 #include "LoRaLinkApi.h"
+#include "LoRaLinkAirtime.h"
+#include "LoRaLinkAdr.h"
+#include "LoRaLinkFrag.h"
+#include "LoRaLinkStats.h"
+#include "LoRaLinkDup.h"
 #include "device.h"
+#include "uart.h"
 #include "utilities.h"
 
 /*!
@@ -23,7 +29,9 @@
  */
 #define LORALINK_WINDOW_TIMEOUT   6
 #define LORALINK_CODERATE         1       //  4/5
-#define LORALINK_PREAMBLE_LENGTH  8
+#define LORALINK_MIN_PREAMBLE     6       // symbols, the radio can't detect shorter ones
+#define LORALINK_CAD_SYMBOLS      2       // CAD takes about 2 symbols
+#define LORALINK_CAD_TIMEOUT      100     // ms, a CAD at SF12 takes 66ms
 #define LORALINK_DUTYCYCLE        10      //  10%
 #define LORALINK_MAX_PORWER       13      //  13dBm
 
@@ -97,6 +105,24 @@ LoRaLinkRadioEvents_t LoRaLinkRadioEventsStatus = { .Value = 0 };
  */
 bool LoRaLinkNextTx = false;
 
+/*!
+ * Oldest frame of the Rx queue is in use by LoRaLinkPacket
+ */
+static bool RxFrameHeld = false;
+
+/*!
+ * Offset of the next message in a LINK_AGGREGATE frame held
+ */
+static uint8_t RxAggregateOffset = 0;
+/*!
+ * LoRaLinkRecvPoll() reception in progress
+ */
+static bool RxPolling = false;
+/*!
+ * Backoff taken by fragments sent again from LoRaLinkRecvPoll()
+ */
+static uint32_t RetxNfcTime = 0;
+
 
 /*
  * Forward declarations
@@ -107,12 +133,19 @@ static void ProcessRadioRxTimeout( void );
 static void ProcessRadioTxTimeout( void );
 static void ProcessRadioRxError( void );
 static void ProcessRadioTxDelaied( void );
+static void ProcessRadioCadDone( bool detected );
+static void ProcessRxQueue( void );
+static void ReleaseRxFrame( void );
+static bool IsRxRunning( void );
+static void RxStart( void );
+static void RxStop( void );
 
 static void OnRadioTxDone( void );
 static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr );
 static void OnRadioTxTimeout( void );
 static void OnRadioRxError( void );
 static void OnRadioRxTimeout( void );
+static void OnRadioCadDone( bool channelActivityDetected );
 static void OnTxDelayedTimerEvent( void *context );
 
 static void LoRaLinkHandleIrqEvents( void );
@@ -121,7 +154,17 @@ static bool SetTxConfig( TxConfigParams_t* txConfig, TimerTime_t* txTimeOnAir );
 static bool SetRxConfig( RxConfigParams_t* rxConfig );
 static void CalcBackOffTime( void );
 static uint32_t GetBandwidth( uint8_t sfValue );
+static void GetRxMeta( LoRaLinkRxMeta_t* meta );
 static uint8_t GetMaxPayloadLength( uint8_t sfValue );
+static uint32_t GetTimeOnAir( uint8_t sfValue, uint8_t pktLen );
+static uint32_t GetFrequency( uint8_t channel );
+static void InitTxChannelPlan( uint8_t channel );
+static void SetTxParams( uint8_t destAddr );
+static LoRaLinkStatus_t SendTo( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t timeout );
+static LoRaLinkStatus_t SetLinkTxData( uint8_t destAddr, uint8_t payloadType, uint8_t payloadLen );
+static LoRaLinkStatus_t SetFragmentTxData( void );
+static LoRaLinkStatus_t SendFragments( uint32_t timeout );
+static LoRaLinkStatus_t PadTxData( LoRaLinkPacket_t* pkt );
 
 
 
@@ -145,6 +188,107 @@ int8_t LoRaLinkGetSnr( void )
 	return RxDoneParams.Snr;
 }
 
+LoRaLinkStatus_t LoRaLinkSetRxScan( uint8_t* sfValues, uint8_t num )
+{
+	if ( num > LORALINK_MAX_SCAN_SF || ( num > 0 && sfValues == NULL ) )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		if ( sfValues[i] < SF_7 || sfValues[i] > SF_12 )
+		{
+			return LORALINK_STATUS_PARAMETER_INVALID;
+		}
+	}
+
+	memcpy1( LoRaLinkCtx.RxScan.SFValue, sfValues, num );
+	LoRaLinkCtx.RxScan.Num = num;
+	LoRaLinkCtx.RxScan.Idx = 0;
+	return LORALINK_STATUS_OK;
+}
+
+uint32_t LoRaLinkGetScanCycle( void )
+{
+	uint32_t cycle = 0;
+	uint8_t sf = 0;
+
+	if ( LoRaLinkCtx.RxScan.Num < 2 )
+	{
+		return 0;
+	}
+	for ( uint8_t i = 0; i < LoRaLinkCtx.RxScan.Num; i++ )
+	{
+		sf = LoRaLinkCtx.RxScan.SFValue[i];
+		// Symbol time in us
+		cycle += LORALINK_CAD_SYMBOLS * ( ( ( 1UL << sf ) * 1000000UL ) / Bandwidths[SF_12 - sf] );
+	}
+	return ( cycle + 999 ) / 1000;
+}
+
+void LoRaLinkGetRxQueueStats( LoRaLinkRxQueueStats_t* stats )
+{
+	CRITICAL_SECTION_BEGIN( );
+	stats->Received = LoRaLinkCtx.RxQueue.Received;
+	stats->Overflow = LoRaLinkCtx.RxQueue.Overflow;
+	stats->HighWater = LoRaLinkCtx.RxQueue.HighWater;
+	CRITICAL_SECTION_END( );
+	stats->BlindTime = LoRaLinkCtx.RxQueue.BlindTime;
+	stats->BlindMax = LoRaLinkCtx.RxQueue.BlindMax;
+	stats->Restarts = LoRaLinkCtx.RxQueue.Restarts;
+	stats->Depth = LORALINK_RX_QUEUE_DEPTH;
+}
+
+void LoRaLinkGetStats( LoRaLinkStats_t* stats )
+{
+	*stats = LoRaLinkStats;
+}
+
+void LoRaLinkResetStats( void )
+{
+	LoRaLinkStatsReset( );
+}
+
+
+void LoRaLinkSetCarrierSense( LoRaLinkCarrierSense_t* carrierSense )
+{
+	if ( carrierSense == NULL )
+	{
+		LoRaLinkCtx.CarrierSense.Method = LORALINK_CS_RSSI;
+		LoRaLinkCtx.CarrierSense.RssiThresh = LORALINK_RSSI_THRESH;
+		LoRaLinkCtx.CarrierSense.SenseTime = LORALINK_MAX_CARRIERSENSE_TIME;
+	}
+	else
+	{
+		LoRaLinkCtx.CarrierSense = *carrierSense;
+	}
+	LoRaLinkCtx.TxConfigValid = false;
+	memset1( (uint8_t*)&LoRaLinkCtx.TxOverhead, 0, sizeof(LoRaLinkTxOverhead_t) );
+}
+
+LoRaLinkStatus_t LoRaLinkSetPhyProfile( LoRaLinkPhyProfile_t* phy )
+{
+	LoRaLinkPhyProfile_t standard = LORALINK_PHY_STANDARD;
+
+	if ( phy == NULL )
+	{
+		phy = &standard;
+	}
+	if ( phy->PreambleLen < LORALINK_MIN_PREAMBLE ||
+	     ( phy->ImplicitHeader == true && ( phy->FixedLen <= LORALINK_AGGREGATE_SUBHDR_LEN + LORALINK_FRAG_FEC_HDR_LEN ||
+	                                        phy->FixedLen > LORA_PHY_MAXPAYLOAD - LORALINK_HDR_LEN - LORALINK_MIC_LEN ) ) )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+	LoRaLinkCtx.Phy = *phy;
+	LoRaLinkCtx.TxConfigValid = false;
+	return LORALINK_STATUS_OK;
+}
+
+void LoRaLinkGetTxOverhead( LoRaLinkTxOverhead_t* overhead )
+{
+	*overhead = LoRaLinkCtx.TxOverhead;
+}
 
 void LoRaLinkInitilize(void)
 {
@@ -154,15 +298,29 @@ void LoRaLinkInitilize(void)
 	LoRaLinkRadioEvents.TxTimeout = OnRadioTxTimeout;
 	LoRaLinkRadioEvents.RxTimeout = OnRadioRxTimeout;
 	LoRaLinkRadioEvents.FhssChangeChannel = NULL;
+	LoRaLinkRadioEvents.CadDone = OnRadioCadDone;
 
 	SX1276Init(&LoRaLinkRadioEvents);
 
 	TimerInit(&LoRaLinkCtx.TxDelayedTimer, OnTxDelayedTimerEvent);
 	LoRaLinkCtx.LastTxDoneTime = 0;
+	LoRaLinkAirtimeInit( LORALINK_DUTYCYCLE_WINDOW );
+	LoRaLinkSetCarrierSense( NULL );
+	LoRaLinkSetPhyProfile( NULL );
+	LoRaLinkFragInit( false );
+	LoRaLinkCtx.FecGroup = 0;
+	memset1( (uint8_t*)LoRaLinkCtx.FecDests, 0, sizeof(LoRaLinkCtx.FecDests) );
+	LoRaLinkDupInit( LORALINK_DUP_OFF, LORALINK_DUP_WINDOW );
+	LoRaLinkStatsReset( );
 }
 
-LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAddr,uint8_t syncWord,  uint8_t uplinkCh, uint8_t dwnlinkCh, LoRaLinkSf_t sfValue, int8_t power )
+LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAddr,uint8_t syncWord,  uint8_t uplinkCh, uint8_t dwnlinkCh, LoRaLinkSf_t sfValue, int8_t power, LoRaLinkCarrierSense_t* carrierSense, LoRaLinkPhyProfile_t* phy )
 {
+	if ( LoRaLinkSetPhyProfile( phy ) != LORALINK_STATUS_OK )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+
 	if ( ( uplinkCh <= DwelltimeRange[0] && uplinkCh < DwelltimeRange[1] ) && ( dwnlinkCh <= DwelltimeRange[0] && dwnlinkCh < DwelltimeRange[1] ) )
 	{
 		LoRaLinkCtx.LoRaLinkDwelltime = DWELLTIME_0;
@@ -204,6 +362,10 @@ LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAd
 	}
 	LoRaLinkCtx.RxConfig.RxContinuous = true;
 	LoRaLinkCtx.RxConfig.WindowTimeout = LORALINK_WINDOW_TIMEOUT;
+	InitTxChannelPlan( uplinkCh );
+	LoRaLinkCtx.TxChannelPlanOn = true;
+	LoRaLinkSetCarrierSense( carrierSense );
+	LoRaLinkAdrInit( LoRaLinkCtx.LoRaLinkDwelltime, sfValue, LoRaLinkCtx.TxConfig.TxPower );
 
 	LoRaLinkCryptoSetKey( key );
 	LoRaLinkSetDeviceId( panId, devAddr);
@@ -215,9 +377,15 @@ LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAd
 
 #define TX_TIMEOUT 20000
 
-LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, LoRaLinkUartType_t uartType, uint8_t syncWord, uint8_t uplinkCh, uint8_t dwnlinkCh, LoRaLinkSf_t sfValue )
+LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, LoRaLinkUartType_t uartType, uint8_t syncWord, uint8_t uplinkCh, uint8_t dwnlinkCh, LoRaLinkSf_t sfValue, LoRaLinkPhyProfile_t* phy )
 {
 	LoRaLinkStatus_t rc = LORALINK_STATUS_ERROR;
+	LoRaLinkRxMeta_t rxMeta = { 0 };
+
+	if ( LoRaLinkSetPhyProfile( phy ) != LORALINK_STATUS_OK )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
 
 	if ( ( dwnlinkCh >= DwelltimeRange[0] && dwnlinkCh < DwelltimeRange[1] ) && ( uplinkCh >= DwelltimeRange[0] && uplinkCh < DwelltimeRange[1] ) )
 	{
@@ -251,20 +419,42 @@ LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, Lo
 	LoRaLinkCtx.TxConfig.SFValue = sfValue;
 	LoRaLinkCtx.TxConfig.TxPower = LORALINK_MAX_PORWER;
 	LoRaLinkCtx.RxConfig.WindowTimeout = LORALINK_WINDOW_TIMEOUT;
+	// Nodes listen on the downlink channel only
+	InitTxChannelPlan( dwnlinkCh );
+	LoRaLinkCtx.TxChannelPlanOn = false;
+	LoRaLinkAdrInit( LoRaLinkCtx.LoRaLinkDwelltime, sfValue, LoRaLinkCtx.TxConfig.TxPower );
+	// Rx modem requests the missing fragments
+	LoRaLinkFragInit( uartType == LORALINK_UART_RX );
+	// Frames heard again are flagged to the gateway, it may ask to drop them
+	LoRaLinkDupInit( uartType == LORALINK_UART_RX ? LORALINK_DUP_FLAG : LORALINK_DUP_OFF, LORALINK_DUP_WINDOW );
 
 	LoRaLinkCryptoSetKey( key );
 	LoRaLinkSetDeviceId( panId, devAddr);
 
 	SX1276SetSyncword(syncWord);
 
+	// Frames to the host leave by DMA while the radio goes on
+	UartStartTxDma();
+
 	if ( uartType == LORALINK_UART_TX )
 	{
+		// Host frames land in memory by DMA, LoRaLinkApiRead() parses them in place
+		UartStartRxDma();
 		LoRaLinkCtx.RxConfig.RxContinuous = false;
 		DeviceStatus = DEVICE_STATE_TX_INIT;
 	}
+	else if ( LoRaLinkCtx.RxScan.Num > 1 )
+	{
+		// Single Rx at the SF found by CAD, the scan goes on after each frame
+		LoRaLinkCtx.RxConfig.RxContinuous = false;
+		LoRaLinkCtx.RxAlwaysOn = false;
+		LoRaLinkCtx.RxScan.Idx = 0;
+		DeviceStatus = DEVICE_STATE_RX_INIT;
+	}
 	else
 	{
 		LoRaLinkCtx.RxConfig.RxContinuous = true;
+		LoRaLinkCtx.RxAlwaysOn = true;
 		DeviceStatus = DEVICE_STATE_RX_INIT;
 	}
 
@@ -273,31 +463,56 @@ LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, Lo
 	rc = LORALINK_STATUS_OK;
 	LoRaLinkApiReadParameters_t resp = { 0 };
 	LoRaLinkApi_t api = { 0 };
-	LoRaLinkPacket_t ack = { 0 };
 
 	uint32_t  nfcTime = 0;
 	int32_t   delay;
+	uint8_t   nackAddr = 0;
+	bool      nackTx = false;
 
 
 	while ( true )
 	{
 		LoRaLinkHandleIrqEvents();
+		// Keep the host frames flowing into the queue while the radio is busy
+		LoRaLinkApiPoll();
 
 		switch ( (int)DeviceStatus )
 		{
 		case DEVICE_STATE_RX_INIT:
+			if ( LoRaLinkFragGetNack( LoRaLinkGetTxPayloadBuffer(), &nackAddr ) == true &&
+			     SetLinkTxData( nackAddr, LINK_FRAGMENT_NACK, LORALINK_FRAG_NACK_LEN ) == LORALINK_STATUS_OK )
+			{
+				RxStop();
+				nackTx = true;
+				nfcTime = 0;
+				LoRaLinkNextTx = true;
+				DeviceStatus = DEVICE_STATE_TX;
+				break;
+			}
+			if ( IsRxRunning() == true )
+			{
+				// Still listening, nothing to set up again
+				DeviceStatus = DEVICE_STATE_SLEEP;
+				break;
+			}
+			if ( LoRaLinkCtx.RxScan.Num > 1 )
+			{
+				LoRaLinkCtx.RxConfig.SFValue = LoRaLinkCtx.RxScan.SFValue[LoRaLinkCtx.RxScan.Idx];
+			}
 			SetRxConfig( &LoRaLinkCtx.RxConfig );
 			DeviceStatus = DEVICE_STATE_RX;
 			break;
 
 		case DEVICE_STATE_RX:
-			SX1276SetRx(0);
+			RxStart();
 			DeviceStatus = DEVICE_STATE_SLEEP;
 			break;
 
 		case DEVICE_STATE_RX_DONE:
-			LoRaLinkApiWrite( &LoRaLinkPacket );
-			DeviceStatus = DEVICE_STATE_RX_INIT;
+			GetRxMeta( &rxMeta );
+			LoRaLinkApiWriteRx( &LoRaLinkPacket, &rxMeta );
+			ReleaseRxFrame();
+			ProcessRxQueue();    // next queued frame or DEVICE_STATE_RX_INIT
 			break;
 
 		case DEVICE_STATE_RX_TIMEOUT:
@@ -308,10 +523,23 @@ LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, Lo
 		case DEVICE_STATE_TX_INIT:
 			if ( ( LoRaLinkApiRead( &api, &resp) == true ) && (resp.Available == true) && ( resp.Error == false ) )
 			{
-				// create TxPacket
-				LoRaLinkApiSetTxData( &LoRaLinkCtx.TxMsg, &api );
-				LoRaLinkNextTx = true;
-				DeviceStatus = DEVICE_STATE_TX;
+				// create TxPacket, a payload longer than the max payload length or with FEC is sent in fragments.
+				// The modem sends at the default Tx parameters.
+				if ( api.PayloadLen > LoRaLinkGetMaxPayloadLength( LORALINK_MULTICAST_ADDR ) || LoRaLinkGetFec( api.DestinationAddr ) > 0 )
+				{
+					if ( LoRaLinkFragStart( api.DestinationAddr, api.PayloadType, api.Payload, api.PayloadLen, LoRaLinkGetMaxPayloadLength( LORALINK_MULTICAST_ADDR ), LoRaLinkGetFec( api.DestinationAddr ) ) == LORALINK_STATUS_OK &&
+					     SetFragmentTxData() == LORALINK_STATUS_OK )
+					{
+						nfcTime = 0;
+						LoRaLinkNextTx = true;
+						DeviceStatus = DEVICE_STATE_TX;
+					}
+				}
+				else if ( LoRaLinkApiSetTxData( &LoRaLinkCtx.TxMsg, &api ) == LORALINK_STATUS_OK )
+				{
+					LoRaLinkNextTx = true;
+					DeviceStatus = DEVICE_STATE_TX;
+				}
 			}
 			break;
 
@@ -331,38 +559,81 @@ LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, Lo
 		case DEVICE_STATE_TX_NO_FREE_CH:
 			delay = randr( RND_LWL, RND_UPL);
 
-			if ( ( nfcTime += delay ) < TX_TIMEOUT )
+			if ( nackTx == false && LoRaLinkApiIsExpired( &api ) == true )
+			{
+				// Deadline passed while waiting for the channel
+				LoRaLinkFragStop();
+				LoRaLinkApiWriteResp( API_RSP_TOT, &api );
+				DeviceStatus = DEVICE_STATE_TX_INIT;
+			}
+			else if ( ( nfcTime += delay ) < TX_TIMEOUT )
 			{
 				TimerSetValue( &LoRaLinkCtx.TxDelayedTimer, delay );
 				TimerStart(&LoRaLinkCtx.TxDelayedTimer);
 				DeviceStatus = DEVICE_STATE_SLEEP;
 			}
+			else if ( nackTx == true )
+			{
+				nackTx = false;
+				DeviceStatus = DEVICE_STATE_RX_INIT;
+			}
 			else
 			{
-				ack.FRMPayloadType = API_RSP_NFC;
-				ack.FRMPayloadSize = 0;
-				ack.DestAddr = api.SourceAddr;
-				ack.SourceAddr = api.SourceAddr;
-				ack.Rssi = 0;
-				ack.Snr = 0;
-				LoRaLinkApiWrite(&ack);
+				LoRaLinkFragStop();
+				LoRaLinkApiWriteResp( API_RSP_NFC, &api );
 				DeviceStatus = DEVICE_STATE_TX_INIT;
 			}
 			break;
 
 		case DEVICE_STATE_TX_DONE:
-			ack.FRMPayloadType = API_RSP_ACK;
-			ack.FRMPayloadSize = 0;
-			ack.DestAddr = api.SourceAddr;
-			ack.SourceAddr = api.SourceAddr;
-			ack.Rssi = 0;
-			ack.Snr = 0;
-			LoRaLinkApiWrite(&ack);
+			if ( nackTx == true )
+			{
+				nackTx = false;
+				DeviceStatus = DEVICE_STATE_RX_INIT;
+				break;
+			}
+			if ( LoRaLinkFragPending() == true && SetFragmentTxData() == LORALINK_STATUS_OK )
+			{
+				nfcTime = 0;
+				LoRaLinkNextTx = true;
+				DeviceStatus = DEVICE_STATE_TX;
+				break;
+			}
+			LoRaLinkApiWriteResp( API_RSP_ACK, &api );
+			DeviceStatus = DEVICE_STATE_TX_INIT;
+			break;
+
+		case DEVICE_STATE_TX_TIMEOUT:
+			if ( nackTx == true )
+			{
+				nackTx = false;
+				DeviceStatus = DEVICE_STATE_RX_INIT;
+				break;
+			}
+			LoRaLinkFragStop();
+			LoRaLinkApiWriteResp( API_RSP_TOT, &api );
 			DeviceStatus = DEVICE_STATE_TX_INIT;
 			break;
 
 		case DEVICE_STATE_SLEEP:
 			// No need to set LowPower, getting the power from USB
+			if ( LoRaLinkCtx.RxScan.Cad == true && TimerGetElapsedTime( LoRaLinkCtx.RxScan.CadStart ) > LORALINK_CAD_TIMEOUT )
+			{
+				// CadDone is lost, go on with the next SF
+				ProcessRadioCadDone( false );
+				break;
+			}
+			if ( uartType == LORALINK_UART_RX && nackTx == false &&
+			     LoRaLinkFragGetNack( LoRaLinkGetTxPayloadBuffer(), &nackAddr ) == true &&
+			     SetLinkTxData( nackAddr, LINK_FRAGMENT_NACK, LORALINK_FRAG_NACK_LEN ) == LORALINK_STATUS_OK )
+			{
+				// Fragments stopped arriving, leave Rx to request the missing ones
+				RxStop();
+				nackTx = true;
+				nfcTime = 0;
+				LoRaLinkNextTx = true;
+				DeviceStatus = DEVICE_STATE_TX;
+			}
 			break;
 
 		default:
@@ -375,6 +646,8 @@ LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, Lo
 
 static LoRaLinkStatus_t LoRaLinkSendPacket( uint32_t timeout )
 {
+	// A reception left by LoRaLinkRecvPoll() ends with the transmission
+	RxPolling = false;
 	LoRaLinkNextTx = true;
 	uint32_t  nfcTime = 0;
 	int32_t   delay;
@@ -430,32 +703,182 @@ static LoRaLinkStatus_t LoRaLinkSendPacket( uint32_t timeout )
 	}
 }
 
+uint8_t* LoRaLinkGetTxPayloadBuffer( void )
+{
+	return LoRaLinkCtx.PktBuffer + LORALINK_HDR_LEN;
+}
+
 LoRaLinkStatus_t LoRaLinkSend( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t timeout )
 {
-	LoRaLinkApi_t api = { 0 };
+	LoRaLinkStatus_t rc = LORALINK_STATUS_OK;
+
+	// Tx parameters of the peer for this frame only
+	SetTxParams( destAddr );
+	rc = SendTo( destAddr, payloadType, buffer, buffLen, timeout );
+	SetTxParams( LORALINK_MULTICAST_ADDR );
+	return rc;
+}
+
+static LoRaLinkStatus_t SendTo( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t timeout )
+{
 	LoRaLinkPacket_t pkt = { 0 };
 
-	if ( buffLen > LoRaLinkGetMaxPayloadLength() )
+	if ( buffLen > LoRaLinkGetMaxPayloadLength( destAddr ) || LoRaLinkGetFec( destAddr ) > 0 )
 	{
-		return LORALINK_STATUS_LENGTH_ERROR;
+		if ( LoRaLinkFragStart( destAddr, payloadType, buffer, buffLen, LoRaLinkGetMaxPayloadLength( destAddr ), LoRaLinkGetFec( destAddr ) ) != LORALINK_STATUS_OK )
+		{
+			return LORALINK_STATUS_LENGTH_ERROR;
+		}
+		return SendFragments( timeout );
 	}
 
-	api.PanId = LoRaLinkCtx.LoRaLinkPanId;
-	api.DestinationAddr = destAddr;
-	api.SourceAddr = LoRaLinkCtx.LoRaLinkDeviceAddr;
-	api.PayloadType = payloadType;
-	api.PayloadLen = buffLen;
-	memcpy1( api.Payload, buffer, buffLen );
+	pkt.PanId = LoRaLinkCtx.LoRaLinkPanId;
+	pkt.DestAddr = destAddr;
+	pkt.SourceAddr = LoRaLinkCtx.LoRaLinkDeviceAddr;
+	pkt.FRMPayloadType = payloadType;
+	pkt.FRMPayload = buffer;
+	pkt.FRMPayloadSize = buffLen;
 
-	LoRaLinkApiSetTxData( &pkt, &api );
+	if ( LoRaLinkSetTxData( &pkt ) != LORALINK_STATUS_OK )
+	{
+		return LORALINK_STATUS_ERROR;
+	}
 	DeviceStatus = DEVICE_STATE_TX;
 
 	return LoRaLinkSendPacket(timeout);
 }
 
+LoRaLinkStatus_t LoRaLinkAggregate( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t maxDelay, uint32_t timeout )
+{
+	LoRaLinkAggregate_t* agg = &LoRaLinkCtx.Aggregate;
+	LoRaLinkStatus_t rc = LORALINK_STATUS_OK;
+	TimerTime_t deadline = TimerGetCurrentTime() + maxDelay;
+
+	if ( buffLen == 0 || buffLen + LORALINK_AGGREGATE_SUBHDR_LEN > LoRaLinkGetMaxPayloadLength( destAddr ) )
+	{
+		// A zero Length byte is the padding of an implicit header frame
+		return LORALINK_STATUS_LENGTH_ERROR;
+	}
+
+	if ( ( agg->Count > 0 ) && ( LoRaLinkAggregateFits( destAddr, buffLen ) == false ) )
+	{
+		rc = LoRaLinkAggregateFlush( timeout );
+		if ( rc != LORALINK_STATUS_OK )
+		{
+			// Queued messages are kept, this one is not taken
+			return rc;
+		}
+	}
+
+	if ( ( agg->Count == 0 ) || ( (int32_t)( deadline - agg->Deadline ) < 0 ) )
+	{
+		agg->Deadline = deadline;
+	}
+	agg->DestAddr = destAddr;
+	agg->Buffer[agg->Len] = buffLen;
+	agg->Buffer[agg->Len + 1] = payloadType;
+	memcpy1( agg->Buffer + agg->Len + LORALINK_AGGREGATE_SUBHDR_LEN, buffer, buffLen );
+	agg->Len += buffLen + LORALINK_AGGREGATE_SUBHDR_LEN;
+	agg->Count++;
+
+	return LoRaLinkAggregateProcess( timeout );
+}
+
+LoRaLinkStatus_t LoRaLinkAggregateProcess( uint32_t timeout )
+{
+	LoRaLinkAggregate_t* agg = &LoRaLinkCtx.Aggregate;
+	TimerTime_t delay = 0;
+
+	if ( agg->Count == 0 )
+	{
+		return LORALINK_STATUS_OK;
+	}
+
+	// Full: no room for another message
+	if ( agg->Len + LORALINK_AGGREGATE_SUBHDR_LEN >= LoRaLinkGetMaxPayloadLength( agg->DestAddr ) )
+	{
+		return LoRaLinkAggregateFlush( timeout );
+	}
+
+	// Delay expired: while the duty cycle holds the frame back, keep collecting
+	if ( (int32_t)( TimerGetCurrentTime() - agg->Deadline ) >= 0 )
+	{
+		SetTxParams( agg->DestAddr );
+		delay = LoRaLinkGetTxDelay( agg->Len );
+		SetTxParams( LORALINK_MULTICAST_ADDR );
+		if ( delay == 0 )
+		{
+			return LoRaLinkAggregateFlush( timeout );
+		}
+	}
+	return LORALINK_STATUS_OK;
+}
+
+LoRaLinkStatus_t LoRaLinkAggregateFlush( uint32_t timeout )
+{
+	LoRaLinkAggregate_t* agg = &LoRaLinkCtx.Aggregate;
+	LoRaLinkStatus_t rc = LORALINK_STATUS_OK;
+
+	if ( agg->Count == 1 )
+	{
+		// Single message is sent as is
+		rc = LoRaLinkSend( agg->DestAddr, agg->Buffer[1], agg->Buffer + LORALINK_AGGREGATE_SUBHDR_LEN, agg->Buffer[0], timeout );
+	}
+	else if ( agg->Count > 1 )
+	{
+		rc = LoRaLinkSend( agg->DestAddr, LINK_AGGREGATE, agg->Buffer, agg->Len, timeout );
+	}
+
+	if ( rc == LORALINK_STATUS_OK )
+	{
+		LoRaLinkAggregateClear();
+	}
+	return rc;
+}
+
+bool LoRaLinkAggregateFits( uint8_t destAddr, uint8_t buffLen )
+{
+	LoRaLinkAggregate_t* agg = &LoRaLinkCtx.Aggregate;
+
+	return ( agg->Count > 0 ) && ( agg->DestAddr == destAddr ) &&
+	       ( agg->Len + buffLen + LORALINK_AGGREGATE_SUBHDR_LEN <= LoRaLinkGetMaxPayloadLength( destAddr ) );
+}
+
+void LoRaLinkAggregateClear( void )
+{
+	LoRaLinkCtx.Aggregate.Count = 0;
+	LoRaLinkCtx.Aggregate.Len = 0;
+}
+
 LoRaLinkStatus_t LoRaLinkRecvPacket( LoRaLinkPacket_t* pkt, uint32_t timeout )
 {
-	DeviceStatus = DEVICE_STATE_RX_INIT;
+	LoRaLinkStatus_t rc;
+
+	while ( ( rc = LoRaLinkRecvPoll( pkt, timeout ) ) == LORALINK_STATUS_BUSY )
+	{
+		DeviceLowPowerHandler( );
+	}
+	return rc;
+}
+
+LoRaLinkStatus_t LoRaLinkRecvPoll( LoRaLinkPacket_t* pkt, uint32_t timeout )
+{
+	int32_t delay;
+
+	if ( RxPolling == false )
+	{
+		// Rest of the messages of an aggregated frame
+		if ( ( RxFrameHeld == true ) && ( LoRaLinkPacket.FRMPayloadType == LINK_AGGREGATE ) &&
+		     ( LoRaLinkApiGetSubMessage( &LoRaLinkPacket, &RxAggregateOffset, pkt ) == true ) )
+		{
+			return LORALINK_STATUS_OK;
+		}
+
+		// Frame returned by the previous call is no longer used
+		ReleaseRxFrame();
+		ProcessRxQueue();
+		RxPolling = true;
+	}
 
 	while ( true )
 	{
@@ -464,10 +887,59 @@ LoRaLinkStatus_t LoRaLinkRecvPacket( LoRaLinkPacket_t* pkt, uint32_t timeout )
 		switch ( (int)DeviceStatus )
 		{
 		case DEVICE_STATE_RX_INIT:
+			if ( LoRaLinkFragPending() == true && SetFragmentTxData() == LORALINK_STATUS_OK )
+			{
+				// Missing fragments requested by the receiver go out one by one before Rx
+				RetxNfcTime = 0;
+				LoRaLinkNextTx = true;
+				DeviceStatus = DEVICE_STATE_TX;
+				break;
+			}
 			SetRxConfig( &LoRaLinkCtx.RxConfig );
 			DeviceStatus = DEVICE_STATE_RX;
 			break;
 
+		case DEVICE_STATE_TX:
+			if ( LoRaLinkNextTx )
+			{
+				LoRaLinkNextTx = scheduleTx();
+				break;
+			}
+			// The TxDone interrupt ends the wait
+			return LORALINK_STATUS_BUSY;
+
+		case DEVICE_STATE_CYCLE:
+			TimerSetValue( &LoRaLinkCtx.TxDelayedTimer, LoRaLinkCtx.BackoffTime );
+			TimerStart(&LoRaLinkCtx.TxDelayedTimer);
+			DeviceStatus = DEVICE_STATE_SLEEP;
+			break;
+
+		case DEVICE_STATE_TX_NO_FREE_CH:
+			delay = randr( RND_LWL, RND_UPL);
+
+			if ( ( RetxNfcTime += delay ) < TX_TIMEOUT )
+			{
+				TimerSetValue( &LoRaLinkCtx.TxDelayedTimer, delay );
+				TimerStart(&LoRaLinkCtx.TxDelayedTimer);
+				DeviceStatus = DEVICE_STATE_SLEEP;
+			}
+			else
+			{
+				// Give up the message, a later NACK finds nothing to send
+				LoRaLinkFragStop();
+				DeviceStatus = DEVICE_STATE_RX_INIT;
+			}
+			break;
+
+		case DEVICE_STATE_TX_DONE:
+			DeviceStatus = DEVICE_STATE_RX_INIT;
+			break;
+
+		case DEVICE_STATE_TX_TIMEOUT:
+			LoRaLinkFragStop();
+			DeviceStatus = DEVICE_STATE_RX_INIT;
+			break;
+
 		case DEVICE_STATE_RX:
 			SX1276SetRx( timeout );
 
@@ -478,10 +950,24 @@ LoRaLinkStatus_t LoRaLinkRecvPacket( LoRaLinkPacket_t* pkt, uint32_t timeout )
 			break;
 
 		case DEVICE_STATE_SLEEP:
-			DeviceLowPowerHandler( );
-			break;
+			// The radio interrupt ends the wait
+			return LORALINK_STATUS_BUSY;
 
 		case DEVICE_STATE_RX_DONE:
+			if ( LoRaLinkPacket.FRMPayloadType == LINK_AGGREGATE )
+			{
+				RxAggregateOffset = 0;
+				if ( LoRaLinkApiGetSubMessage( &LoRaLinkPacket, &RxAggregateOffset, pkt ) == true )
+				{
+					RxPolling = false;
+					return LORALINK_STATUS_OK;
+				}
+				// Empty or broken aggregate
+				ReleaseRxFrame();
+				ProcessRxQueue();
+				break;
+			}
+			RxPolling = false;
 			pkt->Rssi = LoRaLinkPacket.Rssi;
 			pkt->Snr = LoRaLinkPacket.Snr;
 			pkt->PanId = LoRaLinkPacket.PanId;
@@ -494,48 +980,127 @@ LoRaLinkStatus_t LoRaLinkRecvPacket( LoRaLinkPacket_t* pkt, uint32_t timeout )
 			return LORALINK_STATUS_OK;
 
 		case DEVICE_STATE_RX_TIMEOUT:
+			RxPolling = false;
 			return LORALINK_STATUS_RX_TIMEOUT;
 
 		default:
+			RxPolling = false;
 			return LORALINK_STATUS_ERROR;
 			break;
 		}
 	}
 }
 
-void LoRaLinkSetTxData( LoRaLinkPacket_t* pkt )
+bool LoRaLinkRecvPending( void )
 {
-	// encrypt Payload and Set it into LoRaLinkCtx.PktBuffer
-	pkt->Buffer = LoRaLinkCtx.PktBuffer;
-	LoRaLinkCryptoSecureMessage(pkt);
-	LoRaLinkSerializeData(pkt);
-	LoRaLinkCtx.PktBufferLen = pkt->BufSize;
+	LoRaLinkPacket_t sub = { 0 };
+	uint8_t offset = RxAggregateOffset;
+
+	return ( RxPolling == false ) && ( RxFrameHeld == true ) && ( LoRaLinkPacket.FRMPayloadType == LINK_AGGREGATE ) &&
+	       ( LoRaLinkApiGetSubMessage( &LoRaLinkPacket, &offset, &sub ) == true );
 }
 
-LoRaLinkStatus_t LoRaLinkSerializeData( LoRaLinkPacket_t* pkt)
+LoRaLinkStatus_t LoRaLinkSetTxData( LoRaLinkPacket_t* pkt )
 {
-	if ( pkt == NULL )
+	LoRaLinkStatus_t rc;
+
+	// Build the frame in LoRaLinkCtx.PktBuffer, then encrypt the payload and add the MIC in place
+	LoRaLinkCtx.PktBufferLen = 0;
+	pkt->Buffer = LoRaLinkCtx.PktBuffer;
+
+	// Receivers in implicit header mode take every frame as FixedLen long
+	if ( LoRaLinkCtx.Phy.ImplicitHeader == true && pkt->FRMPayloadSize != LoRaLinkCtx.Phy.FixedLen )
 	{
-		return LORALINK_STATUS_PARAMETER_INVALID;
+		rc = PadTxData( pkt );
+		if ( rc != LORALINK_STATUS_OK )
+		{
+			return rc;
+		}
 	}
-	if ( pkt->Buffer == NULL )
+
+	rc = LoRaLinkSerializeData(pkt);
+	if ( rc != LORALINK_STATUS_OK )
 	{
-		return LORALINK_STATUS_PARAMETER_INVALID;
+		return rc;
 	}
+	pkt->FRMPayload = pkt->Buffer + LORALINK_HDR_LEN;
+
+	if ( LoRaLinkCryptoSecureMessage(pkt) != LORALINK_CRYPTO_SUCCESS )
+	{
+		return LORALINK_STATUS_CRYPTO_ERROR;
+	}
+	LoRaLinkCtx.PktBufferLen = pkt->BufSize;
+	return LORALINK_STATUS_OK;
+}
+
+/*
+ * Pad a payload shorter than FixedLen with zeros. Any other type than LINK_AGGREGATE goes
+ * as the single message of a LINK_AGGREGATE payload, a zero Length byte ends the messages.
+ */
+static LoRaLinkStatus_t PadTxData( LoRaLinkPacket_t* pkt )
+{
+	uint8_t* pos = LoRaLinkCtx.PktBuffer + LORALINK_HDR_LEN;
+	uint8_t len = pkt->FRMPayloadSize;
+
+	if ( pkt->FRMPayloadType != LINK_AGGREGATE )
+	{
+		if ( len + LORALINK_AGGREGATE_SUBHDR_LEN > LoRaLinkCtx.Phy.FixedLen )
+		{
+			return LORALINK_STATUS_LENGTH_ERROR;
+		}
+		// Payload may be in place already
+		memmove( pos + LORALINK_AGGREGATE_SUBHDR_LEN, pkt->FRMPayload, len );
+		pos[0] = len;
+		pos[1] = pkt->FRMPayloadType;
+		len += LORALINK_AGGREGATE_SUBHDR_LEN;
+		pkt->FRMPayloadType = LINK_AGGREGATE;
+	}
+	else if ( len > LoRaLinkCtx.Phy.FixedLen )
+	{
+		return LORALINK_STATUS_LENGTH_ERROR;
+	}
+	else if ( pkt->FRMPayload != pos )
+	{
+		memcpy1( pos, pkt->FRMPayload, len );
+	}
+	memset1( pos + len, 0, LoRaLinkCtx.Phy.FixedLen - len );
+	pkt->FRMPayload = pos;
+	pkt->FRMPayloadSize = LoRaLinkCtx.Phy.FixedLen;
+	return LORALINK_STATUS_OK;
+}
+
+LoRaLinkStatus_t LoRaLinkSerializeData( LoRaLinkPacket_t* pkt)
+{
+	if ( pkt == NULL )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+	if ( pkt->Buffer == NULL )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+	if ( pkt->FRMPayloadSize + LORALINK_HDR_LEN + LORALINK_MIC_LEN > LORALINK_MAX_API_LEN )
+	{
+		return LORALINK_STATUS_LENGTH_ERROR;
+	}
+
+	uint8_t* pos = pkt->Buffer;
+
+	*pos++ = pkt->PanId >> 8;
+	*pos++ = (uint8_t)pkt->PanId & 0xff;
+	*pos++ = pkt->DestAddr;
+	*pos++ = pkt->SourceAddr;
+	*pos++ = pkt->FRMPayloadType;
+
+	// Payload written by way of LoRaLinkGetTxPayloadBuffer() is already in place
+	if ( pkt->FRMPayload != pos )
+	{
+		memcpy1(pos, pkt->FRMPayload, pkt->FRMPayloadSize );
+	}
+	pos += pkt->FRMPayloadSize;
+	setUint32(pos, pkt->MIC);
+	pkt->BufSize = pkt->FRMPayloadSize + LORALINK_HDR_LEN + LORALINK_MIC_LEN;
 
-	uint8_t* pos = pkt->Buffer;
-
-	*pos++ = pkt->PanId >> 8;
-	*pos++ = (uint8_t)pkt->PanId & 0xff;
-	*pos++ = pkt->DestAddr;
-	*pos++ = pkt->SourceAddr;
-	*pos++ = pkt->FRMPayloadType;
-
-	memcpy1(pos, pkt->FRMPayload, pkt->FRMPayloadSize );
-	pos += pkt->FRMPayloadSize;
-	setUint32(pos, pkt->MIC);
-	pkt->BufSize = pkt->FRMPayloadSize + LORALINK_HDR_LEN + LORALINK_MIC_LEN;
-
 	return LORALINK_STATUS_OK;
 }
 
@@ -560,6 +1125,55 @@ LoRaLinkStatus_t LoRaLinkDeserializeData(LoRaLinkPacket_t* pkt, RxDoneParams_t*
 	return LORALINK_STATUS_OK;
 }
 
+LoRaLinkStatus_t LoRaLinkSetChannelPlan( uint8_t* channels, uint8_t num )
+{
+	uint32_t freq = 0;
+
+	if ( LoRaLinkCtx.TxChannelPlanOn == false )
+	{
+		return LORALINK_STATUS_ERROR;
+	}
+
+	if ( channels == NULL || num == 0 || num > LORALINK_MAX_CHANNELS )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		if ( GetFrequency( channels[i] ) == 0 )
+		{
+			return LORALINK_STATUS_FREQUENCY_INVALID;
+		}
+	}
+
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		freq = GetFrequency( channels[i] );
+		if ( LoRaLinkCtx.TxChannels[i].Frequency != freq )
+		{
+			LoRaLinkCtx.TxChannels[i].Channel = channels[i];
+			LoRaLinkCtx.TxChannels[i].Frequency = freq;
+			LoRaLinkCtx.TxChannels[i].Attempts = 0;
+			LoRaLinkCtx.TxChannels[i].Busy = 0;
+		}
+	}
+	LoRaLinkCtx.TxChannelNum = num;
+	LoRaLinkCtx.TxChannelIdx = 0;
+	LoRaLinkCtx.TxChannelBusyCnt = 0;
+	LoRaLinkCtx.TxConfig.Frequency = LoRaLinkCtx.TxChannels[0].Frequency;
+
+	return LORALINK_STATUS_OK;
+}
+
+uint8_t LoRaLinkGetChannelStats( LoRaLinkChannel_t* stats, uint8_t maxNum )
+{
+	uint8_t num = MIN( maxNum, LoRaLinkCtx.TxChannelNum );
+
+	memcpy1( (uint8_t*)stats, (uint8_t*)LoRaLinkCtx.TxChannels, num * sizeof(LoRaLinkChannel_t) );
+	return num;
+}
+
 LoRaLinkStatus_t LoRaLinkSetDeviceId( uint16_t panId, uint8_t devAddr )
 {
 	LoRaLinkStatus_t rc = LORALINK_STATUS_PARAMETER_INVALID;
@@ -581,15 +1195,55 @@ static bool scheduleTx( void )
 	{
 		DeviceStatus = DEVICE_STATE_CYCLE;
 	}
-	else if ( SX1276IsChannelFree( LoRaLinkCtx.TxConfig.Frequency, LORALINK_RSSI_THRESH, LORALINK_MAX_CARRIERSENSE_TIME ) == true )
-	{
-		SetTxConfig( &LoRaLinkCtx.TxConfig, &LoRaLinkCtx.TxTimeOnAir );
-		SX1276Send( LoRaLinkCtx.PktBuffer,  LoRaLinkCtx.PktBufferLen );
-		return false;
-	}
 	else
 	{
-		DeviceStatus = DEVICE_STATE_TX_NO_FREE_CH;
+		LoRaLinkChannel_t* channel = &LoRaLinkCtx.TxChannels[LoRaLinkCtx.TxChannelIdx];
+		LoRaLinkCarrierSense_t* cs = &LoRaLinkCtx.CarrierSense;
+		TimerTime_t startTime = TimerGetCurrentTime();
+		TimerTime_t overhead = 0;
+		bool isFree = false;
+
+		channel->Attempts++;
+
+		if ( cs->Method == LORALINK_CS_CAD_RSSI )
+		{
+			// CAD runs with the Tx configuration, the radio stays in LoRa mode
+			SetTxConfig( &LoRaLinkCtx.TxConfig, &LoRaLinkCtx.TxTimeOnAir );
+			isFree = SX1276IsChannelFreeCad( LoRaLinkCtx.TxConfig.Frequency, cs->RssiThresh, cs->SenseTime );
+		}
+		else
+		{
+			// FSK mode overwrites the LoRa configuration
+			LoRaLinkCtx.TxConfigValid = false;
+			isFree = SX1276IsChannelFree( LoRaLinkCtx.TxConfig.Frequency, cs->RssiThresh, cs->SenseTime );
+		}
+
+		if ( isFree == true )
+		{
+			LoRaLinkCtx.TxChannelBusyCnt = 0;
+			SetTxConfig( &LoRaLinkCtx.TxConfig, &LoRaLinkCtx.TxTimeOnAir );
+			SX1276Send( LoRaLinkCtx.PktBuffer,  LoRaLinkCtx.PktBufferLen );
+
+			overhead = TimerGetElapsedTime( startTime );
+			LoRaLinkCtx.TxOverhead.TxCount++;
+			LoRaLinkCtx.TxOverhead.TotalTime += overhead;
+			LoRaLinkCtx.TxOverhead.MaxTime = MAX( LoRaLinkCtx.TxOverhead.MaxTime, overhead );
+			return false;
+		}
+
+		channel->Busy++;
+		LoRaLinkStatsCount( LORALINK_STATS_TX_LBT_BUSY );
+
+		// Try the next channel of the plan at once, back off when all of them are busy
+		LoRaLinkCtx.TxChannelIdx = ( LoRaLinkCtx.TxChannelIdx + 1 ) % LoRaLinkCtx.TxChannelNum;
+		LoRaLinkCtx.TxConfig.Frequency = LoRaLinkCtx.TxChannels[LoRaLinkCtx.TxChannelIdx].Frequency;
+
+		if ( ++LoRaLinkCtx.TxChannelBusyCnt >= LoRaLinkCtx.TxChannelNum )
+		{
+			LoRaLinkCtx.TxChannelBusyCnt = 0;
+			LoRaLinkStatsCount( LORALINK_STATS_TX_NO_FREE_CH );
+			DeviceStatus = DEVICE_STATE_TX_NO_FREE_CH;
+		}
 	}
 	return true;
 }
@@ -598,6 +1252,7 @@ static bool scheduleTx( void )
 static bool SetRxConfig( RxConfigParams_t* rxConfig )
 {
     RadioModems_t modem = MODEM_LORA;
+    LoRaLinkPhyProfile_t* phy = &LoRaLinkCtx.Phy;
     uint8_t maxPayload = 0;
     uint32_t bandwidth = GetBandwidth(rxConfig->SFValue);
 
@@ -609,7 +1264,11 @@ static bool SetRxConfig( RxConfigParams_t* rxConfig )
 
     SX1276SetChannel( rxConfig->Frequency );
 
-	SX1276SetRxConfig( modem, bandwidth, (uint32_t)rxConfig->SFValue, LORALINK_CODERATE, 0, LORALINK_PREAMBLE_LENGTH, rxConfig->WindowTimeout, false, 0, true, false, 0, false, rxConfig->RxContinuous );
+    // Modem registers are rewritten for Rx
+    LoRaLinkCtx.TxConfigValid = false;
+
+	SX1276SetRxConfig( modem, bandwidth, (uint32_t)rxConfig->SFValue, LORALINK_CODERATE, 0, phy->PreambleLen, rxConfig->WindowTimeout,
+	                   phy->ImplicitHeader, phy->FixedLen + LORALINK_HDR_LEN + LORALINK_MIC_LEN, phy->CrcOn, false, 0, false, rxConfig->RxContinuous );
 
 	maxPayload = GetMaxPayloadLength(rxConfig->SFValue);
 
@@ -622,12 +1281,23 @@ static bool SetRxConfig( RxConfigParams_t* rxConfig )
 static bool SetTxConfig( TxConfigParams_t* txConfig, TimerTime_t* txTimeOnAir )
 {
     RadioModems_t modem = MODEM_LORA;
+    LoRaLinkPhyProfile_t* phy = &LoRaLinkCtx.Phy;
     uint32_t bandwidth = GetBandwidth(txConfig->SFValue);
 
-    // Setup the radio frequency
-    SX1276SetChannel( txConfig->Frequency );
+    // Skip the whole setup when the radio still holds the same Tx parameters
+    if ( LoRaLinkCtx.TxConfigValid == false ||
+    	 LoRaLinkCtx.TxConfigApplied.Frequency != txConfig->Frequency ||
+    	 LoRaLinkCtx.TxConfigApplied.SFValue != txConfig->SFValue ||
+    	 LoRaLinkCtx.TxConfigApplied.TxPower != txConfig->TxPower )
+    {
+		// Setup the radio frequency
+		SX1276SetChannel( txConfig->Frequency );
+
+		SX1276SetTxConfig( modem, txConfig->TxPower, 0, bandwidth, txConfig->SFValue, LORALINK_CODERATE , phy->PreambleLen, phy->ImplicitHeader, phy->CrcOn, 0, 0, false, TX_TIMEOUT_DEV_VAL );
 
-	SX1276SetTxConfig( modem, txConfig->TxPower, 0, bandwidth, txConfig->SFValue, LORALINK_CODERATE , LORALINK_PREAMBLE_LENGTH, false, true, 0, 0, false, TX_TIMEOUT_DEV_VAL );
+		LoRaLinkCtx.TxConfigApplied = *txConfig;
+		LoRaLinkCtx.TxConfigValid = true;
+    }
 
     // Setup maximum payload length of the radio driver
     SX1276SetMaxPayloadLength( modem, LoRaLinkCtx.PktBufferLen );
@@ -663,9 +1333,123 @@ uint16_t LoRaLinkGetPanId(void)
 	return LoRaLinkCtx.LoRaLinkPanId;
 }
 
-uint8_t LoRaLinkGetMaxPayloadLength(void)
+uint32_t LoRaLinkGetTimeOnAir( uint8_t payloadLen )
+{
+	uint16_t pktLen = payloadLen + LORALINK_HDR_LEN + LORALINK_MIC_LEN;
+
+	if ( LoRaLinkCtx.Phy.ImplicitHeader == true )
+	{
+		// Every frame is padded to FixedLen
+		pktLen = LoRaLinkCtx.Phy.FixedLen + LORALINK_HDR_LEN + LORALINK_MIC_LEN;
+	}
+	else if ( pktLen > LORA_PHY_MAXPAYLOAD )
+	{
+		pktLen = LORA_PHY_MAXPAYLOAD;
+	}
+	return GetTimeOnAir( LoRaLinkCtx.TxConfig.SFValue, (uint8_t)pktLen );
+}
+
+void LoRaLinkSetDutyCycleWindow( uint32_t windowMs )
+{
+	LoRaLinkAirtimeSetWindow( windowMs );
+}
+
+uint32_t LoRaLinkGetAirtimeBudget( void )
+{
+	return LoRaLinkAirtimeGetRemaining( LoRaLinkCtx.TxConfig.DutyCycle );
+}
+
+TimerTime_t LoRaLinkGetTxDelay( uint8_t payloadLen )
+{
+	return LoRaLinkAirtimeGetTxDelay( LoRaLinkCtx.TxConfig.DutyCycle, LoRaLinkGetTimeOnAir( payloadLen ) );
+}
+
+LoRaLinkStatus_t LoRaLinkSetAdr( bool enable, uint8_t minPayloadLen, uint8_t* sfValues, uint8_t num )
+{
+	if ( enable == true && ( sfValues == NULL || num == 0 || num > LORALINK_MAX_SCAN_SF ) )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+	return LoRaLinkAdrSetAuto( enable, minPayloadLen, sfValues, num );
+}
+
+void LoRaLinkSetDupFilter( LoRaLinkDupMode_t mode, uint32_t window )
 {
-	return GetMaxPayloadLength( LoRaLinkCtx.TxConfig.SFValue );
+	LoRaLinkDupInit( mode, window );
+}
+
+void LoRaLinkGetDupFilter( LoRaLinkDupMode_t* mode, uint32_t* window )
+{
+	LoRaLinkDupGet( mode, window );
+}
+
+LoRaLinkStatus_t LoRaLinkSetFec( uint8_t destAddr, uint8_t group )
+{
+	LoRaLinkFecDest_t* dest = NULL;
+
+	group = MIN( group, LORALINK_FRAG_MAX_COUNT );
+	if ( destAddr == LORALINK_MULTICAST_ADDR )
+	{
+		LoRaLinkCtx.FecGroup = group;
+		return LORALINK_STATUS_OK;
+	}
+
+	for ( uint8_t i = 0; i < LORALINK_FEC_DESTS; i++ )
+	{
+		if ( LoRaLinkCtx.FecDests[i].Used == true && LoRaLinkCtx.FecDests[i].DestAddr == destAddr )
+		{
+			dest = &LoRaLinkCtx.FecDests[i];
+			break;
+		}
+		if ( LoRaLinkCtx.FecDests[i].Used == false && dest == NULL )
+		{
+			dest = &LoRaLinkCtx.FecDests[i];
+		}
+	}
+
+	if ( group == LoRaLinkCtx.FecGroup )
+	{
+		// Same as the default, the entry is not needed
+		if ( dest != NULL && dest->DestAddr == destAddr )
+		{
+			dest->Used = false;
+		}
+		return LORALINK_STATUS_OK;
+	}
+	if ( dest == NULL )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+	dest->DestAddr = destAddr;
+	dest->Group = group;
+	dest->Used = true;
+	return LORALINK_STATUS_OK;
+}
+
+uint8_t LoRaLinkGetFec( uint8_t destAddr )
+{
+	for ( uint8_t i = 0; i < LORALINK_FEC_DESTS; i++ )
+	{
+		if ( LoRaLinkCtx.FecDests[i].Used == true && LoRaLinkCtx.FecDests[i].DestAddr == destAddr )
+		{
+			return LoRaLinkCtx.FecDests[i].Group;
+		}
+	}
+	return LoRaLinkCtx.FecGroup;
+}
+
+uint8_t LoRaLinkGetMaxPayloadLength( uint8_t destAddr )
+{
+	int8_t sfValue = 0;
+	int8_t power = 0;
+
+	LoRaLinkAdrGetTxParams( destAddr, &sfValue, &power );
+	if ( LoRaLinkCtx.Phy.ImplicitHeader == true )
+	{
+		// Room for the Length and PayloadType of the padded payload, longer ones are fragmented
+		return MIN( GetMaxPayloadLength( sfValue ), LoRaLinkCtx.Phy.FixedLen - LORALINK_AGGREGATE_SUBHDR_LEN );
+	}
+	return GetMaxPayloadLength( sfValue );
 }
 
 static uint8_t GetMaxPayloadLength( uint8_t sfValue )
@@ -694,26 +1478,122 @@ static uint32_t GetBandwidth( uint8_t sfValue )
     }
 }
 
-static void CalcBackOffTime( void )
+/*
+ * Reception details of the frame in RxDoneParams for the extended Rx API frame
+ */
+static void GetRxMeta( LoRaLinkRxMeta_t* meta )
+{
+	meta->Counter = RxDoneParams.Counter;
+	meta->RxTime = RxDoneParams.LastRxDone;
+	meta->Frequency = LoRaLinkCtx.RxConfig.Frequency;
+	meta->Fei = RxDoneParams.Fei;
+	meta->SFValue = RxDoneParams.SFValue;
+	meta->Bandwidth = GetBandwidth( RxDoneParams.SFValue );
+	meta->Flags = ( RxDoneParams.Duplicate == true ) ? LORALINK_API_RX_FLAG_DUPLICATE : 0;
+}
+
+/*
+ * Frequency of a channel in the dwell time range in use, 0 if not available
+ */
+static uint32_t GetFrequency( uint8_t channel )
 {
-	if( LoRaLinkCtx.TxConfig.DutyCycle > 0 )
+	if ( LoRaLinkCtx.LoRaLinkDwelltime == DWELLTIME_0 )
 	{
-		TimerTime_t elapsed = TimerGetElapsedTime(LoRaLinkCtx.LastTxDoneTime);
-		TimerTime_t backoff = LoRaLinkCtx.TxTimeOnAir * 100 / LoRaLinkCtx.TxConfig.DutyCycle - LoRaLinkCtx.TxTimeOnAir;
+		if ( channel >= DwelltimeRange[0] && channel < DwelltimeRange[1] )
+		{
+			return FreqenciesDwell0[ channel - DwelltimeRange[0] ];
+		}
+	}
+	else if ( channel >= DwelltimeRange[1] && channel <= DwelltimeRange[2] )
+	{
+		return FreqenciesDwell1[ channel - DwelltimeRange[1] ];
+	}
+	return 0;
+}
+
+static void InitTxChannelPlan( uint8_t channel )
+{
+	memset1( (uint8_t*)LoRaLinkCtx.TxChannels, 0, sizeof(LoRaLinkCtx.TxChannels) );
+	LoRaLinkCtx.TxChannels[0].Channel = channel;
+	LoRaLinkCtx.TxChannels[0].Frequency = LoRaLinkCtx.TxConfig.Frequency;
+	LoRaLinkCtx.TxChannelNum = 1;
+	LoRaLinkCtx.TxChannelIdx = 0;
+	LoRaLinkCtx.TxChannelBusyCnt = 0;
+}
+
+/*
+ * Tx parameters adapted to a peer, the defaults with LORALINK_MULTICAST_ADDR
+ */
+static void SetTxParams( uint8_t destAddr )
+{
+	LoRaLinkAdrGetTxParams( destAddr, &LoRaLinkCtx.TxConfig.SFValue, &LoRaLinkCtx.TxConfig.TxPower );
+}
+
+/*
+ * Frame of a link layer payload written in the Tx payload buffer
+ */
+static LoRaLinkStatus_t SetLinkTxData( uint8_t destAddr, uint8_t payloadType, uint8_t payloadLen )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+
+	pkt.PanId = LoRaLinkCtx.LoRaLinkPanId;
+	pkt.DestAddr = destAddr;
+	pkt.SourceAddr = LoRaLinkCtx.LoRaLinkDeviceAddr;
+	pkt.FRMPayloadType = payloadType;
+	pkt.FRMPayload = LoRaLinkGetTxPayloadBuffer();
+	pkt.FRMPayloadSize = payloadLen;
+
+	return LoRaLinkSetTxData( &pkt );
+}
+
+static LoRaLinkStatus_t SetFragmentTxData( void )
+{
+	uint8_t destAddr = 0;
+	uint8_t payloadType = 0;
+	uint8_t len = LoRaLinkFragNext( LoRaLinkGetTxPayloadBuffer(), &destAddr, &payloadType );
+
+	if ( len == 0 )
+	{
+		return LORALINK_STATUS_ERROR;
+	}
+	return SetLinkTxData( destAddr, payloadType, len );
+}
+
+static LoRaLinkStatus_t SendFragments( uint32_t timeout )
+{
+	LoRaLinkStatus_t rc = LORALINK_STATUS_OK;
 
-		if ( elapsed >= backoff || elapsed == 0 )
+	while ( LoRaLinkFragPending() == true )
+	{
+		if ( SetFragmentTxData() != LORALINK_STATUS_OK )
 		{
-			LoRaLinkCtx.BackoffTime = 0;
+			return LORALINK_STATUS_ERROR;
 		}
-		else
+		DeviceStatus = DEVICE_STATE_TX;
+
+		rc = LoRaLinkSendPacket( timeout );
+		if ( rc != LORALINK_STATUS_OK )
 		{
-			LoRaLinkCtx.BackoffTime = backoff - elapsed;
+			return rc;
 		}
 	}
-	else
-	{
-		LoRaLinkCtx.BackoffTime = 0;
-	}
+	return rc;
+}
+
+static uint32_t GetTimeOnAir( uint8_t sfValue, uint8_t pktLen )
+{
+	LoRaLinkPhyProfile_t* phy = &LoRaLinkCtx.Phy;
+
+	return SX1276GetLoRaTimeOnAir( GetBandwidth( sfValue ), sfValue, LORALINK_CODERATE, phy->PreambleLen, phy->ImplicitHeader, phy->CrcOn, pktLen );
+}
+
+/*
+ * Defer the frame in PktBuffer only when it does not fit in the airtime left in the duty cycle window.
+ */
+static void CalcBackOffTime( void )
+{
+	LoRaLinkCtx.BackoffTime = LoRaLinkAirtimeGetTxDelay( LoRaLinkCtx.TxConfig.DutyCycle,
+			                                             GetTimeOnAir( LoRaLinkCtx.TxConfig.SFValue, LoRaLinkCtx.PktBufferLen ) );
 }
 
 
@@ -752,6 +1632,10 @@ static void LoRaLinkHandleIrqEvents( void )
         {
         	ProcessRadioTxDelaied( );
         }
+        if ( events.Events.CadDone == 1 )
+        {
+            ProcessRadioCadDone( events.Events.CadDetected == 1 );
+        }
     }
 }
 
@@ -763,44 +1647,243 @@ static void ProcessRadioTxDone( void )
 {
 	SX1276SetSleep();
 	LoRaLinkCtx.LastTxDoneTime = TxDoneParams.CurTime;
+	LoRaLinkAirtimeAdd( LoRaLinkCtx.TxTimeOnAir );
+	LoRaLinkStatsCount( LORALINK_STATS_TX_FRAMES );
+	LoRaLinkStatsAdd( LORALINK_STATS_TX_AIRTIME, LoRaLinkCtx.TxTimeOnAir );
 	DeviceStatus = DEVICE_STATE_TX_DONE;
 
 }
 
 static void ProcessRadioRxDone( void )
 {
-	SX1276SetSleep();
-	LoRaLinkApiGetRxData( &LoRaLinkPacket, &RxDoneParams );
-	if ( ( LoRaLinkPacket.PanId == LoRaLinkCtx.LoRaLinkPanId ) &&
-	   ( ( LoRaLinkPacket.DestAddr == LoRaLinkCtx.LoRaLinkDeviceAddr) || ( LoRaLinkPacket.DestAddr == LORALINK_MULTICAST_ADDR ) ) )
-	   {
-		if ( LoRaLinkCryptoUnsecureMessage(&LoRaLinkPacket) == LORALINK_CRYPTO_SUCCESS )
+	if ( IsRxRunning() == false )
+	{
+		RxStop();
+	}
+	ProcessRxQueue();
+}
+
+/*
+ * Take the oldest queued frame into LoRaLinkPacket.
+ * Frames for other devices or with a bad MIC are dropped.
+ * The frame stays in its slot until ReleaseRxFrame() is called.
+ */
+static void ProcessRxQueue( void )
+{
+	LoRaLinkRxQueue_t* queue = &LoRaLinkCtx.RxQueue;
+	LoRaLinkRxFrame_t* frame = NULL;
+	LoRaLinkDupResult_t dup = LORALINK_DUP_NEW;
+
+	if ( RxFrameHeld == true )
+	{
+		// Current frame is not consumed yet, next one is taken after ReleaseRxFrame()
+		return;
+	}
+
+	while ( queue->Tail != queue->Head )
+	{
+		frame = &queue->Frames[queue->Tail & ( LORALINK_RX_QUEUE_DEPTH - 1 )];
+
+		RxDoneParams.LastRxDone = frame->LastRxDone;
+		RxDoneParams.Payload = frame->Payload;
+		RxDoneParams.Size = frame->Size;
+		RxDoneParams.Rssi = frame->Rssi;
+		RxDoneParams.Snr = frame->Snr;
+		RxDoneParams.Fei = frame->Fei;
+		RxDoneParams.Counter = frame->Counter;
+		RxDoneParams.SFValue = frame->SFValue;
+
+		if ( RxDoneParams.Size < LORALINK_HDR_LEN + LORALINK_MIC_LEN )
 		{
-			DeviceStatus = DEVICE_STATE_RX_DONE;
-			return;
+			LoRaLinkStatsCount( LORALINK_STATS_RX_MALFORMED );
 		}
+		else
+		{
+			LoRaLinkApiGetRxData( &LoRaLinkPacket, &RxDoneParams );
+			if ( LoRaLinkPacket.PanId != LoRaLinkCtx.LoRaLinkPanId )
+			{
+				LoRaLinkStatsCount( LORALINK_STATS_RX_WRONG_PAN );
+			}
+			else if ( ( LoRaLinkPacket.DestAddr != LoRaLinkCtx.LoRaLinkDeviceAddr) && ( LoRaLinkPacket.DestAddr != LORALINK_MULTICAST_ADDR ) )
+			{
+				LoRaLinkStatsCount( LORALINK_STATS_RX_OTHER_ADDR );
+			}
+			else if ( ( dup = LoRaLinkDupCheck( &LoRaLinkPacket, RxDoneParams.LastRxDone ) ) == LORALINK_DUP_DROPPED )
+			{
+				// Resent frame, dropped before the MIC check
+			}
+			else if ( LoRaLinkCryptoUnsecureMessage(&LoRaLinkPacket) != LORALINK_CRYPTO_SUCCESS )
+			{
+				LoRaLinkStatsCount( LORALINK_STATS_RX_MIC_ERROR );
+				LoRaLinkStatsAddPeer( LoRaLinkPacket.SourceAddr, RxDoneParams.Rssi, RxDoneParams.Snr, false );
+			}
+			else
+			{
+				if ( dup == LORALINK_DUP_NEW )
+				{
+					LoRaLinkDupAdd( &LoRaLinkPacket, RxDoneParams.LastRxDone );
+				}
+				RxDoneParams.Duplicate = ( dup == LORALINK_DUP_FLAGGED );
+				LoRaLinkStatsCount( LORALINK_STATS_RX_FRAMES );
+				LoRaLinkStatsAddPeer( LoRaLinkPacket.SourceAddr, RxDoneParams.Rssi, RxDoneParams.Snr, true );
+				LoRaLinkAdrAddSample( LoRaLinkPacket.SourceAddr, RxDoneParams.Snr );
+				if ( LoRaLinkPacket.FRMPayloadType == LINK_ADR_CMD )
+				{
+					// Consumed by the link, not delivered
+					LoRaLinkAdrCommand( LoRaLinkPacket.SourceAddr, LoRaLinkPacket.FRMPayload, LoRaLinkPacket.FRMPayloadSize );
+					queue->Tail++;
+					continue;
+				}
+				if ( LoRaLinkPacket.FRMPayloadType == LINK_FRAGMENT_NACK )
+				{
+					LoRaLinkFragNack( LoRaLinkPacket.SourceAddr, LoRaLinkPacket.FRMPayload, LoRaLinkPacket.FRMPayloadSize );
+					queue->Tail++;
+					continue;
+				}
+				if ( LoRaLinkPacket.FRMPayloadType == LINK_FRAGMENT || LoRaLinkPacket.FRMPayloadType == LINK_FRAGMENT_FEC )
+				{
+					LoRaLinkFragRx_t* msg = LoRaLinkFragAdd( LoRaLinkPacket.SourceAddr, LoRaLinkPacket.FRMPayloadType, LoRaLinkPacket.FRMPayload, LoRaLinkPacket.FRMPayloadSize );
+					if ( msg == NULL )
+					{
+						queue->Tail++;
+						continue;
+					}
+					// Reassembled message is delivered in place of the last fragment
+					LoRaLinkPacket.FRMPayloadType = msg->Buffer[0];
+					LoRaLinkPacket.FRMPayload = msg->Buffer + 1;
+					LoRaLinkPacket.FRMPayloadSize = msg->Len - 1;
+				}
+				RxFrameHeld = true;
+				DeviceStatus = DEVICE_STATE_RX_DONE;
+				return;
+			}
+		}
+		queue->Tail++;
 	}
 	DeviceStatus = DEVICE_STATE_RX_INIT;
 }
 
-static void ProcessRadioRxTimeout( void )
+static void ReleaseRxFrame( void )
+{
+	if ( RxFrameHeld == true )
+	{
+		LoRaLinkCtx.RxQueue.Tail++;
+		RxFrameHeld = false;
+	}
+}
+
+/*
+ * In gateway Rx the radio restarts Rx by itself after each frame
+ */
+static bool IsRxRunning( void )
+{
+	return LoRaLinkCtx.RxAlwaysOn == true && SX1276GetStatus() == RF_RX_RUNNING;
+}
+
+static void RxStart( void )
 {
+	LoRaLinkRxQueue_t* queue = &LoRaLinkCtx.RxQueue;
+	uint32_t blind = 0;
+
+	if ( LoRaLinkCtx.RxScan.Num > 1 )
+	{
+		// ProcessRadioCadDone() goes into Rx or on to the next SF
+		LoRaLinkCtx.RxScan.Cad = true;
+		LoRaLinkCtx.RxScan.CadStart = TimerGetCurrentTime();
+		LoRaLinkStatsCount( LORALINK_STATS_RX_CAD );
+		SX1276StartCad();
+	}
+	else
+	{
+		SX1276SetRx(0);
+	}
+
+	if ( queue->Listening == false && queue->BlindStart != 0 )
+	{
+		blind = TimerGetElapsedTime( queue->BlindStart );
+		queue->BlindTime += blind;
+		if ( blind > queue->BlindMax )
+		{
+			queue->BlindMax = blind;
+		}
+		queue->Restarts++;
+	}
+	queue->Listening = true;
+}
+
+/*
+ * Radio out of Rx, the time until RxStart() is blind time
+ */
+static void RxStop( void )
+{
+	LoRaLinkRxQueue_t* queue = &LoRaLinkCtx.RxQueue;
+
 	SX1276SetSleep();
+	LoRaLinkCtx.RxScan.Cad = false;
+
+	if ( queue->Listening == true )
+	{
+		queue->Listening = false;
+		queue->BlindStart = TimerGetCurrentTime();
+	}
+}
+
+static void ProcessRadioRxTimeout( void )
+{
+	LoRaLinkStatsCount( LORALINK_STATS_RX_TIMEOUT );
+	RxStop();
+	if ( LoRaLinkCtx.RxScan.Num > 1 )
+	{
+		// No frame after the CAD, scan the next SF
+		LoRaLinkCtx.RxScan.Idx = ( LoRaLinkCtx.RxScan.Idx + 1 ) % LoRaLinkCtx.RxScan.Num;
+	}
 	DeviceStatus = DEVICE_STATE_RX_TIMEOUT;
 }
 
 static void ProcessRadioTxTimeout( void )
 {
+	LoRaLinkStatsCount( LORALINK_STATS_TX_TIMEOUT );
 	SX1276SetSleep();
 	DeviceStatus = DEVICE_STATE_TX_TIMEOUT;
 }
 
 static void ProcessRadioRxError( void )
 {
-	SX1276SetSleep();
+	LoRaLinkStatsCount( LORALINK_STATS_RX_ERROR );
+	if ( IsRxRunning() == false )
+	{
+		RxStop();
+	}
 	DeviceStatus = DEVICE_STATE_RX_ERROR;
 }
 
+/*
+ * CAD of the SF scan finished, receive at the SF or run CAD on the next one
+ */
+static void ProcessRadioCadDone( bool detected )
+{
+	LoRaLinkRxScan_t* scan = &LoRaLinkCtx.RxScan;
+
+	if ( scan->Cad == false )
+	{
+		// Scan was stopped meanwhile
+		return;
+	}
+	scan->Cad = false;
+
+	if ( detected == true )
+	{
+		// RxTimeout comes after LORALINK_WINDOW_TIMEOUT symbols without a preamble
+		LoRaLinkStatsCount( LORALINK_STATS_RX_CAD_DETECTED );
+		SX1276SetRx( 0 );
+		return;
+	}
+
+	SX1276SetStby();
+	scan->Idx = ( scan->Idx + 1 ) % scan->Num;
+	DeviceStatus = DEVICE_STATE_RX_INIT;
+}
+
 static void ProcessRadioTxDelaied( void )
 {
 	SX1276SetSleep();
@@ -827,11 +1910,35 @@ static void OnRadioTxDone( void )
 
 static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr )
 {
-    RxDoneParams.LastRxDone = TimerGetCurrentTime( );
-    RxDoneParams.Payload = payload;
-    RxDoneParams.Size = size;
-    RxDoneParams.Rssi = rssi;
-    RxDoneParams.Snr = snr;
+    LoRaLinkRxQueue_t* queue = &LoRaLinkCtx.RxQueue;
+    uint8_t used = queue->Head - queue->Tail;
+
+    if ( used < LORALINK_RX_QUEUE_DEPTH && size <= LORA_PHY_MAXPAYLOAD )
+    {
+        // Copy the frame out of the radio buffer, it is reused by the next reception
+        LoRaLinkRxFrame_t* frame = &queue->Frames[queue->Head & ( LORALINK_RX_QUEUE_DEPTH - 1 )];
+
+        frame->LastRxDone = TimerGetCurrentTime( );
+        frame->Size = size;
+        frame->Rssi = rssi;
+        frame->Snr = snr;
+        frame->Fei = SX1276GetFrequencyError( );
+        frame->Counter = queue->Received;
+        frame->SFValue = LoRaLinkCtx.RxConfig.SFValue;
+        memcpy1( frame->Payload, payload, size );
+
+        // Publish the slot to the main loop
+        queue->Head++;
+        queue->Received++;
+        if ( ++used > queue->HighWater )
+        {
+            queue->HighWater = used;
+        }
+    }
+    else
+    {
+        queue->Overflow++;
+    }
 
     LoRaLinkRadioEventsStatus.Events.RxDone = 1;
 
@@ -871,6 +1978,17 @@ static void OnRadioRxTimeout( void )
     }
 }
 
+static void OnRadioCadDone( bool channelActivityDetected )
+{
+	LoRaLinkRadioEventsStatus.Events.CadDetected = channelActivityDetected ? 1 : 0;
+	LoRaLinkRadioEventsStatus.Events.CadDone = 1;
+
+    if( LoRaLinkCtx.LinkProcessNotify != NULL )
+    {
+        LoRaLinkCtx.LinkProcessNotify( );
+    }
+}
+
 static void OnTxDelayedTimerEvent( void *context )
 {
 //	LoRaLinkCtx.BackoffTime = 0;
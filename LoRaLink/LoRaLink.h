@@ -12,6 +12,8 @@
 #define LORALINK_H_
 
 #include "LoRaLinkTypes.h"
+#include "LoRaLinkAirtime.h"
+#include "LoRaLinkStats.h"
 #include "systime.h"
 #include "timer.h"
 #include "radio.h"
@@ -31,6 +33,8 @@ typedef union uLoRaMacRadioEvents
         uint32_t RxDone    : 1;
         uint32_t TxDone    : 1;
         uint32_t TxDelaied : 1;
+        uint32_t CadDone   : 1;
+        uint32_t CadDetected : 1;
     }Events;
 }LoRaLinkRadioEvents_t;
 
@@ -48,9 +52,31 @@ void LoRaLinkInitialize(void);
  * \param [IN] devRxCh  Downlink channel
  * \param [IN] sfValue  Spreading Factor
  * \param [IN] power    Output power in dBm
+ * \param [IN] carrierSense  Carrier sense method and timings, NULL for FSK RSSI -83dBm 5ms
+ * \param [IN] phy      PHY profile of the PAN, NULL for LORALINK_PHY_STANDARD
  * \retval value    LoRaLinkStatus
  */
-LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAddr, uint8_t syncWord, uint8_t uplinkCh, uint8_t dwnlinkCh, LoRaLinkSf_t sfValue, int8_t power );
+LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAddr, uint8_t syncWord, uint8_t uplinkCh, uint8_t dwnlinkCh, LoRaLinkSf_t sfValue, int8_t power, LoRaLinkCarrierSense_t* carrierSense, LoRaLinkPhyProfile_t* phy );
+/*!
+ * Setup the carrier sense, for modems call it before LoRaLinkUart()
+ *
+ * \param [IN] carrierSense  Carrier sense method and timings, NULL for FSK RSSI -83dBm 5ms
+ */
+void LoRaLinkSetCarrierSense( LoRaLinkCarrierSense_t* carrierSense );
+/*!
+ * Setup the PHY profile, preamble length, CRC and header mode of every frame sent and received.
+ * All devices of the PAN have to use the same profile, a frame sent with another one is lost.
+ *
+ * \param [IN] phy  PHY profile, NULL for LORALINK_PHY_STANDARD
+ * \retval value    LoRaLinkStatus
+ */
+LoRaLinkStatus_t LoRaLinkSetPhyProfile( LoRaLinkPhyProfile_t* phy );
+/*!
+ * Get the time taken from the start of the carrier sense to the start of the transmission
+ *
+ * \param [OUT] overhead  Number of transmissions, total and max time in ms
+ */
+void LoRaLinkGetTxOverhead( LoRaLinkTxOverhead_t* overhead );
 /*!
  * Gateway Modem Process
  *
@@ -60,9 +86,10 @@ LoRaLinkStatus_t LoRaLinkDeviceInit( uint8_t* key, uint16_t panId, uint8_t devAd
  * \param [IN] devRxCh  Downlink channel
  * \param [IN] sfValue  Spreading Factor
  * \param [IN] power    Output power in dBm
+ * \param [IN] phy      PHY profile of the PAN, NULL for LORALINK_PHY_STANDARD
  * \retval value    LoRaLinkStatus
  */
-LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, LoRaLinkUartType_t devType, uint8_t syncWord, uint8_t devTxCh, uint8_t devRxCh, LoRaLinkSf_t sfValue );
+LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, LoRaLinkUartType_t devType, uint8_t syncWord, uint8_t devTxCh, uint8_t devRxCh, LoRaLinkSf_t sfValue, LoRaLinkPhyProfile_t* phy );
 /*!
  * Receive LoRaLink Packet
  *
@@ -71,6 +98,26 @@ LoRaLinkStatus_t LoRaLinkUart( uint8_t* key, uint16_t panId, uint8_t devAddr, Lo
  * \retval value    LoRaLinkStatus
  */
 LoRaLinkStatus_t LoRaLinkRecvPacket(LoRaLinkPacket_t* pkt, uint32_t timeout);
+/*!
+ * Receive LoRaLink Packet without waiting
+ *
+ * The first call starts the reception, the next ones return LORALINK_STATUS_BUSY until
+ * a packet is received or the timeout expires. The MCU can sleep in between, the radio
+ * interrupt wakes it up. A transmission meanwhile ends the reception.
+ *
+ * \param [OUT] pkt Received packet pointer
+ * \param [IN]  timeout  Receive time out value in ms
+ * \retval value    LoRaLinkStatus
+ */
+LoRaLinkStatus_t LoRaLinkRecvPoll( LoRaLinkPacket_t* pkt, uint32_t timeout );
+/*!
+ * Check whether messages of the aggregated frame received last are left
+ *
+ * LoRaLinkRecvPoll() returns them at once, without listening again.
+ *
+ * \retval value    true when the next LoRaLinkRecvPoll() returns a message of the frame
+ */
+bool LoRaLinkRecvPending( void );
 /*!
  * Send Payload
  *
@@ -82,6 +129,58 @@ LoRaLinkStatus_t LoRaLinkRecvPacket(LoRaLinkPacket_t* pkt, uint32_t timeout);
  * \retval value    LoRaLinkStatus
  */
 LoRaLinkStatus_t LoRaLinkSend( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t timeout );
+/*!
+ * Queue Payload to be sent with other messages in one LINK_AGGREGATE frame
+ *
+ * The frame is sent when the next message does not fit or goes to another destination,
+ * or when maxDelay of the earliest message expired and the duty cycle allows to send.
+ * Call LoRaLinkAggregateProcess() periodically to send the frame when maxDelay expires.
+ * When the frame queued before fails, it is kept and this message is not queued.
+ *
+ * \param [IN] destAddr     Destination address
+ * \param [IN] payloadType  Payload Type
+ * \param [IN] buffer       Payload data pointer
+ * \param [IN] buffLen      Payload length
+ * \param [IN] maxDelay     Max time in ms the message can wait, 0: send now
+ * \param [IN] timeout      Send time out value in ms
+ * \retval value    LoRaLinkStatus of the frame sent, LORALINK_STATUS_OK if queued only
+ */
+LoRaLinkStatus_t LoRaLinkAggregate( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t maxDelay, uint32_t timeout );
+/*!
+ * Send the queued messages if the frame is full or the delay expired
+ *
+ * \param [IN] timeout      Send time out value in ms
+ * \retval value    LoRaLinkStatus
+ */
+LoRaLinkStatus_t LoRaLinkAggregateProcess( uint32_t timeout );
+/*!
+ * Send the queued messages now, they are kept when the frame fails
+ *
+ * \param [IN] timeout      Send time out value in ms
+ * \retval value    LoRaLinkStatus
+ */
+LoRaLinkStatus_t LoRaLinkAggregateFlush( uint32_t timeout );
+/*!
+ * Check whether a message goes in the frame queued
+ *
+ * \param [IN] destAddr     Destination address
+ * \param [IN] buffLen      Length of the message
+ * \retval value    true when messages to destAddr are queued and leave room for it
+ */
+bool LoRaLinkAggregateFits( uint8_t destAddr, uint8_t buffLen );
+/*!
+ * Drop the queued messages
+ */
+void LoRaLinkAggregateClear( void );
+/*!
+ * Get the transmit payload buffer
+ *
+ * The payload written here is passed to LoRaLinkSend() and sent without being copied.
+ * The header and the MIC are built around it in place.
+ *
+ * \retval value  Payload buffer, LoRaLinkGetMaxPayloadLength() of the peer bytes are available
+ */
+uint8_t* LoRaLinkGetTxPayloadBuffer( void );
 
 
 /*!
@@ -100,18 +199,140 @@ LoRaLinkStatus_t LoRaLinkDeserializeData(LoRaLinkPacket_t* pkt, RxDoneParams_t*
  * \retval value    LoRaLinkStatus
  */
 LoRaLinkStatus_t LoRaLinkSetDeviceId( uint16_t panId, uint8_t devAddr );
+/*!
+ * Setup the uplink channel plan of a node
+ *
+ * When carrier sense finds the channel busy, the frame is sent on the next channel of the plan.
+ * The random back off is taken only after all channels are found busy.
+ * Frames on every channel take from the same duty cycle budget of the station.
+ * The gateway runs one RX modem per channel of the plan, each started with that channel as
+ * its uplink channel. The downlink is not rotated: nodes listen on their downlink channel
+ * only, so the TX modem always sends on the downlink channel given to LoRaLinkUart().
+ * Call after LoRaLinkDeviceInit(), all channels must be in the dwell time range of the uplink channel.
+ *
+ * \param [IN] channels  ARIB channel numbers
+ * \param [IN] num       Number of channels, up to LORALINK_MAX_CHANNELS
+ * \retval value    LoRaLinkStatus, LORALINK_STATUS_ERROR on a modem
+ */
+LoRaLinkStatus_t LoRaLinkSetChannelPlan( uint8_t* channels, uint8_t num );
+/*!
+ * Let the Rx modem receive on several spreading factors.
+ * It runs CAD on each of them in turn and receives at the one that detected a preamble.
+ * The SF of a frame is reported in the extended Rx frame.
+ * A frame is caught only if a CAD at its SF starts early in the preamble, a low SF
+ * scanned with slow ones is mostly missed with the 8 symbol preamble, a PHY profile
+ * with a longer preamble catches more of them.
+ * An SF can be listed more than once to run CAD on it more often.
+ * Call before LoRaLinkUart(), it replaces the SF given there.
+ *
+ * \param [IN] sfValues  Spreading factors in scan order, SF_7 to SF_12
+ * \param [IN] num       Number of SFs up to LORALINK_MAX_SCAN_SF, less than 2 stops scanning
+ * \retval value    LoRaLinkStatus
+ */
+LoRaLinkStatus_t LoRaLinkSetRxScan( uint8_t* sfValues, uint8_t num );
+/*!
+ * Get the time to run CAD on every SF of the scan once
+ *
+ * \retval value  Time in ms, 0 if not scanning
+ */
+uint32_t LoRaLinkGetScanCycle( void );
+/*!
+ * Get the carrier sense statistics of the Tx channels
+ *
+ * \param [OUT] stats   Channels of the plan with their counters
+ * \param [IN]  maxNum  Number of entries of stats
+ * \retval value  Number of channels copied
+ */
+uint8_t LoRaLinkGetChannelStats( LoRaLinkChannel_t* stats, uint8_t maxNum );
 /*!
  * Get Tx data from LoraLinkPacket and setup
  *
  * param [IN] LoRaLinkPkt    PacketData to be sent
+ * \retval value    LoRaLinkStatus
  */
-void LoRaLinkSetTxData( LoRaLinkPacket_t* LoRaLinkPkt );
+LoRaLinkStatus_t LoRaLinkSetTxData( LoRaLinkPacket_t* LoRaLinkPkt );
 /*!
- * Get Max available payload length
+ * Get Max available payload length of a frame to a peer, at the SF adapted to it
  *
+ * \param [IN] destAddr  Peer address, LORALINK_MULTICAST_ADDR for the default SF
  * \retval value  Payload length
  */
-uint8_t LoRaLinkGetMaxPayloadLength( void );
+uint8_t LoRaLinkGetMaxPayloadLength( uint8_t destAddr );
+/*!
+ * Get the time on air of a frame with the default Tx parameters.
+ * LoRaLinkSend() applies the ones adapted to the peer to its frame only.
+ *
+ * \param [IN] payloadLen  Payload length, LoRaLink header and MIC are added
+ * \retval value  Time on air in ms
+ */
+uint32_t LoRaLinkGetTimeOnAir( uint8_t payloadLen );
+/*!
+ * Set the duty cycle window, the airtime recorded so far is cleared
+ *
+ * \param [IN] windowMs  Window in ms, LORALINK_DUTYCYCLE_WINDOW by default
+ */
+void LoRaLinkSetDutyCycleWindow( uint32_t windowMs );
+/*!
+ * Get the airtime left in the duty cycle window, shared by every Tx channel
+ *
+ * \retval value  Airtime in ms, LORALINK_AIRTIME_UNLIMITED without duty cycle
+ */
+uint32_t LoRaLinkGetAirtimeBudget( void );
+/*!
+ * Get the time until a frame can be sent within the duty cycle
+ *
+ * \param [IN] payloadLen  Payload length
+ * \retval value  Delay in ms, 0 if it can be sent now
+ */
+TimerTime_t LoRaLinkGetTxDelay( uint8_t payloadLen );
+/*!
+ * Adapt the SF and Tx power of each peer from the SNR of the frames received from it.
+ * The peer receives at the adapted SF, so the SF is kept within the SFs the peers scan
+ * ( LoRaLinkSetRxScan() on their side ). With one SF only the power is adapted.
+ * A peer can set them with a LINK_ADR_CMD frame even if disabled, within the SFs scanned
+ * and up to the default power.
+ *
+ * \param [IN] enable         true: enable, disabled by default
+ * \param [IN] minPayloadLen  SF is not raised to one that can not carry this length
+ * \param [IN] sfValues       SFs the peers scan, the default SF must be one of them or ADR is disabled
+ * \param [IN] num            Number of SFs up to LORALINK_MAX_SCAN_SF
+ * \retval value    LoRaLinkStatus, ADR stays disabled unless OK
+ */
+LoRaLinkStatus_t LoRaLinkSetAdr( bool enable, uint8_t minPayloadLen, uint8_t* sfValues, uint8_t num );
+/*!
+ * Filter the frames received again within a window, keyed on the source address and MIC.
+ * Only frames sent again unchanged match, PUBLISH retries set DUP and get a new MIC.
+ * The Rx modem flags the matches by default, the host sets the mode by API_REQ_DUP_FILTER.
+ * Fragments and link commands are not filtered.
+ *
+ * \param [IN] mode    LORALINK_DUP_OFF, LORALINK_DUP_DROP or LORALINK_DUP_FLAG
+ * \param [IN] window  Time a frame is remembered in ms, LORALINK_DUP_WINDOW by default
+ */
+void LoRaLinkSetDupFilter( LoRaLinkDupMode_t mode, uint32_t window );
+/*!
+ * Get the duplicate filter in use
+ *
+ * \param [OUT] mode    LORALINK_DUP_OFF, LORALINK_DUP_DROP or LORALINK_DUP_FLAG
+ * \param [OUT] window  Time a frame is remembered in ms
+ */
+void LoRaLinkGetDupFilter( LoRaLinkDupMode_t* mode, uint32_t* window );
+/*!
+ * Send every payload to a destination in fragments with one XOR parity fragment for each
+ * group of fragments. The receiver rebuilds one lost fragment of a group without a retransmission.
+ * The TX modem host sets it by API_REQ_FEC.
+ *
+ * \param [IN] destAddr  Destination, LORALINK_MULTICAST_ADDR for the destinations without their own group
+ * \param [IN] group     Fragments of a parity group, 0: FEC off (default)
+ * \retval value    LORALINK_STATUS_PARAMETER_INVALID if LORALINK_FEC_DESTS destinations have their own group
+ */
+LoRaLinkStatus_t LoRaLinkSetFec( uint8_t destAddr, uint8_t group );
+/*!
+ * Get the FEC parity group of a destination
+ *
+ * \param [IN] destAddr  Destination address
+ * \retval value    Fragments of a parity group, 0: FEC off
+ */
+uint8_t LoRaLinkGetFec( uint8_t destAddr );
 
 uint8_t LoRaLinkGetSourceAddr( void );
 
@@ -121,6 +342,24 @@ LoRaLinkPacket_t* LoRaLinkClearPacket( LoRaLinkPacket_t* pkt );
 
 int16_t LoRaLinkGetRssi( void );
 int8_t LoRaLinkGetSnr( void );
+/*!
+ * Get counters of the received frame queue
+ *
+ * \param [OUT] stats  Received, overflowed frames, queue high water mark and
+ *                     the time the receiver was not listening
+ */
+void LoRaLinkGetRxQueueStats( LoRaLinkRxQueueStats_t* stats );
+/*!
+ * Get the link statistics, counters since the last reset and the RSSI/SNR
+ * histograms of the source addresses. The modems answer API_REQ_STATS with them.
+ *
+ * \param [OUT] stats  Statistics
+ */
+void LoRaLinkGetStats( LoRaLinkStats_t* stats );
+/*!
+ * Clear the link statistics
+ */
+void LoRaLinkResetStats( void );
 
 
 #endif /* LORALINK_H_ */
@@ -0,0 +1,285 @@
+/**************************************************************************************
+ *
+ * LoRaLinkAdr.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "LoRaLinkAdr.h"
+#include "utilities.h"
+
+/*
+ * Max payload tables in LoRaLink.c, indexed by SF_12 - sf
+ */
+extern uint8_t MaxPayloadDwell0[];
+extern uint8_t MaxPayloadDwell1[];
+
+/*
+ * Demodulation floor in 0.1dB, SF7 - SF12
+ */
+static const int16_t RequiredSnr[] = { -75, -100, -125, -150, -175, -200 };
+
+static struct
+{
+	LoRaLinkAdrPeer_t Peers[LORALINK_ADR_PEERS];
+	LoRaLinkDwelltime_t Dwelltime;
+	int8_t DefaultSf;
+	int8_t DefaultPower;
+	int8_t MaxPower;
+	bool Auto;
+	uint8_t MinPayloadLen;
+	uint16_t ScanSf;     // bit n: SF n is scanned by the peers
+} AdrCtx;
+
+static LoRaLinkAdrPeer_t* GetPeer( uint8_t addr, bool create );
+static bool IsSfAvailable( int8_t sfValue );
+static bool IsSfScanned( int8_t sfValue );
+static void Adapt( LoRaLinkAdrPeer_t* peer );
+
+
+void LoRaLinkAdrInit( LoRaLinkDwelltime_t dwelltime, int8_t sfValue, int8_t power )
+{
+	memset1( (uint8_t*)AdrCtx.Peers, 0, sizeof(AdrCtx.Peers) );
+	AdrCtx.Dwelltime = dwelltime;
+	AdrCtx.DefaultSf = sfValue;
+	AdrCtx.DefaultPower = power;
+	AdrCtx.MaxPower = power;
+
+	if ( ( AdrCtx.ScanSf & ( 1 << sfValue ) ) == 0 )
+	{
+		// Enabled for an other default SF
+		AdrCtx.Auto = false;
+	}
+}
+
+LoRaLinkStatus_t LoRaLinkAdrSetAuto( bool enable, uint8_t minPayloadLen, uint8_t* sfValues, uint8_t num )
+{
+	uint16_t scanSf = 0;
+
+	AdrCtx.Auto = false;
+	if ( enable == false )
+	{
+		return LORALINK_STATUS_OK;
+	}
+
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		if ( sfValues[i] < SF_7 || sfValues[i] > SF_12 )
+		{
+			return LORALINK_STATUS_DATARATE_INVALID;
+		}
+		scanSf |= 1 << sfValues[i];
+	}
+
+	// Frames to a peer not adapted yet go at the default SF, set by LoRaLinkAdrInit()
+	if ( AdrCtx.DefaultSf != 0 && ( scanSf & ( 1 << AdrCtx.DefaultSf ) ) == 0 )
+	{
+		return LORALINK_STATUS_DATARATE_INVALID;
+	}
+	AdrCtx.ScanSf = scanSf;
+	AdrCtx.MinPayloadLen = minPayloadLen;
+	AdrCtx.Auto = true;
+	return LORALINK_STATUS_OK;
+}
+
+void LoRaLinkAdrAddSample( uint8_t srcAddr, int8_t snr )
+{
+	if ( AdrCtx.Auto == false )
+	{
+		return;
+	}
+
+	LoRaLinkAdrPeer_t* peer = GetPeer( srcAddr, true );
+
+	peer->Snr[peer->SnrCnt++] = snr;
+	if ( peer->SnrCnt >= LORALINK_ADR_WINDOW )
+	{
+		Adapt( peer );
+		peer->SnrCnt = 0;
+	}
+}
+
+LoRaLinkStatus_t LoRaLinkAdrCommand( uint8_t srcAddr, uint8_t* payload, uint8_t len )
+{
+	int8_t sfValue = 0;
+	int8_t power = 0;
+
+	if ( len < LORALINK_ADR_CMD_LEN )
+	{
+		return LORALINK_STATUS_LENGTH_ERROR;
+	}
+	sfValue = (int8_t)payload[0];
+	power = (int8_t)payload[1];
+
+	// Ignored as a whole when a value is out of range, the peers only hear the SFs they scan
+	if ( sfValue != LORALINK_ADR_SF_KEEP && IsSfScanned( sfValue ) == false &&
+	     ( sfValue != AdrCtx.DefaultSf || IsSfAvailable( sfValue ) == false ) )
+	{
+		return LORALINK_STATUS_DATARATE_INVALID;
+	}
+	if ( power != LORALINK_ADR_POWER_KEEP && ( power < LORALINK_ADR_MIN_POWER || power > AdrCtx.MaxPower ) )
+	{
+		return LORALINK_STATUS_PARAMETER_INVALID;
+	}
+
+	LoRaLinkAdrPeer_t* peer = GetPeer( srcAddr, true );
+
+	if ( sfValue != LORALINK_ADR_SF_KEEP )
+	{
+		peer->SFValue = sfValue;
+	}
+	if ( power != LORALINK_ADR_POWER_KEEP )
+	{
+		peer->TxPower = power;
+	}
+	peer->SnrCnt = 0;
+
+	return LORALINK_STATUS_OK;
+}
+
+void LoRaLinkAdrGetTxParams( uint8_t destAddr, int8_t* sfValue, int8_t* power )
+{
+	LoRaLinkAdrPeer_t* peer = NULL;
+
+	if ( destAddr != LORALINK_MULTICAST_ADDR )
+	{
+		peer = GetPeer( destAddr, false );
+	}
+
+	if ( peer == NULL )
+	{
+		*sfValue = AdrCtx.DefaultSf;
+		*power = AdrCtx.DefaultPower;
+	}
+	else
+	{
+		*sfValue = peer->SFValue;
+		*power = peer->TxPower;
+	}
+}
+
+static LoRaLinkAdrPeer_t* GetPeer( uint8_t addr, bool create )
+{
+	LoRaLinkAdrPeer_t* peer = NULL;
+
+	for ( uint8_t i = 0; i < LORALINK_ADR_PEERS; i++ )
+	{
+		if ( AdrCtx.Peers[i].Addr == addr )
+		{
+			return &AdrCtx.Peers[i];
+		}
+		if ( peer == NULL && AdrCtx.Peers[i].Addr == 0 )
+		{
+			peer = &AdrCtx.Peers[i];
+		}
+	}
+
+	if ( create == false )
+	{
+		return NULL;
+	}
+	if ( peer == NULL )
+	{
+		// Table full, the first peer starts over
+		peer = &AdrCtx.Peers[0];
+	}
+
+	memset1( (uint8_t*)peer, 0, sizeof(LoRaLinkAdrPeer_t) );
+	peer->Addr = addr;
+	peer->SFValue = AdrCtx.DefaultSf;
+	peer->TxPower = AdrCtx.DefaultPower;
+	return peer;
+}
+
+/*
+ * SF is valid in the dwell time and its max payload holds MinPayloadLen
+ */
+static bool IsSfAvailable( int8_t sfValue )
+{
+	uint8_t maxPayload = 0;
+
+	if ( sfValue < SF_7 || sfValue > SF_12 )
+	{
+		return false;
+	}
+
+	if ( AdrCtx.Dwelltime == DWELLTIME_0 )
+	{
+		maxPayload = MaxPayloadDwell0[ SF_12 - sfValue ];
+	}
+	else
+	{
+		maxPayload = MaxPayloadDwell1[ SF_12 - sfValue ];
+	}
+	return maxPayload > 0 && maxPayload >= AdrCtx.MinPayloadLen;
+}
+
+/*
+ * SF is available and the peers listen at it
+ */
+static bool IsSfScanned( int8_t sfValue )
+{
+	return IsSfAvailable( sfValue ) && ( AdrCtx.ScanSf & ( 1 << sfValue ) ) != 0;
+}
+
+/*
+ * Step SF and power by the SNR margin of the best frame in the window.
+ * A positive margin lowers SF first then power, a negative one raises power first then SF.
+ */
+static void Adapt( LoRaLinkAdrPeer_t* peer )
+{
+	int8_t maxSnr = peer->Snr[0];
+	int16_t margin = 0;
+	int16_t steps = 0;
+
+	for ( uint8_t i = 1; i < LORALINK_ADR_WINDOW; i++ )
+	{
+		maxSnr = MAX( maxSnr, peer->Snr[i] );
+	}
+
+	// margin in 0.1dB
+	margin = maxSnr * 10 - RequiredSnr[peer->SFValue - SF_7] - LORALINK_ADR_MARGIN * 10;
+	if ( margin >= 0 )
+	{
+		steps = margin / ( LORALINK_ADR_STEP * 10 );
+	}
+	else
+	{
+		steps = -( ( -margin + LORALINK_ADR_STEP * 10 - 1 ) / ( LORALINK_ADR_STEP * 10 ) );
+	}
+
+	for ( ; steps > 0; steps-- )
+	{
+		if ( peer->SFValue > SF_7 && IsSfScanned( peer->SFValue - 1 ) )
+		{
+			peer->SFValue--;
+		}
+		else if ( peer->TxPower - LORALINK_ADR_STEP >= LORALINK_ADR_MIN_POWER )
+		{
+			peer->TxPower -= LORALINK_ADR_STEP;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	for ( ; steps < 0; steps++ )
+	{
+		if ( peer->TxPower < AdrCtx.MaxPower )
+		{
+			peer->TxPower = MIN( peer->TxPower + LORALINK_ADR_STEP, AdrCtx.MaxPower );
+		}
+		else if ( peer->SFValue < SF_12 && IsSfScanned( peer->SFValue + 1 ) )
+		{
+			peer->SFValue++;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,121 @@
+/**************************************************************************************
+ *
+ * LoRaLinkAdr.h
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef LORALINKADR_H_
+#define LORALINKADR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "LoRaLinkTypes.h"
+
+/*!
+ * Number of SNR samples evaluated at once
+ */
+#define LORALINK_ADR_WINDOW           8
+
+/*!
+ * Number of peers tracked
+ */
+#define LORALINK_ADR_PEERS            4
+
+/*!
+ * SNR margin kept above the demodulation floor in dB
+ */
+#define LORALINK_ADR_MARGIN           10
+
+/*!
+ * SNR change of one SF or power step in dB
+ */
+#define LORALINK_ADR_STEP             3
+
+/*!
+ * Lowest Tx power in dBm
+ */
+#define LORALINK_ADR_MIN_POWER        1
+
+/*!
+ * LINK_ADR_CMD payload: TargetSF(1) TxPower(1)
+ */
+#define LORALINK_ADR_CMD_LEN          2
+#define LORALINK_ADR_SF_KEEP          0
+#define LORALINK_ADR_POWER_KEEP       0x7F
+
+/*!
+ * Tx parameters of a peer
+ */
+typedef struct
+{
+	/*!
+	 * Peer address, 0 if not used
+	 */
+	uint8_t Addr;
+	/*!
+	 * Spreading factor used to the peer
+	 */
+	int8_t SFValue;
+	/*!
+	 * Tx power used to the peer
+	 */
+	int8_t TxPower;
+	/*!
+	 * Number of SNR samples in Snr
+	 */
+	uint8_t SnrCnt;
+	/*!
+	 * SNR of the frames received from the peer
+	 */
+	int8_t Snr[LORALINK_ADR_WINDOW];
+} LoRaLinkAdrPeer_t;
+
+/*!
+ * Reset all peers to the default Tx parameters
+ *
+ * \param [IN] dwelltime  Dwell time of the channels in use
+ * \param [IN] sfValue    Default spreading factor
+ * \param [IN] power      Default and maximum Tx power in dBm
+ */
+void LoRaLinkAdrInit( LoRaLinkDwelltime_t dwelltime, int8_t sfValue, int8_t power );
+/*!
+ * Enable the SNR driven adaptation
+ *
+ * \param [IN] enable         true: adapt SF and power from the received SNR
+ * \param [IN] minPayloadLen  SF is not raised above the one whose max payload is shorter
+ * \param [IN] sfValues       SFs the peers scan, the adapted SF is one of them
+ * \param [IN] num            Number of SFs
+ * \retval value    LoRaLinkStatus, DATARATE_INVALID when the default SF is not scanned
+ */
+LoRaLinkStatus_t LoRaLinkAdrSetAuto( bool enable, uint8_t minPayloadLen, uint8_t* sfValues, uint8_t num );
+/*!
+ * Add the SNR of a frame received from a peer
+ *
+ * \param [IN] srcAddr  Peer address
+ * \param [IN] snr      SNR in dB
+ */
+void LoRaLinkAdrAddSample( uint8_t srcAddr, int8_t snr );
+/*!
+ * Apply a LINK_ADR_CMD received from a peer. The command is ignored when its SF is not
+ * scanned by the peers (the default SF without LoRaLinkAdrSetAuto()) or does not hold
+ * the minimum payload, or when its power is out of LORALINK_ADR_MIN_POWER to the default power.
+ *
+ * \param [IN] srcAddr  Peer address
+ * \param [IN] payload  Command payload
+ * \param [IN] len      Command payload length
+ * \retval value    LoRaLinkStatus, DATARATE_INVALID or PARAMETER_INVALID when ignored
+ */
+LoRaLinkStatus_t LoRaLinkAdrCommand( uint8_t srcAddr, uint8_t* payload, uint8_t len );
+/*!
+ * Get the Tx parameters to a peer
+ *
+ * \param [IN]  destAddr  Peer address, multicast uses the defaults
+ * \param [OUT] sfValue   Spreading factor
+ * \param [OUT] power     Tx power in dBm
+ */
+void LoRaLinkAdrGetTxParams( uint8_t destAddr, int8_t* sfValue, int8_t* power );
+
+#endif /* LORALINKADR_H_ */
@@ -0,0 +1,146 @@
+/**************************************************************************************
+ *
+ * LoRaLinkAirtime.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "LoRaLinkAirtime.h"
+#include "utilities.h"
+
+#define AIRTIME_RING_SIZE   ( LORALINK_AIRTIME_SLOTS + 1 )
+
+/*
+ * Airtime of the station on every Tx frequency
+ */
+static LoRaLinkAirtimeLedger_t Ledger;
+
+static uint32_t WindowTime = LORALINK_DUTYCYCLE_WINDOW;
+
+static void AdvanceLedger( LoRaLinkAirtimeLedger_t* ledger, TimerTime_t now );
+static uint32_t GetUsedAirtime( LoRaLinkAirtimeLedger_t* ledger );
+static uint32_t GetBudget( int8_t dutyCycle );
+
+
+void LoRaLinkAirtimeInit( uint32_t windowMs )
+{
+	memset1( (uint8_t*)&Ledger, 0, sizeof(Ledger) );
+	Ledger.SlotStart = TimerGetCurrentTime();
+
+	if ( windowMs < LORALINK_AIRTIME_SLOTS )
+	{
+		windowMs = LORALINK_AIRTIME_SLOTS;
+	}
+	WindowTime = windowMs;
+}
+
+void LoRaLinkAirtimeSetWindow( uint32_t windowMs )
+{
+	LoRaLinkAirtimeInit( windowMs );
+}
+
+void LoRaLinkAirtimeAdd( uint32_t timeOnAir )
+{
+	LoRaLinkAirtimeLedger_t* ledger = &Ledger;
+
+	AdvanceLedger( ledger, TimerGetCurrentTime() );
+	ledger->Airtime[ledger->CurrentSlot] += timeOnAir;
+}
+
+uint32_t LoRaLinkAirtimeGetRemaining( int8_t dutyCycle )
+{
+	if ( dutyCycle <= 0 )
+	{
+		return LORALINK_AIRTIME_UNLIMITED;
+	}
+
+	LoRaLinkAirtimeLedger_t* ledger = &Ledger;
+	uint32_t budget = GetBudget( dutyCycle );
+	uint32_t used = 0;
+
+	AdvanceLedger( ledger, TimerGetCurrentTime() );
+	used = GetUsedAirtime( ledger );
+
+	return ( used < budget ) ? budget - used : 0;
+}
+
+TimerTime_t LoRaLinkAirtimeGetTxDelay( int8_t dutyCycle, uint32_t timeOnAir )
+{
+	if ( dutyCycle <= 0 )
+	{
+		return 0;
+	}
+
+	LoRaLinkAirtimeLedger_t* ledger = &Ledger;
+	TimerTime_t now = TimerGetCurrentTime();
+	uint32_t slotTime = WindowTime / LORALINK_AIRTIME_SLOTS;
+	uint32_t budget = GetBudget( dutyCycle );
+	uint32_t used = 0;
+
+	if ( timeOnAir > budget )
+	{
+		// Never fits, retry after a whole window
+		return WindowTime;
+	}
+
+	AdvanceLedger( ledger, now );
+	used = GetUsedAirtime( ledger );
+
+	// Oldest slots leave the window first
+	for ( uint8_t i = 1; i <= AIRTIME_RING_SIZE; i++ )
+	{
+		if ( used + timeOnAir <= budget )
+		{
+			if ( i == 1 )
+			{
+				return 0;
+			}
+			return ledger->SlotStart + ( i - 1 ) * slotTime - now;
+		}
+		used -= ledger->Airtime[( ledger->CurrentSlot + i ) % AIRTIME_RING_SIZE];
+	}
+	return ledger->SlotStart + AIRTIME_RING_SIZE * slotTime - now;
+}
+
+/*
+ * Move the current slot up to now, clearing the slots leaving the window
+ */
+static void AdvanceLedger( LoRaLinkAirtimeLedger_t* ledger, TimerTime_t now )
+{
+	uint32_t slotTime = WindowTime / LORALINK_AIRTIME_SLOTS;
+	uint32_t slots = ( now - ledger->SlotStart ) / slotTime;
+
+	if ( slots >= AIRTIME_RING_SIZE )
+	{
+		memset1( (uint8_t*)ledger->Airtime, 0, sizeof(ledger->Airtime) );
+		ledger->CurrentSlot = 0;
+		ledger->SlotStart = now;
+		return;
+	}
+
+	for ( uint32_t i = 0; i < slots; i++ )
+	{
+		ledger->CurrentSlot = ( ledger->CurrentSlot + 1 ) % AIRTIME_RING_SIZE;
+		ledger->Airtime[ledger->CurrentSlot] = 0;
+	}
+	ledger->SlotStart += slots * slotTime;
+}
+
+static uint32_t GetUsedAirtime( LoRaLinkAirtimeLedger_t* ledger )
+{
+	uint32_t used = 0;
+
+	for ( uint8_t i = 0; i < AIRTIME_RING_SIZE; i++ )
+	{
+		used += ledger->Airtime[i];
+	}
+	return used;
+}
+
+static uint32_t GetBudget( int8_t dutyCycle )
+{
+	return WindowTime / 100 * dutyCycle;
+}
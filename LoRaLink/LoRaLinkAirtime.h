@@ -0,0 +1,88 @@
+/**************************************************************************************
+ *
+ * LoRaLinkAirtime.h
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef LORALINKAIRTIME_H_
+#define LORALINKAIRTIME_H_
+
+#include <stdint.h>
+#include "timer.h"
+#include "LoRaLinkTypes.h"
+
+/*!
+ * Default duty cycle window ( ARIB T-108: 360 s in any hour at 10% )
+ */
+#define LORALINK_DUTYCYCLE_WINDOW     3600000      // 1 hour in ms
+
+/*!
+ * Number of slots the window is divided into.
+ * Airtime leaves the window one slot at a time.
+ */
+#define LORALINK_AIRTIME_SLOTS        12
+
+/*!
+ * Remaining budget without duty cycle restriction
+ */
+#define LORALINK_AIRTIME_UNLIMITED    0xFFFFFFFF
+
+/*!
+ * Airtime ledger of the station. The duty cycle limits the airtime of the station,
+ * every channel of the Tx channel plan takes from the same budget.
+ */
+typedef struct
+{
+	/*!
+	 * Start time of the current slot
+	 */
+	TimerTime_t SlotStart;
+	/*!
+	 * Index of the current slot
+	 */
+	uint8_t CurrentSlot;
+	/*!
+	 * Airtime in ms transmitted during each slot.
+	 * One extra slot keeps a slot until its end is a whole window old.
+	 */
+	uint32_t Airtime[LORALINK_AIRTIME_SLOTS + 1];
+} LoRaLinkAirtimeLedger_t;
+
+/*!
+ * Clear the ledger and set the window
+ *
+ * \param [IN] windowMs  Duty cycle window in ms
+ */
+void LoRaLinkAirtimeInit( uint32_t windowMs );
+/*!
+ * Change the duty cycle window, recorded airtime is cleared
+ *
+ * \param [IN] windowMs  Duty cycle window in ms
+ */
+void LoRaLinkAirtimeSetWindow( uint32_t windowMs );
+/*!
+ * Record a transmission on any channel
+ *
+ * \param [IN] timeOnAir  Time on air in ms
+ */
+void LoRaLinkAirtimeAdd( uint32_t timeOnAir );
+/*!
+ * Get the airtime still available in the window
+ *
+ * \param [IN] dutyCycle  Duty cycle in %, 0 for no restriction
+ * \retval value  Remaining airtime in ms or LORALINK_AIRTIME_UNLIMITED
+ */
+uint32_t LoRaLinkAirtimeGetRemaining( int8_t dutyCycle );
+/*!
+ * Get the delay until a frame fits in the window budget
+ *
+ * \param [IN] dutyCycle  Duty cycle in %, 0 for no restriction
+ * \param [IN] timeOnAir  Time on air of the frame in ms
+ * \retval value  Delay in ms, 0 if the frame can be sent now
+ */
+TimerTime_t LoRaLinkAirtimeGetTxDelay( int8_t dutyCycle, uint32_t timeOnAir );
+
+#endif /* LORALINKAIRTIME_H_ */
@@ -11,6 +11,9 @@
 #include "LoRaLinkTypes.h"
 #include "LoRaLinkCrypto.h"
 #include "LoRaLink.h"
+#include "LoRaLinkStats.h"
+#include "LoRaLinkDup.h"
+#include "LoRaLinkFrag.h"
 #include "aes.h"
 #include "timer.h"
 #include "utilities.h"
@@ -23,8 +26,61 @@
 #define XOFF         0x13
 #define PAD          0x20
 
+// FRAME_DLMT + escaped Length(2) [Seq(1) Ack(1) Window(1)] SrcAddr(1) Rssi(2) Snr(2) PayloadType(1) [Rx ext] Payload Crc(1 or 2)
+#define API_TX_BUF_LEN  ( 1 + ( LORALINK_MAX_API_LEN + 8 + LORALINK_API_RX_EXT_LEN ) * 2 )
+
+// Length(2) Seq(1) Ack(1) Window(1) DestAddr(1) PayloadType(1) Payload Crc(2)
+#define API_RX_BUF_LEN  ( 2 + LORALINK_API_SEQ_HDR_LEN + 2 + LORA_PHY_MAXPAYLOAD + LORALINK_API_CRC_LEN )
+
+/*!
+ * Escaped API frame staged for the UART
+ */
+static uint8_t ApiTxBuffer[API_TX_BUF_LEN];
+static uint16_t ApiTxLen = 0;
+
+/*!
+ * Unescaped frame from the host and the frames waiting for LoRaLinkApiRead()
+ */
+static uint8_t ApiRxFrame[API_RX_BUF_LEN];
+static LoRaLinkApiReadParameters_t ApiRxPara = { 0 };
+static LoRaLinkApiTxEntry_t ApiTxQueue[LORALINK_API_WINDOW];
+static uint8_t ApiTxOrder = 0;
+static uint8_t ApiRxCount = 0;
+
+static LoRaLinkApiLink_t ApiLink = { 0 };
+
+/*!
+ * Sequenced frames to the host not acknowledged yet, by Seq
+ */
+static LoRaLinkApiResendEntry_t ApiResend[LORALINK_API_RESEND_WINDOW];
+
+/*!
+ * Rx frame format requested by the host and whether it sent its UTC
+ */
+static uint8_t ApiRxFormat = LORALINK_API_RX_FORMAT_PLAIN;
+static bool ApiUtcSynced = false;
+
 //static uint8_t UartGetByte( uint8_t* buf );
-static void UartPutByte( uint8_t c );
+static void StageByte( uint8_t c );
+static uint8_t StageBlock( uint8_t* data, uint16_t len, uint16_t* crc );
+static uint16_t Crc16Update( uint16_t crc, uint8_t c );
+static bool ApiRxReady( void );
+static bool ApiParseByte( LoRaLinkApiReadParameters_t* para, uint8_t byte );
+static void ApiFrameReceived( void );
+static void ApiSetLinkMode( LoRaLinkApi_t* req );
+static void ApiSetRxFormat( LoRaLinkApi_t* req );
+static void ApiSetUtc( LoRaLinkApi_t* req );
+static void ApiSendStats( LoRaLinkApi_t* req );
+static void ApiSetDupFilter( LoRaLinkApi_t* req );
+static void ApiSetFec( LoRaLinkApi_t* req );
+static LoRaLinkApiTxEntry_t* ApiTxFreeEntry( void );
+static void ApiWriteFrame( LoRaLinkPacket_t* pkt );
+static void ApiWriteRxExt( LoRaLinkPacket_t* pkt, LoRaLinkRxMeta_t* meta );
+static void ApiWriteAck( void );
+static void ApiStageFrame( uint8_t* hdr, uint8_t hdrLen, uint8_t* payload, uint16_t payloadLen );
+static void ApiPutFrame( uint8_t seq, uint8_t* hdr, uint8_t hdrLen, uint8_t* payload, uint16_t payloadLen );
+static void ApiAcknowledged( uint8_t ack, bool resend );
+static void ApiResendFrames( void );
 
 extern uint8_t LoRaLinkGetSourceAddr(void);
 extern uint16_t LoRaLinkGetPanId(void);
@@ -52,45 +108,244 @@ void LoRaLinkApiGetRxData( LoRaLinkPacket_t* pkt, RxDoneParams_t* rxDonePara )
 
 void LoRaLinkApiWrite( LoRaLinkPacket_t* pkt )
 {
-	uint8_t buf[4] = { 0 };
-	uint8_t* pos = 0;
-	uint8_t chks = 0;
-	uint16_t len = pkt->FRMPayloadSize + 7;  //  = DestAddr[1] + Rssi[2] + Snr[2] + PayloadType[1] + Crc[1]
+	LoRaLinkPacket_t sub = { 0 };
+	uint8_t offset = 0;
+
+	if ( pkt->FRMPayloadType != LINK_AGGREGATE )
+	{
+		ApiWriteFrame( pkt );
+		return;
+	}
+
+	// One API frame for each message
+	while ( LoRaLinkApiGetSubMessage( pkt, &offset, &sub ) == true )
+	{
+		ApiWriteFrame( &sub );
+	}
+}
+
+/*
+ * Write a received packet in the format the host asked for by API_REQ_RX_FORMAT
+ */
+void LoRaLinkApiWriteRx( LoRaLinkPacket_t* pkt, LoRaLinkRxMeta_t* meta )
+{
+	LoRaLinkPacket_t sub = { 0 };
+	uint8_t offset = 0;
+
+	if ( ApiRxFormat == LORALINK_API_RX_FORMAT_PLAIN )
+	{
+		LoRaLinkApiWrite( pkt );
+		return;
+	}
+
+	if ( pkt->FRMPayloadType != LINK_AGGREGATE )
+	{
+		ApiWriteRxExt( pkt, meta );
+		return;
+	}
+
+	// Messages of one packet share the metadata
+	while ( LoRaLinkApiGetSubMessage( pkt, &offset, &sub ) == true )
+	{
+		ApiWriteRxExt( &sub, meta );
+	}
+}
+
+/*
+ * Take the message at offset out of a LINK_AGGREGATE packet and advance offset.
+ * Returns false at the end of the payload, at the padding or if the message is truncated.
+ */
+bool LoRaLinkApiGetSubMessage( LoRaLinkPacket_t* pkt, uint8_t* offset, LoRaLinkPacket_t* sub )
+{
+	uint8_t* pos = pkt->FRMPayload + *offset;
+	uint8_t len = 0;
+
+	if ( *offset + LORALINK_AGGREGATE_SUBHDR_LEN > pkt->FRMPayloadSize )
+	{
+		return false;
+	}
+	len = pos[0];
+	if ( len == 0 )
+	{
+		// Padding of an implicit header frame
+		return false;
+	}
+	if ( *offset + LORALINK_AGGREGATE_SUBHDR_LEN + len > pkt->FRMPayloadSize )
+	{
+		return false;
+	}
+
+	sub->PanId = pkt->PanId;
+	sub->DestAddr = pkt->DestAddr;
+	sub->SourceAddr = pkt->SourceAddr;
+	sub->Rssi = pkt->Rssi;
+	sub->Snr = pkt->Snr;
+	sub->FRMPayloadType = pos[1];
+	sub->FRMPayload = pos + LORALINK_AGGREGATE_SUBHDR_LEN;
+	sub->FRMPayloadSize = len;
+
+	*offset += LORALINK_AGGREGATE_SUBHDR_LEN + len;
+	return true;
+}
+
+static void ApiWriteFrame( LoRaLinkPacket_t* pkt )
+{
+	uint8_t hdr[6] = { 0 };  //  SrcAddr[1] + Rssi[2] + Snr[2] + PayloadType[1]
+
+	hdr[0] = pkt->SourceAddr;
+	setUint16( hdr + 1, pkt->Rssi );
+	setUint16( hdr + 3, pkt->Snr );
+	hdr[5] = pkt->FRMPayloadType;
+
+	ApiStageFrame( hdr, sizeof(hdr), pkt->FRMPayload, pkt->FRMPayloadSize );
+}
+
+static void ApiWriteRxExt( LoRaLinkPacket_t* pkt, LoRaLinkRxMeta_t* meta )
+{
+	uint8_t hdr[6 + LORALINK_API_RX_EXT_LEN] = { 0 };
+	uint8_t* pos = hdr + 6;
+	SysTime_t utc = { 0 };
+	TimerTime_t elapsed = 0;
 
-	UartPutChar(FRAME_DLMT);
+	hdr[0] = pkt->SourceAddr;
+	setUint16( hdr + 1, pkt->Rssi );
+	setUint16( hdr + 3, pkt->Snr );
+	hdr[5] = API_RX_EXT;
 
-	setUint16(buf,len);
-	UartPutByte(buf[0]);
-	UartPutByte(buf[1]);
+	if ( ApiUtcSynced == true )
+	{
+		// UTC of RxDone, the frame waited in the Rx queue
+		elapsed = TimerGetElapsedTime( meta->RxTime );
+		utc.Seconds = elapsed / 1000;
+		utc.SubSeconds = elapsed % 1000;
+		utc = SysTimeSub( SysTimeGet(), utc );
+	}
 
-	UartPutByte(pkt->SourceAddr);
-	chks = pkt->SourceAddr;
+	*pos++ = LORALINK_API_RX_FORMAT_EXT;
+	*pos++ = LORALINK_API_RX_META_LEN;
+	setUint32( pos, meta->Counter );
+	pos += 4;
+	setUint32( pos, meta->RxTime );
+	pos += 4;
+	setUint32( pos, utc.Seconds );
+	pos += 4;
+	setUint16( pos, utc.SubSeconds );
+	pos += 2;
+	setUint32( pos, meta->Frequency );
+	pos += 4;
+	*pos++ = meta->SFValue;
+	*pos++ = meta->Bandwidth;
+	setUint32( pos, (uint32_t)meta->Fei );
+	pos += 4;
+	setUint16( pos, pkt->PanId );
+	pos += 2;
+	*pos++ = pkt->DestAddr;
+	*pos++ = meta->Flags;
+	*pos = pkt->FRMPayloadType;
+
+	ApiStageFrame( hdr, sizeof(hdr), pkt->FRMPayload, pkt->FRMPayloadSize );
+}
 
-	setUint16(buf, pkt->Rssi);
-	UartPutByte(buf[0]);
-	UartPutByte(buf[1]);
-	chks += buf[0] + buf[1];
+/*
+ * Acknowledgement only, a sequenced frame without Body
+ */
+static void ApiWriteAck( void )
+{
+	ApiStageFrame( NULL, 0, NULL, 0 );
+}
 
-	setUint16(buf, pkt->Snr);
-	UartPutByte(buf[0]);
-	UartPutByte(buf[1]);
-	chks += buf[0] + buf[1];
+/*
+ * A sequenced frame with Body is kept until the host acknowledges it
+ */
+static void ApiStageFrame( uint8_t* hdr, uint8_t hdrLen, uint8_t* payload, uint16_t payloadLen )
+{
+	LoRaLinkApiResendEntry_t* entry = NULL;
 
-	UartPutByte( pkt->FRMPayloadType);
-	chks += pkt->FRMPayloadType;
+	if ( ApiLink.Sequenced == false || hdrLen + payloadLen == 0 )
+	{
+		ApiPutFrame( ApiLink.TxSeq, hdr, hdrLen, payload, payloadLen );
+		return;
+	}
 
-	pos = pkt->FRMPayload;
-	for( uint8_t i = 0; i < pkt->FRMPayloadSize; i++ )
+	if ( (uint8_t)( ApiLink.TxSeq - ApiLink.TxBase ) == LORALINK_API_RESEND_WINDOW )
 	{
-		UartPutByte(*pos);
-		chks += *pos++;
+		// The host is behind, the oldest frame makes room
+		ApiLink.TxBase++;
+		ApiLink.Recovering = false;
+		LoRaLinkStatsCount( LORALINK_STATS_API_TX_GIVEN_UP );
+	}
+	if ( ApiLink.TxSeq == ApiLink.TxBase )
+	{
+		ApiLink.TxTime = TimerGetCurrentTime();
+	}
+
+	entry = &ApiResend[ApiLink.TxSeq % LORALINK_API_RESEND_WINDOW];
+	memcpy1( entry->Body, hdr, hdrLen );
+	memcpy1( entry->Body + hdrLen, payload, payloadLen );
+	entry->Len = hdrLen + payloadLen;
+	ApiPutFrame( ApiLink.TxSeq++, NULL, 0, entry->Body, entry->Len );
+}
+
+static void ApiPutFrame( uint8_t seq, uint8_t* hdr, uint8_t hdrLen, uint8_t* payload, uint16_t payloadLen )
+{
+	uint8_t buf[LORALINK_API_SEQ_HDR_LEN] = { 0 };
+	uint8_t chks = 0;
+	uint16_t crc = 0xFFFF;
+	uint16_t len = 0;
+	TimerTime_t start = 0;
+
+	ApiTxLen = 0;
+	ApiTxBuffer[ApiTxLen++] = FRAME_DLMT;
+
+	if ( ApiLink.Sequenced == false )
+	{
+		len = hdrLen + payloadLen + 1;      //  + Crc[1]
+		setUint16( buf, len );
+		StageByte( buf[0] );
+		StageByte( buf[1] );
+		chks = StageBlock( hdr, hdrLen, &crc ) + StageBlock( payload, payloadLen, &crc );
+		StageByte( 0xff - chks );  // CRC
+	}
+	else
+	{
+		len = LORALINK_API_SEQ_HDR_LEN + hdrLen + payloadLen + LORALINK_API_CRC_LEN;
+		setUint16( buf, len );
+		StageBlock( buf, 2, &crc );
+
+		ApiLink.Window = LORALINK_API_WINDOW - ApiRxCount;
+		buf[0] = seq;
+		buf[1] = ApiLink.RxSeq;
+		buf[2] = ApiLink.Window;
+		if ( hdrLen + payloadLen > 0 && seq == ApiLink.TxBase )
+		{
+			// Frames before it are given up, the host takes this one after a gap
+			buf[2] |= LORALINK_API_WINDOW_BASE;
+		}
+		StageBlock( buf, LORALINK_API_SEQ_HDR_LEN, &crc );
+		StageBlock( hdr, hdrLen, &crc );
+		StageBlock( payload, payloadLen, &crc );
+
+		setUint16( buf, crc );
+		StageByte( buf[0] );
+		StageByte( buf[1] );
 	}
 
-	UartPutByte(0xff - chks);  // CRC
+	// Whole frame in one push, the UART drains it in the background
+	start = TimerGetCurrentTime();
+	while ( UartPutBlock( ApiTxBuffer, ApiTxLen ) != 0 )
+	{
+		if ( TimerGetElapsedTime( start ) >= LORALINK_API_TX_WAIT )
+		{
+			// The host holds CTS or stopped reading, a sequenced frame is resent
+			LoRaLinkStatsCount( LORALINK_STATS_API_TX_DROPPED );
+			return;
+		}
+		DelayMs( 1 );
+	}
 }
 
 
-void LoRaLinkApiSetTxData( LoRaLinkPacket_t* pkt, LoRaLinkApi_t* api )
+LoRaLinkStatus_t LoRaLinkApiSetTxData( LoRaLinkPacket_t* pkt, LoRaLinkApi_t* api )
 {
 	pkt->PanId = api->PanId;
 	pkt->DestAddr = api->DestinationAddr;
@@ -99,102 +354,594 @@ void LoRaLinkApiSetTxData( LoRaLinkPacket_t* pkt, LoRaLinkApi_t* api )
 	pkt->FRMPayload = api->Payload;
 	pkt->FRMPayloadSize = api->PayloadLen;
 
-	LoRaLinkSetTxData(pkt);
+	return LoRaLinkSetTxData(pkt);
+}
+
+/*
+ * Ack of the host releases the frames before it, the frames after it are sent again on request
+ */
+static void ApiAcknowledged( uint8_t ack, bool resend )
+{
+	if ( ack != ApiLink.TxBase && (uint8_t)( ack - ApiLink.TxBase ) <= (uint8_t)( ApiLink.TxSeq - ApiLink.TxBase ) )
+	{
+		ApiLink.TxBase = ack;
+		ApiLink.Recovering = false;
+		ApiLink.Retry = 0;
+		ApiLink.TxTime = TimerGetCurrentTime();
+	}
+	if ( resend == true && ApiLink.TxSeq != ApiLink.TxBase && ApiLink.Recovering == false )
+	{
+		// A frame was lost or corrupted on the way to the host, once for the frames after it
+		ApiLink.Recovering = true;
+		ApiResendFrames();
+	}
+}
+
+/*
+ * Go back to the oldest frame not acknowledged
+ */
+static void ApiResendFrames( void )
+{
+	LoRaLinkApiResendEntry_t* entry = NULL;
+
+	for ( uint8_t seq = ApiLink.TxBase; seq != ApiLink.TxSeq; seq++ )
+	{
+		entry = &ApiResend[seq % LORALINK_API_RESEND_WINDOW];
+		ApiPutFrame( seq, NULL, 0, entry->Body, entry->Len );
+		LoRaLinkStatsCount( LORALINK_STATS_API_TX_RESENT );
+	}
+	ApiLink.TxTime = TimerGetCurrentTime();
 }
 
 
 
-bool LoRaLinkApiRead(LoRaLinkApi_t* api, LoRaLinkApiReadParameters_t* para)
+/*
+ * Parse the host input into the Rx queue, called from the modem loop
+ * so that the DMA buffer never holds more than the bytes of one pass.
+ */
+void LoRaLinkApiPoll( void )
 {
+	uint8_t* data = NULL;
+	uint16_t len = 0;
+	uint16_t i = 0;
 	uint8_t byte = 0;
-	uint16_t val = 0;
 
-	while ( UartGetChar(&byte) == 0 )
+	// Parse in place in the DMA buffer
+	while ( ApiRxReady() == true && ( len = UartPeekBuffer( &data ) ) > 0 )
 	{
-		if ( byte == FRAME_DLMT )
+		for ( i = 0; i < len && ApiRxReady() == true; i++ )
 		{
-			para->apipos= 1;
-			para->Error = true;
-			para->Available = false;
-			continue;
+			if ( ApiParseByte( &ApiRxPara, data[i] ) == true )
+			{
+				ApiFrameReceived();
+			}
 		}
+		UartSkipBuffer( i );
+	}
 
-		if ( para->apipos > 0 && byte == ESCAPE )
+	if ( UartIsRxOverrun() == true )
+	{
+		// Bytes of the frame in progress were lost, resync on the next frame delimiter
+		ApiRxPara.apipos = 0;
+		LoRaLinkStatsCount( LORALINK_STATS_API_RX_OVERRUN );
+	}
+
+	// Byte by byte from the Rx FIFO without DMA
+	while ( ApiRxReady() == true && UartGetChar(&byte) == 0 )
+	{
+		if ( ApiParseByte( &ApiRxPara, byte ) == true )
 		{
-			if( UartGetChar(&byte ) == 0 )
-			{
-				byte ^= PAD;  // decode
-			}
-			else
-			{
-				para->Escape = true;
-				continue;
-			}
+			ApiFrameReceived();
 		}
+	}
 
-		if( para->Escape == true )
+	if ( ApiLink.Sequenced == true && ApiLink.TxBase != ApiLink.TxSeq && TimerGetElapsedTime( ApiLink.TxTime ) >= LORALINK_API_RETX_TIME )
+	{
+		if ( ++ApiLink.Retry > LORALINK_API_MAX_RETRY )
+		{
+			// The host stopped reading
+			LoRaLinkStatsAdd( LORALINK_STATS_API_TX_GIVEN_UP, (uint8_t)( ApiLink.TxSeq - ApiLink.TxBase ) );
+			ApiLink.TxBase = ApiLink.TxSeq;
+			ApiLink.Retry = 0;
+		}
+		else
 		{
-			byte ^= PAD;
-			para->Escape = false;
+			ApiResendFrames();
 		}
+	}
 
-		switch ( para->apipos )
+	if ( ApiLink.Baudrate > 0 )
+	{
+		// The mode response is out, switch both ends
+		UartSetBaudrate( ApiLink.Baudrate, ( ApiLink.Flags & LORALINK_API_MODE_RTSCTS ) ? RTS_CTS_FLOW_CTRL : NO_FLOW_CTRL );
+		ApiLink.Sequenced = ( ApiLink.Flags & LORALINK_API_MODE_SEQUENCED ) != 0;
+		ApiLink.TxSeq = 0;
+		ApiLink.TxBase = 0;
+		ApiLink.Recovering = false;
+		ApiLink.Retry = 0;
+		ApiLink.RxSeq = 0;
+		// The host got the window in the mode response, no reopening ack is due
+		ApiLink.Window = LORALINK_API_WINDOW - ApiRxCount;
+		ApiLink.Baudrate = 0;
+		ApiRxPara.apipos = 0;
+	}
+}
+
+/*
+ * Take the next frame to send, the oldest of the highest priority.
+ * Expired frames are dropped with API_RSP_TOT.
+ */
+bool LoRaLinkApiRead(LoRaLinkApi_t* api, LoRaLinkApiReadParameters_t* para)
+{
+	LoRaLinkApiTxEntry_t* next = NULL;
+	LoRaLinkApiTxEntry_t* entry = NULL;
+
+	LoRaLinkApiPoll();
+
+	for ( uint8_t i = 0; i < LORALINK_API_WINDOW; i++ )
+	{
+		entry = &ApiTxQueue[i];
+		if ( entry->Used == false )
 		{
-		case 0:
-			break;
+			continue;
+		}
+		if ( LoRaLinkApiIsExpired( &entry->Api ) == true )
+		{
+			entry->Used = false;
+			ApiRxCount--;
+			LoRaLinkApiWriteResp( API_RSP_TOT, &entry->Api );
+			continue;
+		}
+		if ( next == NULL || entry->Api.Priority > next->Api.Priority ||
+		     ( entry->Api.Priority == next->Api.Priority && (int8_t)( entry->Order - next->Order ) < 0 ) )
+		{
+			next = entry;
+		}
+	}
 
-		case 1:
-			val = (uint16_t)byte;
-			api->PayloadLen = val << 8;
-			break;
+	if ( next != NULL )
+	{
+		memcpy1( (uint8_t*)api, (uint8_t*)&next->Api, sizeof(LoRaLinkApi_t) );
+		next->Used = false;
+		ApiRxCount--;
 
-		case 2:
-			api->PayloadLen += byte;
-			break;
+		para->Available = true;
+		para->Error = false;
+	}
 
-		case 3:
-			api->DestinationAddr = byte;
-			para->checksum = byte;
-			break;
+	if ( ApiLink.Sequenced == true && ApiLink.Window == 0 && ApiRxCount < LORALINK_API_WINDOW )
+	{
+		// Reopen the window of the host
+		ApiWriteAck();
+	}
+	return next != NULL;
+}
 
-		case 4:
-			api->PayloadType = byte;
-			para->checksum += byte;
-			break;
+/*
+ * Response to the host for a frame taken by LoRaLinkApiRead()
+ */
+void LoRaLinkApiWriteResp( LoRaLinkPayloadType_t type, LoRaLinkApi_t* api )
+{
+	LoRaLinkPacket_t rsp = { 0 };
+
+	rsp.FRMPayloadType = type;
+	rsp.FRMPayload = &api->FrameId;
+	rsp.FRMPayloadSize = ( api->FrameId > 0 ) ? 1 : 0;
+	rsp.DestAddr = api->SourceAddr;
+	rsp.SourceAddr = api->SourceAddr;
+	LoRaLinkApiWrite( &rsp );
+}
 
-		default:
-			if ( para->apipos >= api->PayloadLen + 2 )    //  FRM_DEL + CRC = 2
-			{
-				para->Error = ( (0xff - para->checksum) != byte );
-				para->Available = true;
-				para->apipos = 0;
-				para->checksum = 0;
-				api->PayloadLen -= 3;   // 3 = DestAddr[1] + PlType[1] + Crc[1]
-				api->SourceAddr = LoRaLinkGetSourceAddr();
-				api->PanId = LoRaLinkGetPanId();
-				return true;
-			}
-			else
-			{
-				api->Payload[para->apipos - 5] = byte;
-				para->checksum += byte;
-			}
-			break;
+bool LoRaLinkApiIsExpired( LoRaLinkApi_t* api )
+{
+	return api->Lifetime > 0 && TimerGetElapsedTime( api->SubmitTime ) > api->Lifetime;
+}
+
+static LoRaLinkApiTxEntry_t* ApiTxFreeEntry( void )
+{
+	for ( uint8_t i = 0; i < LORALINK_API_WINDOW; i++ )
+	{
+		if ( ApiTxQueue[i].Used == false )
+		{
+			return &ApiTxQueue[i];
 		}
-		para->apipos++;
+	}
+	return NULL;
+}
+
+/*
+ * Without flow control in the old framing the bytes stay in the Rx buffer while the queue is full.
+ * Sequenced frames are always parsed, the window of the host keeps the queue from overflowing.
+ */
+static bool ApiRxReady( void )
+{
+	if ( ApiLink.Baudrate > 0 )
+	{
+		return false;
+	}
+	return ApiLink.Sequenced == true || ApiRxCount < LORALINK_API_WINDOW;
+}
+
+/*
+ * Feed one byte to the deframer, returns true when ApiRxFrame holds a whole frame
+ */
+static bool ApiParseByte( LoRaLinkApiReadParameters_t* para, uint8_t byte )
+{
+	uint16_t len = 0;
+
+	if ( byte == FRAME_DLMT )
+	{
+		para->apipos = 1;
+		para->Escape = false;
+		return false;
+	}
+
+	if ( para->apipos == 0 )
+	{
+		return false;
+	}
+
+	if ( byte == ESCAPE )
+	{
+		para->Escape = true;
+		return false;
+	}
+
+	if( para->Escape == true )
+	{
+		byte ^= PAD;
+		para->Escape = false;
+	}
+
+	ApiRxFrame[para->apipos++ - 1] = byte;
+
+	if ( para->apipos <= 2 )
+	{
+		return false;
+	}
+
+	len = getUint16( ApiRxFrame );
+	if ( len + 2 > API_RX_BUF_LEN )
+	{
+		// Too long, wait for the next frame delimiter
+		para->apipos = 0;
+		return false;
+	}
+	if ( para->apipos - 1 == len + 2 )
+	{
+		para->apipos = 0;
+		return true;
 	}
 	return false;
 }
 
-static void UartPutByte( uint8_t c )
+/*
+ * Check the frame in ApiRxFrame and queue it
+ */
+static void ApiFrameReceived( void )
+{
+	LoRaLinkApiTxEntry_t* entry = NULL;
+	LoRaLinkApi_t* api = NULL;
+	uint16_t len = getUint16( ApiRxFrame );
+	uint8_t* body = ApiRxFrame + 2;
+	uint16_t bodyLen = 0;
+	uint8_t chks = 0;
+	uint16_t crc = 0xFFFF;
+
+	if ( ApiLink.Sequenced == false )
+	{
+		if ( len < 3 )    // 3 = DestAddr[1] + PlType[1] + Crc[1]
+		{
+			return;
+		}
+		bodyLen = len - 1;
+		for ( uint16_t i = 0; i < bodyLen; i++ )
+		{
+			chks += body[i];
+		}
+		if ( (uint8_t)( chks + body[bodyLen] ) != 0xff || ApiRxCount == LORALINK_API_WINDOW )
+		{
+			return;
+		}
+	}
+	else
+	{
+		if ( len < LORALINK_API_SEQ_HDR_LEN + LORALINK_API_CRC_LEN )
+		{
+			return;
+		}
+		bodyLen = len - LORALINK_API_SEQ_HDR_LEN - LORALINK_API_CRC_LEN;
+		for ( uint16_t i = 0; i < len; i++ )
+		{
+			crc = Crc16Update( crc, ApiRxFrame[i] );
+		}
+		if ( crc != getUint16( ApiRxFrame + len ) )
+		{
+			// Duplicate ack makes the host go back
+			ApiWriteAck();
+			return;
+		}
+		ApiAcknowledged( body[1], ( body[2] & LORALINK_API_WINDOW_RESEND ) != 0 );
+		if ( bodyLen == 0 )
+		{
+			// Acknowledgement only
+			return;
+		}
+		if ( body[0] != ApiLink.RxSeq || ApiRxCount == LORALINK_API_WINDOW || bodyLen < 2 )
+		{
+			// Out of sequence, duplicated or no room
+			ApiWriteAck();
+			return;
+		}
+		ApiLink.RxSeq++;
+		body += LORALINK_API_SEQ_HDR_LEN;
+	}
+
+	if ( bodyLen < 2 || bodyLen - 2 > LORA_PHY_MAXPAYLOAD )   // 2 = DestAddr[1] + PlType[1]
+	{
+		return;
+	}
+
+	entry = ApiTxFreeEntry();
+	api = &entry->Api;
+	api->DestinationAddr = body[0];
+	api->PayloadType = body[1];
+	api->FrameId = 0;
+	api->Priority = 0;
+	api->SubmitTime = TimerGetCurrentTime();
+	api->Lifetime = 0;
+	body += 2;
+	bodyLen -= 2;
+
+	if ( api->PayloadType == API_REQ_QUEUE_TX && bodyLen >= LORALINK_API_QUEUE_HDR_LEN )
+	{
+		api->FrameId = body[0];
+		api->Priority = body[1];
+		api->Lifetime = (uint32_t)getUint16( body + 2 ) * LORALINK_API_LIFETIME_UNIT;
+		api->PayloadType = body[4];
+		body += LORALINK_API_QUEUE_HDR_LEN;
+		bodyLen -= LORALINK_API_QUEUE_HDR_LEN;
+	}
+
+	api->PayloadLen = bodyLen;
+	memcpy1( api->Payload, body, api->PayloadLen );
+	api->SourceAddr = LoRaLinkGetSourceAddr();
+	api->PanId = LoRaLinkGetPanId();
+
+	if ( api->PayloadType == API_REQ_LINK_MODE )
+	{
+		ApiSetLinkMode( api );
+	}
+	else if ( api->PayloadType == API_REQ_RX_FORMAT )
+	{
+		ApiSetRxFormat( api );
+	}
+	else if ( api->PayloadType == API_RSP_UTC )
+	{
+		ApiSetUtc( api );
+	}
+	else if ( api->PayloadType == API_REQ_STATS )
+	{
+		ApiSendStats( api );
+	}
+	else if ( api->PayloadType == API_REQ_DUP_FILTER )
+	{
+		ApiSetDupFilter( api );
+	}
+	else if ( api->PayloadType == API_REQ_FEC )
+	{
+		ApiSetFec( api );
+	}
+	else
+	{
+		entry->Order = ApiTxOrder++;
+		entry->Used = true;
+		ApiRxCount++;
+	}
+
+	if ( ApiLink.Sequenced == true && ApiLink.Baudrate == 0 )
+	{
+		ApiWriteAck();
+	}
+}
+
+/*
+ * Answer API_REQ_LINK_MODE, LoRaLinkApiPoll() switches the mode after the response
+ */
+static void ApiSetLinkMode( LoRaLinkApi_t* req )
+{
+	LoRaLinkPacket_t rsp = { 0 };
+	uint8_t buf[LORALINK_API_MODE_RSP_LEN] = { 0 };
+	uint32_t baudrate = 0;
+	uint8_t flags = 0;
+
+	if ( req->PayloadLen >= LORALINK_API_MODE_REQ_LEN )
+	{
+		baudrate = getUint32( req->Payload );
+		flags = req->Payload[4] & ( LORALINK_API_MODE_RTSCTS | LORALINK_API_MODE_SEQUENCED );
+	}
+
+	if ( baudrate < LORALINK_API_MIN_BAUDRATE || baudrate > LORALINK_API_MAX_BAUDRATE ||
+	     ( ( flags & LORALINK_API_MODE_RTSCTS ) && UartIsFlowCtrlSupported() == false ) )
+	{
+		baudrate = 0;
+		flags = 0;
+	}
+
+	setUint32( buf, baudrate );
+	buf[4] = flags;
+	buf[5] = LORALINK_API_WINDOW;
+
+	rsp.FRMPayloadType = API_RSP_LINK_MODE;
+	rsp.FRMPayload = buf;
+	rsp.FRMPayloadSize = LORALINK_API_MODE_RSP_LEN;
+	rsp.DestAddr = req->SourceAddr;
+	rsp.SourceAddr = req->SourceAddr;
+	ApiWriteFrame( &rsp );
+
+	ApiLink.Baudrate = baudrate;
+	ApiLink.Flags = flags;
+}
+
+/*
+ * Answer API_REQ_RX_FORMAT with the version in use, unknown versions keep the plain frame
+ */
+static void ApiSetRxFormat( LoRaLinkApi_t* req )
+{
+	LoRaLinkPacket_t rsp = { 0 };
+	uint8_t version = LORALINK_API_RX_FORMAT_PLAIN;
+
+	if ( req->PayloadLen >= 1 && req->Payload[0] >= LORALINK_API_RX_FORMAT_EXT )
+	{
+		// Newer hosts read the fields they know
+		version = LORALINK_API_RX_FORMAT_EXT;
+	}
+	ApiRxFormat = version;
+
+	rsp.FRMPayloadType = API_RSP_RX_FORMAT;
+	rsp.FRMPayload = &ApiRxFormat;
+	rsp.FRMPayloadSize = 1;
+	rsp.DestAddr = req->SourceAddr;
+	rsp.SourceAddr = req->SourceAddr;
+	ApiWriteFrame( &rsp );
+}
+
+/*
+ * Answer API_REQ_STATS, see LoRaLinkStats.h
+ */
+static void ApiSendStats( LoRaLinkApi_t* req )
+{
+	LoRaLinkPacket_t rsp = { 0 };
+	uint8_t buf[LORALINK_STATS_RSP_LEN] = { 0 };
+	uint8_t index = 0;
+	uint8_t flags = 0;
+
+	if ( req->PayloadLen >= LORALINK_STATS_REQ_LEN )
+	{
+		index = req->Payload[0];
+		flags = req->Payload[1];
+	}
+
+	rsp.FRMPayloadType = API_RSP_STATS;
+	rsp.FRMPayload = buf;
+	rsp.FRMPayloadSize = LoRaLinkStatsSerialize( index, buf, sizeof(buf) );
+	rsp.DestAddr = req->SourceAddr;
+	rsp.SourceAddr = req->SourceAddr;
+	ApiWriteFrame( &rsp );
+
+	if ( flags & LORALINK_STATS_FLAG_RESET )
+	{
+		LoRaLinkStatsReset();
+	}
+}
+
+/*
+ * Answer API_REQ_DUP_FILTER with the filter in use
+ */
+static void ApiSetDupFilter( LoRaLinkApi_t* req )
+{
+	LoRaLinkPacket_t rsp = { 0 };
+	uint8_t buf[LORALINK_API_DUP_LEN] = { 0 };
+	LoRaLinkDupMode_t mode = LORALINK_DUP_OFF;
+	uint32_t window = 0;
+
+	if ( req->PayloadLen >= LORALINK_API_DUP_LEN && req->Payload[0] <= LORALINK_DUP_FLAG )
+	{
+		window = getUint32( req->Payload + 1 );
+		LoRaLinkSetDupFilter( (LoRaLinkDupMode_t)req->Payload[0], window > 0 ? window : LORALINK_DUP_WINDOW );
+	}
+	LoRaLinkGetDupFilter( &mode, &window );
+	buf[0] = mode;
+	setUint32( buf + 1, window );
+
+	rsp.FRMPayloadType = API_RSP_DUP_FILTER;
+	rsp.FRMPayload = buf;
+	rsp.FRMPayloadSize = LORALINK_API_DUP_LEN;
+	rsp.DestAddr = req->SourceAddr;
+	rsp.SourceAddr = req->SourceAddr;
+	ApiWriteFrame( &rsp );
+}
+
+/*
+ * Answer API_REQ_FEC with the group in use for the destination
+ */
+static void ApiSetFec( LoRaLinkApi_t* req )
+{
+	LoRaLinkPacket_t rsp = { 0 };
+	uint8_t buf[LORALINK_API_FEC_LEN] = { 0 };
+
+	if ( req->PayloadLen < LORALINK_API_FEC_LEN )
+	{
+		return;
+	}
+	if ( req->Payload[1] <= LORALINK_FRAG_MAX_COUNT )
+	{
+		LoRaLinkSetFec( req->Payload[0], req->Payload[1] );
+	}
+	buf[0] = req->Payload[0];
+	buf[1] = LoRaLinkGetFec( req->Payload[0] );
+
+	rsp.FRMPayloadType = API_RSP_FEC;
+	rsp.FRMPayload = buf;
+	rsp.FRMPayloadSize = LORALINK_API_FEC_LEN;
+	rsp.DestAddr = req->SourceAddr;
+	rsp.SourceAddr = req->SourceAddr;
+	ApiWriteFrame( &rsp );
+}
+
+/*
+ * UTC from the host, stamps the extended Rx frames
+ */
+static void ApiSetUtc( LoRaLinkApi_t* req )
+{
+	SysTime_t utc = { 0 };
+
+	if ( req->PayloadLen < LORALINK_API_UTC_LEN )
+	{
+		return;
+	}
+	utc.Seconds = getUint32( req->Payload );
+	utc.SubSeconds = getUint16( req->Payload + 4 );
+	SysTimeSet( utc );
+	ApiUtcSynced = true;
+}
+
+/*
+ * CRC-16/CCITT-FALSE, polynomial 0x1021
+ */
+static uint16_t Crc16Update( uint16_t crc, uint8_t c )
+{
+	uint8_t x = ( crc >> 8 ) ^ c;
+
+	x ^= x >> 4;
+	return ( crc << 8 ) ^ ( (uint16_t)x << 12 ) ^ ( (uint16_t)x << 5 ) ^ x;
+}
+
+/*
+ * Stage a block for the UART, returns the additive checksum and updates the CRC
+ */
+static uint8_t StageBlock( uint8_t* data, uint16_t len, uint16_t* crc )
+{
+	uint8_t chks = 0;
+
+	for ( uint16_t i = 0; i < len; i++ )
+	{
+		StageByte( data[i] );
+		chks += data[i];
+		*crc = Crc16Update( *crc, data[i] );
+	}
+	return chks;
+}
+
+static void StageByte( uint8_t c )
 {
 	if ( c == FRAME_DLMT || c == ESCAPE || c == XON || c == XOFF )
 	{
-		UartPutChar( ESCAPE );
-		UartPutChar( c ^ PAD );
+		ApiTxBuffer[ApiTxLen++] = ESCAPE;
+		ApiTxBuffer[ApiTxLen++] = c ^ PAD;
 	}
 	else
 	{
-		UartPutChar( c );
+		ApiTxBuffer[ApiTxLen++] = c;
 	}
 }
@@ -13,6 +13,109 @@
 #include <stdbool.h>
 #include "LoRaLinkTypes.h"
 
+/*!
+ * Sequenced UART link
+ *
+ * API_REQ_LINK_MODE  Baudrate(4) Flags(1)
+ * API_RSP_LINK_MODE  Baudrate(4) Flags(1) Window(1), Baudrate 0 when rejected
+ *
+ * The response goes out in the current mode, the new mode starts after it.
+ * A sequenced frame replaces the checksum of the API frame by a CRC-16 and
+ * inserts Seq, Ack and Window after the length:
+ *
+ * FRAME_DLMT Len(2) Seq(1) Ack(1) Window(1) Body Crc(2)
+ *
+ * Ack is the next Seq expected from the peer and Window the number of frames
+ * the modem still accepts after Ack. A frame without Body only acknowledges.
+ *
+ * The modem keeps its last LORALINK_API_RESEND_WINDOW frames until the host acknowledges
+ * them and sends them again after LORALINK_API_RETX_TIME without an Ack or when the host
+ * sets LORALINK_API_WINDOW_RESEND. The host acknowledges each frame, discards a frame out
+ * of sequence and asks for a resend. LORALINK_API_WINDOW_BASE in the Window of a modem frame marks the
+ * oldest frame the modem keeps: a gap before it holds frames the modem gave up after
+ * LORALINK_API_MAX_RETRY or when newer frames needed the room.
+ *
+ * LORALINK_API_MODE_RTSCTS needs UART1_RTS and UART1_CTS in device-config.h, the boards
+ * of this repository leave them out and the modem rejects the flag.
+ */
+#define LORALINK_API_WINDOW          4       // Host frames queued in the modem
+#define LORALINK_API_RESEND_WINDOW   8       // Modem frames kept until acknowledged, a power of 2
+#define LORALINK_API_RETX_TIME       100     // ms without an Ack before the modem goes back
+#define LORALINK_API_MAX_RETRY       10
+#define LORALINK_API_WINDOW_BASE     0x80    // Modem frame, the oldest one kept
+#define LORALINK_API_WINDOW_RESEND   0x40    // Host frame, go back to Ack
+#define LORALINK_API_SEQ_HDR_LEN     3       // Seq Ack Window
+#define LORALINK_API_CRC_LEN         2
+#define LORALINK_API_MODE_REQ_LEN    5
+#define LORALINK_API_MODE_RSP_LEN    6
+#define LORALINK_API_MODE_RTSCTS     0x01
+#define LORALINK_API_MODE_SEQUENCED  0x02
+#define LORALINK_API_MIN_BAUDRATE    9600
+#define LORALINK_API_MAX_BAUDRATE    921600
+#define LORALINK_API_TX_WAIT         100     // ms the UART Tx FIFO may stay full before a frame to the host is dropped
+
+/*!
+ * Queued transmission
+ *
+ * API_REQ_QUEUE_TX  FrameId(1) Priority(1) Lifetime(2) PayloadType(1) Payload
+ *
+ * Lifetime is in LORALINK_API_LIFETIME_UNIT ms, 0 for no deadline. The modem sends
+ * the frame with the highest priority first, the oldest of them, and drops the frames
+ * whose lifetime has passed with API_RSP_TOT. API_RSP_ACK, API_RSP_NFC and
+ * API_RSP_TOT carry the FrameId, frames sent without API_REQ_QUEUE_TX get empty responses.
+ */
+#define LORALINK_API_QUEUE_HDR_LEN   5
+#define LORALINK_API_LIFETIME_UNIT   100
+
+/*!
+ * Extended Rx frame
+ *
+ * API_REQ_RX_FORMAT  Version(1), 0 for the plain Rx frame
+ * API_RSP_RX_FORMAT  Version(1) in use
+ * API_RSP_UTC        Seconds(4) SubSeconds(2), UTC of the host
+ *
+ * With version 1 a received message comes as API_RX_EXT instead of its own PayloadType:
+ *
+ * Version(1) MetaLen(1) Counter(4) Timestamp(4) UtcSeconds(4) UtcSubSeconds(2)
+ * Frequency(4) SF(1) Bandwidth(1) Fei(4) PanId(2) DestAddr(1) Flags(1) PayloadType(1) Payload
+ *
+ * MetaLen counts the bytes from Counter to Flags, later versions append fields there.
+ * Counter is the modem reception count, Timestamp the modem time of RxDone in ms,
+ * UtcSeconds 0 until the host sent API_RSP_UTC. Bandwidth 0: 125 kHz, 1: 250 kHz,
+ * 2: 500 kHz and Fei is the frequency error of the frame in Hz.
+ * Flags came after the first release, a host reading up to DestAddr skips it.
+ * SrcAddr, Rssi and Snr stay in the API frame header.
+ */
+#define LORALINK_API_RX_FORMAT_PLAIN 0
+#define LORALINK_API_RX_FORMAT_EXT   1
+#define LORALINK_API_RX_META_LEN     28
+#define LORALINK_API_RX_EXT_LEN      ( 2 + LORALINK_API_RX_META_LEN + 1 )  // Version MetaLen Meta PayloadType
+#define LORALINK_API_UTC_LEN         6
+#define LORALINK_API_RX_FLAG_DUPLICATE  0x01    // same source and MIC within the duplicate window
+
+/*!
+ * Duplicate filter, see LoRaLinkSetDupFilter()
+ *
+ * API_REQ_DUP_FILTER  Mode(1) Window(4)
+ * API_RSP_DUP_FILTER  Mode(1) Window(4) in use
+ *
+ * Mode 0: off, 1: drop, 2: flag with LORALINK_API_RX_FLAG_DUPLICATE. Window is in ms,
+ * 0 for LORALINK_DUP_WINDOW. An unknown mode keeps the filter and only reads it.
+ */
+#define LORALINK_API_DUP_LEN         5
+
+/*!
+ * FEC parity group of a destination of the TX modem, see LoRaLinkSetFec()
+ *
+ * API_REQ_FEC  DestAddr(1) Group(1)
+ * API_RSP_FEC  DestAddr(1) Group(1) in use
+ *
+ * DestAddr 0xFF sets the group of the destinations without their own. Group 0 turns
+ * FEC off, a group above LORALINK_FRAG_MAX_COUNT only reads it. The group in use stays
+ * when no more destinations can have their own.
+ */
+#define LORALINK_API_FEC_LEN         2
+
 
 typedef struct
 {
@@ -23,15 +126,47 @@ typedef struct
 	uint8_t checksum;
 } LoRaLinkApiReadParameters_t;
 
+typedef struct
+{
+	LoRaLinkApi_t Api;
+	uint8_t Order;       // arrival, oldest first within a priority
+	bool Used;
+} LoRaLinkApiTxEntry_t;
+
+typedef struct
+{
+	uint8_t Body[6 + LORALINK_API_RX_EXT_LEN + LORA_PHY_MAXPAYLOAD];
+	uint16_t Len;
+} LoRaLinkApiResendEntry_t;
+
+typedef struct
+{
+	bool Sequenced;
+	uint8_t TxSeq;       // next frame to the host
+	uint8_t TxBase;      // oldest frame not acknowledged by the host
+	bool Recovering;     // went back once for this TxBase
+	uint8_t Retry;
+	TimerTime_t TxTime;  // last progress or resend
+	uint8_t RxSeq;       // next frame expected from the host
+	uint8_t Window;      // advertised in the last frame
+	uint32_t Baudrate;   // to apply after the mode response
+	uint8_t Flags;
+} LoRaLinkApiLink_t;
+
 
 
 
 bool LoRaLinkApiRead(LoRaLinkApi_t* api, LoRaLinkApiReadParameters_t* para);
+void LoRaLinkApiPoll( void );
 void LoRaLinkApiSerializeData( LoRaLinkPacket_t* pkt );
 void LoRaLinkApiGetRxData( LoRaLinkPacket_t* pkt, RxDoneParams_t* rxDonePara );
 
-void LoRaLinkApiSetTxData( LoRaLinkPacket_t* pkt, LoRaLinkApi_t* LoRaLinkApi );
+LoRaLinkStatus_t LoRaLinkApiSetTxData( LoRaLinkPacket_t* pkt, LoRaLinkApi_t* LoRaLinkApi );
 void LoRaLinkApiWrite( LoRaLinkPacket_t* pkt );
+void LoRaLinkApiWriteRx( LoRaLinkPacket_t* pkt, LoRaLinkRxMeta_t* meta );
+void LoRaLinkApiWriteResp( LoRaLinkPayloadType_t type, LoRaLinkApi_t* api );
+bool LoRaLinkApiIsExpired( LoRaLinkApi_t* api );
+bool LoRaLinkApiGetSubMessage( LoRaLinkPacket_t* pkt, uint8_t* offset, LoRaLinkPacket_t* sub );
 
 void LoRaLinkApiPutRecvData(LoRaLinkPacket_t* pkt);
 void LoRaLinkApiPutSendResp(LoRaLinkPacket_t* pkt);
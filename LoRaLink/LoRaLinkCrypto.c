@@ -22,10 +22,6 @@
  * Maximum size of the message that can be handled by the crypto operations
  */
 #define CRYPTO_MAXMESSAGE_SIZE          256
-/*
- * Maximum size of the buffer for crypto operations
- */
-#define CRYPTO_BUFFER_SIZE              CRYPTO_MAXMESSAGE_SIZE + MIC_BLOCK_BX_SIZE
 
 /*
  * Secure Element Non Volatile Context structure
@@ -33,11 +29,8 @@
 typedef struct sSecureElementNvCtx
 {
     /*
-     * AES computation context variable
-     */
-    aes_context AesContext;
-    /*
-     * CMAC computation context variable
+     * CMAC computation context variable.
+     * Its expanded key is also used for the payload encryption.
      */
     AES_CMAC_CTX AesCmacCtx[1];
     /*
@@ -55,31 +48,31 @@ static LoRaLinkCryptoStatus_t ComputeCmacB0( uint8_t* msg, uint16_t len, Key_t*
 static LoRaLinkCryptoStatus_t VerifyCmacB0( uint8_t* msg, uint16_t len, Key_t* key, uint16_t panId, uint8_t destAddr, uint8_t srcAddr, uint8_t plType, uint32_t cmac );
 static LoRaLinkCryptoStatus_t PayloadEncrypt( uint8_t* buffer, int16_t size, Key_t* key, uint16_t panId, uint8_t destAddr, uint8_t srcAddr, uint8_t plType );
 static SecureElementStatus_t SecureElementComputeAesCmac( uint8_t *micBxBuffer, uint8_t *buffer, uint16_t size, Key_t* key, uint32_t* cmac );
-static SecureElementStatus_t SecureElementVerifyAesCmac( uint8_t* buffer, uint16_t size, uint32_t expectedCmac, Key_t* keyID );
+static SecureElementStatus_t SecureElementVerifyAesCmac( uint8_t *micBxBuffer, uint8_t* buffer, uint16_t size, uint32_t expectedCmac, Key_t* keyID );
 
 void LoRaLinkCryptoSetKey(uint8_t* key)
 {
 	memcpy1(SeCtx.Key.KeyValue, key, MIC_BLOCK_BX_SIZE);
+
+	// Expand the key and derive the CMAC subkeys once for all messages
+	AES_CMAC_Init( SeCtx.AesCmacCtx );
+	AES_CMAC_SetKey( SeCtx.AesCmacCtx, SeCtx.Key.KeyValue );
 }
 
 LoRaLinkCryptoStatus_t LoRaLinkCryptoSecureMessage(LoRaLinkPacket_t* packet)
 {
-    if( packet == NULL )
+    if( packet == NULL || packet->Buffer == NULL )
     {
         return LORALINK_CRYPTO_ERROR_NPE;
     }
 
+    // The message is already serialized in packet->Buffer and FRMPayload points into it.
+    // Encrypt the payload and append the MIC in place.
     if ( PayloadEncrypt( packet->FRMPayload, packet->FRMPayloadSize, &SeCtx.Key, packet->PanId, packet->DestAddr, packet->SourceAddr, packet->FRMPayloadType ) != LORALINK_CRYPTO_SUCCESS )
 	{
 		return LORALINK_CRYPTO_ERROR;
 	}
 
-    // Serialize message
-    if( LoRaLinkSerializeData( packet ) != LORALINK_STATUS_OK )
-    {
-        return LORALINK_CRYPTO_ERROR_SERIALIZER;
-    }
-
     LoRaLinkCryptoStatus_t retval = ComputeCmacB0( packet->Buffer, ( packet->BufSize - LORALINK_MIC_LEN ), &SeCtx.Key,
     		                                       packet->PanId, packet->DestAddr, packet->SourceAddr, packet->FRMPayloadType, &packet->MIC );
 
@@ -88,11 +81,7 @@ LoRaLinkCryptoStatus_t LoRaLinkCryptoSecureMessage(LoRaLinkPacket_t* packet)
     	return retval;
     }
 
-    // Re-serialize message to add the MIC
-	if( LoRaLinkSerializeData( packet ) != LORALINK_STATUS_OK )
-	{
-		return LORALINK_CRYPTO_ERROR_SERIALIZER;
-	}
+    setUint32( packet->Buffer + packet->BufSize - LORALINK_MIC_LEN, packet->MIC );
 
 	return LORALINK_CRYPTO_SUCCESS;
 }
@@ -167,15 +156,12 @@ static SecureElementStatus_t SecureElementAesEncrypt( uint8_t* buffer, uint16_t
         return SECURE_ELEMENT_ERROR_BUF_SIZE;
     }
 
-    memset1( SeCtx.AesContext.ksch, '\0', 240 );
-
-    aes_set_key( key->KeyValue, 16, &SeCtx.AesContext );
-
+    // Key schedule is prepared by LoRaLinkCryptoSetKey()
     uint8_t block = 0;
 
     while( size != 0 )
     {
-        aes_encrypt( &buffer[block], &encBuffer[block], &SeCtx.AesContext );
+        aes_encrypt( &buffer[block], &encBuffer[block], &SeCtx.AesCmacCtx->rijndael );
         block = block + 16;
         size = size - 16;
     }
@@ -217,17 +203,14 @@ static LoRaLinkCryptoStatus_t VerifyCmacB0( uint8_t* msg, uint16_t len, Key_t* k
         return LORALINK_CRYPTO_ERROR_BUF_SIZE;
     }
 
-    uint8_t micBuff[CRYPTO_BUFFER_SIZE];
-    memset1( micBuff, 0, CRYPTO_BUFFER_SIZE );
+    uint8_t micBuff[MIC_BLOCK_BX_SIZE];
 
     // Initialize the first Block
     PrepareB0( len, panId, destAddr, srcAddr, plType, micBuff );
 
-    // Copy the given data to the mic computation buffer
-    memcpy1( ( micBuff + MIC_BLOCK_BX_SIZE ), msg, len );
-
+    // B0 and the received message are fed to the CMAC in turn, no staging copy
     SecureElementStatus_t retval = SECURE_ELEMENT_ERROR;
-    retval = SecureElementVerifyAesCmac( micBuff, ( len + MIC_BLOCK_BX_SIZE ), expectedCmac, &SeCtx.Key );
+    retval = SecureElementVerifyAesCmac( micBuff, msg, len, expectedCmac, &SeCtx.Key );
 
     if( retval == SECURE_ELEMENT_SUCCESS )
     {
@@ -297,9 +280,8 @@ static SecureElementStatus_t ComputeCmac( uint8_t *micBxBuffer, uint8_t *buffer,
 
     uint8_t Cmac[16];
 
-    AES_CMAC_Init( SeCtx.AesCmacCtx );
-
-	AES_CMAC_SetKey( SeCtx.AesCmacCtx, key->KeyValue );
+    // Key schedule and subkeys are prepared by LoRaLinkCryptoSetKey()
+    AES_CMAC_Reset( SeCtx.AesCmacCtx );
 
 	if( micBxBuffer != 0 )
 	{
@@ -322,7 +304,7 @@ static SecureElementStatus_t SecureElementComputeAesCmac( uint8_t *micBxBuffer,
     return ComputeCmac( micBxBuffer, buffer, size, key, cmac );
 }
 
-static SecureElementStatus_t SecureElementVerifyAesCmac( uint8_t* buffer, uint16_t size, uint32_t expectedCmac, Key_t* keyID )
+static SecureElementStatus_t SecureElementVerifyAesCmac( uint8_t *micBxBuffer, uint8_t* buffer, uint16_t size, uint32_t expectedCmac, Key_t* keyID )
 {
     if( buffer == NULL )
     {
@@ -331,13 +313,19 @@ static SecureElementStatus_t SecureElementVerifyAesCmac( uint8_t* buffer, uint16
 
     SecureElementStatus_t retval = SECURE_ELEMENT_ERROR;
     uint32_t compCmac = 0;
-    retval = ComputeCmac( NULL, buffer, size, keyID, &compCmac );
+    uint8_t diff = 0;
+    retval = ComputeCmac( micBxBuffer, buffer, size, keyID, &compCmac );
     if( retval != SECURE_ELEMENT_SUCCESS )
     {
         return retval;
     }
 
-    if( expectedCmac != compCmac )
+    // Every byte is compared without an early exit, the time taken does not depend on where it differs
+    for( uint8_t i = 0; i < 4; i++ )
+    {
+        diff |= ( uint8_t )( ( expectedCmac >> ( 8 * i ) ) ^ ( compCmac >> ( 8 * i ) ) );
+    }
+    if( diff != 0 )
     {
         retval = SECURE_ELEMENT_FAIL_CMAC;
     }
@@ -113,6 +113,10 @@ typedef struct
     uint8_t KeyValue[KEY_SIZE];
 } Key_t;
 
+/*!
+ * Encrypt the payload and append the MIC in place.
+ * packet->Buffer must hold the serialized message and packet->FRMPayload must point into it.
+ */
 LoRaLinkCryptoStatus_t LoRaLinkCryptoSecureMessage(LoRaLinkPacket_t* packet);
 LoRaLinkCryptoStatus_t LoRaLinkCryptoUnsecureMessage( LoRaLinkPacket_t* packet );
 void LoRaLinkCryptoSetKey( uint8_t* key );
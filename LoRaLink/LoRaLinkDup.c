@@ -0,0 +1,122 @@
+/**************************************************************************************
+ *
+ * LoRaLinkDup.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include "LoRaLinkDup.h"
+#include "LoRaLinkStats.h"
+#include "utilities.h"
+
+/*
+ * A frame sent again unchanged has the same MIC, the link has no counter: REGISTER,
+ * SUBSCRIBE, PUBREL and PINGREQ retries or a frame heard twice. PUBLISH retries set
+ * DUP and are not matched. A frame is remembered from its first reception only,
+ * the same message sent again after the window is delivered.
+ */
+typedef struct
+{
+	uint32_t Mic;
+	TimerTime_t RxTime;
+	uint8_t SrcAddr;
+	bool Used;
+} LoRaLinkDupEntry_t;
+
+static struct
+{
+	LoRaLinkDupEntry_t Entries[LORALINK_DUP_ENTRIES];
+	LoRaLinkDupMode_t Mode;
+	uint32_t Window;
+} DupCtx;
+
+static bool IsFiltered( LoRaLinkPacket_t* pkt );
+
+
+void LoRaLinkDupInit( LoRaLinkDupMode_t mode, uint32_t window )
+{
+	memset1( (uint8_t*)DupCtx.Entries, 0, sizeof(DupCtx.Entries) );
+	DupCtx.Mode = mode;
+	DupCtx.Window = window;
+}
+
+void LoRaLinkDupGet( LoRaLinkDupMode_t* mode, uint32_t* window )
+{
+	*mode = DupCtx.Mode;
+	*window = DupCtx.Window;
+}
+
+LoRaLinkDupResult_t LoRaLinkDupCheck( LoRaLinkPacket_t* pkt, TimerTime_t rxTime )
+{
+	LoRaLinkDupEntry_t* entry = NULL;
+
+	if ( IsFiltered( pkt ) == false )
+	{
+		return LORALINK_DUP_NEW;
+	}
+
+	for ( uint8_t i = 0; i < LORALINK_DUP_ENTRIES; i++ )
+	{
+		entry = &DupCtx.Entries[i];
+		if ( entry->Used == true && entry->Mic == pkt->MIC && entry->SrcAddr == pkt->SourceAddr &&
+		     rxTime - entry->RxTime < DupCtx.Window )
+		{
+			LoRaLinkStatsCount( LORALINK_STATS_RX_DUP_HIT );
+			return ( DupCtx.Mode == LORALINK_DUP_DROP ) ? LORALINK_DUP_DROPPED : LORALINK_DUP_FLAGGED;
+		}
+	}
+	return LORALINK_DUP_NEW;
+}
+
+void LoRaLinkDupAdd( LoRaLinkPacket_t* pkt, TimerTime_t rxTime )
+{
+	LoRaLinkDupEntry_t* entry = &DupCtx.Entries[0];
+
+	if ( IsFiltered( pkt ) == false )
+	{
+		return;
+	}
+
+	for ( uint8_t i = 0; i < LORALINK_DUP_ENTRIES; i++ )
+	{
+		if ( DupCtx.Entries[i].Used == false )
+		{
+			entry = &DupCtx.Entries[i];
+			break;
+		}
+		if ( DupCtx.Entries[i].RxTime - entry->RxTime > 0x7FFFFFFF )
+		{
+			// Older than the entry found so far
+			entry = &DupCtx.Entries[i];
+		}
+	}
+
+	entry->Mic = pkt->MIC;
+	entry->SrcAddr = pkt->SourceAddr;
+	entry->RxTime = rxTime;
+	entry->Used = true;
+	LoRaLinkStatsCount( LORALINK_STATS_RX_DUP_MISS );
+}
+
+/*
+ * Fragments and link commands are handled by the link itself
+ */
+static bool IsFiltered( LoRaLinkPacket_t* pkt )
+{
+	if ( DupCtx.Mode == LORALINK_DUP_OFF )
+	{
+		return false;
+	}
+	switch ( pkt->FRMPayloadType )
+	{
+	case LINK_FRAGMENT:
+	case LINK_FRAGMENT_NACK:
+	case LINK_FRAGMENT_FEC:
+	case LINK_ADR_CMD:
+		return false;
+	default:
+		return true;
+	}
+}
@@ -0,0 +1,69 @@
+/**************************************************************************************
+ *
+ * LoRaLinkDup.h
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef LORALINKDUP_H_
+#define LORALINKDUP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "LoRaLinkTypes.h"
+
+/*!
+ * Number of frames remembered
+ */
+#define LORALINK_DUP_ENTRIES          16
+
+/*!
+ * Time a frame is remembered in ms, covers the MQTT-SN retries
+ * ( MQTTSN_TIMEOUT_MS x MQTTSN_RETRY_COUNT )
+ */
+#define LORALINK_DUP_WINDOW           40000
+
+/*!
+ * Result of LoRaLinkDupCheck()
+ */
+typedef enum
+{
+	LORALINK_DUP_NEW,        // not seen, or not filtered
+	LORALINK_DUP_DROPPED,    // seen within the window, to be dropped
+	LORALINK_DUP_FLAGGED,    // seen within the window, to be delivered flagged
+} LoRaLinkDupResult_t;
+
+/*!
+ * Forget all frames and set the filter
+ *
+ * \param [IN] mode    LORALINK_DUP_OFF, LORALINK_DUP_DROP or LORALINK_DUP_FLAG
+ * \param [IN] window  Time a frame is remembered in ms
+ */
+void LoRaLinkDupInit( LoRaLinkDupMode_t mode, uint32_t window );
+/*!
+ * Get the filter in use
+ *
+ * \param [OUT] mode    LORALINK_DUP_OFF, LORALINK_DUP_DROP or LORALINK_DUP_FLAG
+ * \param [OUT] window  Time a frame is remembered in ms
+ */
+void LoRaLinkDupGet( LoRaLinkDupMode_t* mode, uint32_t* window );
+/*!
+ * Look up a received frame by its source address and MIC.
+ * The frame is not verified yet, nothing is remembered.
+ *
+ * \param [IN] pkt     Received packet
+ * \param [IN] rxTime  RxDone time
+ * \retval value  LoRaLinkDupResult
+ */
+LoRaLinkDupResult_t LoRaLinkDupCheck( LoRaLinkPacket_t* pkt, TimerTime_t rxTime );
+/*!
+ * Remember a new frame whose MIC is verified, the oldest one is forgotten
+ *
+ * \param [IN] pkt     Received packet
+ * \param [IN] rxTime  RxDone time
+ */
+void LoRaLinkDupAdd( LoRaLinkPacket_t* pkt, TimerTime_t rxTime );
+
+#endif /* LORALINKDUP_H_ */
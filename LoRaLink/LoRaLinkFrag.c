@@ -0,0 +1,418 @@
+/**************************************************************************************
+ *
+ * LoRaLinkFrag.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "LoRaLinkFrag.h"
+#include "utilities.h"
+
+static LoRaLinkFragTx_t FragTx;
+static LoRaLinkFragRx_t FragRx[LORALINK_FRAG_SOURCES];
+static bool FragNackEnabled = false;
+
+static LoRaLinkFragRx_t* GetFragRx( uint8_t srcAddr, uint8_t seq );
+static uint32_t AllFragments( uint8_t count );
+static uint32_t GroupMask( uint8_t group, uint8_t groupSize, uint8_t count );
+static uint8_t FragmentSize( uint8_t idx, uint8_t fragLen, uint16_t len );
+static void XorBlock( uint8_t* dst, uint8_t* src, uint8_t len );
+static void Recover( LoRaLinkFragRx_t* rx, uint8_t group );
+
+
+void LoRaLinkFragInit( bool nack )
+{
+	memset1( (uint8_t*)&FragTx, 0, sizeof(FragTx) );
+	memset1( (uint8_t*)FragRx, 0, sizeof(FragRx) );
+	FragNackEnabled = nack;
+}
+
+LoRaLinkStatus_t LoRaLinkFragStart( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint8_t maxPayload, uint8_t group )
+{
+	uint16_t len = buffLen + 1;
+	uint8_t fragLen = 0;
+	uint8_t count = 0;
+
+	if ( group > 0 )
+	{
+		// Parity fragments carry LastLen(1) after the data
+		if ( maxPayload > LORALINK_FRAG_FEC_HDR_LEN + 1 )
+		{
+			fragLen = maxPayload - LORALINK_FRAG_FEC_HDR_LEN - 1;
+			count = ( len + fragLen - 1 ) / fragLen;
+		}
+		if ( count == 0 || count > LORALINK_FRAG_MAX_COUNT || ( ( count + group - 1 ) / group ) * fragLen > LORALINK_FRAG_BUF_LEN )
+		{
+			group = 0;
+		}
+	}
+
+	if ( group == 0 )
+	{
+		if ( maxPayload <= LORALINK_FRAG_HDR_LEN )
+		{
+			return LORALINK_STATUS_LENGTH_ERROR;
+		}
+		fragLen = maxPayload - LORALINK_FRAG_HDR_LEN;
+		count = ( len + fragLen - 1 ) / fragLen;
+		if ( count > LORALINK_FRAG_MAX_COUNT )
+		{
+			return LORALINK_STATUS_LENGTH_ERROR;
+		}
+	}
+
+	// buffer can be the Tx payload buffer, which is overwritten by the fragments
+	FragTx.Buffer[0] = payloadType;
+	memcpy1( FragTx.Buffer + 1, buffer, buffLen );
+	FragTx.Len = len;
+	FragTx.DestAddr = destAddr;
+	FragTx.Seq++;
+	FragTx.FragLen = fragLen;
+	FragTx.Count = count;
+	FragTx.Group = group;
+	FragTx.Pending = AllFragments( count );
+	FragTx.ParityPending = ( group > 0 ) ? AllFragments( ( count + group - 1 ) / group ) : 0;
+	return LORALINK_STATUS_OK;
+}
+
+uint8_t LoRaLinkFragNext( uint8_t* payload, uint8_t* destAddr, uint8_t* payloadType )
+{
+	uint8_t groupSize = ( FragTx.Group > 0 ) ? FragTx.Group : FragTx.Count;
+	uint8_t hdrLen = ( FragTx.Group > 0 ) ? LORALINK_FRAG_FEC_HDR_LEN : LORALINK_FRAG_HDR_LEN;
+	uint32_t mask = 0;
+	uint8_t idx = 0;
+	uint8_t len = 0;
+
+	if ( FragTx.Pending == 0 && FragTx.ParityPending == 0 )
+	{
+		return 0;
+	}
+
+	payload[0] = FragTx.Seq;
+	payload[2] = FragTx.Count;
+	payload[3] = FragTx.FragLen;
+	payload[4] = FragTx.Group;
+	*destAddr = FragTx.DestAddr;
+	*payloadType = ( FragTx.Group > 0 ) ? LINK_FRAGMENT_FEC : LINK_FRAGMENT;
+
+	// Each group is followed by its parity
+	for ( uint8_t g = 0; g * groupSize < FragTx.Count; g++ )
+	{
+		mask = GroupMask( g, groupSize, FragTx.Count );
+
+		if ( ( FragTx.Pending & mask ) != 0 )
+		{
+			while ( ( FragTx.Pending & mask & ( 1UL << idx ) ) == 0 )
+			{
+				idx++;
+			}
+			FragTx.Pending &= ~( 1UL << idx );
+
+			len = FragmentSize( idx, FragTx.FragLen, FragTx.Len );
+			payload[1] = idx;
+			memcpy1( payload + hdrLen, FragTx.Buffer + idx * FragTx.FragLen, len );
+			return len + hdrLen;
+		}
+
+		if ( ( FragTx.ParityPending & ( 1UL << g ) ) != 0 )
+		{
+			FragTx.ParityPending &= ~( 1UL << g );
+
+			payload[1] = LORALINK_FRAG_PARITY | g;
+			memset1( payload + hdrLen, 0, FragTx.FragLen );
+			for ( idx = g * groupSize; idx < FragTx.Count && ( mask & ( 1UL << idx ) ) != 0; idx++ )
+			{
+				XorBlock( payload + hdrLen, FragTx.Buffer + idx * FragTx.FragLen, FragmentSize( idx, FragTx.FragLen, FragTx.Len ) );
+			}
+			payload[hdrLen + FragTx.FragLen] = FragmentSize( FragTx.Count - 1, FragTx.FragLen, FragTx.Len );
+			return hdrLen + FragTx.FragLen + 1;
+		}
+	}
+	return 0;
+}
+
+bool LoRaLinkFragPending( void )
+{
+	return FragTx.Pending != 0 || FragTx.ParityPending != 0;
+}
+
+void LoRaLinkFragStop( void )
+{
+	// A late NACK finds no fragment to send again
+	FragTx.Count = 0;
+	FragTx.Pending = 0;
+	FragTx.ParityPending = 0;
+}
+
+void LoRaLinkFragNack( uint8_t srcAddr, uint8_t* payload, uint8_t len )
+{
+	if ( len < LORALINK_FRAG_NACK_LEN || srcAddr != FragTx.DestAddr || payload[0] != FragTx.Seq )
+	{
+		return;
+	}
+	// Missing fragments are sent again without parity
+	FragTx.Pending |= getUint32( payload + 1 ) & AllFragments( FragTx.Count );
+}
+
+LoRaLinkFragRx_t* LoRaLinkFragAdd( uint8_t srcAddr, uint8_t payloadType, uint8_t* payload, uint8_t len )
+{
+	LoRaLinkFragRx_t* rx = NULL;
+	bool fec = ( payloadType == LINK_FRAGMENT_FEC );
+	uint8_t hdrLen = fec ? LORALINK_FRAG_FEC_HDR_LEN : LORALINK_FRAG_HDR_LEN;
+	uint8_t seq = payload[0];
+	uint8_t idx = payload[1];
+	uint8_t count = payload[2];
+	uint8_t fragLen = payload[3];
+	uint8_t group = 0;
+	uint8_t groupSize = count;
+	uint8_t* data = payload + hdrLen;
+	uint8_t dataLen = len - hdrLen;
+	bool parity = false;
+	bool last = false;
+
+	if ( len <= hdrLen || count == 0 || count > LORALINK_FRAG_MAX_COUNT || fragLen == 0 )
+	{
+		return NULL;
+	}
+
+	if ( fec == true )
+	{
+		group = payload[4];
+		groupSize = group;
+		parity = ( idx & LORALINK_FRAG_PARITY ) != 0;
+		idx &= ~LORALINK_FRAG_PARITY;
+		if ( group == 0 || ( ( count + group - 1 ) / group ) * fragLen > LORALINK_FRAG_BUF_LEN )
+		{
+			return NULL;
+		}
+	}
+
+	if ( parity == true )
+	{
+		if ( idx * groupSize >= count || dataLen != fragLen + 1 || data[fragLen] == 0 || data[fragLen] > fragLen )
+		{
+			return NULL;
+		}
+		last = ( ( idx + 1 ) * groupSize >= count );
+	}
+	else
+	{
+		if ( idx >= count || dataLen > fragLen || ( idx < count - 1 && dataLen != fragLen ) || idx * fragLen + dataLen > LORALINK_FRAG_BUF_LEN )
+		{
+			return NULL;
+		}
+		// With FEC the parity of the last group comes last
+		last = ( idx == count - 1 ) && ( fec == false );
+	}
+
+	rx = GetFragRx( srcAddr, seq );
+	if ( rx->Used == true && rx->Done == true )
+	{
+		return NULL;
+	}
+	if ( rx->Used == false )
+	{
+		// Zero padding of the last fragment is part of the parity
+		memset1( rx->Buffer, 0, LORALINK_FRAG_BUF_LEN );
+		rx->Used = true;
+		rx->Done = false;
+		rx->SourceAddr = srcAddr;
+		rx->Seq = seq;
+		rx->Count = count;
+		rx->FragLen = fragLen;
+		rx->Group = group;
+		rx->Len = 0;
+		rx->LastLen = 0;
+		rx->Received = 0;
+		rx->ParityReceived = 0;
+		rx->NackCnt = 0;
+		rx->NackDue = false;
+	}
+	else if ( rx->Count != count || rx->FragLen != fragLen || rx->Group != group )
+	{
+		return NULL;
+	}
+
+	rx->LastRxTime = TimerGetCurrentTime();
+	if ( parity == true )
+	{
+		memcpy1( rx->Parity + idx * fragLen, data, fragLen );
+		rx->ParityReceived |= 1UL << idx;
+		rx->LastLen = data[fragLen];
+		Recover( rx, idx );
+	}
+	else if ( ( rx->Received & ( 1UL << idx ) ) == 0 )
+	{
+		memcpy1( rx->Buffer + idx * fragLen, data, dataLen );
+		rx->Received |= 1UL << idx;
+		if ( idx == count - 1 )
+		{
+			rx->Len = idx * fragLen + dataLen;
+		}
+		if ( fec == true )
+		{
+			Recover( rx, idx / group );
+		}
+	}
+
+	if ( rx->Received == AllFragments( count ) )
+	{
+		if ( rx->Len == 0 )
+		{
+			// Last fragment was rebuilt from the parity
+			rx->Len = ( count - 1 ) * fragLen + rx->LastLen;
+		}
+		// Buffer stays intact until the next fragment is added
+		rx->Done = true;
+		return rx;
+	}
+	if ( last == true )
+	{
+		rx->NackDue = true;
+	}
+	return NULL;
+}
+
+bool LoRaLinkFragGetNack( uint8_t* payload, uint8_t* destAddr )
+{
+	for ( uint8_t i = 0; i < LORALINK_FRAG_SOURCES; i++ )
+	{
+		LoRaLinkFragRx_t* rx = &FragRx[i];
+
+		if ( rx->Used == false || rx->Done == true )
+		{
+			continue;
+		}
+
+		if ( rx->NackDue == false && TimerGetElapsedTime( rx->LastRxTime ) < LORALINK_FRAG_NACK_DELAY )
+		{
+			continue;
+		}
+
+		if ( FragNackEnabled == false || rx->NackCnt >= LORALINK_FRAG_MAX_NACK )
+		{
+			if ( TimerGetElapsedTime( rx->LastRxTime ) >= LORALINK_FRAG_NACK_DELAY )
+			{
+				// Stale, the sender has given up
+				rx->Used = false;
+			}
+			rx->NackDue = false;
+			continue;
+		}
+
+		rx->NackCnt++;
+		rx->NackDue = false;
+		rx->LastRxTime = TimerGetCurrentTime();
+
+		payload[0] = rx->Seq;
+		setUint32( payload + 1, ~rx->Received & AllFragments( rx->Count ) );
+		*destAddr = rx->SourceAddr;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Entry of the message, a new or the least recently used one if not found
+ */
+static LoRaLinkFragRx_t* GetFragRx( uint8_t srcAddr, uint8_t seq )
+{
+	LoRaLinkFragRx_t* rx = NULL;
+
+	for ( uint8_t i = 0; i < LORALINK_FRAG_SOURCES; i++ )
+	{
+		if ( FragRx[i].Used == true && FragRx[i].SourceAddr == srcAddr )
+		{
+			if ( FragRx[i].Seq == seq )
+			{
+				return &FragRx[i];
+			}
+			// New message from the source, the old one is dropped
+			FragRx[i].Used = false;
+			return &FragRx[i];
+		}
+	}
+
+	for ( uint8_t i = 0; i < LORALINK_FRAG_SOURCES; i++ )
+	{
+		if ( FragRx[i].Used == false || FragRx[i].Done == true )
+		{
+			FragRx[i].Used = false;
+			return &FragRx[i];
+		}
+		if ( rx == NULL || (int32_t)( FragRx[i].LastRxTime - rx->LastRxTime ) < 0 )
+		{
+			rx = &FragRx[i];
+		}
+	}
+	rx->Used = false;
+	return rx;
+}
+
+static uint32_t AllFragments( uint8_t count )
+{
+	return ( count >= 32 ) ? 0xFFFFFFFFUL : ( ( 1UL << count ) - 1 );
+}
+
+/*
+ * Fragments of a parity group
+ */
+static uint32_t GroupMask( uint8_t group, uint8_t groupSize, uint8_t count )
+{
+	uint8_t first = group * groupSize;
+	uint8_t last = MIN( first + groupSize, count );
+
+	return AllFragments( last ) & ~AllFragments( first );
+}
+
+static uint8_t FragmentSize( uint8_t idx, uint8_t fragLen, uint16_t len )
+{
+	return MIN( fragLen, len - idx * fragLen );
+}
+
+static void XorBlock( uint8_t* dst, uint8_t* src, uint8_t len )
+{
+	while ( len-- > 0 )
+	{
+		*dst++ ^= *src++;
+	}
+}
+
+/*
+ * Rebuild the fragment lost in a group from the parity and the rest of the group
+ */
+static void Recover( LoRaLinkFragRx_t* rx, uint8_t group )
+{
+	uint32_t mask = GroupMask( group, rx->Group, rx->Count );
+	uint32_t missing = mask & ~rx->Received;
+	uint8_t* dst = NULL;
+	uint8_t size = 0;
+	uint8_t idx = 0;
+
+	if ( ( rx->ParityReceived & ( 1UL << group ) ) == 0 || missing == 0 || ( missing & ( missing - 1 ) ) != 0 )
+	{
+		return;
+	}
+
+	while ( ( missing & ( 1UL << idx ) ) == 0 )
+	{
+		idx++;
+	}
+
+	// Bytes beyond the buffer are padding of the last fragment
+	dst = rx->Buffer + idx * rx->FragLen;
+	size = MIN( rx->FragLen, LORALINK_FRAG_BUF_LEN - idx * rx->FragLen );
+	memcpy1( dst, rx->Parity + group * rx->FragLen, size );
+
+	for ( uint8_t i = group * rx->Group; i < rx->Count && ( mask & ( 1UL << i ) ) != 0; i++ )
+	{
+		if ( i != idx )
+		{
+			XorBlock( dst, rx->Buffer + i * rx->FragLen, MIN( size, LORALINK_FRAG_BUF_LEN - i * rx->FragLen ) );
+		}
+	}
+	rx->Received |= 1UL << idx;
+}
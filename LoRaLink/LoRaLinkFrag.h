@@ -0,0 +1,186 @@
+/**************************************************************************************
+ *
+ * LoRaLinkFrag.h
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef LORALINKFRAG_H_
+#define LORALINKFRAG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "LoRaLinkTypes.h"
+#include "timer.h"
+
+/*!
+ * LINK_FRAGMENT payload: Seq(1) Index(1) Count(1) FragLen(1) Data
+ * Data of all fragments is PayloadType(1) followed by the message.
+ */
+#define LORALINK_FRAG_HDR_LEN         4
+/*!
+ * LINK_FRAGMENT_FEC payload: Seq(1) Index(1) Count(1) FragLen(1) Group(1) Data
+ * A parity fragment has LORALINK_FRAG_PARITY in Index with the group number,
+ * its Data is the XOR of the fragments of the group followed by LastLen(1).
+ */
+#define LORALINK_FRAG_FEC_HDR_LEN     5
+#define LORALINK_FRAG_PARITY          0x80
+/*!
+ * LINK_FRAGMENT_NACK payload: Seq(1) Missing(4)
+ */
+#define LORALINK_FRAG_NACK_LEN        5
+/*!
+ * Max number of fragments of a message, one bit of the Missing bitmap each
+ */
+#define LORALINK_FRAG_MAX_COUNT       32
+/*!
+ * PayloadType(1) + message
+ */
+#define LORALINK_FRAG_BUF_LEN         ( LORA_PHY_MAXPAYLOAD + 1 )
+/*!
+ * Number of sources reassembled at once
+ */
+#define LORALINK_FRAG_SOURCES         2
+/*!
+ * Time without a fragment before the missing ones are requested in ms
+ */
+#define LORALINK_FRAG_NACK_DELAY      3000
+/*!
+ * Max number of LINK_FRAGMENT_NACK for a message
+ */
+#define LORALINK_FRAG_MAX_NACK        3
+
+/*!
+ * Message being sent in fragments
+ */
+typedef struct
+{
+	uint8_t Buffer[LORALINK_FRAG_BUF_LEN];
+	uint16_t Len;
+	uint8_t DestAddr;
+	uint8_t Seq;
+	uint8_t FragLen;
+	uint8_t Count;
+	/*!
+	 * Fragments of a parity group, 0 without FEC
+	 */
+	uint8_t Group;
+	/*!
+	 * Fragments to be sent
+	 */
+	uint32_t Pending;
+	/*!
+	 * Parity fragments to be sent
+	 */
+	uint32_t ParityPending;
+} LoRaLinkFragTx_t;
+
+/*!
+ * Message being reassembled
+ */
+typedef struct
+{
+	uint8_t Buffer[LORALINK_FRAG_BUF_LEN];
+	uint16_t Len;
+	uint8_t SourceAddr;
+	uint8_t Seq;
+	uint8_t FragLen;
+	uint8_t Count;
+	uint8_t Group;
+	/*!
+	 * Data length of the last fragment taken from a parity fragment
+	 */
+	uint8_t LastLen;
+	/*!
+	 * Fragments received
+	 */
+	uint32_t Received;
+	/*!
+	 * Parity fragments received
+	 */
+	uint32_t ParityReceived;
+	/*!
+	 * Parity of each group, FragLen bytes each
+	 */
+	uint8_t Parity[LORALINK_FRAG_BUF_LEN];
+	TimerTime_t LastRxTime;
+	uint8_t NackCnt;
+	/*!
+	 * Last fragment received while others are missing
+	 */
+	bool NackDue;
+	/*!
+	 * Reassembled, later copies of the fragments are ignored
+	 */
+	bool Done;
+	bool Used;
+} LoRaLinkFragRx_t;
+
+/*!
+ * Clear all messages
+ *
+ * \param [IN] nack  true: request missing fragments with LINK_FRAGMENT_NACK
+ */
+void LoRaLinkFragInit( bool nack );
+/*!
+ * Start sending a message in fragments
+ *
+ * \param [IN] destAddr     Destination address
+ * \param [IN] payloadType  Payload Type
+ * \param [IN] buffer       Payload data pointer
+ * \param [IN] buffLen      Payload length
+ * \param [IN] maxPayload   Max payload length of a frame
+ * \param [IN] group        Fragments of a parity group, 0: no parity.
+ *                          The message is sent without parity if the parity does not fit.
+ * \retval value    LoRaLinkStatus
+ */
+LoRaLinkStatus_t LoRaLinkFragStart( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint8_t maxPayload, uint8_t group );
+/*!
+ * Build the next fragment to be sent
+ *
+ * \param [OUT] payload      LINK_FRAGMENT or LINK_FRAGMENT_FEC payload
+ * \param [OUT] destAddr     Destination address
+ * \param [OUT] payloadType  LINK_FRAGMENT or LINK_FRAGMENT_FEC
+ * \retval value    Payload length, 0 if no fragment to be sent
+ */
+uint8_t LoRaLinkFragNext( uint8_t* payload, uint8_t* destAddr, uint8_t* payloadType );
+/*!
+ * Check if fragments are waiting to be sent
+ */
+bool LoRaLinkFragPending( void );
+/*!
+ * Give up the fragments not sent yet
+ */
+void LoRaLinkFragStop( void );
+/*!
+ * Apply a LINK_FRAGMENT_NACK, the missing fragments are sent again
+ *
+ * \param [IN] srcAddr  Address of the receiver
+ * \param [IN] payload  LINK_FRAGMENT_NACK payload
+ * \param [IN] len      Payload length
+ */
+void LoRaLinkFragNack( uint8_t srcAddr, uint8_t* payload, uint8_t len );
+/*!
+ * Add a received fragment
+ *
+ * A fragment lost in a parity group is rebuilt when the rest of the group and its parity are received.
+ *
+ * \param [IN] srcAddr      Source address
+ * \param [IN] payloadType  LINK_FRAGMENT or LINK_FRAGMENT_FEC
+ * \param [IN] payload      Fragment payload
+ * \param [IN] len          Payload length
+ * \retval value    Reassembled message, NULL if not completed
+ */
+LoRaLinkFragRx_t* LoRaLinkFragAdd( uint8_t srcAddr, uint8_t payloadType, uint8_t* payload, uint8_t len );
+/*!
+ * Drop the stale messages and build a LINK_FRAGMENT_NACK if fragments are missing
+ *
+ * \param [OUT] payload   LINK_FRAGMENT_NACK payload
+ * \param [OUT] destAddr  Source of the message
+ * \retval value    true if the LINK_FRAGMENT_NACK is to be sent
+ */
+bool LoRaLinkFragGetNack( uint8_t* payload, uint8_t* destAddr );
+
+#endif /* LORALINKFRAG_H_ */
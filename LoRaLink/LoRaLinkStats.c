@@ -0,0 +1,171 @@
+/**************************************************************************************
+ *
+ * LoRaLinkStats.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include "LoRaLinkStats.h"
+#include "timer.h"
+#include "utilities.h"
+
+LoRaLinkStats_t LoRaLinkStats = { 0 };
+
+static LoRaLinkStatsPeer_t* GetPeer( uint8_t addr, bool create );
+static uint8_t GetBin( int16_t value, int16_t floor, int16_t step );
+
+
+void LoRaLinkStatsReset( void )
+{
+	memset1( (uint8_t*)&LoRaLinkStats, 0, sizeof(LoRaLinkStats) );
+	LoRaLinkStats.ResetTime = TimerGetCurrentTime();
+}
+
+void LoRaLinkStatsAddPeer( uint8_t srcAddr, int16_t rssi, int8_t snr, bool micOk )
+{
+	LoRaLinkStatsPeer_t* peer = GetPeer( srcAddr, micOk );
+	uint16_t* bin = NULL;
+
+	if ( micOk == false )
+	{
+		// The address of a frame failing the MIC is not trusted, no entry is taken for it
+		if ( peer != NULL )
+		{
+			peer->MicErrors++;
+		}
+		return;
+	}
+
+	peer->Frames++;
+	peer->LastRssi = rssi;
+	peer->LastSnr = snr;
+
+	// Saturate instead of wrapping around
+	bin = &peer->RssiHist[GetBin( rssi, LORALINK_STATS_RSSI_FLOOR, LORALINK_STATS_RSSI_STEP )];
+	if ( *bin != UINT16_MAX )
+	{
+		( *bin )++;
+	}
+	bin = &peer->SnrHist[GetBin( snr, LORALINK_STATS_SNR_FLOOR, LORALINK_STATS_SNR_STEP )];
+	if ( *bin != UINT16_MAX )
+	{
+		( *bin )++;
+	}
+}
+
+uint16_t LoRaLinkStatsSerialize( uint8_t index, uint8_t* buf, uint16_t maxLen )
+{
+	LoRaLinkStatsPeer_t* peer = NULL;
+	uint8_t* pos = buf;
+	uint8_t numPeers = 0;
+
+	if ( maxLen < 2 )
+	{
+		return 0;
+	}
+	*pos++ = index;
+	*pos++ = LORALINK_STATS_VERSION;
+
+	if ( index == 0 )
+	{
+		if ( maxLen < 2 + 4 + 1 + LORALINK_STATS_COUNTERS * 4 + 1 )
+		{
+			return 0;
+		}
+		setUint32( pos, TimerGetElapsedTime( LoRaLinkStats.ResetTime ) );
+		pos += 4;
+		*pos++ = LORALINK_STATS_COUNTERS;
+		for ( uint8_t i = 0; i < LORALINK_STATS_COUNTERS; i++ )
+		{
+			setUint32( pos, LoRaLinkStats.Counters[i] );
+			pos += 4;
+		}
+		for ( uint8_t i = 0; i < LORALINK_STATS_PEERS; i++ )
+		{
+			if ( LoRaLinkStats.Peers[i].Addr != 0 )
+			{
+				numPeers++;
+			}
+		}
+		*pos++ = numPeers;
+		return pos - buf;
+	}
+
+	// Peers in use from the index-th
+	for ( uint8_t i = 0; i < LORALINK_STATS_PEERS; i++ )
+	{
+		peer = &LoRaLinkStats.Peers[i];
+		if ( peer->Addr == 0 || ++numPeers < index )
+		{
+			continue;
+		}
+		if ( ( pos - buf ) + LORALINK_STATS_PEER_LEN > maxLen )
+		{
+			break;
+		}
+		*pos++ = peer->Addr;
+		setUint32( pos, peer->Frames );
+		pos += 4;
+		setUint16( pos, peer->MicErrors );
+		pos += 2;
+		setUint16( pos, (uint16_t)peer->LastRssi );
+		pos += 2;
+		*pos++ = (uint8_t)peer->LastSnr;
+		for ( uint8_t j = 0; j < LORALINK_STATS_BINS; j++ )
+		{
+			setUint16( pos, peer->RssiHist[j] );
+			pos += 2;
+		}
+		for ( uint8_t j = 0; j < LORALINK_STATS_BINS; j++ )
+		{
+			setUint16( pos, peer->SnrHist[j] );
+			pos += 2;
+		}
+	}
+	return pos - buf;
+}
+
+/*
+ * Find or take an entry, a full table gives up the peer with the fewest frames
+ */
+static LoRaLinkStatsPeer_t* GetPeer( uint8_t addr, bool create )
+{
+	LoRaLinkStatsPeer_t* peer = &LoRaLinkStats.Peers[0];
+
+	for ( uint8_t i = 0; i < LORALINK_STATS_PEERS; i++ )
+	{
+		if ( LoRaLinkStats.Peers[i].Addr == addr )
+		{
+			return &LoRaLinkStats.Peers[i];
+		}
+		if ( peer->Addr != 0 && ( LoRaLinkStats.Peers[i].Addr == 0 || LoRaLinkStats.Peers[i].Frames < peer->Frames ) )
+		{
+			peer = &LoRaLinkStats.Peers[i];
+		}
+	}
+
+	if ( create == false )
+	{
+		return NULL;
+	}
+	memset1( (uint8_t*)peer, 0, sizeof(LoRaLinkStatsPeer_t) );
+	peer->Addr = addr;
+	return peer;
+}
+
+static uint8_t GetBin( int16_t value, int16_t floor, int16_t step )
+{
+	int16_t bin = ( value - floor ) / step;
+
+	if ( bin < 0 )
+	{
+		return 0;
+	}
+	if ( bin >= LORALINK_STATS_BINS )
+	{
+		return LORALINK_STATS_BINS - 1;
+	}
+	return bin;
+}
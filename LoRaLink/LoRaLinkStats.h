@@ -0,0 +1,138 @@
+/**************************************************************************************
+ *
+ * LoRaLinkStats.h
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef LORALINKSTATS_H_
+#define LORALINKSTATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "LoRaLinkTypes.h"
+
+/*!
+ * Number of source addresses with a histogram
+ */
+#define LORALINK_STATS_PEERS          8
+
+/*!
+ * Histogram bins, the first and the last bins take everything below and above
+ */
+#define LORALINK_STATS_BINS           8
+#define LORALINK_STATS_RSSI_FLOOR     -130    // dBm, bin 0 is below -120
+#define LORALINK_STATS_RSSI_STEP      10
+#define LORALINK_STATS_SNR_FLOOR      -20     // dB, bin 0 is below -16
+#define LORALINK_STATS_SNR_STEP       4
+
+/*!
+ * Statistics over the UART API
+ *
+ * API_REQ_STATS  Index(1) Flags(1)
+ * API_RSP_STATS  Index 0: Index(1) Version(1) Elapsed(4) NumCounters(1) Counters(4 each) NumPeers(1)
+ *                Index n: Index(1) Version(1) peers from the n-th, as many as fit:
+ *                         Addr(1) Frames(4) MicErrors(2) LastRssi(2) LastSnr(1)
+ *                         RssiHist(2 x LORALINK_STATS_BINS) SnrHist(2 x LORALINK_STATS_BINS)
+ *
+ * Elapsed is the time since the last reset in ms, Counters are in LoRaLinkStatsCounter_t order.
+ * LORALINK_STATS_FLAG_RESET clears the statistics after the response.
+ */
+#define LORALINK_STATS_VERSION        1
+#define LORALINK_STATS_REQ_LEN        2
+#define LORALINK_STATS_PEER_LEN       ( 10 + LORALINK_STATS_BINS * 4 )
+#define LORALINK_STATS_RSP_LEN        ( 2 + LORALINK_STATS_PEER_LEN * 4 )     // up to 4 peers a response
+#define LORALINK_STATS_FLAG_RESET     0x01
+
+/*!
+ * Link event counters
+ */
+typedef enum
+{
+	LORALINK_STATS_RX_FRAMES,       // accepted frames
+	LORALINK_STATS_RX_MIC_ERROR,    // MIC check failed
+	LORALINK_STATS_RX_WRONG_PAN,    // frame of another PAN
+	LORALINK_STATS_RX_OTHER_ADDR,   // frame to another device
+	LORALINK_STATS_RX_MALFORMED,    // shorter than header and MIC
+	LORALINK_STATS_RX_ERROR,        // radio RxError, CRC
+	LORALINK_STATS_RX_TIMEOUT,      // radio RxTimeout
+	LORALINK_STATS_TX_FRAMES,
+	LORALINK_STATS_TX_TIMEOUT,
+	LORALINK_STATS_TX_LBT_BUSY,     // channel found busy by carrier sense
+	LORALINK_STATS_TX_NO_FREE_CH,   // every channel of the plan busy, backed off
+	LORALINK_STATS_TX_AIRTIME,      // ms
+	LORALINK_STATS_RX_DUP_HIT,      // frame seen within the duplicate window
+	LORALINK_STATS_RX_DUP_MISS,     // new frame remembered by the duplicate filter
+	LORALINK_STATS_RX_CAD,          // CADs of the SF scan
+	LORALINK_STATS_RX_CAD_DETECTED, // CADs that found a preamble
+	LORALINK_STATS_API_RX_OVERRUN,  // host bytes overwritten in the UART Rx buffer before they were parsed
+	LORALINK_STATS_API_TX_DROPPED,  // frames to the host dropped after the UART Tx FIFO stayed full for LORALINK_API_TX_WAIT
+	LORALINK_STATS_API_TX_RESENT,   // frames to the host sent again in the sequenced mode
+	LORALINK_STATS_API_TX_GIVEN_UP, // frames to the host never acknowledged
+	LORALINK_STATS_COUNTERS
+} LoRaLinkStatsCounter_t;
+
+/*!
+ * Frames received from a source address
+ */
+typedef struct
+{
+	/*!
+	 * Source address, 0 if not used
+	 */
+	uint8_t Addr;
+	int8_t LastSnr;
+	int16_t LastRssi;
+	uint32_t Frames;
+	uint16_t MicErrors;
+	/*!
+	 * Number of accepted frames in each RSSI and SNR bin
+	 */
+	uint16_t RssiHist[LORALINK_STATS_BINS];
+	uint16_t SnrHist[LORALINK_STATS_BINS];
+} LoRaLinkStatsPeer_t;
+
+typedef struct
+{
+	TimerTime_t ResetTime;
+	uint32_t Counters[LORALINK_STATS_COUNTERS];
+	LoRaLinkStatsPeer_t Peers[LORALINK_STATS_PEERS];
+} LoRaLinkStats_t;
+
+/*!
+ * Updated in place by LoRaLinkStatsCount() and LoRaLinkStatsAdd()
+ */
+extern LoRaLinkStats_t LoRaLinkStats;
+
+/*!
+ * Count a link event
+ */
+#define LoRaLinkStatsCount( counter )          ( LoRaLinkStats.Counters[counter]++ )
+#define LoRaLinkStatsAdd( counter, value )     ( LoRaLinkStats.Counters[counter] += ( value ) )
+
+/*!
+ * Clear all counters and peers
+ */
+void LoRaLinkStatsReset( void );
+/*!
+ * Add a frame received from a source address
+ *
+ * \param [IN] srcAddr  Source address
+ * \param [IN] rssi     RSSI in dBm
+ * \param [IN] snr      SNR in dB
+ * \param [IN] micOk    false: only MicErrors is counted
+ */
+void LoRaLinkStatsAddPeer( uint8_t srcAddr, int16_t rssi, int8_t snr, bool micOk );
+/*!
+ * Serialize the statistics for API_RSP_STATS
+ *
+ * \param [IN]  index   0: counters, n: peers from the n-th
+ * \param [OUT] buf     Payload
+ * \param [IN]  maxLen  Size of buf
+ * \retval value  Payload length
+ */
+uint16_t LoRaLinkStatsSerialize( uint8_t index, uint8_t* buf, uint16_t maxLen );
+
+#endif /* LORALINKSTATS_H_ */
@@ -23,6 +23,11 @@
 typedef enum
 {
 	MQTT_SN        = 0x40,
+	LINK_AGGREGATE = 0x41,
+	LINK_FRAGMENT  = 0x42,
+	LINK_FRAGMENT_NACK = 0x43,
+	LINK_FRAGMENT_FEC = 0x44,
+	LINK_ADR_CMD   = 0x50,
 	API_RSP_ACK    = 0x80,
 	API_RSP_NFC    = 0x81,
 	API_RSP_TOT,
@@ -30,6 +35,18 @@ typedef enum
 	API_RSP_UTC,
 	API_CHG_TASK_PARAM,
 	API_REQ_RESET,
+	API_REQ_LINK_MODE = 0x87,
+	API_RSP_LINK_MODE,
+	API_REQ_QUEUE_TX,
+	API_REQ_RX_FORMAT,
+	API_RSP_RX_FORMAT,
+	API_RX_EXT,
+	API_REQ_STATS,
+	API_RSP_STATS,
+	API_REQ_DUP_FILTER,
+	API_RSP_DUP_FILTER,
+	API_REQ_FEC,
+	API_RSP_FEC,
 
 }LoRaLinkPayloadType_t;
 
@@ -42,6 +59,16 @@ typedef enum
 	LORALINK_UART_RX,
 }LoRaLinkUartType_t;
 
+/*!
+ * Duplicate frame filter
+ */
+typedef enum
+{
+	LORALINK_DUP_OFF,
+	LORALINK_DUP_DROP,
+	LORALINK_DUP_FLAG,    // delivered with LORALINK_API_RX_FLAG_DUPLICATE in the extended Rx frame
+}LoRaLinkDupMode_t;
+
 /*!
  * LoRaLink Spreading Factor
  */
@@ -64,6 +91,101 @@ typedef enum
 	DWELLTIME_1,
 } LoRaLinkDwelltime_t;
 
+/*!
+ * LoRaLink carrier sense method
+ */
+typedef enum
+{
+	/*!
+	 * RSSI in FSK mode for the whole carrier sense time
+	 */
+	LORALINK_CS_RSSI,
+	/*!
+	 * LoRa CAD followed by RSSI for the rest of the carrier sense time
+	 */
+	LORALINK_CS_CAD_RSSI,
+} LoRaLinkCarrierSenseMethod_t;
+
+/*!
+ * LoRaLink carrier sense parameters
+ */
+typedef struct
+{
+	/*!
+	 * Carrier sense method
+	 */
+	LoRaLinkCarrierSenseMethod_t Method;
+	/*!
+	 * Channel is busy above this RSSI in dBm
+	 */
+	int16_t RssiThresh;
+	/*!
+	 * Carrier sense time in ms
+	 */
+	uint32_t SenseTime;
+} LoRaLinkCarrierSense_t;
+
+/*!
+ * LoRaLink PHY profile, every device of a PAN has to use the same one
+ */
+typedef struct
+{
+	/*!
+	 * Preamble length in symbols, 6 or more
+	 */
+	uint16_t PreambleLen;
+	/*!
+	 * Payload CRC, the MIC detects corrupted frames without it
+	 */
+	bool CrcOn;
+	/*!
+	 * Implicit header, the length is not sent
+	 */
+	bool ImplicitHeader;
+	/*!
+	 * Payload length of every frame in implicit header mode
+	 */
+	uint8_t FixedLen;
+} LoRaLinkPhyProfile_t;
+
+/*!
+ * Explicit header, CRC on, 8 symbols preamble
+ */
+#define LORALINK_PHY_STANDARD         { 8, true, false, 0 }
+/*!
+ * CRC off, a corrupted frame fails the MIC check
+ */
+#define LORALINK_PHY_NO_CRC           { 8, false, false, 0 }
+/*!
+ * CRC off and the shortest preamble, the receiver has to listen when the frame starts.
+ * Not for an Rx modem scanning SFs by CAD.
+ */
+#define LORALINK_PHY_SHORT_PREAMBLE   { 6, false, false, 0 }
+/*!
+ * Implicit header and CRC off, every frame carries a len bytes payload.
+ * Shorter payloads are padded in a LINK_AGGREGATE payload, longer ones are fragmented.
+ */
+#define LORALINK_PHY_IMPLICIT( len )  { 8, false, true, ( len ) }
+
+/*!
+ * Time taken from the start of the carrier sense to the start of the transmission
+ */
+typedef struct
+{
+	/*!
+	 * Number of transmissions measured
+	 */
+	uint32_t TxCount;
+	/*!
+	 * Sum of the pre-Tx time in ms
+	 */
+	uint32_t TotalTime;
+	/*!
+	 * Longest pre-Tx time in ms
+	 */
+	uint32_t MaxTime;
+} LoRaLinkTxOverhead_t;
+
 /*!
  * LoRaLink State machine status
  */
@@ -157,8 +279,209 @@ typedef struct
     uint16_t Size;
     int16_t Rssi;
     int8_t Snr;
+    int32_t Fei;
+    uint32_t Counter;
+    uint8_t SFValue;
+    bool Duplicate;
 } RxDoneParams_t;
 
+/*!
+ * Reception details for the extended Rx API frame
+ */
+typedef struct
+{
+	uint32_t Counter;      // modem local count of received frames
+	TimerTime_t RxTime;    // RxDone time [ms]
+	uint32_t Frequency;    // [Hz]
+	int32_t Fei;           // frequency error [Hz]
+	uint8_t SFValue;
+	uint8_t Bandwidth;     // 0: 125 kHz, 1: 250 kHz, 2: 500 kHz
+	uint8_t Flags;         // LORALINK_API_RX_FLAG_xxx
+} LoRaLinkRxMeta_t;
+
+/*!
+ * Depth of the received frame queue. Must be a power of 2.
+ */
+#define LORALINK_RX_QUEUE_DEPTH                  4
+
+/*!
+ * Received frame copied out of the radio buffer by the RxDone interrupt
+ */
+typedef struct
+{
+    TimerTime_t LastRxDone;
+    uint16_t Size;
+    int16_t Rssi;
+    int8_t Snr;
+    int32_t Fei;
+    uint32_t Counter;
+    uint8_t SFValue;
+    uint8_t Payload[LORA_PHY_MAXPAYLOAD];
+} LoRaLinkRxFrame_t;
+
+/*!
+ * Single producer ( RxDone IRQ ) / single consumer ( LoRaLink main loop ) ring of received frames
+ */
+typedef struct
+{
+	/*!
+	 * Frame slots
+	 */
+	LoRaLinkRxFrame_t Frames[LORALINK_RX_QUEUE_DEPTH];
+	/*!
+	 * Free running write index, updated by the IRQ only
+	 */
+	volatile uint8_t Head;
+	/*!
+	 * Free running read index, updated by the main loop only
+	 */
+	volatile uint8_t Tail;
+	/*!
+	 * Number of frames queued
+	 */
+	volatile uint32_t Received;
+	/*!
+	 * Number of frames dropped because the queue was full
+	 */
+	volatile uint32_t Overflow;
+	/*!
+	 * Maximum number of frames waiting in the queue
+	 */
+	volatile uint8_t HighWater;
+	/*!
+	 * Radio is receiving, the blind time starts when it stops
+	 */
+	bool Listening;
+	TimerTime_t BlindStart;
+	/*!
+	 * Total and longest time out of Rx between two receptions [ms], number of Rx restarts
+	 */
+	uint32_t BlindTime;
+	uint32_t BlindMax;
+	uint32_t Restarts;
+} LoRaLinkRxQueue_t;
+
+/*!
+ * Received frame queue counters
+ */
+typedef struct
+{
+	uint32_t Received;
+	uint32_t Overflow;
+	uint8_t  HighWater;
+	uint8_t  Depth;
+	uint32_t BlindTime;
+	uint32_t BlindMax;
+	uint32_t Restarts;
+} LoRaLinkRxQueueStats_t;
+
+/*!
+ * Maximum number of spreading factors scanned by the Rx modem
+ */
+#define LORALINK_MAX_SCAN_SF                     6
+
+/*!
+ * Rx modem scanning the spreading factors by CAD
+ */
+typedef struct
+{
+	/*!
+	 * Spreading factors in scan order, scan is off with less than 2
+	 */
+	uint8_t SFValue[LORALINK_MAX_SCAN_SF];
+	uint8_t Num;
+	/*!
+	 * Spreading factor of the current CAD or reception
+	 */
+	uint8_t Idx;
+	/*!
+	 * CAD running since CadStart
+	 */
+	bool Cad;
+	TimerTime_t CadStart;
+} LoRaLinkRxScan_t;
+
+/*!
+ * Maximum number of channels in the Tx channel plan
+ */
+#define LORALINK_MAX_CHANNELS                    4
+
+/*!
+ * Tx channel of the channel plan
+ */
+typedef struct
+{
+	/*!
+	 * ARIB channel number
+	 */
+	uint8_t Channel;
+	/*!
+	 * Frequency of the channel
+	 */
+	uint32_t Frequency;
+	/*!
+	 * Number of carrier sense done on the channel
+	 */
+	uint32_t Attempts;
+	/*!
+	 * Number of carrier sense which found the channel busy
+	 */
+	uint32_t Busy;
+} LoRaLinkChannel_t;
+
+/*!
+ * Header of a message in a LINK_AGGREGATE payload
+ */
+#define LORALINK_AGGREGATE_SUBHDR_LEN  (2)     // Length(1) + PayloadType(1)
+
+/*!
+ * Maximum number of destinations with their own FEC parity group
+ */
+#define LORALINK_FEC_DESTS                       4
+
+/*!
+ * FEC parity group of a destination
+ */
+typedef struct
+{
+	/*!
+	 * Destination address
+	 */
+	uint8_t DestAddr;
+	/*!
+	 * Fragments of a parity group, 0: FEC off
+	 */
+	uint8_t Group;
+	bool Used;
+} LoRaLinkFecDest_t;
+
+/*!
+ * Messages collected into one LINK_AGGREGATE frame
+ */
+typedef struct
+{
+	/*!
+	 * Length(1) PayloadType(1) Payload(Length) repeated
+	 */
+	uint8_t Buffer[LORA_PHY_MAXPAYLOAD];
+	/*!
+	 * Length of Buffer in use
+	 */
+	uint8_t Len;
+	/*!
+	 * Number of messages in Buffer
+	 */
+	uint8_t Count;
+	/*!
+	 * Destination of all messages
+	 */
+	uint8_t DestAddr;
+	/*!
+	 * Time the earliest message must be sent
+	 */
+	TimerTime_t Deadline;
+} LoRaLinkAggregate_t;
+
 /*!
  * LoRaLink Packet format
  */
@@ -282,6 +605,70 @@ typedef struct
 	TimerTime_t LastTxDoneTime;
 
 	TimerTime_t BackoffTime;
+	/*!
+	 * Carrier sense parameters
+	 */
+	LoRaLinkCarrierSense_t CarrierSense;
+	/*!
+	 * PHY profile of the PAN
+	 */
+	LoRaLinkPhyProfile_t Phy;
+	/*!
+	 * Pre-Tx time of the carrier sense method
+	 */
+	LoRaLinkTxOverhead_t TxOverhead;
+	/*!
+	 * Tx parameters programmed into the radio
+	 */
+	TxConfigParams_t TxConfigApplied;
+	/*!
+	 * Radio still holds TxConfigApplied
+	 */
+	bool TxConfigValid;
+	/*!
+	 * Tx channel plan, rotated when the channel is busy
+	 */
+	LoRaLinkChannel_t TxChannels[LORALINK_MAX_CHANNELS];
+	/*!
+	 * Number of channels in the Tx channel plan
+	 */
+	uint8_t TxChannelNum;
+	/*!
+	 * Index of the current Tx channel
+	 */
+	uint8_t TxChannelIdx;
+	/*!
+	 * Number of busy channels found for the current frame
+	 */
+	uint8_t TxChannelBusyCnt;
+	/*!
+	 * A node may rotate its uplink, a modem stays on the channel its peers listen on
+	 */
+	bool TxChannelPlanOn;
+	/*!
+	 * Messages waiting to be sent in one frame
+	 */
+	LoRaLinkAggregate_t Aggregate;
+	/*!
+	 * Fragments of a FEC parity group of the destinations not in FecDests, 0: FEC off
+	 */
+	uint8_t FecGroup;
+	/*!
+	 * Destinations with their own FEC parity group
+	 */
+	LoRaLinkFecDest_t FecDests[LORALINK_FEC_DESTS];
+	/*!
+	 * Received frames waiting for the main loop
+	 */
+	LoRaLinkRxQueue_t RxQueue;
+	/*!
+	 * Gateway Rx, the radio stays in Rx continuous with the TCXO on between frames
+	 */
+	bool RxAlwaysOn;
+	/*!
+	 * Gateway Rx on several spreading factors
+	 */
+	LoRaLinkRxScan_t RxScan;
 	/*!
 	 * Dwelltime
 	 */
@@ -362,6 +749,10 @@ typedef struct
 	uint8_t   PayloadType;
 	uint8_t   Payload[LORA_PHY_MAXPAYLOAD];
 	uint16_t  PayloadLen;
+	uint8_t   FrameId;      // echoed in the responses, 0 for none
+	uint8_t   Priority;     // higher goes out first
+	TimerTime_t SubmitTime;
+	uint32_t  Lifetime;     // ms, 0 for no deadline
 }LoRaLinkApi_t;
 
 
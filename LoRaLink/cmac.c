@@ -54,6 +54,13 @@ DEALINGS WITH THE SOFTWARE
         }                          \
     } while (0) \
 
+#define SUBKEY(v, r) do {                                       \
+            uint8_t msb = (v)[0] & 0x80;                            \
+            LSHIFT(v, r);                                           \
+            if (msb)                                                \
+                    (r)[15] ^= 0x87;                                \
+    } while (0)
+
 
 void AES_CMAC_Init(AES_CMAC_CTX *ctx)
 {
@@ -66,6 +73,21 @@ void AES_CMAC_SetKey(AES_CMAC_CTX *ctx, const uint8_t key[AES_CMAC_KEY_LENGTH])
 {
            //rijndael_set_key_enc_only(&ctx->rijndael, key, 128);
        aes_set_key( key, AES_CMAC_KEY_LENGTH, &ctx->rijndael);
+
+            /* generate subkey K1 */
+            memset1(ctx->K1, '\0', 16);
+            aes_encrypt( ctx->K1, ctx->K1, &ctx->rijndael);
+            SUBKEY(ctx->K1, ctx->K1);
+
+            /* generate subkey K2 */
+            SUBKEY(ctx->K1, ctx->K2);
+}
+
+/* Start a new message, keeping the key schedule and the subkeys */
+void AES_CMAC_Reset(AES_CMAC_CTX *ctx)
+{
+            memset1(ctx->X, 0, sizeof ctx->X);
+            ctx->M_n = 0;
 }
     
 void AES_CMAC_Update(AES_CMAC_CTX *ctx, const uint8_t *data, uint32_t len)
@@ -106,40 +128,19 @@ void AES_CMAC_Update(AES_CMAC_CTX *ctx, const uint8_t *data, uint32_t len)
    
 void AES_CMAC_Final(uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX *ctx)
 {
-            uint8_t K[16];
         uint8_t in[16];
-            /* generate subkey K1 */
-            memset1(K, '\0', 16);
-
-            //rijndael_encrypt(&ctx->rijndael, K, K);
-
-            aes_encrypt( K, K, &ctx->rijndael);
-
-            if (K[0] & 0x80) {
-                    LSHIFT(K, K);
-                   K[15] ^= 0x87;
-            } else
-                    LSHIFT(K, K);
-
 
             if (ctx->M_n == 16) {
                     /* last block was a complete block */
-                    XOR(K, ctx->M_last);
+                    XOR(ctx->K1, ctx->M_last);
 
            } else {
-                   /* generate subkey K2 */
-                  if (K[0] & 0x80) {
-                          LSHIFT(K, K);
-                          K[15] ^= 0x87;
-                  } else
-                           LSHIFT(K, K);
-
                    /* padding(M_last) */
                    ctx->M_last[ctx->M_n] = 0x80;
                    while (++ctx->M_n < 16)
                          ctx->M_last[ctx->M_n] = 0;
    
-                  XOR(K, ctx->M_last);
+                  XOR(ctx->K2, ctx->M_last);
 
 
            }
@@ -149,7 +150,6 @@ void AES_CMAC_Final(uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX *ctx)
 
        memcpy1(in, &ctx->X[0], 16); //Bestela ez du ondo iten
        aes_encrypt(in, digest, &ctx->rijndael);
-           memset1(K, 0, sizeof K);
 
 }
 
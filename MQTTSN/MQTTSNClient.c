@@ -13,6 +13,7 @@
 #include "MQTTSNPublish.h"
 #include "MQTTSNRegister.h"
 #include "MQTTSNSubscribe.h"
+#include "MQTTSNOffline.h"
 #include "TaskMgmt.h"
 #include <stdlib.h>
 #include <stdbool.h>
@@ -22,6 +23,7 @@
 #include "utilities.h"
 #include "sx1276.h"
 #include "systime.h"
+#include "device.h"
 
 extern void OnConnect( void );
 
@@ -63,6 +65,15 @@ static bool  onConnectExecFlg = false;
 
 static bool  QoSM1DeviceFlg = false;
 
+static uint8_t          WaitType = 0;          // response awaited, 0 for none
+static uint32_t         WaitTimeout = MQTTSN_TIMEOUT_MS;
+static bool             InProcess = false;
+static MQTTSNHandle_t   NextHandle = 0;
+static MQTTSNHandle_t   WaitHandle = 0;        // request of MQTTSNClientWait()
+static MQTTSNState_t    WaitState = MQTTSN_STATE_OK;
+static MQTTSNHandle_t   ConnectHandle = 0;
+static MQTTSNCallback_t ConnectCallback = NULL;
+
 
 uint8_t      Msg[MQTTSN_MAX_MSG_LENGTH + 1];
 uint8_t*     MQTTSNMsg;
@@ -82,9 +93,16 @@ LoRaLinkPacket_t RecvPacket = { 0 };
 /*
  * Predefined functions
  */
-static void GetConnectResponce( uint32_t timeout );
+static bool ConnectStep( void );
+static void ConnectTimeout( uint8_t msgType );
+static void ConnectDone( MQTTSNState_t state );
 static uint8_t GetDisconnectResponce( uint32_t timeout );
+static void DispatchMsg( uint8_t len );
+static LoRaLinkStatus_t PollMsg( uint32_t timeout, uint8_t* len );
 static uint8_t ReadMsg( uint32_t timeout );
+static void SendHeldMsg( void );
+static bool SendPingReqMsg( void );
+static void PingTimeout( void );
 static void OnKeepAliveTimeupEvent( void *context );
 static void OnSleepTimeupEvent( void *context );
 static void StartClientWakeupTimer( uint32_t ms );
@@ -113,6 +131,7 @@ void MQTTSNClientInit( MQTTSNConf_t* conf )
 
 	TimerInit( &KeepAliveTimer, OnKeepAliveTimeupEvent );
 	TimerInit( &SleepTimer, OnSleepTimeupEvent );
+	OfflineInit();
 }
 
 void MQTTSNQoSM1Init( uint8_t*  prefixOfClientId, uint8_t gwAddr )
@@ -137,10 +156,20 @@ uint8_t* GetMsgType( uint8_t msgType )
 	return (uint8_t*)packet_names[ msgType ];
 }
 
-void Connect( void )
+MQTTSNHandle_t ConnectAsync( MQTTSNCallback_t callback )
 {
-	uint8_t* pos;
+	if ( ConnectHandle != 0 )
+	{
+		// Already requested, completed together
+		return ConnectHandle;
+	}
+	ConnectHandle = GetNextHandle();
+	ConnectCallback = callback;
+	return ConnectHandle;
+}
 
+void Connect( void )
+{
 	if ( QoSM1DeviceFlg == true )
 	{
 		return;
@@ -148,77 +177,132 @@ void Connect( void )
 
 	while ( ClientStatus != CS_ACTIVE )
 	{
-		pos = Msg;
-
-		if ( ClientStatus == CS_CONNECTING || ClientStatus == CS_DISCONNECTED )
+		if ( MQTTSNClientWait( ConnectAsync( NULL ) ) == MQTTSN_STATE_PENDING )
 		{
-			uint8_t clientIdLen = strlen( (const char*)ClientId );
-			*pos++ = 6 + clientIdLen;
-			*pos++ = MQTTSN_TYPE_CONNECT;
-			pos++;
-			if ( CleanSession )
-			{
-				Msg[2] = MQTTSN_FLAG_CLEAN;
-			}
-			*pos++ = MQTTSN_PROTOCOL_ID;
-			setUint16( pos, TkeepAliveMs );
-			pos += 2;
-			strncpy( (char*)pos, (const char*)ClientId, clientIdLen);
-			Msg[6 + clientIdLen] = 0;
+			return;
+		}
+	}
+}
 
-			if ( ( strlen( (const char*)WillMsg ) > 0 ) && ( strlen( (const char*)WillTopic ) > 0 ) )
-			{
-				Msg[2] = Msg[2] | MQTTSN_FLAG_WILL;   // CONNECT
-				ClientStatus = CS_WAIT_WILLTOPICREQ;
-			}
-			else
-			{
-				ClientStatus = CS_WAIT_CONNACK;
-			}
+/*
+ * Send the next message of the connection
+ */
+static bool ConnectStep( void )
+{
+	uint8_t* pos = Msg;
 
-			RetryCount = MQTTSN_RETRY_COUNT;
+	if ( ClientStatus != CS_GW_LOST && ClientStatus != CS_SEND_WILLTOPIC && ClientStatus != CS_SEND_WILLMSG )
+	{
+		// Disconnected, asleep or no response to the previous step
+		ClientStatus = CS_CONNECTING;
+	}
 
-			DLOG("Send %s\r\n", packet_names[ Msg[1] ] );
-			WriteMsg( Msg );
+	if ( ClientStatus == CS_CONNECTING )
+	{
+		uint8_t clientIdLen = strlen( (const char*)ClientId );
+		*pos++ = 6 + clientIdLen;
+		*pos++ = MQTTSN_TYPE_CONNECT;
+		*pos++ = 0;
+		if ( CleanSession )
+		{
+			Msg[2] = MQTTSN_FLAG_CLEAN;
 		}
-		else if ( ClientStatus == CS_SEND_WILLTOPIC )
+		*pos++ = MQTTSN_PROTOCOL_ID;
+		setUint16( pos, TkeepAliveMs );
+		pos += 2;
+		strncpy( (char*)pos, (const char*)ClientId, clientIdLen);
+		Msg[6 + clientIdLen] = 0;
+
+		if ( ( strlen( (const char*)WillMsg ) > 0 ) && ( strlen( (const char*)WillTopic ) > 0 ) )
 		{
-			*pos++ = 3 + (uint8_t) strlen( (const char*)WillTopic );
-			*pos++ = MQTTSN_TYPE_WILLTOPIC;
-			*pos++ = QosWill | RetainWill;
-			strcpy((char*)pos, (const char*)WillTopic);
-			ClientStatus = CS_WAIT_WILLMSGREQ;
-			RetryCount = MQTTSN_RETRY_COUNT;
-
-			DLOG("Send %s\r\n", packet_names[ Msg[1] ] );
-			WriteMsg( Msg );
+			Msg[2] = Msg[2] | MQTTSN_FLAG_WILL;   // CONNECT
+			ClientStatus = CS_WAIT_WILLTOPICREQ;
+			MQTTSNWaitResponse( MQTTSN_TYPE_WILLTOPICREQ );
 		}
-		else if ( ClientStatus == CS_SEND_WILLMSG )
+		else
 		{
-			*pos++ = 2 +(uint8_t)strlen( (const char*)WillMsg );
-			*pos++ = MQTTSN_TYPE_WILLMSG;
-			strcpy( (char*)pos, (const char*)WillMsg);
 			ClientStatus = CS_WAIT_CONNACK;
-			RetryCount = MQTTSN_RETRY_COUNT;
-
-			DLOG("Send %s\r\n", packet_names[ Msg[1] ] );
-			WriteMsg( Msg );
+			MQTTSNWaitResponse( MQTTSN_TYPE_CONNACK );
 		}
-		else  if ( ClientStatus == CS_GW_LOST )
-		{
-			*pos++ = 3;
-			*pos++ = MQTTSN_TYPE_SEARCHGW;
-			*pos = 0;                        // SERCHGW
-			ClientStatus = CS_SEARCHING;
-			RetryCount = MQTTSN_RETRY_COUNT;
+	}
+	else if ( ClientStatus == CS_SEND_WILLTOPIC )
+	{
+		*pos++ = 3 + (uint8_t) strlen( (const char*)WillTopic );
+		*pos++ = MQTTSN_TYPE_WILLTOPIC;
+		*pos++ = QosWill | RetainWill;
+		strcpy((char*)pos, (const char*)WillTopic);
+		ClientStatus = CS_WAIT_WILLMSGREQ;
+		MQTTSNWaitResponse( MQTTSN_TYPE_WILLMSGREQ );
+	}
+	else if ( ClientStatus == CS_SEND_WILLMSG )
+	{
+		*pos++ = 2 +(uint8_t)strlen( (const char*)WillMsg );
+		*pos++ = MQTTSN_TYPE_WILLMSG;
+		strcpy( (char*)pos, (const char*)WillMsg);
+		ClientStatus = CS_WAIT_CONNACK;
+		MQTTSNWaitResponse( MQTTSN_TYPE_CONNACK );
+	}
+	else
+	{
+		*pos++ = 3;
+		*pos++ = MQTTSN_TYPE_SEARCHGW;
+		*pos = 0;                        // SERCHGW
+		ClientStatus = CS_SEARCHING;
+		MQTTSNWaitResponse( MQTTSN_TYPE_GWINFO );
+	}
 
-			DLOG("Send %s\r\n", packet_names[ Msg[1] ] );
-			WriteMsg( Msg );
-		}
+	RetryCount = MQTTSN_RETRY_COUNT;
 
-		GetConnectResponce( MQTTSN_TIMEOUT_MS );
+	DLOG("Send %s\r\n", packet_names[ Msg[1] ] );
+	WriteMsg( Msg );
+	return true;
+}
+
+static void ConnectTimeout( uint8_t msgType )
+{
+	if ( Msg[1] == MQTTSN_TYPE_CONNECT || Msg[1] == MQTTSN_TYPE_SEARCHGW )
+	{
+		ConnectRetry++;
+	}
+
+	if ( RetryCount++ < MQTTSN_RETRY_COUNT )
+	{
+		MQTTSNWaitResponse( msgType );
+		WriteMsg( Msg );
+	}
+	else if ( ConnectRetry < MQTTSN_RETRY_COUNT )
+	{
+		ClientStatus = ( ClientStatus == CS_SEARCHING ) ? CS_GW_LOST : CS_CONNECTING;
+	}
+	else if ( ClientStatus != CS_SEARCHING )
+	{
+		ConnectRetry = 0;
+		ClientStatus = CS_GW_LOST;
+		GwId = 0;
+	}
+	else
+	{
+		// No gateway found, the requests fail instead of searching on and on
+		ConnectRetry = 0;
+		ClientStatus = CS_GW_LOST;
+		GwId = 0;
+		OfflineHold();
+		ConnectDone( MQTTSN_STATE_RETRY_OUT );
+		RegisterAbort( MQTTSN_STATE_RETRY_OUT );
+		SubscribeAbort( MQTTSN_STATE_RETRY_OUT );
+		PublishAbort( MQTTSN_STATE_RETRY_OUT );
+	}
+}
+
+static void ConnectDone( MQTTSNState_t state )
+{
+	MQTTSNHandle_t handle = ConnectHandle;
+
+	if ( handle != 0 )
+	{
+		ConnectHandle = 0;
+		MQTTSNClientComplete( handle, ConnectCallback, state );
 	}
-	return;
 }
 
 void Reconnect( void )
@@ -234,6 +318,9 @@ void Disconnect( uint32_t ms )
 		return;
 	}
 
+	// Requests in progress are completed first
+	MQTTSNClientWaitIdle();
+
 	ClientStatus = CS_DISCONNECTING;
 	TsleepMs = ms;
 
@@ -274,101 +361,6 @@ void Disconnect( uint32_t ms )
 	}
 }
 
-static void GetConnectResponce( uint32_t timeout )
-{
-	uint8_t len = ReadMsg( timeout );
-
-	if ( len == 0 )
-	{
-		if ( Msg[1] == MQTTSN_TYPE_CONNECT )
-		{
-			ConnectRetry++;
-		}
-
-		if ( RetryCount++ < MQTTSN_RETRY_COUNT )
-		{
-			WriteMsg( Msg );
-		}
-		else
-		{
-			if (ClientStatus >= CS_CONNECTING && ConnectRetry < MQTTSN_RETRY_COUNT )
-			{
-				ClientStatus = CS_CONNECTING;
-			}
-			else
-			{
-				ClientStatus = CS_GW_LOST;
-				GwId = 0;
-			}
-		}
-	}
-	else
-	{
-		DLOG("GetConnectResponce Recv %s\r\n", packet_names[ MQTTSNMsg[1] ] );
-
-		if ( MQTTSNMsg[1] == MQTTSN_TYPE_GWINFO && ClientStatus == CS_SEARCHING)
-		{
-			GwId = MQTTSNMsg[2];
-			GwDevAddr = SenderDevAddr;
-			ClientStatus = CS_CONNECTING;
-		}
-		else if (MQTTSNMsg[1] == MQTTSN_TYPE_WILLTOPICREQ && ClientStatus == CS_WAIT_WILLTOPICREQ)
-		{
-			ClientStatus = CS_SEND_WILLTOPIC;
-		}
-		else if (MQTTSNMsg[1] == MQTTSN_TYPE_WILLMSGREQ && ClientStatus == CS_WAIT_WILLMSGREQ)
-		{
-			ClientStatus = CS_SEND_WILLMSG;
-		}
-		else if (MQTTSNMsg[1] == MQTTSN_TYPE_CONNACK && ClientStatus == CS_WAIT_CONNACK)
-		{
-			if (MQTTSNMsg[2] == MQTTSN_RC_ACCEPTED)
-			{
-				RestartPingRequestTimer();
-				ConnectRetry = 0;
-				GwPanId = RecvPacket.PanId;
-				ClientStatus = CS_ACTIVE;
-
-				if ( MQTTSNMsg[0] == 7 )
-				{
-					SysTime_t syst = { 0 };
-					syst.Seconds = getUint32( MQTTSNMsg + 3 );
-					SysTimeSet( syst );
-				}
-
-				if ( CleanSession == true )
-				{
-					ClearTopicTable();
-				}
-
-				if ( AsleepFlg == false &&  ( CleanSession == false && onConnectExecFlg == false ) )
-				{
-					OnConnect();  // SUBSCRIBEs are conducted
-					onConnectExecFlg = true;
-				}
-
-				DLOG("Wait PUBLISH from the gateway.\r\n");
-				GetMessage( MQTTSN_TIMEOUT_MS );  // try to receive PUBLIC. GW sends PUBLISH if it has retain message.
-			}
-			else
-			{
-				ClientStatus = CS_CONNECTING;
-			}
-		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBLISH )
-		{
-			GwDevAddr = SenderDevAddr;
-			ClientStatus = CS_ACTIVE;
-			DLOG("       msgId:%04x topicType:%02x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[1] & 0x03, MQTTSNMsg[3], MQTTSNMsg[4] );
-
-			Published( MQTTSNMsg, MQTTSNMsg[0] );
-			ClientStatus = CS_CONNECTING;
-		}
-	}
-}
-
-
-
 static uint8_t GetDisconnectResponce( uint32_t timeout )
 {
 	int len = ReadMsg( timeout );
@@ -423,153 +415,418 @@ uint8_t GetMessage( uint32_t timeout )
 
 	if ( len > 0 )
 	{
-		DLOG("GetMessage Recv %s\r\n",packet_names[ MQTTSNMsg[1] ] );
+		DispatchMsg( len );
+	}
+	else
+	{
+		DLOG("Recv Timeout\r\n");
+	}
+	return len;
+}
 
-		if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBLISH)
-		{
-			DLOG("       msgId:%04x topicType:%02x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[1] & 0x03, MQTTSNMsg[3], MQTTSNMsg[4] );
+static void DispatchMsg( uint8_t len )
+{
+	DLOG("GetMessage Recv %s\r\n",packet_names[ MQTTSNMsg[1] ] );
 
-			Published( MQTTSNMsg, MQTTSNMsg[0] );
-		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBACK )
+	if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBLISH)
+	{
+		DLOG("       msgId:%04x topicType:%02x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[1] & 0x03, MQTTSNMsg[3], MQTTSNMsg[4] );
+
+		MQTTSNWaitDone( MQTTSN_TYPE_PUBLISH );
+		Published( MQTTSNMsg, MQTTSNMsg[0] );
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBACK )
+	{
+		DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 4) ), MQTTSNMsg[2], MQTTSNMsg[3] );
+
+		ResponcePublish( MQTTSNMsg, len );
+
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBCOMP || MQTTSNMsg[1] == MQTTSN_TYPE_PUBREC
+				|| MQTTSNMsg[1] == MQTTSN_TYPE_PUBREL)
+	{
+		DLOG("       msgId:%04x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 2) ) );
+		ResponcePublish( MQTTSNMsg, (uint16_t) len );
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_SUBACK || MQTTSNMsg[1] == MQTTSN_TYPE_UNSUBACK)
+	{
+		DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[3], MQTTSNMsg[4] );
+
+		if ( MQTTSNMsg[1] == MQTTSN_TYPE_SUBACK )
 		{
-			DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 4) ), MQTTSNMsg[2], MQTTSNMsg[3] );
+			WaitPublishFlg = true;
+		}
+
+		ResponceSubscribe( MQTTSNMsg );
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_REGISTER)
+	{
+		DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[3], MQTTSNMsg[4] );
+
+		ResponceRegister( MQTTSNMsg, len );
+
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_REGACK)
+	{
+		DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[2], MQTTSNMsg[3] );
 
-			ResponcePublish( MQTTSNMsg, len );
+		ResponceRegAck( getUint16( MQTTSNMsg + 4), getUint16( MQTTSNMsg + 2), MQTTSNMsg[6] );
 
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PINGRESP)
+	{
+		MQTTSNWaitDone( MQTTSN_TYPE_PINGRESP );
+		RestartPingRequestTimer();
+
+		if ( ClientStatus == CS_AWAKE )
+		{
+			ClientStatus = CS_ASLEEP;
 		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PUBCOMP || MQTTSNMsg[1] == MQTTSN_TYPE_PUBREC
-					|| MQTTSNMsg[1] == MQTTSN_TYPE_PUBREL)
+		else
+		{
+			ClientStatus = CS_ACTIVE;
+		}
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_DISCONNECT)
+	{
+		ClientStatus = CS_DISCONNECTED;
+		StopPingRequestTimer( );
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_ADVERTISE)
+	{
+		uint16_t duration = getUint16( (const uint8_t*)(MQTTSNMsg + 3) );
+		if ( duration < 61 )
 		{
-			DLOG("       msgId:%04x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 2) ) );
-			ResponcePublish( MQTTSNMsg, (uint16_t) len );
+			Tadv = duration * 1500;
 		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_SUBACK || MQTTSNMsg[1] == MQTTSN_TYPE_UNSUBACK)
+		else
 		{
-			DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[3], MQTTSNMsg[4] );
+			Tadv = duration * 1100;
+		}
+	}
+	else if ( MQTTSNMsg[1] == MQTTSN_TYPE_GWINFO && ClientStatus == CS_SEARCHING)
+	{
+		MQTTSNWaitDone( MQTTSN_TYPE_GWINFO );
+		GwId = MQTTSNMsg[2];
+		GwDevAddr = SenderDevAddr;
+		ClientStatus = CS_CONNECTING;
+	}
+	else if (MQTTSNMsg[1] == MQTTSN_TYPE_WILLTOPICREQ && ClientStatus == CS_WAIT_WILLTOPICREQ)
+	{
+		MQTTSNWaitDone( MQTTSN_TYPE_WILLTOPICREQ );
+		ClientStatus = CS_SEND_WILLTOPIC;
+	}
+	else if (MQTTSNMsg[1] == MQTTSN_TYPE_WILLMSGREQ && ClientStatus == CS_WAIT_WILLMSGREQ)
+	{
+		MQTTSNWaitDone( MQTTSN_TYPE_WILLMSGREQ );
+		ClientStatus = CS_SEND_WILLMSG;
+	}
+	else if (MQTTSNMsg[1] == MQTTSN_TYPE_CONNACK && ClientStatus == CS_WAIT_CONNACK)
+	{
+		MQTTSNWaitDone( MQTTSN_TYPE_CONNACK );
 
-			if ( MQTTSNMsg[1] == MQTTSN_TYPE_SUBACK )
+		if (MQTTSNMsg[2] == MQTTSN_RC_ACCEPTED)
+		{
+			RestartPingRequestTimer();
+			ConnectRetry = 0;
+			GwPanId = RecvPacket.PanId;
+			ClientStatus = CS_ACTIVE;
+			OfflineConnected();
+
+			if ( MQTTSNMsg[0] == 7 )
 			{
-				WaitPublishFlg = true;
+				SysTime_t syst = { 0 };
+				syst.Seconds = getUint32( MQTTSNMsg + 3 );
+				SysTimeSet( syst );
 			}
 
-			ResponceSubscribe( MQTTSNMsg );
-		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_REGISTER)
-		{
-			DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[3], MQTTSNMsg[4] );
+			if ( CleanSession == true )
+			{
+				ClearTopicTable();
+			}
 
-			ResponceRegister( MQTTSNMsg, len );
+			if ( AsleepFlg == false &&  ( CleanSession == false && onConnectExecFlg == false ) )
+			{
+				OnConnect();  // SUBSCRIBEs are queued
+				onConnectExecFlg = true;
+			}
+			ConnectDone( MQTTSN_STATE_OK );
 
+			if ( MQTTSNClientIsIdle() == true )
+			{
+				// GW sends PUBLISH if it has retain message.
+				DLOG("Wait PUBLISH from the gateway.\r\n");
+				MQTTSNWaitResponse( MQTTSN_TYPE_PUBLISH );
+			}
 		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_REGACK)
+		else
 		{
-			DLOG("       msgId:%04x topicId:%02x%02x\r\n", getUint16( (const uint8_t*)(MQTTSNMsg+ 5) ), MQTTSNMsg[2], MQTTSNMsg[3] );
+			ClientStatus = CS_CONNECTING;
+		}
+	}
+}
 
-			ResponceRegAck(getUint16( MQTTSNMsg + 4), getUint16( MQTTSNMsg + 2));
+/*
+ * Next message to send, false when there is nothing to send
+ */
+static bool StartNext( void )
+{
+	if ( PingRequestFlg == true && ( ClientStatus == CS_ACTIVE || ClientStatus == CS_ASLEEP ) )
+	{
+		return SendPingReqMsg( );
+	}
 
+	if ( ClientStatus != CS_ACTIVE )
+	{
+		// PUBLISH of QoS -1 goes without the connection
+		if ( PublishProcess( ) == true )
+		{
+			return true;
 		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_PINGRESP)
+		if ( ConnectHandle != 0 || IsRegisterDone() == false || IsSubscribeDone() == false || IsPublishDone() == false
+		     || IsOfflinePending() == true )
 		{
-			ResponceRegAck(getUint16( MQTTSNMsg + 4), getUint16( MQTTSNMsg + 2));
-			RestartPingRequestTimer();
+			return ConnectStep( );
+		}
+		return false;
+	}
+
+	ConnectDone( MQTTSN_STATE_OK );
+
+	// Kept messages go after the new ones, within the airtime of the duty cycle
+	return SubscribeProcess( ) || RegisterProcess( ) || PublishProcess( ) || OfflineProcess( );
+}
+
+static void ResponseTimeout( uint8_t msgType )
+{
+	DLOG("Recv Timeout %s\r\n", packet_names[ msgType ] );
+
+	switch ( msgType )
+	{
+	case MQTTSN_TYPE_GWINFO:
+	case MQTTSN_TYPE_WILLTOPICREQ:
+	case MQTTSN_TYPE_WILLMSGREQ:
+	case MQTTSN_TYPE_CONNACK:
+		ConnectTimeout( msgType );
+		break;
+	case MQTTSN_TYPE_REGACK:
+		RegisterTimeout( );
+		break;
+	case MQTTSN_TYPE_SUBACK:
+	case MQTTSN_TYPE_UNSUBACK:
+		SubscribeTimeout( );
+		break;
+	case MQTTSN_TYPE_PUBACK:
+	case MQTTSN_TYPE_PUBREC:
+	case MQTTSN_TYPE_PUBCOMP:
+		PublishTimeout( );
+		break;
+	case MQTTSN_TYPE_PINGRESP:
+		PingTimeout( );
+		break;
+	default:
+		// PUBLISH of the gateway, nothing came
+		break;
+	}
+}
+
+void MQTTSNClientProcess( void )
+{
+	LoRaLinkStatus_t rc;
+	uint8_t len = 0;
+	uint8_t msgType = 0;
+
+	if ( InProcess == true )
+	{
+		return;
+	}
+	InProcess = true;
 
-			if ( ClientStatus == CS_AWAKE )
+	while ( true )
+	{
+		if ( WaitType == 0 )
+		{
+			if ( LoRaLinkRecvPending() == true )
 			{
-				ClientStatus = CS_ASLEEP;
+				// Rest of the messages of a frame received go before the next request
+				PollMsg( WaitTimeout, &len );
+				if ( len > 0 )
+				{
+					DispatchMsg( len );
+				}
+				continue;
 			}
-			else
+			if ( StartNext( ) == false )
 			{
-				ClientStatus = CS_ACTIVE;
+				break;
 			}
+			continue;
 		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_DISCONNECT)
+
+		rc = PollMsg( WaitTimeout, &len );
+
+		if ( rc == LORALINK_STATUS_BUSY )
 		{
-			ClientStatus = CS_DISCONNECTED;
-			StopPingRequestTimer( );
+			// Radio interrupt wakes up the MCU
+			break;
 		}
-		else if ( MQTTSNMsg[1] == MQTTSN_TYPE_ADVERTISE)
+		else if ( len > 0 )
 		{
-			uint16_t duration = getUint16( (const uint8_t*)(MQTTSNMsg + 3) );
-			if ( duration < 61 )
-			{
-				Tadv = duration * 1500;
-			}
-			else
-			{
-				Tadv = duration * 1100;
-			}
+			DispatchMsg( len );
+		}
+		else if ( rc != LORALINK_STATUS_OK )
+		{
+			msgType = WaitType;
+			WaitType = 0;
+			ResponseTimeout( msgType );
 		}
 	}
-	else
-	{
-		DLOG("Recv Timeout\r\n");
-	}
-	return len;
+	SendHeldMsg();
+	InProcess = false;
+}
+
+bool MQTTSNClientIsIdle( void )
+{
+	return WaitType == 0 && PingRequestFlg == false && ConnectHandle == 0 &&
+	       IsRegisterDone() == true && IsSubscribeDone() == true && IsPublishDone() == true;
 }
 
-static MQTTSNState_t SendPingReq( uint8_t* msg )
+MQTTSNState_t MQTTSNClientWait( MQTTSNHandle_t handle )
 {
-	while ( (ClientStatus !=  CS_ACTIVE) && (ClientStatus != CS_ASLEEP)  )
+	if ( handle == 0 )
+	{
+		return MQTTSN_STATE_BUSY;
+	}
+	if ( InProcess == true )
 	{
-		LoRaLinkStatus_t stat = WriteMsg( msg );
+		// Called back from MQTTSNClientProcess(), the request runs on after the return
+		return MQTTSN_STATE_PENDING;
+	}
 
-		if ( stat == LORALINK_STATUS_OK )
-		{
+	WaitHandle = handle;
 
-			if ( GetMessage( MQTTSN_TIMEOUT_MS ) > 0 )
+	while ( WaitHandle != 0 )
+	{
+		MQTTSNClientProcess( );
+
+		if ( WaitHandle != 0 )
+		{
+			if ( WaitType == 0 )
 			{
-				free( msg );
-				return MQTTSN_STATE_OK;
+				// Nothing in progress, the request is lost
+				WaitHandle = 0;
+				return MQTTSN_STATE_INVALID_STATUS;
 			}
+			DeviceLowPowerHandler( );
 		}
 	}
+	return WaitState;
+}
 
-	free( msg );
-	ClientStatus = CS_GW_LOST;
-	GwId = 0;
-	DLOG("     !!! PINGRESP Recv Timeout\n");
-	return MQTTSN_STATE_RETRY_OUT;
+void MQTTSNClientWaitIdle( void )
+{
+	if ( InProcess == true )
+	{
+		return;
+	}
+
+	while ( MQTTSNClientIsIdle() == false )
+	{
+		MQTTSNClientProcess( );
+
+		if ( WaitType == 0 )
+		{
+			break;
+		}
+		DeviceLowPowerHandler( );
+	}
 }
 
-static MQTTSNState_t SendPingReqMsg( void )
+void MQTTSNClientComplete( MQTTSNHandle_t handle, MQTTSNCallback_t callback, MQTTSNState_t state )
 {
-	PingRetryCount = 0;
+	if ( handle == WaitHandle )
+	{
+		WaitHandle = 0;
+		WaitState = state;
+	}
+	if ( callback != NULL )
+	{
+		callback( handle, state );
+	}
+}
+
+void MQTTSNWaitResponse( uint8_t msgType )
+{
+	MQTTSNWaitResponseFor( msgType, MQTTSN_TIMEOUT_MS );
+}
+
+void MQTTSNWaitResponseFor( uint8_t msgType, uint32_t timeout )
+{
+	WaitType = msgType;
+	WaitTimeout = timeout;
+}
 
-	uint8_t* msg = NULL;
+void MQTTSNWaitDone( uint8_t msgType )
+{
+	if ( WaitType == msgType )
+	{
+		WaitType = 0;
+	}
+}
+
+static bool SendPingReqMsg( void )
+{
+	uint8_t msg[ MQTTSN_MAX_MSG_LENGTH + 1 ];
 	uint8_t len = strlen( (const char*)ClientId );
 
+	PingRequestFlg = false;
+
 	if ( ClientStatus == CS_ASLEEP )
 	{
-		msg = (uint8_t*)malloc( len + 2 + 1 );
 		msg[0] = len + 2;
 		msg[1] = MQTTSN_TYPE_PINGREQ;
 		memcpy1( msg + 2, ClientId, len );
-		msg[ 2 + len + 1] = 0;
 		ClientStatus = CS_AWAKE;
 
-		DLOG("Send %s ClientId: %s\r\n", "PINGREQ" , msg + 3 + len );
-		return SendPingReq( msg );
+		DLOG("Send %s ClientId: %s\r\n", "PINGREQ" , ClientId );
 	}
-	else if ( ClientStatus == CS_ACTIVE )
+	else
 	{
-		msg = (uint8_t*)malloc( 2 );
 		msg[0] = 2;
 		msg[1] = MQTTSN_TYPE_PINGREQ;
 		ClientStatus = CS_WAIT_PINGRESP;
 
 		DLOG("Send %s w/o ClientId\r\n", "PINGREQ" );
-		return SendPingReq( msg );
 	}
-	return MQTTSN_STATE_INVALID_STATUS;
+
+	PingRetryCount++;
+	MQTTSNWaitResponse( MQTTSN_TYPE_PINGRESP );
+	WriteMsg( msg );
+	return true;
+}
+
+static void PingTimeout( void )
+{
+	if ( PingRetryCount < MQTTSN_RETRY_COUNT )
+	{
+		// Sent again from the state before PINGREQ
+		ClientStatus = ( ClientStatus == CS_AWAKE ) ? CS_ASLEEP : CS_ACTIVE;
+		PingRequestFlg = true;
+	}
+	else
+	{
+		PingRetryCount = 0;
+		ClientStatus = CS_GW_LOST;
+		GwId = 0;
+		DLOG("     !!! PINGRESP Recv Timeout\n");
+	}
 }
 
 void CheckPingRequest( void )
 {
 	if ( PingRequestFlg == true )
 	{
-		PingRequestFlg = false;
-		SendPingReqMsg( );
+		MQTTSNClientWaitIdle( );
 	}
 }
 
@@ -590,6 +847,7 @@ void RestartPingRequestTimer( void )
 	TimerSetValue( &KeepAliveTimer, TkeepAliveMs );
 	TimerStart( &KeepAliveTimer );
 	PingRequestFlg = false;
+	PingRetryCount = 0;
 }
 
 static void StopPingRequestTimer( void )
@@ -629,7 +887,52 @@ LoRaLinkStatus_t WriteMsg( uint8_t* msg )
 		devAddr = GwDevAddr;
 	}
 
-	stat = LoRaLinkSend( devAddr, MQTT_SN, msg, len, 4000 );
+	if ( msg[1] == MQTTSN_TYPE_PUBACK && MQTTSN_PUBACK_HOLD_MS > 0 )
+	{
+		// A PUBLISH of the OnPublish callback goes in the same LINK_AGGREGATE frame
+		return LoRaLinkAggregate( devAddr, MQTT_SN, msg, len, MQTTSN_PUBACK_HOLD_MS, 4000 );
+	}
+
+	if ( LoRaLinkAggregateFits( devAddr, len ) == true )
+	{
+		// Goes in one frame with the held PUBACK
+		stat = LoRaLinkAggregate( devAddr, MQTT_SN, msg, len, 0, 4000 );
+		if ( stat == LORALINK_STATUS_OK )
+		{
+			// Not sent yet while the duty cycle holds the frame back
+			stat = LoRaLinkAggregateFlush( 4000 );
+		}
+		if ( stat != LORALINK_STATUS_OK )
+		{
+			// The message is retried by the client, not by the aggregation
+			LoRaLinkAggregateClear();
+		}
+	}
+	else
+	{
+		// msg may be the Tx payload buffer, a held PUBACK is sent after it
+		stat = LoRaLinkSend( devAddr, MQTT_SN, msg, len, 4000 );
+	}
+
+	if ( stat == LORALINK_STATUS_OK )
+	{
+		TimeSend = SysTimeGet();
+	}
+	return stat;
+}
+
+LoRaLinkStatus_t HoldMsg( uint8_t* msg )
+{
+	LoRaLinkStatus_t stat = LORALINK_STATUS_ERROR;
+
+	if ( msg[0] + LORALINK_AGGREGATE_SUBHDR_LEN > LoRaLinkGetMaxPayloadLength( GwDevAddr ) )
+	{
+		// Too long to share a frame
+		return WriteMsg( msg );
+	}
+
+	// Sent by SendHeldMsg() before the client listens, or when the frame is full
+	stat = LoRaLinkAggregate( GwDevAddr, MQTT_SN, msg, msg[0], MQTTSN_TIMEOUT_MS, 4000 );
 
 	if ( stat == LORALINK_STATUS_OK )
 	{
@@ -638,14 +941,58 @@ LoRaLinkStatus_t WriteMsg( uint8_t* msg )
 	return stat;
 }
 
+uint8_t* GetMsgBuffer( uint8_t len )
+{
+	if ( LoRaLinkAggregateFits( GwDevAddr, len ) == false )
+	{
+		// Held messages are sent from the same buffer
+		SendHeldMsg();
+	}
+	return LoRaLinkGetTxPayloadBuffer();
+}
+
 
 static uint8_t ReadMsg( uint32_t timeout )
 {
 	uint8_t len = 0;
+
+	while ( PollMsg( timeout, &len ) == LORALINK_STATUS_BUSY )
+	{
+		DeviceLowPowerHandler( );
+	}
+	return len;
+}
+
+/*
+ * Messages held by WriteMsg() and HoldMsg() go before the client listens or sleeps
+ */
+static void SendHeldMsg( void )
+{
+	if ( LoRaLinkAggregateFlush( 4000 ) != LORALINK_STATUS_OK )
+	{
+		// Gateway sends the PUBLISH again, a PUBLISH is sent again after its timeout
+		LoRaLinkAggregateClear();
+	}
+}
+
+/*
+ * Receive without waiting, LORALINK_STATUS_BUSY until a frame or the timeout
+ */
+static LoRaLinkStatus_t PollMsg( uint32_t timeout, uint8_t* len )
+{
+	LoRaLinkStatus_t rc;
+
+	*len = 0;
 	LoRaLinkClearPacket( & RecvPacket );
 	MQTTSNMsg = NULL;
+	if ( LoRaLinkRecvPending() == false )
+	{
+		SendHeldMsg();
+	}
+
+	rc = LoRaLinkRecvPoll( &RecvPacket, timeout );
 
-	if ( LoRaLinkRecvPacket( &RecvPacket, timeout ) == LORALINK_STATUS_OK )
+	if ( rc == LORALINK_STATUS_OK )
 	{
 		RssiValue = RecvPacket.Rssi;
 		SnrValue = RecvPacket.Snr;
@@ -654,11 +1001,11 @@ static uint8_t ReadMsg( uint32_t timeout )
 
 		if ( RecvPacket.FRMPayloadType == MQTT_SN )
 		{
-			len = RecvPacket.FRMPayloadSize;
+			*len = RecvPacket.FRMPayloadSize;
 			MQTTSNMsg = RecvPacket.FRMPayload;
 		}
 	}
-	return len;
+	return rc;
 }
 
 uint16_t GetNextMsgId( void )
@@ -674,3 +1021,12 @@ uint8_t* GetClientId( void )
 {
 	return ClientId;
 }
+
+MQTTSNHandle_t GetNextHandle( void )
+{
+	if ( NextHandle == 0 )
+	{
+		NextHandle = 1;
+	}
+	return NextHandle++;
+}
@@ -39,14 +39,55 @@ typedef enum
 	MQTTSN_STATE_RETRY_OUT,
 	MQTTSN_STATE_INVALID_MSGID,
 	MQTTSN_STATE_INVALID_STATUS,
+	MQTTSN_STATE_REJECTED,      // return code of the gateway is not accepted
+	MQTTSN_STATE_BUSY,          // request not accepted, the previous one is not completed
+	MQTTSN_STATE_PENDING,       // request accepted, completed later by MQTTSNClientProcess()
+	MQTTSN_STATE_STORED,        // PUBLISH failed by the loss of the gateway, kept and sent later
 }MQTTSNState_t;
 
+/*
+ * Request of the non-blocking API, 0 when the request is not accepted
+ */
+typedef uint16_t MQTTSNHandle_t;
+
+/*
+ * Completion of a request, called from MQTTSNClientProcess()
+ */
+typedef void (*MQTTSNCallback_t)( MQTTSNHandle_t handle, MQTTSNState_t state );
+
 void MQTTSNClientInit( MQTTSNConf_t* conf );
 void MQTTSNQoSM1Init( uint8_t*  prefixOfClientId, uint8_t gwAddr );
+
+/*
+ * Run the client, sends the requests, receives the responses and completes them.
+ * It returns when it waits for the radio, call it from the main loop after every wake up.
+ * The callbacks must not call the blocking functions.
+ */
+void MQTTSNClientProcess( void );
+bool MQTTSNClientIsIdle( void );
+
+/*
+ * Run MQTTSNClientProcess() until the request is completed, for the blocking functions
+ */
+MQTTSNState_t MQTTSNClientWait( MQTTSNHandle_t handle );
+void MQTTSNClientWaitIdle( void );
+void MQTTSNClientComplete( MQTTSNHandle_t handle, MQTTSNCallback_t callback, MQTTSNState_t state );
+void MQTTSNWaitResponse( uint8_t msgType );
+void MQTTSNWaitResponseFor( uint8_t msgType, uint32_t timeout );
+void MQTTSNWaitDone( uint8_t msgType );
+MQTTSNHandle_t GetNextHandle( void );
+
+MQTTSNHandle_t ConnectAsync( MQTTSNCallback_t callback );
 void Connect( void );
 void Reconnect( void );
 uint16_t GetNextMsgId( void );
 LoRaLinkStatus_t WriteMsg( uint8_t* msg );
+/*
+ * Hold a message of a burst, the held messages share LINK_AGGREGATE frames sent before
+ * the client listens. A message built in the Tx payload buffer takes it from GetMsgBuffer().
+ */
+LoRaLinkStatus_t HoldMsg( uint8_t* msg );
+uint8_t* GetMsgBuffer( uint8_t len );
 uint8_t GetMessage( uint32_t timeout );
 void Disconnect( uint32_t ms );
 void RestartPingRequestTimer( void );
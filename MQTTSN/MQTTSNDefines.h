@@ -80,6 +80,20 @@
 #define MQTTSN_DEFAULT_DURATION_SEC   (900)     // 15min=900sec
 #define MQTTSN_TIMEOUT_MS           (10000)    // 10sec=10000ms
 #define MQTTSN_RETRY_COUNT              (3)
+#ifndef MQTTSN_MAX_INFLIGHT
+#define MQTTSN_MAX_INFLIGHT             (4)    // PUBLISHes sent before their responses, -DMQTTSN_MAX_INFLIGHT=n to change
+#endif
+#define MQTTSN_PUBACK_HOLD_MS        (1000)    // PUBACK held for a message of the OnPublish callback to share its frame, 0: sent at once
+#ifndef MQTTSN_OFFLINE_QUEUE_SIZE
+#define MQTTSN_OFFLINE_QUEUE_SIZE      (16)    // PUBLISHes kept in the EEPROM while the gateway is lost, the oldest is dropped
+#endif
+#define MQTTSN_OFFLINE_TOPIC_LEN       (32)    // messages of a longer topic name are not kept
+#define MQTTSN_OFFLINE_PAYLOAD_LEN     (48)
+#define MQTTSN_OFFLINE_HOLD_MS      (60000)    // no gateway search after a failed one, doubled up to MQTTSN_OFFLINE_HOLD_MAX_MS
+#define MQTTSN_OFFLINE_HOLD_MAX_MS (3600000)
+#define MQTTSN_OFFLINE_PACE_MS      (60000)    // next replay when the airtime is short or the replay failed
+#define MQTTSN_OFFLINE_RESERVE_MS   (36000)    // airtime of the duty cycle window left to the new messages
+#define MQTTSN_OFFLINE_MAX_AGE_SEC      (0)    // older messages are dropped, 0 for none
 /*======================================
   MACROs and structure for Application
 =======================================*/
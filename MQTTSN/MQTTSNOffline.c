@@ -0,0 +1,368 @@
+/**************************************************************************************
+ *
+ * MQTTSNOffline.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include "MQTTSNOffline.h"
+#include "MQTTSNDefines.h"
+#include "MQTTSNClient.h"
+#include "MQTTSNPublish.h"
+#include "LoRaLink.h"
+#include "nvmm.h"
+#include "utilities.h"
+#include "systime.h"
+#include "timer.h"
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#define OFFLINE_PUBLISH_HEADER  7             // PUBLISH without the payload
+#define OFFLINE_UTC_VALID       1577836800    // 2020-01-01, the time is set by CONNACK of the gateway
+
+typedef struct
+{
+	uint32_t Seq;
+	uint32_t Timestamp;   // SysTime seconds when it is kept
+	uint16_t TopicId;     // short or predefined topic
+	uint8_t  TopicType;
+	uint8_t  Qos;
+	uint8_t  Retain;
+	uint8_t  PayloadLen;
+	uint8_t  TopicName[ MQTTSN_OFFLINE_TOPIC_LEN + 1 ];
+	uint8_t  Payload[ MQTTSN_OFFLINE_PAYLOAD_LEN ];
+}OfflineMsg_t;
+
+/*
+ *  The message of sequence number n is in the slot n % MQTTSN_OFFLINE_QUEUE_SIZE, the done block of the slot
+ *  gets n when it is sent. Head and Tail are found from the slots at start, nothing is rewritten per event.
+ */
+static NvmmDataBlock_t SlotBlock[ MQTTSN_OFFLINE_QUEUE_SIZE ] = { 0 };
+static NvmmDataBlock_t DoneBlock[ MQTTSN_OFFLINE_QUEUE_SIZE ] = { 0 };
+static uint32_t        Head = 0;              // oldest message
+static uint32_t        Tail = 0;              // next message
+static bool            Declared = false;
+static MQTTSNOfflineStats_t Stats = { 0 };
+
+static MQTTSNHandle_t  ReplayHandle = 0;      // message being replayed
+static uint32_t        ReplaySeq = 0;
+static TimerTime_t     HoldTime = 0;
+static TimerTime_t     HoldMs = 0;
+static TimerTime_t     PaceTime = 0;
+static TimerTime_t     PaceMs = 0;
+static TimerEvent_t    OfflineTimer = { 0 };
+
+extern MQTTSNClientState_t ClientStatus;
+
+
+static void OnOfflineTimerEvent( void *context )
+{
+	// Wakes up the MCU, MQTTSNClientProcess() goes on
+}
+
+static void StartOfflineTimer( TimerTime_t ms )
+{
+	TimerStop( &OfflineTimer );
+	TimerSetValue( &OfflineTimer, ms );
+	TimerStart( &OfflineTimer );
+}
+
+static void StartPace( TimerTime_t ms )
+{
+	PaceTime = TimerGetCurrentTime();
+	PaceMs = ms;
+	StartOfflineTimer( ms );
+}
+
+static bool ReadSlot( uint32_t seq, OfflineMsg_t* msg )
+{
+	NvmmDataBlock_t* block = &SlotBlock[ seq % MQTTSN_OFFLINE_QUEUE_SIZE ];
+
+	return NvmmVerify( block, sizeof( OfflineMsg_t ) ) == NVMM_SUCCESS
+	       && NvmmRead( block, msg, sizeof( OfflineMsg_t ) ) == NVMM_SUCCESS
+	       && msg->PayloadLen <= MQTTSN_OFFLINE_PAYLOAD_LEN;
+}
+
+static bool ReadDone( uint32_t seq, uint32_t* done )
+{
+	NvmmDataBlock_t* block = &DoneBlock[ seq % MQTTSN_OFFLINE_QUEUE_SIZE ];
+
+	return NvmmVerify( block, sizeof( uint32_t ) ) == NVMM_SUCCESS
+	       && NvmmRead( block, done, sizeof( uint32_t ) ) == NVMM_SUCCESS;
+}
+
+static void WriteDone( uint32_t seq )
+{
+	NvmmWrite( &DoneBlock[ seq % MQTTSN_OFFLINE_QUEUE_SIZE ], &seq, sizeof( uint32_t ) );
+}
+
+void OfflineInit( void )
+{
+	OfflineMsg_t msg;
+	uint32_t done = 0;
+	bool pending = false;
+
+	if ( Declared == false )
+	{
+		// Addresses of the blocks follow the order of the declarations, declared once
+		Declared = true;
+		Head = 0;
+		Tail = 0;
+
+		for ( uint8_t i = 0; i < MQTTSN_OFFLINE_QUEUE_SIZE; i++ )
+		{
+			NvmmDeclare( &SlotBlock[i], sizeof( OfflineMsg_t ) );
+			NvmmDeclare( &DoneBlock[i], sizeof( uint32_t ) );
+		}
+
+		for ( uint8_t i = 0; i < MQTTSN_OFFLINE_QUEUE_SIZE; i++ )
+		{
+			bool isDone = ReadDone( i, &done );
+
+			if ( isDone == true && done >= Tail )
+			{
+				// Sequence numbers are not used again
+				Tail = done + 1;
+			}
+
+			if ( ReadSlot( i, &msg ) == false || msg.Seq % MQTTSN_OFFLINE_QUEUE_SIZE != i )
+			{
+				// Empty, or broken by a reset while it was written
+				continue;
+			}
+
+			if ( msg.Seq >= Tail )
+			{
+				Tail = msg.Seq + 1;
+			}
+
+			if ( ( isDone == false || done != msg.Seq ) && ( pending == false || msg.Seq < Head ) )
+			{
+				Head = msg.Seq;
+				pending = true;
+			}
+		}
+
+		if ( pending == false || Tail - Head > MQTTSN_OFFLINE_QUEUE_SIZE )
+		{
+			Head = ( pending == false ) ? Tail : Tail - MQTTSN_OFFLINE_QUEUE_SIZE;
+		}
+		TimerInit( &OfflineTimer, OnOfflineTimerEvent );
+	}
+	ReplayHandle = 0;
+	HoldMs = 0;
+	PaceMs = 0;
+	DLOG("Offline messages %lu\r\n", (unsigned long)( Tail - Head ) );
+}
+
+bool OfflineStore( MQTTSNHandle_t handle, uint8_t* topicName, uint16_t topicId, uint8_t topicType,
+                   uint8_t* payload, uint8_t len, MQTTSNQos_t qos, bool retain )
+{
+	OfflineMsg_t msg;
+	uint8_t topicLen = ( topicName == NULL ) ? 0 : strlen( (const char*)topicName );
+
+	if ( Declared == false || ( ReplayHandle != 0 && handle == ReplayHandle ) )
+	{
+		// The replayed one is kept until it is sent
+		return false;
+	}
+
+	if ( len > MQTTSN_OFFLINE_PAYLOAD_LEN || topicLen > MQTTSN_OFFLINE_TOPIC_LEN
+	     || ( topicType == MQTTSN_TOPIC_TYPE_NORMAL && topicLen == 0 ) )
+	{
+		Stats.Dropped++;
+		return false;
+	}
+
+	memset1( (uint8_t*)&msg, 0, sizeof( OfflineMsg_t ) );
+	msg.Seq = Tail;
+	msg.Timestamp = SysTimeGet().Seconds;
+	msg.TopicType = topicType;
+	msg.Qos = qos;
+	msg.Retain = retain;
+	msg.PayloadLen = len;
+	memcpy1( msg.Payload, payload, len );
+
+	if ( topicType == MQTTSN_TOPIC_TYPE_NORMAL )
+	{
+		// Topic id is valid in the session only
+		memcpy1( msg.TopicName, topicName, topicLen );
+	}
+	else
+	{
+		msg.TopicId = topicId;
+	}
+
+	if ( Tail - Head >= MQTTSN_OFFLINE_QUEUE_SIZE )
+	{
+		// The oldest one is overwritten
+		Head++;
+		Stats.Dropped++;
+	}
+
+	// The checksum of the slot is written first, a slot broken by a reset is not found at start
+	NvmmWrite( &SlotBlock[ msg.Seq % MQTTSN_OFFLINE_QUEUE_SIZE ], &msg, sizeof( OfflineMsg_t ) );
+	Tail++;
+	Stats.Stored++;
+
+	DLOG("Offline stored %lu, %lu messages\r\n", (unsigned long)msg.Seq, (unsigned long)( Tail - Head ) );
+	return true;
+}
+
+static void OnReplayed( MQTTSNHandle_t handle, MQTTSNState_t state )
+{
+	ReplayHandle = 0;
+
+	if ( state == MQTTSN_STATE_OK || state == MQTTSN_STATE_REJECTED )
+	{
+		if ( state == MQTTSN_STATE_OK )
+		{
+			Stats.Replayed++;
+		}
+		else
+		{
+			// Never accepted, the next ones are not blocked
+			Stats.Rejected++;
+		}
+
+		if ( Head == ReplaySeq )
+		{
+			// Not dropped by a full queue meanwhile
+			Head++;
+			WriteDone( ReplaySeq );
+		}
+	}
+	else if ( ClientStatus == CS_ACTIVE )
+	{
+		// The same message is sent again later, OfflineConnected() resumes after a lost connection
+		StartPace( MQTTSN_OFFLINE_PACE_MS );
+	}
+}
+
+bool OfflineProcess( void )
+{
+	OfflineMsg_t msg;
+	MQTTSNHandle_t handle = 0;
+	uint32_t done = 0;
+	TimerTime_t delay = 0;
+	uint32_t budget = 0;
+	uint32_t now = SysTimeGet().Seconds;
+
+	if ( Declared == false || ReplayHandle != 0 || Tail == Head || IsMaxFlight() == true )
+	{
+		return false;
+	}
+
+	if ( PaceMs > 0 && TimerGetElapsedTime( PaceTime ) < PaceMs )
+	{
+		return false;
+	}
+	PaceMs = 0;
+
+	if ( ReadSlot( Head, &msg ) == false || msg.Seq != Head )
+	{
+		// Broken by a reset, not found at the next start
+		Head++;
+		Stats.Dropped++;
+		return true;
+	}
+
+	if ( ReadDone( Head, &done ) == true && done == Head )
+	{
+		// Sent before a reset
+		Head++;
+		return true;
+	}
+
+	if ( MQTTSN_OFFLINE_MAX_AGE_SEC > 0 && msg.Timestamp >= OFFLINE_UTC_VALID && now >= OFFLINE_UTC_VALID
+	     && now - msg.Timestamp > MQTTSN_OFFLINE_MAX_AGE_SEC )
+	{
+		WriteDone( Head );
+		Head++;
+		Stats.Expired++;
+		return true;
+	}
+
+	delay = LoRaLinkGetTxDelay( msg.PayloadLen + OFFLINE_PUBLISH_HEADER );
+	budget = LoRaLinkGetAirtimeBudget();
+
+	if ( delay == 0 && budget != LORALINK_AIRTIME_UNLIMITED
+	     && budget < MQTTSN_OFFLINE_RESERVE_MS + LoRaLinkGetTimeOnAir( msg.PayloadLen + OFFLINE_PUBLISH_HEADER ) )
+	{
+		// The rest of the duty cycle window is left to the new messages
+		delay = MQTTSN_OFFLINE_PACE_MS;
+	}
+
+	if ( delay > 0 )
+	{
+		StartPace( delay );
+		return false;
+	}
+
+	if ( msg.TopicType == MQTTSN_TOPIC_TYPE_PREDEFINED )
+	{
+		handle = PublishRowdataByPredefinedIdAsync( msg.TopicId, msg.Payload, msg.PayloadLen, (MQTTSNQos_t)msg.Qos, msg.Retain, OnReplayed );
+	}
+	else
+	{
+		if ( msg.TopicType == MQTTSN_TOPIC_TYPE_SHORT )
+		{
+			msg.TopicName[0] = msg.TopicId >> 8;
+			msg.TopicName[1] = msg.TopicId & 0xff;
+		}
+		handle = PublishRowdataByNameAsync( msg.TopicName, msg.Payload, msg.PayloadLen, (MQTTSNQos_t)msg.Qos, msg.Retain, OnReplayed );
+	}
+
+	if ( handle == 0 )
+	{
+		return false;
+	}
+	ReplayHandle = handle;
+	ReplaySeq = msg.Seq;
+
+	DLOG("Offline replay %lu, kept %lu sec ago\r\n", (unsigned long)msg.Seq, (unsigned long)( now - msg.Timestamp ) );
+	return true;
+}
+
+void OfflineHold( void )
+{
+	HoldMs = ( HoldMs == 0 ) ? MQTTSN_OFFLINE_HOLD_MS : MIN( HoldMs * 2, MQTTSN_OFFLINE_HOLD_MAX_MS );
+	HoldTime = TimerGetCurrentTime();
+	StartOfflineTimer( HoldMs );
+	DLOG("Offline hold %lu ms\r\n", (unsigned long)HoldMs );
+}
+
+void OfflineConnected( void )
+{
+	HoldMs = 0;
+	PaceMs = 0;
+}
+
+bool IsOfflineHolding( void )
+{
+	return HoldMs > 0 && TimerGetElapsedTime( HoldTime ) < HoldMs;
+}
+
+bool IsOfflinePending( void )
+{
+	// Lost or connecting, not disconnected by the application
+	return Tail != Head && ClientStatus <= CS_WAIT_CONNACK && IsOfflineHolding() == false;
+}
+
+uint16_t GetOfflineCount( void )
+{
+	return Tail - Head;
+}
+
+void GetOfflineStats( MQTTSNOfflineStats_t* stats )
+{
+	memcpy1( (uint8_t*)stats, (uint8_t*)&Stats, sizeof( MQTTSNOfflineStats_t ) );
+}
+
+void ClearOfflineStats( void )
+{
+	memset1( (uint8_t*)&Stats, 0, sizeof( MQTTSNOfflineStats_t ) );
+}
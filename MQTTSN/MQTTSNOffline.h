@@ -0,0 +1,62 @@
+/***************************************************************************************
+ *
+ * MQTTSNOffline.h
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef MQTTSNOFFLINE_H_
+#define MQTTSNOFFLINE_H_
+
+#include "MQTTSNDefines.h"
+#include "MQTTSNClient.h"
+
+/*
+ * Counted from the start in the RAM, the EEPROM is written only to keep and to send a message
+ */
+typedef struct
+{
+	uint32_t Stored;      // PUBLISHes kept while the gateway is lost
+	uint32_t Replayed;    // sent after the connection is recovered
+	uint32_t Dropped;     // oldest ones dropped by a full queue, or too long to be kept
+	uint32_t Rejected;    // not accepted by the gateway when replayed
+	uint32_t Expired;     // older than MQTTSN_OFFLINE_MAX_AGE_SEC when replayed
+}MQTTSNOfflineStats_t;
+
+/*
+ * Queue of the PUBLISHes failed by the loss of the gateway, kept in the EEPROM
+ * over resets and replayed in order when the client is CS_ACTIVE.
+ */
+void OfflineInit( void );
+
+/*
+ * Keep a QoS 0 or 1 PUBLISH completed with MQTTSN_STATE_RETRY_OUT, false when it is not kept
+ */
+bool OfflineStore( MQTTSNHandle_t handle, uint8_t* topicName, uint16_t topicId, uint8_t topicType,
+                   uint8_t* payload, uint8_t len, MQTTSNQos_t qos, bool retain );
+
+/*
+ * Send the oldest message, one at once and within the airtime of the duty cycle
+ */
+bool OfflineProcess( void );
+
+/*
+ * No gateway was found, the PUBLISHes are kept without searching for a while
+ */
+void OfflineHold( void );
+void OfflineConnected( void );
+bool IsOfflineHolding( void );
+
+/*
+ * Messages kept and a search of the gateway is allowed
+ */
+bool IsOfflinePending( void );
+
+uint16_t GetOfflineCount( void );
+void GetOfflineStats( MQTTSNOfflineStats_t* stats );
+void ClearOfflineStats( void );
+
+
+#endif /* MQTTSNOFFLINE_H_ */
@@ -13,42 +13,61 @@
 #include "MQTTSNClient.h"
 #include "MQTTSNPublish.h"
 #include "MQTTSNRegister.h"
+#include "MQTTSNOffline.h"
+#include "LoRaLink.h"
 #include "utilities.h"
 #include "systime.h"
 #include "TaskMgmt.h"
-
-#define TOPICID_IS_SUSPEND  0
-#define TOPICID_IS_READY    1
-#define WAIT_PUBACK         2
-#define WAIT_PUBREC         3
-#define WAIT_PUBREL         4
-#define WAIT_PUBCOMP        5
-#define WAIT_NORESP         6
+#include "timer.h"
+
+#define PUB_IDLE            0
+#define TOPICID_IS_SUSPEND  1
+#define WAIT_REGACK         2
+#define TOPICID_IS_READY    3
+#define WAIT_PUBACK         4
+#define WAIT_PUBREC         5
+#define WAIT_PUBREL         6
+#define WAIT_PUBCOMP        7
+#define WAIT_NORESP         8
+#define SEND_PUBREL         9
 
 #define MQTTSN_FLAG_TOPIC_TYPE 0x03
+#define MQTTSN_MAX_PUB_PAYLOAD ( MQTTSN_MAX_MSG_LENGTH - 7 )
 
 typedef struct PubElement{
     uint16_t  msgId;
     uint16_t  topicId;
     uint8_t   topicName[ MQTTSN_MAX_TOPIC_LEN + 1 ];
-    uint8_t*  payload;
+    uint8_t   payload[ MQTTSN_MAX_PUB_PAYLOAD ];
     uint16_t  payloadlen;
-    void      (*callback)(void);
+    MQTTSNCallback_t callback;
+    MQTTSNHandle_t   handle;
+    MQTTSNHandle_t   regHandle;   // REGISTER of the topic
+    TimerTime_t      sendTime;    // last PUBLISH or PUBREL
     uint8_t   retryCount;
     uint8_t   flag;
     MQTTSNQos_t   qos;
     uint8_t   topicType;
-    uint8_t   status;  // 0:SUSPEND, 1:READY
+    uint8_t   status;  // PUB_IDLE, TOPICID_IS_SUSPEND ...
 } MQTTSNPublish_t;
 
-MQTTSNPublish_t PublishMsg = { 0 };
+/*
+ *  Publish messages in flight, found by msgId
+ */
+MQTTSNPublish_t PublishMsg[ MQTTSN_MAX_INFLIGHT ] = { 0 };
+
+/*
+ *  Response type awaited for the window, 0 for none
+ */
+static uint8_t PubWaitType = 0;
+
+extern MQTTSNClientState_t ClientStatus;
 
 const char* NULLCHAR = "";
 
 
-static MQTTSNState_t publish( uint8_t* topicName, uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, uint8_t topicType, bool retain);
+static MQTTSNHandle_t publish( uint8_t* topicName, uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, uint8_t topicType, bool retain, MQTTSNCallback_t callback );
 
-static MQTTSNState_t sendPublishMsg( MQTTSNPublish_t* msg );
 static  LoRaLinkStatus_t sendPublish( MQTTSNPublish_t* msg );
 void SendPubAck( uint16_t topicId, uint16_t msgId, uint8_t rc );
 void SendPubRel( uint16_t msgId );
@@ -58,13 +77,85 @@ static void resetPublishMsg( MQTTSNPublish_t* msg )
 	memset1( (uint8_t*)msg, 0, sizeof( MQTTSNPublish_t ) );
 }
 
-MQTTSNState_t PublishByName( uint8_t* topicName, Payload_t* payload, MQTTSNQos_t qos, bool retain)
+static void PublishDone( MQTTSNPublish_t* msg, MQTTSNState_t state )
 {
-	return PublishRowdataByName( topicName, GetPL_RowData( payload ), GetRowdataLength( payload ), qos, retain );
+	MQTTSNHandle_t handle = msg->handle;
+	MQTTSNCallback_t callback = msg->callback;
+
+	// QoS 2 is not kept, a replay under a new msgId would not be exactly once
+	if ( state == MQTTSN_STATE_RETRY_OUT && msg->qos != QOS_M1 && msg->qos != QOS_2
+	     && OfflineStore( handle, msg->topicName, msg->topicId, msg->topicType, msg->payload, msg->payloadlen,
+	                      msg->qos, ( msg->flag & MQTTSN_FLAG_RETAIN ) != 0 ) == true )
+	{
+		// Sent when the connection is recovered
+		state = MQTTSN_STATE_STORED;
+	}
+	resetPublishMsg( msg );
+	MQTTSNClientComplete( handle, callback, state );
+}
+
+static MQTTSNPublish_t* GetPublishMsg( uint16_t msgId )
+{
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( PublishMsg[i].status != PUB_IDLE && PublishMsg[i].msgId == msgId )
+		{
+			return &PublishMsg[i];
+		}
+	}
+	return NULL;
 }
 
+static bool IsWaitResponse( MQTTSNPublish_t* msg )
+{
+	return msg->status == WAIT_PUBACK || msg->status == WAIT_PUBREC || msg->status == WAIT_PUBCOMP;
+}
 
-MQTTSNState_t PublishRowdataByName( uint8_t* topicName, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain)
+/*
+ *  A response of the window came, the next ready message can be sent
+ */
+static void PublishResponded( void )
+{
+	MQTTSNWaitDone( PubWaitType );
+	PubWaitType = 0;
+}
+
+static uint8_t GetResponseType( MQTTSNPublish_t* msg )
+{
+	return msg->status == WAIT_PUBACK ? MQTTSN_TYPE_PUBACK :
+	       msg->status == WAIT_PUBREC ? MQTTSN_TYPE_PUBREC : MQTTSN_TYPE_PUBCOMP;
+}
+
+bool IsPublishDone( void )
+{
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( PublishMsg[i].status != PUB_IDLE )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool IsMaxFlight( void )
+{
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( PublishMsg[i].status == PUB_IDLE )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+MQTTSNHandle_t PublishByNameAsync( uint8_t* topicName, Payload_t* payload, MQTTSNQos_t qos, bool retain, MQTTSNCallback_t callback )
+{
+	return PublishRowdataByNameAsync( topicName, GetPL_RowData( payload ), GetRowdataLength( payload ), qos, retain, callback );
+}
+
+MQTTSNHandle_t PublishRowdataByNameAsync( uint8_t* topicName, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain, MQTTSNCallback_t callback )
 {
 	uint8_t topicType = MQTTSN_TOPIC_TYPE_NORMAL;
 	uint8_t topiclen = strlen ( (const char*)topicName );
@@ -73,13 +164,60 @@ MQTTSNState_t PublishRowdataByName( uint8_t* topicName, uint8_t* rowdata, uint8_
 	{
 		topicType = MQTTSN_TOPIC_TYPE_SHORT;
 	}
-	return publish( topicName, 0, rowdata, len, qos, topicType, retain );
+	else if ( topiclen > MQTTSN_MAX_TOPIC_LEN )
+	{
+		return 0;
+	}
+	return publish( topicName, 0, rowdata, len, qos, topicType, retain, callback );
+}
+
+MQTTSNHandle_t PublishRowdataByPredefinedIdAsync( uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain, MQTTSNCallback_t callback )
+{
+	return publish( 0, topicId, rowdata, len, qos, MQTTSN_TOPIC_TYPE_PREDEFINED, retain, callback );
+}
+
+MQTTSNState_t PublishByName( uint8_t* topicName, Payload_t* payload, MQTTSNQos_t qos, bool retain)
+{
+	return PublishRowdataByName( topicName, GetPL_RowData( payload ), GetRowdataLength( payload ), qos, retain );
+}
+
+
+MQTTSNState_t PublishRowdataByName( uint8_t* topicName, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain)
+{
+	if ( IsMaxFlight() == true )
+	{
+		MQTTSNClientWaitIdle();
+	}
+	return MQTTSNClientWait( PublishRowdataByNameAsync( topicName, rowdata, len, qos, retain, NULL ) );
+}
+
+MQTTSNState_t PublishRowdataByPredefinedId(uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain)
+{
+	if ( IsMaxFlight() == true )
+	{
+		MQTTSNClientWaitIdle();
+	}
+	return MQTTSNClientWait( PublishRowdataByPredefinedIdAsync( topicId, rowdata, len, qos, retain, NULL ) );
 }
 
-static MQTTSNState_t publish( uint8_t* topicName, uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, uint8_t topicType, bool retain)
+static MQTTSNHandle_t publish( uint8_t* topicName, uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, uint8_t topicType, bool retain, MQTTSNCallback_t callback )
 {
 	uint16_t tid = 0;
-	resetPublishMsg( &PublishMsg );
+	MQTTSNPublish_t* msg = NULL;
+
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT && msg == NULL; i++ )
+	{
+		if ( PublishMsg[i].status == PUB_IDLE )
+		{
+			msg = &PublishMsg[i];
+		}
+	}
+
+	if ( msg == NULL || len > MQTTSN_MAX_PUB_PAYLOAD )
+	{
+		return 0;
+	}
+	resetPublishMsg( msg );
 
 	if ( topicType == MQTTSN_TOPIC_TYPE_SHORT )
 	{
@@ -89,7 +227,7 @@ static MQTTSNState_t publish( uint8_t* topicName, uint16_t topicId, uint8_t* row
 
 	if ( qos > QOS_0 )
 	{
-		PublishMsg.msgId = GetNextMsgId();
+		msg->msgId = GetNextMsgId();
 	}
 
 	if ( topicName != NULL && topicType != MQTTSN_TOPIC_TYPE_SHORT )
@@ -111,92 +249,273 @@ static MQTTSNState_t publish( uint8_t* topicName, uint16_t topicId, uint8_t* row
 
 	if ( topicName != NULL && topicType != MQTTSN_TOPIC_TYPE_SHORT )
 	{
-		memcpy1( PublishMsg.topicName, topicName, strlen( (const char*)topicName ) );
+		memcpy1( msg->topicName, topicName, strlen( (const char*)topicName ) );
 	}
 
-	PublishMsg.topicId = tid;
-	PublishMsg.payload = rowdata;
-	PublishMsg.payloadlen = len;
-	PublishMsg.qos = qos;
-	PublishMsg.topicType = topicType;
-	PublishMsg.flag = qos ;
-	PublishMsg.flag = PublishMsg.flag | ( retain << 4 );
-	PublishMsg.flag = PublishMsg.flag | topicType;
+	msg->topicId = tid;
+	memcpy1( msg->payload, rowdata, len );
+	msg->payloadlen = len;
+	msg->qos = qos;
+	msg->topicType = topicType;
+	msg->flag = qos ;
+	msg->flag = msg->flag | ( retain << 4 );
+	msg->flag = msg->flag | topicType;
+	msg->callback = callback;
+	msg->handle = GetNextHandle();
 
 	if ( tid > 0 )
 	{
-		PublishMsg.status = TOPICID_IS_READY;
-		return sendPublishMsg( &PublishMsg );
+		msg->status = TOPICID_IS_READY;
 	}
 	else
 	{
-		PublishMsg.status = TOPICID_IS_SUSPEND;
-		return RegisterTopic( topicName );
+		msg->status = TOPICID_IS_SUSPEND;
 	}
+	return msg->handle;
 }
 
-MQTTSNState_t PublishRowdataByPredefinedId(uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain)
+static void OnRegistered( MQTTSNHandle_t handle, MQTTSNState_t state )
 {
-	return publish( 0, topicId, rowdata, len, qos, MQTTSN_TOPIC_TYPE_PREDEFINED, retain );
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( PublishMsg[i].status == WAIT_REGACK && PublishMsg[i].regHandle == handle )
+		{
+			if ( state == MQTTSN_STATE_OK )
+			{
+				// REGACK of an other topic name
+				PublishMsg[i].status = TOPICID_IS_SUSPEND;
+			}
+			else
+			{
+				PublishDone( &PublishMsg[i], state );
+			}
+		}
+	}
 }
 
+/*
+ *  REGISTER the topic of a suspended message, one topic at once
+ */
+static bool RegisterSuspend( MQTTSNPublish_t* msg )
+{
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( PublishMsg[i].status == WAIT_REGACK )
+		{
+			if ( strcmp( (const char*)PublishMsg[i].topicName, (const char*)msg->topicName ) == 0 )
+			{
+				msg->regHandle = PublishMsg[i].regHandle;
+				msg->status = WAIT_REGACK;
+			}
+			return false;
+		}
+	}
 
-void ResponcePublish( uint8_t* msg, uint8_t msglen )
+	msg->regHandle = RegisterTopicAsync( msg->topicName, OnRegistered );
+
+	if ( msg->regHandle == 0 )
+	{
+		// REGISTER of the application goes first
+		return false;
+	}
+	msg->status = WAIT_REGACK;
+	return RegisterProcess();
+}
+
+static void RetryPublish( MQTTSNPublish_t* msg )
 {
-	if ( msg == NULL )
+	if ( msg->retryCount >= MQTTSN_RETRY_COUNT )
 	{
-		return;
+		PublishDone( msg, MQTTSN_STATE_RETRY_OUT );
+	}
+	else if ( msg->status == WAIT_PUBCOMP )
+	{
+		msg->status = SEND_PUBREL;
+	}
+	else
+	{
+		// Sent again with DUP
+		msg->status = TOPICID_IS_READY;
+	}
+}
+
+/*
+ *  Send the ready messages of the window back to back, they are held to share frames.
+ *  The responses are listened for in one Rx window until the timeout of the oldest message.
+ */
+bool PublishProcess( void )
+{
+	MQTTSNPublish_t* msg = NULL;
+	MQTTSNPublish_t* oldest = NULL;
+	uint32_t elapsed = 0;
+	bool waiting = false;
+	bool sent = false;
+
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( IsWaitResponse( &PublishMsg[i] ) == true && TimerGetElapsedTime( PublishMsg[i].sendTime ) >= MQTTSN_TIMEOUT_MS )
+		{
+			// Response lost while the others came
+			RetryPublish( &PublishMsg[i] );
+		}
+		else if ( IsWaitResponse( &PublishMsg[i] ) == true )
+		{
+			waiting = true;
+		}
 	}
 
-	if (msg[0] == MQTTSN_TYPE_PUBACK)
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
 	{
-		uint16_t msgId = getUint16( msg + 3 );
+		msg = &PublishMsg[i];
 
-		if ( PublishMsg.msgId != msgId )
+		if ( msg->qos != QOS_M1 && ClientStatus != CS_ACTIVE )
 		{
-			return;
+			if ( msg->status != PUB_IDLE && IsOfflineHolding() == true )
+			{
+				// No gateway was found a moment ago, kept without searching again
+				PublishDone( msg, MQTTSN_STATE_RETRY_OUT );
+				return true;
+			}
+			continue;
+		}
+
+		if ( msg->status == TOPICID_IS_SUSPEND && waiting == false && sent == false && RegisterSuspend( msg ) == true )
+		{
+			return true;
 		}
-		if (msg[5] == MQTTSN_RC_ACCEPTED)
+		else if ( msg->status == SEND_PUBREL )
 		{
-			if ( PublishMsg.status == WAIT_PUBACK )
+			msg->retryCount++;
+			msg->status = WAIT_PUBCOMP;
+			msg->sendTime = TimerGetCurrentTime();
+			SendPubRel( msg->msgId );
+			sent = true;
+		}
+		else if ( msg->status == TOPICID_IS_READY )
+		{
+			if ( sendPublish( msg ) != LORALINK_STATUS_OK )
+			{
+				if ( msg->retryCount >= MQTTSN_RETRY_COUNT )
+				{
+					PublishDone( msg, MQTTSN_STATE_RETRY_OUT );
+				}
+				return true;
+			}
+			sent = true;
+
+			if ( IsWaitResponse( msg ) == false )
 			{
-				resetPublishMsg( &PublishMsg );
+				PublishDone( msg, MQTTSN_STATE_OK );
 			}
 		}
-		else if (msg[5] == MQTTSN_RC_REJECTED_INVALID_TOPIC_ID)
+	}
+
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( IsWaitResponse( &PublishMsg[i] ) == true &&
+		     ( oldest == NULL || TimerGetElapsedTime( PublishMsg[i].sendTime ) > TimerGetElapsedTime( oldest->sendTime ) ) )
 		{
-			PublishMsg.status = TOPICID_IS_SUSPEND;
-			PublishMsg.topicId = 0;
-			PublishMsg.retryCount = MQTTSN_RETRY_COUNT;
-			RegisterTopic( PublishMsg.topicName );
+			oldest = &PublishMsg[i];
 		}
 	}
-	else if (msg[0] == MQTTSN_TYPE_PUBREC)
+
+	if ( oldest == NULL )
 	{
-		uint16_t msgId = getUint16( msg + 1 );
+		return sent;
+	}
 
-		if ( PublishMsg.msgId == msgId )
+	// The held messages go when the client listens, the gateway answers them together
+	elapsed = TimerGetElapsedTime( oldest->sendTime );
+	PubWaitType = GetResponseType( oldest );
+	MQTTSNWaitResponseFor( PubWaitType, elapsed < MQTTSN_TIMEOUT_MS ? MQTTSN_TIMEOUT_MS - elapsed : 1 );
+	return true;
+}
+
+void PublishTimeout( void )
+{
+	PubWaitType = 0;
+
+	// No response in MQTTSN_TIMEOUT_MS of the oldest message
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( IsWaitResponse( &PublishMsg[i] ) == true && TimerGetElapsedTime( PublishMsg[i].sendTime ) >= MQTTSN_TIMEOUT_MS )
+		{
+			RetryPublish( &PublishMsg[i] );
+		}
+	}
+}
+
+void PublishAbort( MQTTSNState_t state )
+{
+	PubWaitType = 0;
+
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		if ( PublishMsg[i].status != PUB_IDLE )
+		{
+			PublishDone( &PublishMsg[i], state );
+		}
+	}
+}
+
+void ResponcePublish( uint8_t* msg, uint8_t msglen )
+{
+	MQTTSNPublish_t* pub = NULL;
+
+	if ( msg == NULL )
+	{
+		return;
+	}
+
+	if (msg[1] == MQTTSN_TYPE_PUBACK)
+	{
+		pub = GetPublishMsg( getUint16( msg + 4 ) );
+
+		if ( pub == NULL || pub->status != WAIT_PUBACK )
 		{
 			return;
 		}
-		if ( PublishMsg.status == WAIT_PUBREC || PublishMsg.status == WAIT_PUBCOMP )
+		PublishResponded();
+
+		if (msg[6] == MQTTSN_RC_ACCEPTED)
+		{
+			PublishDone( pub, MQTTSN_STATE_OK );
+		}
+		else if (msg[6] == MQTTSN_RC_REJECTED_INVALID_TOPIC_ID && pub->retryCount < MQTTSN_RETRY_COUNT
+		         && pub->topicType == MQTTSN_TOPIC_TYPE_NORMAL )
 		{
-			SendPubRel( msgId );
-			PublishMsg.status = WAIT_PUBCOMP;
+			pub->status = TOPICID_IS_SUSPEND;
+			pub->topicId = 0;
+		}
+		else
+		{
+			PublishDone( pub, MQTTSN_STATE_REJECTED );
 		}
 	}
-	else if ( msg[0] == MQTTSN_TYPE_PUBCOMP )
+	else if (msg[1] == MQTTSN_TYPE_PUBREC)
 	{
-		uint16_t msgId = getUint16( msg + 1 );
+		pub = GetPublishMsg( getUint16( msg + 2 ) );
 
-		if ( PublishMsg.msgId == msgId )
+		if ( pub == NULL )
 		{
 			return;
 		}
+		if ( pub->status == WAIT_PUBREC || pub->status == WAIT_PUBCOMP )
+		{
+			// PUBREL is sent by PublishProcess() with the other messages
+			PublishResponded();
+			pub->status = SEND_PUBREL;
+			pub->retryCount = 0;
+		}
+	}
+	else if ( msg[1] == MQTTSN_TYPE_PUBCOMP )
+	{
+		pub = GetPublishMsg( getUint16( msg + 2 ) );
 
-		if (PublishMsg.status == WAIT_PUBCOMP )
+		if ( pub != NULL && pub->status == WAIT_PUBCOMP )
 		{
-			resetPublishMsg( &PublishMsg );
+			PublishResponded();
+			PublishDone( pub, MQTTSN_STATE_OK );
 		}
 	}
 }
@@ -204,12 +523,17 @@ void ResponcePublish( uint8_t* msg, uint8_t msglen )
 
 void SendPublishSuspend( uint8_t* topicName, uint16_t topicId, uint8_t topicType)
 {
-	if ( strcmp( (const char*)PublishMsg.topicName, (const char*)topicName) == 0 && PublishMsg.status == TOPICID_IS_SUSPEND)
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
 	{
-		PublishMsg.topicId = topicId;
-		PublishMsg.flag |= topicType & MQTTSN_FLAG_TOPIC_TYPE;
-		PublishMsg.status = TOPICID_IS_READY;
-		sendPublishMsg( &PublishMsg );
+		MQTTSNPublish_t* msg = &PublishMsg[i];
+
+		if ( strcmp( (const char*)msg->topicName, (const char*)topicName) == 0
+		     && ( msg->status == TOPICID_IS_SUSPEND || msg->status == WAIT_REGACK ) )
+		{
+			msg->topicId = topicId;
+			msg->flag |= topicType & MQTTSN_FLAG_TOPIC_TYPE;
+			msg->status = TOPICID_IS_READY;
+		}
 	}
 }
 
@@ -234,31 +558,13 @@ void SendPubRel( uint16_t msgId)
 	setUint16( buf + 2, msgId );
 
 	DLOG("Send %s msgId: %d\r\n", "PUBREL" , msgId );
-	WriteMsg( buf );
+	HoldMsg( buf );
 }
 
 
-static MQTTSNState_t sendPublishMsg( MQTTSNPublish_t* msg )
-{
-
-	while ( msg->retryCount < MQTTSN_RETRY_COUNT )
-	{
-		LoRaLinkStatus_t stat = sendPublish( msg );
-
-		if ( stat == LORALINK_STATUS_OK )
-		{
-			if ( GetMessage( MQTTSN_TIMEOUT_MS ) > 0 )
-			{
-				return MQTTSN_STATE_OK;
-			}
-		}
-	}
-	return MQTTSN_STATE_RETRY_OUT;
-}
-
 static  LoRaLinkStatus_t sendPublish( MQTTSNPublish_t* msg )
 {
-	uint8_t buf[MQTTSN_MAX_MSG_LENGTH + 1];
+	uint8_t* buf = NULL;
 	LoRaLinkStatus_t stat = LORALINK_STATUS_ERROR;
 
 	if ( msg ==  NULL )
@@ -266,31 +572,25 @@ static  LoRaLinkStatus_t sendPublish( MQTTSNPublish_t* msg )
 		return LORALINK_STATUS_PARAMETER_INVALID;
 	}
 
-	if ( msg->qos != QOS_M1)
-	{
-		Connect();
-	}
-
-
-	if ( msg->retryCount == 0 )
-	{
-
-		buf[0] = (uint8_t)msg->payloadlen + 7;
-		buf[1] = MQTTSN_TYPE_PUBLISH;
-
-		setUint16( buf + 3, msg->topicId );
-		setUint16( buf + 5, msg->msgId );
-		memcpy1( buf + 7, msg->payload, msg->payloadlen);
-	}
-	else
+	if ( msg->retryCount > 0 )
 	{
 		msg->flag |= MQTTSN_FLAG_DUP;
 	}
 
+	// Build the message straight into the LoRaLink frame buffer.
+	// The buffer is encrypted when sent, so the message is rebuilt on every retry.
+	buf = GetMsgBuffer( (uint8_t)msg->payloadlen + 7 );
+	buf[0] = (uint8_t)msg->payloadlen + 7;
+	buf[1] = MQTTSN_TYPE_PUBLISH;
 	buf[2] = msg->flag;
+	setUint16( buf + 3, msg->topicId );
+	setUint16( buf + 5, msg->msgId );
+	memcpy1( buf + 7, msg->payload, msg->payloadlen);
 
-	stat =  WriteMsg( buf );
+	// A message awaiting a response goes with the others of the window
+	stat = ( msg->qos == QOS_1 || msg->qos == QOS_2 ) ? HoldMsg( buf ) : WriteMsg( buf );
 	msg->retryCount++;
+	msg->sendTime = TimerGetCurrentTime();
 
 	if ( stat != LORALINK_STATUS_OK )
 	{
@@ -299,7 +599,7 @@ static  LoRaLinkStatus_t sendPublish( MQTTSNPublish_t* msg )
 
 	RestartPingRequestTimer( );
 
-	DLOG("Send %s msgId: %c%04x\r\n", "PUBLISH", buf[2] & MQTTSN_FLAG_DUP ? '+' : ' ', msg->msgId );
+	DLOG("Send %s msgId: %c%04x\r\n", "PUBLISH", msg->flag & MQTTSN_FLAG_DUP ? '+' : ' ', msg->msgId );
 
 	if ( msg->qos == QOS_0 || msg->qos == QOS_M1 )
 	{
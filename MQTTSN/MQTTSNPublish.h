@@ -12,11 +12,23 @@
 
 #include "MQTTSNTopic.h"
 #include "Payload.h"
+#include "MQTTSNClient.h"
 
 
 MQTTSNState_t PublishByName( uint8_t* topicName, Payload_t* payload, uint8_t qos, bool retain );
 MQTTSNState_t PublishRowdataByName( uint8_t* topicName, uint8_t* rowdata, uint8_t len, uint8_t qos, bool retain );
 MQTTSNState_t PublishRowdataByPredefinedId( uint16_t topicId, uint8_t* rowdata, uint8_t len, uint8_t qos, bool retain );
+
+/*
+ * Non-blocking requests, the payload is copied. 0 when MQTTSN_MAX_INFLIGHT messages are in flight
+ */
+MQTTSNHandle_t PublishByNameAsync( uint8_t* topicName, Payload_t* payload, MQTTSNQos_t qos, bool retain, MQTTSNCallback_t callback );
+MQTTSNHandle_t PublishRowdataByNameAsync( uint8_t* topicName, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain, MQTTSNCallback_t callback );
+MQTTSNHandle_t PublishRowdataByPredefinedIdAsync( uint16_t topicId, uint8_t* rowdata, uint8_t len, MQTTSNQos_t qos, bool retain, MQTTSNCallback_t callback );
+
+bool PublishProcess( void );
+void PublishTimeout( void );
+void PublishAbort( MQTTSNState_t state );
 void ResponcePublish( uint8_t* msg, uint8_t msglen );
 void Published( uint8_t* msg, uint8_t msglen );
 void SendPublishSuspend( uint8_t* topicName, uint16_t topicId, uint8_t topicType );
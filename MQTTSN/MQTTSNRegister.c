@@ -19,18 +19,25 @@
 #include <string.h>
 #include <stdio.h>
 
+#define REG_IDLE     0
+#define REG_READY    1      // REGISTER to be sent
+#define REG_WAIT     2      // REGACK awaited
+
 typedef struct
 {
 	uint8_t topicName[ MQTTSN_MAX_MSG_LENGTH + 1 ];
 	uint16_t msgId;
     uint8_t      retryCount;
+    uint8_t      status;
+    MQTTSNHandle_t   handle;
+    MQTTSNCallback_t callback;
 }MQTTSNRegister_t;
 
 
 MQTTSNRegister_t RegisterMsg = { 0 };
 
 
-static MQTTSNState_t SendRegisterMsg( MQTTSNRegister_t* msg );
+static LoRaLinkStatus_t SendRegister( MQTTSNRegister_t* msg );
 
 
 static void resetRegisterMsg( MQTTSNRegister_t* msg )
@@ -38,32 +45,105 @@ static void resetRegisterMsg( MQTTSNRegister_t* msg )
 	memset1( (uint8_t*)msg, 0, sizeof( MQTTSNRegister_t ) );
 }
 
+static void RegisterDone( MQTTSNState_t state )
+{
+	MQTTSNHandle_t handle = RegisterMsg.handle;
+	MQTTSNCallback_t callback = RegisterMsg.callback;
+
+	resetRegisterMsg( &RegisterMsg );
+	MQTTSNClientComplete( handle, callback, state );
+}
+
 bool IsRegisterDone( void )
 {
-	return *RegisterMsg.topicName == 0;
+	return RegisterMsg.status == REG_IDLE;
 }
 
-MQTTSNState_t RegisterTopic( uint8_t* topicName )
+MQTTSNHandle_t RegisterTopicAsync( uint8_t* topicName, MQTTSNCallback_t callback )
 {
+	if ( RegisterMsg.status != REG_IDLE || strlen( (const char*)topicName ) > MQTTSN_MAX_MSG_LENGTH - 6 )
+	{
+		return 0;
+	}
+	resetRegisterMsg( &RegisterMsg );
 	memcpy1( RegisterMsg.topicName, topicName, strlen( (const char*)topicName) );
 	RegisterMsg.msgId = GetNextMsgId();
-	return SendRegisterMsg( &RegisterMsg );
+	RegisterMsg.callback = callback;
+	RegisterMsg.handle = GetNextHandle();
+	RegisterMsg.status = REG_READY;
+	return RegisterMsg.handle;
+}
+
+MQTTSNState_t RegisterTopic( uint8_t* topicName )
+{
+	return MQTTSNClientWait( RegisterTopicAsync( topicName, NULL ) );
+}
+
+bool RegisterProcess( void )
+{
+	if ( RegisterMsg.status != REG_READY )
+	{
+		return false;
+	}
+
+	if ( SendRegister( &RegisterMsg ) == LORALINK_STATUS_OK )
+	{
+		RegisterMsg.status = REG_WAIT;
+		MQTTSNWaitResponse( MQTTSN_TYPE_REGACK );
+	}
+	else if ( RegisterMsg.retryCount >= MQTTSN_RETRY_COUNT )
+	{
+		RegisterDone( MQTTSN_STATE_RETRY_OUT );
+	}
+	return true;
+}
+
+void RegisterTimeout( void )
+{
+	if ( RegisterMsg.status != REG_WAIT )
+	{
+		return;
+	}
+
+	if ( RegisterMsg.retryCount < MQTTSN_RETRY_COUNT )
+	{
+		RegisterMsg.status = REG_READY;
+	}
+	else
+	{
+		RegisterDone( MQTTSN_STATE_RETRY_OUT );
+	}
 }
 
-MQTTSNState_t ResponceRegAck( uint16_t msgId, uint16_t topicId )
+void RegisterAbort( MQTTSNState_t state )
 {
-	if ( RegisterMsg.msgId == msgId )
+	if ( RegisterMsg.status != REG_IDLE )
 	{
+		RegisterDone( state );
+	}
+}
+
+MQTTSNState_t ResponceRegAck( uint16_t msgId, uint16_t topicId, uint8_t rc )
+{
+	if ( RegisterMsg.status == REG_WAIT && RegisterMsg.msgId == msgId )
+	{
+		MQTTSNWaitDone( MQTTSN_TYPE_REGACK );
+
+		if ( rc != MQTTSN_RC_ACCEPTED )
+		{
+			RegisterDone( MQTTSN_STATE_REJECTED );
+			return MQTTSN_STATE_REJECTED;
+		}
+
 		uint8_t topicType = strlen((const char*) RegisterMsg.topicName) > 2 ? MQTTSN_TOPIC_TYPE_NORMAL : MQTTSN_TOPIC_TYPE_SHORT;
 		SetTopicId( RegisterMsg.topicName, topicId, topicType );
 
 		SendPublishSuspend( RegisterMsg.topicName, topicId, topicType );
-		resetRegisterMsg( &RegisterMsg );
+		RegisterDone( MQTTSN_STATE_OK );
 		return MQTTSN_STATE_OK;
 	}
 	return MQTTSN_STATE_INVALID_MSGID;
 }
-
 void ResponceRegister( uint8_t* msg, uint16_t msglen )
 {
 	// *msg is terminated with 0x00 by Network::getMessage()
@@ -99,26 +179,7 @@ static LoRaLinkStatus_t SendRegister( MQTTSNRegister_t* msg )
 	buf[2] = buf[3] = 0;
 	setUint16( buf + 4, msg->msgId );
 	strcpy( (char*) buf + 6, (const char*)msg->topicName );
-	Connect();
 	stat = WriteMsg(buf);
 	msg->retryCount++;
 	return stat;
 }
-
-static MQTTSNState_t SendRegisterMsg( MQTTSNRegister_t* msg )
-{
-	while ( msg->retryCount < MQTTSN_RETRY_COUNT )
-	{
-		LoRaLinkStatus_t stat = SendRegister( msg );
-
-		if ( stat == LORALINK_STATUS_OK )
-		{
-			if ( GetMessage( MQTTSN_TIMEOUT_MS ) > 0  )
-			{
-				return MQTTSN_STATE_OK;
-			}
-		}
-	}
-	return MQTTSN_STATE_RETRY_OUT;
-}
-
@@ -15,7 +15,11 @@
 
 
 MQTTSNState_t RegisterTopic( uint8_t* topicName );
-MQTTSNState_t ResponceRegAck( uint16_t msgId, uint16_t topicId );
+MQTTSNHandle_t RegisterTopicAsync( uint8_t* topicName, MQTTSNCallback_t callback );
+bool RegisterProcess( void );
+void RegisterTimeout( void );
+void RegisterAbort( MQTTSNState_t state );
+MQTTSNState_t ResponceRegAck( uint16_t msgId, uint16_t topicId, uint8_t rc );
 void ResponceRegister( uint8_t* msg, uint16_t msglen );
 bool IsRegisterDone(void);
 uint8_t checkTimeout();
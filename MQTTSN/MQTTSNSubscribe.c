@@ -19,8 +19,9 @@
 #include <string.h>
 #include <stdio.h>
 
-#define SUB_DONE   1
-#define SUB_READY  0
+#define SUB_IDLE   0
+#define SUB_READY  1      // SUBSCRIBE or UNSUBSCRIBE to be sent
+#define SUB_WAIT   2      // SUBACK or UNSUBACK awaited
 
 
 
@@ -34,82 +35,191 @@ typedef struct subElement
     uint8_t   topicType;
     MQTTSNQos_t   qos;
     uint8_t   retryCount;
+    uint8_t   status;
+    MQTTSNHandle_t   handle;
+    MQTTSNCallback_t done;
 } MQTTSNSubscribe_t;
 
 extern OnPublishList_t theOnPublishList[];
 
-static MQTTSNState_t SendSubscribeMsg( MQTTSNSubscribe_t* msg );
+static LoRaLinkStatus_t SendSubscribeMsg( MQTTSNSubscribe_t* msg );
 
 /*
  *  Subscribe Message
  */
 MQTTSNSubscribe_t  SubscribeMsg = { 0 };
 
+/*
+ *  Next entry of theOnPublishList to subscribe, -1 for none
+ */
+static int16_t SubscribeListIdx = -1;
+
 void ClearSubscribeMsg( MQTTSNSubscribe_t* msg )
 {
 	memset1( (uint8_t*)msg, 0, sizeof( MQTTSNSubscribe_t ) );
 }
 
-void OnConnect( void )
+static void SubscribeDone( MQTTSNState_t state )
 {
-	DLOG("onConnect start\r\n");
-	for ( uint8_t i = 0; theOnPublishList[i].topicName != 0; i++ )
-	{
-		SubscribeByName( theOnPublishList[i].topicName, theOnPublishList[i].pubCallback, theOnPublishList[i].qos );
-	}
-	DLOG("onConnect done\r\n");
+	MQTTSNHandle_t handle = SubscribeMsg.handle;
+	MQTTSNCallback_t done = SubscribeMsg.done;
+
+	ClearSubscribeMsg( &SubscribeMsg );
+	MQTTSNClientComplete( handle, done, state );
 }
 
-void SubscribeByName( uint8_t* topicName, TopicCallback onPublish, MQTTSNQos_t qos )
+static MQTTSNHandle_t SetSubscribeMsg( uint8_t msgType, uint8_t* topicName, uint16_t topicId, uint8_t topicType,
+                                       TopicCallback onPublish, MQTTSNQos_t qos, MQTTSNCallback_t done )
 {
-	uint8_t len = strlen( (const char*)topicName );
-
-	if ( len <= 2 )
+	if ( SubscribeMsg.status != SUB_IDLE || ( topicName != NULL && strlen( (const char*)topicName ) > MQTTSN_MAX_TOPIC_LEN ) )
 	{
-		SubscribeMsg.topicType = MQTTSN_TOPIC_TYPE_SHORT;
+		return 0;
 	}
-	else
+
+	ClearSubscribeMsg( &SubscribeMsg );
+
+	if ( topicName != NULL )
 	{
-		SubscribeMsg.topicType = MQTTSN_TOPIC_TYPE_NORMAL;
+		memcpy1( SubscribeMsg.topicName, topicName, strlen( (const char*)topicName ) );
 	}
-
-	SubscribeMsg.msgType = MQTTSN_TYPE_SUBSCRIBE;
-	memcpy1( SubscribeMsg.topicName, topicName, len );
+	SubscribeMsg.msgType = msgType;
+	SubscribeMsg.topicId = topicId;
+	SubscribeMsg.topicType = topicType;
 	SubscribeMsg.callback = onPublish;
 	SubscribeMsg.qos = qos;
-	SendSubscribeMsg( &SubscribeMsg );
+	SubscribeMsg.done = done;
+	SubscribeMsg.handle = GetNextHandle();
+	SubscribeMsg.status = SUB_READY;
+	return SubscribeMsg.handle;
+}
+
+void OnConnect( void )
+{
+	DLOG("onConnect start\r\n");
+	// Subscribed one by one by SubscribeProcess()
+	SubscribeListIdx = 0;
+}
+
+bool IsSubscribeDone( void )
+{
+	return SubscribeMsg.status == SUB_IDLE && SubscribeListIdx < 0;
+}
+
+MQTTSNHandle_t SubscribeByNameAsync( uint8_t* topicName, TopicCallback onPublish, MQTTSNQos_t qos, MQTTSNCallback_t done )
+{
+	uint8_t topicType = strlen( (const char*)topicName ) <= 2 ? MQTTSN_TOPIC_TYPE_SHORT : MQTTSN_TOPIC_TYPE_NORMAL;
+
+	return SetSubscribeMsg( MQTTSN_TYPE_SUBSCRIBE, topicName, 0, topicType, onPublish, qos, done );
+}
+
+MQTTSNHandle_t SubscribeByIdAsync( uint16_t topicId, uint8_t topicType, TopicCallback onPublish, MQTTSNQos_t qos, MQTTSNCallback_t done )
+{
+	return SetSubscribeMsg( MQTTSN_TYPE_SUBSCRIBE, NULL, topicId, topicType, onPublish, qos, done );
+}
+
+MQTTSNHandle_t UnsubscribeByNameAsync( uint8_t* topicName, MQTTSNCallback_t done )
+{
+	return SetSubscribeMsg( MQTTSN_TYPE_UNSUBSCRIBE, topicName, 0, MQTTSN_TOPIC_TYPE_NORMAL, NULL, 0, done );
+}
+
+MQTTSNHandle_t UnsubscribeByIdAsync( uint16_t topicId, uint8_t topicType, MQTTSNCallback_t done )
+{
+	return SetSubscribeMsg( MQTTSN_TYPE_UNSUBSCRIBE, NULL, topicId, topicType, NULL, 0, done );
+}
+
+void SubscribeByName( uint8_t* topicName, TopicCallback onPublish, MQTTSNQos_t qos )
+{
+	MQTTSNClientWaitIdle();
+	MQTTSNClientWait( SubscribeByNameAsync( topicName, onPublish, qos, NULL ) );
 }
 
 
 void SubscribeById( uint16_t topicId, uint8_t topicType, TopicCallback onPublish, MQTTSNQos_t qos )
 {
-	SubscribeMsg.msgType = MQTTSN_TYPE_SUBSCRIBE;
-	SubscribeMsg.topicId = topicId;
-	SubscribeMsg.topicType = topicType;
-	SubscribeMsg.callback = onPublish;
-	SubscribeMsg.qos = qos;
-	SendSubscribeMsg( &SubscribeMsg );
+	MQTTSNClientWaitIdle();
+	MQTTSNClientWait( SubscribeByIdAsync( topicId, topicType, onPublish, qos, NULL ) );
 }
 
 void UnsubscribeByName( uint8_t* topicName)
 {
-	memcpy1( SubscribeMsg.topicName, topicName, strlen( (const char*)topicName ) );
-	SubscribeMsg.msgType = MQTTSN_TYPE_UNSUBSCRIBE;
-	SubscribeMsg.topicType = MQTTSN_TOPIC_TYPE_NORMAL;
-
-	SendSubscribeMsg( &SubscribeMsg );
+	MQTTSNClientWaitIdle();
+	MQTTSNClientWait( UnsubscribeByNameAsync( topicName, NULL ) );
 }
 
 void UnsubscribeById(uint16_t topicId, uint8_t topicType)
 {
-	SubscribeMsg.topicId = topicId;
-	SubscribeMsg.topicType = topicType;
+	MQTTSNClientWaitIdle();
+	MQTTSNClientWait( UnsubscribeByIdAsync( topicId, topicType, NULL ) );
+}
+
+bool SubscribeProcess( void )
+{
+	if ( SubscribeMsg.status == SUB_IDLE && SubscribeListIdx >= 0 )
+	{
+		OnPublishList_t* entry = &theOnPublishList[ SubscribeListIdx ];
 
-	SendSubscribeMsg( &SubscribeMsg );
+		if ( entry->topicName == 0 )
+		{
+			SubscribeListIdx = -1;
+			DLOG("onConnect done\r\n");
+		}
+		else if ( SubscribeByNameAsync( entry->topicName, entry->pubCallback, entry->qos, NULL ) != 0 )
+		{
+			SubscribeListIdx++;
+		}
+	}
+
+	if ( SubscribeMsg.status != SUB_READY )
+	{
+		return false;
+	}
+
+	if ( SendSubscribeMsg( &SubscribeMsg ) == LORALINK_STATUS_OK )
+	{
+		SubscribeMsg.status = SUB_WAIT;
+		MQTTSNWaitResponse( SubscribeMsg.msgType == MQTTSN_TYPE_SUBSCRIBE ? MQTTSN_TYPE_SUBACK : MQTTSN_TYPE_UNSUBACK );
+	}
+	else if ( SubscribeMsg.retryCount >= MQTTSN_RETRY_COUNT )
+	{
+		SubscribeDone( MQTTSN_STATE_RETRY_OUT );
+	}
+	return true;
+}
+
+void SubscribeTimeout( void )
+{
+	if ( SubscribeMsg.status != SUB_WAIT )
+	{
+		return;
+	}
+
+	if ( SubscribeMsg.retryCount < MQTTSN_RETRY_COUNT )
+	{
+		SubscribeMsg.status = SUB_READY;
+	}
+	else
+	{
+		SubscribeDone( MQTTSN_STATE_RETRY_OUT );
+	}
+}
+
+void SubscribeAbort( MQTTSNState_t state )
+{
+	SubscribeListIdx = -1;
+
+	if ( SubscribeMsg.status != SUB_IDLE )
+	{
+		SubscribeDone( state );
+	}
 }
 
 void ResponceSubscribe( uint8_t* resp )
 {
+	if ( SubscribeMsg.status != SUB_WAIT )
+	{
+		return;
+	}
+
 	if ( resp[1] == MQTTSN_TYPE_SUBACK )
 	{
 		uint16_t topicId;
@@ -129,11 +239,18 @@ void ResponceSubscribe( uint8_t* resp )
 
 		if ( SubscribeMsg.msgId == msgId )
 		{
+			MQTTSNWaitDone( MQTTSN_TYPE_SUBACK );
+			RestartPingRequestTimer();
+
 			if ( rc == MQTTSN_RC_ACCEPTED )
 			{
 				SetTopicId( SubscribeMsg.topicName, topicId, topicType );
+				SubscribeDone( MQTTSN_STATE_OK );
+			}
+			else
+			{
+				SubscribeDone( MQTTSN_STATE_REJECTED );
 			}
-			ClearSubscribeMsg( &SubscribeMsg );
 		}
 	}
 	else if ( resp[1] == MQTTSN_TYPE_UNSUBACK )
@@ -142,14 +259,15 @@ void ResponceSubscribe( uint8_t* resp )
 
 		if ( SubscribeMsg.msgId == msgId )
 		{
-			// NOP;
+			MQTTSNWaitDone( MQTTSN_TYPE_UNSUBACK );
+			RestartPingRequestTimer();
+			SubscribeDone( MQTTSN_STATE_OK );
 		}
-		ClearSubscribeMsg( &SubscribeMsg );
 	}
 }
 
 
-static MQTTSNState_t SendSubscribeMsg( MQTTSNSubscribe_t* msg )
+static LoRaLinkStatus_t SendSubscribeMsg( MQTTSNSubscribe_t* msg )
 {
 	uint8_t buf[MQTTSN_MAX_MSG_LENGTH + 1];
 	uint8_t len = strlen( (const char*)msg->topicName);
@@ -166,6 +284,7 @@ static MQTTSNState_t SendSubscribeMsg( MQTTSNSubscribe_t* msg )
 	}
 	else
 	{
+		msg->retryCount = MQTTSN_RETRY_COUNT;
 		return LORALINK_STATUS_PARAMETER_INVALID;
 	}
 
@@ -175,6 +294,11 @@ static MQTTSNState_t SendSubscribeMsg( MQTTSNSubscribe_t* msg )
 	if ( msg->retryCount == 0 )
 	{
 		msg->msgId = GetNextMsgId();
+
+		if ( msg->msgType == MQTTSN_TYPE_SUBSCRIBE )
+		{
+			MQTTSNTopicAdd( msg->topicName, msg->topicId, msg->topicType, msg->callback );
+		}
 	}
 
 	if ( (msg->retryCount > 0 ) && msg->msgType == MQTTSN_TYPE_SUBSCRIBE )
@@ -184,28 +308,7 @@ static MQTTSNState_t SendSubscribeMsg( MQTTSNSubscribe_t* msg )
 
 	setUint16( buf + 3, msg->msgId );
 
-	MQTTSNTopicAdd( msg->topicName, msg->topicId, msg->topicType, msg->callback );
-
-
-	while ( msg->retryCount < MQTTSN_RETRY_COUNT )
-	{
-		Connect();
-
-		DLOG("Send %s msgId: %c%04x\r\n", GetMsgType( buf[1] ), buf[2] & MQTTSN_FLAG_DUP ? '+' : ' ', msg->msgId );
-		LoRaLinkStatus_t stat = WriteMsg( buf );
-
-		msg->retryCount++;
-
-		if ( stat == LORALINK_STATUS_OK )
-		{
-			if ( GetMessage( MQTTSN_TIMEOUT_MS ) > 0 )
-			{
-				RestartPingRequestTimer();
-				return MQTTSN_STATE_OK;
-			}
-		}
-
-	}
-	return MQTTSN_STATE_RETRY_OUT;
+	DLOG("Send %s msgId: %c%04x\r\n", GetMsgType( buf[1] ), buf[2] & MQTTSN_FLAG_DUP ? '+' : ' ', msg->msgId );
+	msg->retryCount++;
+	return WriteMsg( buf );
 }
-
@@ -11,6 +11,7 @@
 #define MQTTSNSUBSCRIB_H_
 
 #include "MQTTSNTopic.h"
+#include "MQTTSNClient.h"
 
 
 
@@ -19,8 +20,20 @@ void SubscribeByName( uint8_t* topicName, TopicCallback onPublish, MQTTSNQos_t q
 void SubscribeById( uint16_t topicId, uint8_t topicType, TopicCallback onPublish, MQTTSNQos_t qos );
 void UnsubscribeByName( uint8_t* topicName );
 void UnsubscribeById( uint16_t topicId, uint8_t topicType );
+
+/*
+ * Non-blocking requests, 0 when the previous one is not completed
+ */
+MQTTSNHandle_t SubscribeByNameAsync( uint8_t* topicName, TopicCallback onPublish, MQTTSNQos_t qos, MQTTSNCallback_t done );
+MQTTSNHandle_t SubscribeByIdAsync( uint16_t topicId, uint8_t topicType, TopicCallback onPublish, MQTTSNQos_t qos, MQTTSNCallback_t done );
+MQTTSNHandle_t UnsubscribeByNameAsync( uint8_t* topicName, MQTTSNCallback_t done );
+MQTTSNHandle_t UnsubscribeByIdAsync( uint16_t topicId, uint8_t topicType, MQTTSNCallback_t done );
+
+bool SubscribeProcess( void );
+void SubscribeTimeout( void );
+void SubscribeAbort( MQTTSNState_t state );
 void GetSubscribeResponce( uint8_t* msg );
-//bool IsSubscribeDone( void );
+bool IsSubscribeDone( void );
 void ResponceSubscribe( uint8_t* resp );
 //bool ChecktSubscribeRetryOut( void );
 
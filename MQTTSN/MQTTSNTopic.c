@@ -65,7 +65,7 @@ MQTTSNTopic_t* MQTTSNTopicAdd( uint8_t* topicName, uint16_t id, uint8_t type, To
 			prev = last;
 			if ( prev->Next != NULL )
 			{
-				last = prev;
+				last = prev->Next;
 			}
 			else
 			{
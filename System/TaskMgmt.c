@@ -395,6 +395,9 @@ static void Task_run(void)
 
 	while ( true )
 	{
+		// Requests of the tasks are sent before sleeping, responses are received after waking up
+		MQTTSNClientProcess();
+
 		if ( TaskListHead == 0 )
 		{
 			execTime = SysTimeGet().Seconds + 24 * 60 * TASK_EXECUTION_TIME_UNIT;  // 24 Hours
@@ -410,8 +413,6 @@ static void Task_run(void)
 			DeviceLowPowerHandler( );
 		}
 
-		CheckPingRequest();
-
 		if ( Task_Int0Cnt > 0 )
 		{
 			Task_Int0Cnt--;
@@ -0,0 +1,272 @@
+/**************************************************************************************
+ *
+ * HostRadio.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostRadio.h"
+#include "HostStub.h"
+#include "sx1276.h"
+#include "LoRaLink.h"
+#include "LoRaLinkCrypto.h"
+
+HostRadio_t HostRadio;
+void ( *HostRadioTxHook )( uint8_t* buffer, uint8_t size, uint32_t timeOnAir ) = NULL;
+bool ( *HostRadioBusyHook )( uint32_t frequency ) = NULL;
+bool ( *HostRadioCadHook )( uint32_t sfValue ) = NULL;
+
+static RadioEvents_t* Events = NULL;
+static TimerEvent_t RadioTimer;
+static uint16_t SymbTimeout = 0;
+static uint8_t TxBuffer[256];
+static uint8_t RxBuffer[256];
+
+static void OnRadioTimer( void* context );
+static uint32_t SymbolTime( void );
+
+
+void HostRadioInit( void )
+{
+	memset( &HostRadio, 0, sizeof(HostRadio) );
+	HostRadioTxHook = NULL;
+	HostRadioBusyHook = NULL;
+	HostRadioCadHook = NULL;
+	TimerInit( &RadioTimer, OnRadioTimer );
+}
+
+bool HostRadioReceive( uint8_t* payload, uint8_t size, int16_t rssi, int8_t snr )
+{
+	if ( HostRadio.State != RF_RX_RUNNING )
+	{
+		return false;
+	}
+	TimerStop( &RadioTimer );
+	if ( HostRadio.RxContinuous == false )
+	{
+		HostRadio.State = RF_IDLE;
+	}
+	memcpy( RxBuffer, payload, size );
+	if ( Events != NULL && Events->RxDone != NULL )
+	{
+		Events->RxDone( RxBuffer, size, rssi, snr );
+	}
+	return true;
+}
+
+uint8_t HostRadioFrame( uint8_t* buffer, uint16_t panId, uint8_t destAddr, uint8_t srcAddr, uint8_t payloadType,
+                        uint8_t* payload, uint8_t len )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+
+	pkt.Buffer = buffer;
+	pkt.PanId = panId;
+	pkt.DestAddr = destAddr;
+	pkt.SourceAddr = srcAddr;
+	pkt.FRMPayloadType = payloadType;
+	pkt.FRMPayload = payload;
+	pkt.FRMPayloadSize = len;
+	if ( LoRaLinkSerializeData( &pkt ) != LORALINK_STATUS_OK )
+	{
+		return 0;
+	}
+	pkt.FRMPayload = buffer + LORALINK_HDR_LEN;
+	LoRaLinkCryptoSecureMessage( &pkt );
+	return pkt.BufSize;
+}
+
+/*
+ * Time of one symbol in ms, at least 1
+ */
+static uint32_t SymbolTime( void )
+{
+	uint32_t t = ( 1UL << HostRadio.SFValue ) / ( 125UL << HostRadio.Bandwidth );
+
+	return t > 0 ? t : 1;
+}
+
+static void OnRadioTimer( void* context )
+{
+	RadioState_t state = HostRadio.State;
+
+	( void )context;
+	HostRadio.State = RF_IDLE;
+
+	if ( state == RF_TX_RUNNING )
+	{
+		if ( Events != NULL && Events->TxDone != NULL )
+		{
+			Events->TxDone();
+		}
+	}
+	else if ( state == RF_RX_RUNNING )
+	{
+		if ( Events != NULL && Events->RxTimeout != NULL )
+		{
+			Events->RxTimeout();
+		}
+	}
+	else if ( state == RF_CAD )
+	{
+		if ( Events != NULL && Events->CadDone != NULL )
+		{
+			Events->CadDone( HostRadioCadHook != NULL && HostRadioCadHook( HostRadio.SFValue ) );
+		}
+	}
+}
+
+/*
+ * sx1276.h
+ */
+void SX1276Init( RadioEvents_t *events )
+{
+	Events = events;
+	HostRadio.State = RF_IDLE;
+}
+
+RadioState_t SX1276GetStatus( void )
+{
+	return HostRadio.State;
+}
+
+void SX1276SetChannel( uint32_t freq )
+{
+	HostRadio.Frequency = freq;
+}
+
+bool SX1276IsChannelFree( uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime )
+{
+	( void )rssiThresh;
+	HostRadio.CarrierSenses++;
+	HostRunUntil( HostTime + maxCarrierSenseTime );
+	return HostRadioBusyHook == NULL || HostRadioBusyHook( freq ) == false;
+}
+
+bool SX1276IsChannelFreeCad( uint32_t freq, int16_t rssiThresh, uint32_t maxCarrierSenseTime )
+{
+	return SX1276IsChannelFree( freq, rssiThresh, maxCarrierSenseTime );
+}
+
+void SX1276SetRxConfig( RadioModems_t modem, uint32_t bandwidth,
+                         uint32_t datarate, uint8_t coderate,
+                         uint32_t bandwidthAfc, uint16_t preambleLen,
+                         uint16_t symbTimeout, bool fixLen,
+                         uint8_t payloadLen,
+                         bool crcOn, bool freqHopOn, uint8_t hopPeriod,
+                         bool iqInverted, bool rxContinuous )
+{
+	HostRadio.Bandwidth = bandwidth;
+	HostRadio.SFValue = datarate;
+	HostRadio.PreambleLen = preambleLen;
+	HostRadio.ImplicitHeader = fixLen;
+	HostRadio.CrcOn = crcOn;
+	HostRadio.RxContinuous = rxContinuous;
+	HostRadio.SetupUs += HostRadio.ConfigUs;
+	SymbTimeout = symbTimeout;
+}
+
+void SX1276SetTxConfig( RadioModems_t modem, int8_t power, uint32_t fdev,
+                        uint32_t bandwidth, uint32_t datarate,
+                        uint8_t coderate, uint16_t preambleLen,
+                        bool fixLen, bool crcOn, bool freqHopOn,
+                        uint8_t hopPeriod, bool iqInverted, uint32_t timeout )
+{
+	HostRadio.Bandwidth = bandwidth;
+	HostRadio.SFValue = datarate;
+	HostRadio.TxPower = power;
+	HostRadio.PreambleLen = preambleLen;
+	HostRadio.ImplicitHeader = fixLen;
+	HostRadio.CrcOn = crcOn;
+}
+
+uint32_t SX1276GetTimeOnAir( RadioModems_t modem, uint8_t pktLen )
+{
+	return HostTimeOnAir( HostRadio.Bandwidth, HostRadio.SFValue, 1, HostRadio.PreambleLen,
+	                      HostRadio.ImplicitHeader, HostRadio.CrcOn, pktLen );
+}
+
+uint32_t SX1276GetLoRaTimeOnAir( uint32_t bandwidth, uint32_t datarate, uint8_t coderate, uint16_t preambleLen,
+                                 bool fixLen, bool crcOn, uint8_t pktLen )
+{
+	return HostTimeOnAir( bandwidth, datarate, coderate, preambleLen, fixLen, crcOn, pktLen );
+}
+
+void SX1276Send( uint8_t *buffer, uint8_t size )
+{
+	uint32_t timeOnAir = SX1276GetTimeOnAir( MODEM_LORA, size );
+
+	memcpy( TxBuffer, buffer, size );
+	HostRadio.State = RF_TX_RUNNING;
+	HostRadio.TxFrames++;
+	TimerSetValue( &RadioTimer, timeOnAir );
+	TimerStart( &RadioTimer );
+	if ( HostRadioTxHook != NULL )
+	{
+		HostRadioTxHook( TxBuffer, size, timeOnAir );
+	}
+}
+
+void SX1276SetSleep( void )
+{
+	SX1276SetStby();
+	HostRadio.TcxoOn = false;
+}
+
+void SX1276SetStby( void )
+{
+	TimerStop( &RadioTimer );
+	HostRadio.State = RF_IDLE;
+}
+
+void SX1276SetRx( uint32_t timeout )
+{
+	if ( HostRadio.TcxoOn == false )
+	{
+		HostRadio.SetupUs += HostRadio.WakeUpUs;
+		HostRadio.TcxoOn = true;
+	}
+	TimerStop( &RadioTimer );
+	HostRadio.State = RF_RX_RUNNING;
+	HostRadio.RxSince = HostTime + ( HostRadio.SetupUs + 999 ) / 1000;
+	HostRadio.SetupUs = 0;
+	HostRadio.RxStarts++;
+	if ( timeout == 0 && HostRadio.RxContinuous == false )
+	{
+		// Single Rx ends by the symbol timeout unless a preamble is locked
+		timeout = ( SymbTimeout > 0 ? SymbTimeout : 1 ) * SymbolTime();
+		if ( (int32_t)( HostRadio.LockUntil - HostTime ) >= (int32_t)timeout )
+		{
+			timeout = HostRadio.LockUntil - HostTime + 1;
+		}
+	}
+	if ( timeout > 0 )
+	{
+		TimerSetValue( &RadioTimer, timeout );
+		TimerStart( &RadioTimer );
+	}
+}
+
+void SX1276StartCad( void )
+{
+	TimerStop( &RadioTimer );
+	HostRadio.State = RF_CAD;
+	HostRadio.RxStarts++;
+	TimerSetValue( &RadioTimer, 2 * SymbolTime() );
+	TimerStart( &RadioTimer );
+}
+
+int32_t SX1276GetFrequencyError( void )
+{
+	return 0;
+}
+
+void SX1276SetMaxPayloadLength( RadioModems_t modem, uint8_t max )
+{
+}
+
+void SX1276SetSyncword( uint8_t syncword )
+{
+}
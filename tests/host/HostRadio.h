@@ -0,0 +1,78 @@
+/**************************************************************************************
+ *
+ * HostRadio.h
+ *
+ * SX1276 driver functions used by LoRaLink.c, simulated for the host tests.
+ * A frame sent by the modem is passed to HostRadioTxHook, a frame sent by a peer
+ * is put on the air by HostRadioReceive().
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef HOSTRADIO_H_
+#define HOSTRADIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "radio.h"
+#include "timer.h"
+
+typedef struct
+{
+	RadioState_t State;
+	uint32_t Frequency;
+	uint32_t SFValue;              // of the last Rx or Tx configuration
+	int8_t TxPower;                // of the last Tx configuration
+	uint32_t Bandwidth;
+	uint16_t PreambleLen;
+	bool ImplicitHeader;
+	bool CrcOn;
+	bool RxContinuous;
+	TimerTime_t RxSince;           // start of the Rx running now, after the setup below
+	TimerTime_t LockUntil;         // a single Rx does not time out before, a preamble is locked
+	uint32_t RxStarts;             // SX1276SetRx() and SX1276StartCad() calls
+	uint32_t TxFrames;
+	uint32_t CarrierSenses;
+
+	// Setup before the receiver listens, 0 unless a test sets them after HostRadioInit()
+	uint32_t ConfigUs;             // register writes of SX1276SetRxConfig()
+	uint32_t WakeUpUs;             // TCXO start of SX1276SetRx() after SX1276SetSleep()
+	uint32_t SetupUs;              // owed by the next SX1276SetRx()
+	bool TcxoOn;
+}HostRadio_t;
+
+extern HostRadio_t HostRadio;
+
+/*!
+ * Called by SX1276Send() with the frame and its time on air, TxDone follows after it
+ */
+extern void ( *HostRadioTxHook )( uint8_t* buffer, uint8_t size, uint32_t timeOnAir );
+
+/*!
+ * Result of the carrier sense and of the CAD, NULL for a free channel and no preamble
+ */
+extern bool ( *HostRadioBusyHook )( uint32_t frequency );
+extern bool ( *HostRadioCadHook )( uint32_t sfValue );
+
+void HostRadioInit( void );
+
+/*!
+ * Frame of a peer ends now, false when the radio does not receive it
+ */
+bool HostRadioReceive( uint8_t* payload, uint8_t size, int16_t rssi, int8_t snr );
+
+/*!
+ * Frame of a peer secured with the key given to LoRaLink, returns its length
+ */
+uint8_t HostRadioFrame( uint8_t* buffer, uint16_t panId, uint8_t destAddr, uint8_t srcAddr, uint8_t payloadType,
+                        uint8_t* payload, uint8_t len );
+
+/*!
+ * Time on air in ms by the floating point formula of the SX1276 datasheet
+ */
+uint32_t HostTimeOnAir( uint32_t bandwidth, uint32_t datarate, uint8_t coderate, uint16_t preambleLen,
+                        bool fixLen, bool crcOn, uint8_t pktLen );
+
+#endif /* HOSTRADIO_H_ */
@@ -0,0 +1,417 @@
+/**************************************************************************************
+ *
+ * HostStub.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "systime.h"
+#include "eeprom.h"
+#include "uart.h"
+#include "device.h"
+#include "delay.h"
+
+int HostFailures = 0;
+TimerTime_t HostTime = 0;
+void ( *HostIdleHook )( void ) = NULL;
+uint32_t HostIdleCount = 0;
+
+uint8_t HostEeprom[HOST_EEPROM_SIZE];
+uint32_t HostEepromWrites = 0;
+
+uint8_t HostUartRx[HOST_UART_BUF_LEN];
+uint16_t HostUartRxHead = 0;
+uint16_t HostUartRxTail = 0;
+uint8_t HostUartTx[HOST_UART_BUF_LEN];
+uint16_t HostUartTxLen = 0;
+uint32_t HostUartBusy = 0;
+uint32_t HostUartBaudrate = 0;
+uint16_t HostUartDmaSize = 0;
+bool HostUartDma = true;
+static bool HostUartLost = false;
+static bool HostUartOverrun = false;
+void ( *HostUartPollHook )( void ) = NULL;
+
+/*
+ * Running timers, not sorted
+ */
+static TimerEvent_t* TimerList = NULL;
+static SysTime_t SysTimeBase = { 0 };
+
+/*
+ * Referred to by the free memory check of utilities.c
+ */
+char __bss_end__;
+
+
+void HostCheck( bool cond, const char* expr, const char* file, int line )
+{
+	if ( cond == false )
+	{
+		printf( "%s:%d: check failed: %s\n", file, line, expr );
+		HostFailures++;
+	}
+}
+
+int HostResult( const char* name )
+{
+	printf( "%s: %s\n", name, HostFailures == 0 ? "OK" : "FAILED" );
+	return HostFailures == 0 ? 0 : 1;
+}
+
+void HostReset( TimerTime_t now )
+{
+	HostTime = now;
+	TimerList = NULL;
+	HostIdleHook = NULL;
+	HostIdleCount = 0;
+	HostUartClear();
+}
+
+bool HostNextTimer( TimerTime_t* expiry )
+{
+	TimerEvent_t* next = NULL;
+
+	for ( TimerEvent_t* obj = TimerList; obj != NULL; obj = obj->Next )
+	{
+		if ( next == NULL || (int32_t)( obj->Timestamp - next->Timestamp ) < 0 )
+		{
+			next = obj;
+		}
+	}
+	if ( next != NULL )
+	{
+		*expiry = next->Timestamp;
+	}
+	return next != NULL;
+}
+
+void HostRunUntil( TimerTime_t time )
+{
+	TimerTime_t expiry = 0;
+
+	while ( HostNextTimer( &expiry ) == true && (int32_t)( expiry - time ) <= 0 )
+	{
+		HostRunNext();
+	}
+	if ( (int32_t)( time - HostTime ) > 0 )
+	{
+		HostTime = time;
+	}
+}
+
+bool HostRunNext( void )
+{
+	TimerEvent_t* next = NULL;
+	TimerTime_t expiry = 0;
+
+	if ( HostNextTimer( &expiry ) == false )
+	{
+		return false;
+	}
+	for ( next = TimerList; next->Timestamp != expiry; next = next->Next )
+	{
+	}
+	TimerStop( next );
+	if ( (int32_t)( expiry - HostTime ) > 0 )
+	{
+		HostTime = expiry;
+	}
+	if ( next->Callback != NULL )
+	{
+		next->Callback( next->Context );
+	}
+	return true;
+}
+
+void HostUartWrite( const uint8_t* data, uint16_t len )
+{
+	if ( HostUartRxTail == HostUartRxHead )
+	{
+		HostUartRxHead = 0;
+		HostUartRxTail = 0;
+	}
+	if ( HostUartRxTail + len > HOST_UART_BUF_LEN )
+	{
+		memmove( HostUartRx, HostUartRx + HostUartRxHead, HostUartRxTail - HostUartRxHead );
+		HostUartRxTail -= HostUartRxHead;
+		HostUartRxHead = 0;
+	}
+	memcpy( HostUartRx + HostUartRxTail, data, len );
+	HostUartRxTail += len;
+	if ( HostUartDmaSize > 0 && HostUartRxTail - HostUartRxHead >= HostUartDmaSize )
+	{
+		// The DMA wrote over bytes not read yet
+		HostUartLost = true;
+	}
+}
+
+void HostUartClear( void )
+{
+	HostUartRxHead = 0;
+	HostUartRxTail = 0;
+	HostUartTxLen = 0;
+	HostUartBusy = 0;
+	HostUartPollHook = NULL;
+	HostUartDmaSize = 0;
+	HostUartDma = true;
+	HostUartLost = false;
+	HostUartOverrun = false;
+}
+
+/*
+ * timer.h
+ */
+void TimerInit( TimerEvent_t *obj, void ( *callback )( void *context ) )
+{
+	obj->Timestamp = 0;
+	obj->ReloadValue = 0;
+	obj->IsStarted = false;
+	obj->IsNext2Expire = false;
+	obj->Callback = callback;
+	obj->Context = NULL;
+	obj->Next = NULL;
+}
+
+void TimerSetContext( TimerEvent_t *obj, void* context )
+{
+	obj->Context = context;
+}
+
+void TimerStart( TimerEvent_t *obj )
+{
+	if ( obj->IsStarted == true )
+	{
+		TimerStop( obj );
+	}
+	obj->Timestamp = HostTime + obj->ReloadValue;
+	obj->IsStarted = true;
+	obj->Next = TimerList;
+	TimerList = obj;
+}
+
+bool TimerIsStarted( TimerEvent_t *obj )
+{
+	return obj->IsStarted;
+}
+
+void TimerStop( TimerEvent_t *obj )
+{
+	for ( TimerEvent_t** pos = &TimerList; *pos != NULL; pos = &( *pos )->Next )
+	{
+		if ( *pos == obj )
+		{
+			*pos = obj->Next;
+			break;
+		}
+	}
+	obj->IsStarted = false;
+	obj->Next = NULL;
+}
+
+void TimerReset( TimerEvent_t *obj )
+{
+	TimerStop( obj );
+	TimerStart( obj );
+}
+
+void TimerSetValue( TimerEvent_t *obj, uint32_t value )
+{
+	TimerStop( obj );
+	obj->ReloadValue = value;
+}
+
+TimerTime_t TimerGetCurrentTime( void )
+{
+	return HostTime;
+}
+
+TimerTime_t TimerGetElapsedTime( TimerTime_t past )
+{
+	if ( past == 0 )
+	{
+		return 0;
+	}
+	return HostTime - past;
+}
+
+/*
+ * systime.h, UTC runs with the simulated clock
+ */
+SysTime_t SysTimeSub( SysTime_t a, SysTime_t b )
+{
+	SysTime_t c = { .Seconds = 0, .SubSeconds = 0 };
+
+	c.Seconds = a.Seconds - b.Seconds;
+	c.SubSeconds = a.SubSeconds - b.SubSeconds;
+	if ( c.SubSeconds < 0 )
+	{
+		c.Seconds--;
+		c.SubSeconds += 1000;
+	}
+	return c;
+}
+
+void SysTimeSet( SysTime_t sysTime )
+{
+	SysTime_t now = { .Seconds = HostTime / 1000, .SubSeconds = HostTime % 1000 };
+
+	SysTimeBase = SysTimeSub( sysTime, now );
+}
+
+SysTime_t SysTimeGet( void )
+{
+	SysTime_t t = { .Seconds = SysTimeBase.Seconds + HostTime / 1000, .SubSeconds = SysTimeBase.SubSeconds + HostTime % 1000 };
+
+	if ( t.SubSeconds >= 1000 )
+	{
+		t.Seconds++;
+		t.SubSeconds -= 1000;
+	}
+	return t;
+}
+
+/*
+ * device.h, delay.h
+ */
+void DeviceCriticalSectionBegin( uint32_t *mask )
+{
+	*mask = 0;
+}
+
+void DeviceCriticalSectionEnd( uint32_t *mask )
+{
+	( void )mask;
+}
+
+void DeviceLowPowerHandler( void )
+{
+	HostIdleCount++;
+	if ( HostIdleHook != NULL )
+	{
+		HostIdleHook();
+	}
+	else
+	{
+		HostRunNext();
+	}
+}
+
+void DisableLowPower( void )
+{
+}
+
+void DelayMs( uint32_t ms )
+{
+	HostRunUntil( HostTime + ms );
+}
+
+/*
+ * eeprom.h
+ */
+uint8_t EepromWriteBuffer( uint16_t addr, uint8_t *buffer, uint16_t size )
+{
+	if ( addr + size > HOST_EEPROM_SIZE )
+	{
+		return 0;
+	}
+	memcpy( HostEeprom + addr, buffer, size );
+	HostEepromWrites += size;
+	return 1;
+}
+
+uint8_t EepromReadBuffer( uint16_t addr, uint8_t *buffer, uint16_t size )
+{
+	if ( addr + size > HOST_EEPROM_SIZE )
+	{
+		return 0;
+	}
+	memcpy( buffer, HostEeprom + addr, size );
+	return 1;
+}
+
+/*
+ * uart.h, the DMA buffer is HostUartRx. Weak, TestUartTx links uart.c instead.
+ */
+__attribute__(( weak )) uint8_t UartStartRxDma( void )
+{
+	return 0;
+}
+
+__attribute__(( weak )) uint8_t UartStartTxDma( void )
+{
+	return 0;
+}
+
+__attribute__(( weak )) uint16_t UartPeekBuffer( uint8_t **data )
+{
+	if ( HostUartPollHook != NULL )
+	{
+		HostUartPollHook();
+	}
+	if ( HostUartLost == true )
+	{
+		// Dropped up to the write index as uart.c does
+		HostUartRxHead = HostUartRxTail;
+		HostUartLost = false;
+		HostUartOverrun = true;
+	}
+	*data = HostUartRx + HostUartRxHead;
+	return HostUartDma == true ? HostUartRxTail - HostUartRxHead : 0;
+}
+
+__attribute__(( weak )) void UartSkipBuffer( uint16_t size )
+{
+	HostUartRxHead += size;
+}
+
+__attribute__(( weak )) bool UartIsRxOverrun( void )
+{
+	bool overrun = HostUartOverrun;
+
+	HostUartOverrun = false;
+	return overrun;
+}
+
+__attribute__(( weak )) uint8_t UartGetChar( uint8_t *data )
+{
+	if ( HostUartDma == true || HostUartRxHead == HostUartRxTail )
+	{
+		return 1;
+	}
+	*data = HostUartRx[HostUartRxHead++];
+	return 0;
+}
+
+__attribute__(( weak )) uint8_t UartPutBlock( uint8_t *buffer, uint16_t size )
+{
+	if ( HostUartBusy > 0 )
+	{
+		HostUartBusy--;
+		return 1;
+	}
+	if ( HostUartTxLen + size > HOST_UART_BUF_LEN )
+	{
+		// Nobody reads the frames, keep the latest
+		HostUartTxLen = 0;
+	}
+	memcpy( HostUartTx + HostUartTxLen, buffer, size );
+	HostUartTxLen += size;
+	return 0;
+}
+
+__attribute__(( weak )) uint8_t UartSetBaudrate( uint32_t baudrate, FlowCtrl_t flowCtrl )
+{
+	( void )flowCtrl;
+	HostUartBaudrate = baudrate;
+	return 0;
+}
+
+__attribute__(( weak )) bool UartIsFlowCtrlSupported( void )
+{
+	return true;
+}
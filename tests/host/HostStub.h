@@ -0,0 +1,92 @@
+/**************************************************************************************
+ *
+ * HostStub.h
+ *
+ * Board functions of the firmware for the host tests: a simulated clock that runs
+ * the timers, the data EEPROM in RAM and a UART that is a pair of byte buffers.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef HOSTSTUB_H_
+#define HOSTSTUB_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+
+/*!
+ * Checks of the tests, a failure is reported and counted, the test goes on
+ */
+extern int HostFailures;
+
+#define CHECK( cond )    HostCheck( ( cond ), #cond, __FILE__, __LINE__ )
+
+void HostCheck( bool cond, const char* expr, const char* file, int line );
+int HostResult( const char* name );
+
+/*!
+ * Simulated clock in ms, the timers expire when the clock is moved past them
+ */
+extern TimerTime_t HostTime;
+
+void HostReset( TimerTime_t now );
+
+/*!
+ * Expiry of the next running timer, false when none is running
+ */
+bool HostNextTimer( TimerTime_t* expiry );
+
+/*!
+ * Move the clock to time and run the timers expiring on the way
+ */
+void HostRunUntil( TimerTime_t time );
+
+/*!
+ * Move the clock to the next timer and run it, false when none is running
+ */
+bool HostRunNext( void );
+
+/*!
+ * DeviceLowPowerHandler() calls the hook, HostRunNext() when it is NULL
+ */
+extern void ( *HostIdleHook )( void );
+extern uint32_t HostIdleCount;
+
+/*!
+ * Data EEPROM
+ */
+#define HOST_EEPROM_SIZE   6144
+
+extern uint8_t HostEeprom[HOST_EEPROM_SIZE];
+extern uint32_t HostEepromWrites;     // bytes written
+
+/*!
+ * UART: bytes from the host wait in HostUartRx, UartPeekBuffer() returns them as
+ * the DMA buffer would. The bytes sent by the modem are appended to HostUartTx.
+ */
+#define HOST_UART_BUF_LEN  8192
+
+extern uint8_t HostUartRx[HOST_UART_BUF_LEN];
+extern uint16_t HostUartRxHead;
+extern uint16_t HostUartRxTail;
+extern uint8_t HostUartTx[HOST_UART_BUF_LEN];
+extern uint16_t HostUartTxLen;
+extern uint32_t HostUartBusy;         // UartPutBlock() calls that fail before the next succeeds
+extern uint32_t HostUartBaudrate;
+extern uint16_t HostUartDmaSize;      // DMA buffer size, more bytes not read are overwritten; 0: no limit
+extern bool HostUartDma;              // false: the bytes come by UartGetChar() as without DMA
+
+/*!
+ * Called by UartPeekBuffer(), once in each pass of the LoRaLinkUart() loop
+ */
+extern void ( *HostUartPollHook )( void );
+
+void HostUartWrite( const uint8_t* data, uint16_t len );
+void HostUartClear( void );
+
+#endif /* HOSTSTUB_H_ */
@@ -0,0 +1,29 @@
+/**************************************************************************************
+ *
+ * HostToa.c
+ *
+ * Time on air by the floating point formula the driver used before the integer one,
+ * the reference of TestTimeOnAir and the time on air of HostRadio.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <math.h>
+#include "HostRadio.h"
+
+uint32_t HostTimeOnAir( uint32_t bandwidth, uint32_t datarate, uint8_t coderate, uint16_t preambleLen,
+                        bool fixLen, bool crcOn, uint8_t pktLen )
+{
+	double bw = 125000.0 * ( 1 << bandwidth );
+	bool ldro = ( bandwidth == 0 && ( datarate == 11 || datarate == 12 ) ) || ( bandwidth == 1 && datarate == 12 );
+	double rs = bw / ( 1 << datarate );
+	double ts = 1 / rs;
+	double tPreamble = ( preambleLen + 4.25 ) * ts;
+	double tmp = ceil( ( 8.0 * pktLen - 4.0 * datarate + 28 + 16 * crcOn - ( fixLen ? 20 : 0 ) ) /
+	                   ( 4.0 * ( datarate - ( ldro ? 2 : 0 ) ) ) ) * ( coderate + 4 );
+	double nPayload = 8 + ( ( tmp > 0 ) ? tmp : 0 );
+
+	return floor( ( tPreamble + nPayload * ts ) * 1000 + 0.999 );
+}
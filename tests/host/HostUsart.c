@@ -0,0 +1,296 @@
+/**************************************************************************************
+ *
+ * HostUsart.c
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostUsart.h"
+#include "gpio.h"
+
+USART_TypeDef HostUsart1;
+DMA_Channel_TypeDef HostDma1Channel2;
+DMA_Channel_TypeDef HostDma1Channel3;
+RCC_TypeDef HostRcc;
+HostUsart_t HostUsart;
+void ( *HostUsartTxHook )( uint8_t data ) = NULL;
+
+extern void USART1_IRQHandler( void );
+extern void DMA1_Channel2_3_IRQHandler( void );
+
+/*
+ * Time in ns, a byte takes ByteNs from the TDR through the shift register
+ */
+static uint64_t Now = 0;
+static uint64_t ByteNs = 0;
+static UART_HandleTypeDef* Handle = NULL;
+static uint8_t* TxPtr = NULL;
+static uint16_t TxCount = 0;
+static bool TxByDma = false;
+static bool DmaDone = false;
+static bool TdrFull = false;
+static uint8_t Tdr = 0;
+static bool Shifting = false;
+static uint8_t Shift = 0;
+static uint64_t ShiftEnd = 0;
+
+
+/*
+ * What the hardware does without the CPU: the shift register takes the TDR, the DMA fills it
+ */
+static void Settle( void )
+{
+	bool moved = true;
+
+	while ( moved == true )
+	{
+		moved = false;
+		if ( Shifting == false && TdrFull == true )
+		{
+			Shift = Tdr;
+			TdrFull = false;
+			Shifting = true;
+			ShiftEnd = Now + ByteNs;
+			moved = true;
+		}
+		if ( TxByDma == true && TxCount > 0 && TdrFull == false && ( HostUsart1.CR3 & USART_CR3_DMAT ) != 0 )
+		{
+			Tdr = *TxPtr++;
+			TdrFull = true;
+			DmaDone = ( --TxCount == 0 );
+			moved = true;
+		}
+	}
+}
+
+static void Advance( uint64_t to )
+{
+	while ( Shifting == true && ShiftEnd <= to )
+	{
+		Now = ShiftEnd;
+		Shifting = false;
+		HostUsart.Us = Now / 1000;
+		HostUsart.TxBytes++;
+		if ( HostUsartTxHook != NULL )
+		{
+			HostUsartTxHook( Shift );
+		}
+		Settle();
+	}
+	if ( to > Now )
+	{
+		Now = to;
+	}
+	HostUsart.Us = Now / 1000;
+}
+
+static bool UsartIrqPending( void )
+{
+	return ( ( HostUsart1.CR1 & USART_CR1_TXEIE ) != 0 && TdrFull == false ) ||
+	       ( ( HostUsart1.CR1 & USART_CR1_TCIE ) != 0 && TdrFull == false && Shifting == false );
+}
+
+/*
+ * Runs an interrupt if one is pending, the wire goes on meanwhile
+ */
+static bool TakeIrq( void )
+{
+	uint64_t end = 0;
+
+	Settle();
+	if ( DmaDone == false && UsartIrqPending() == false )
+	{
+		return false;
+	}
+	end = Now + HOST_USART_ISR_US * 1000;
+	HostUsart.Irqs++;
+	HostUsart.IrqUs += HOST_USART_ISR_US;
+	if ( DmaDone == true )
+	{
+		DMA1_Channel2_3_IRQHandler();
+	}
+	else
+	{
+		USART1_IRQHandler();
+	}
+	Settle();
+	Advance( end );
+	return true;
+}
+
+void HostUsartInit( uint32_t baudrate )
+{
+	memset( &HostUsart, 0, sizeof(HostUsart) );
+	memset( &HostUsart1, 0, sizeof(HostUsart1) );
+	HostUsart.Baudrate = baudrate;
+	HostUsartTxHook = NULL;
+	Now = 0;
+	ByteNs = 10ULL * 1000000000ULL / baudrate;
+	TxPtr = NULL;
+	TxCount = 0;
+	TxByDma = false;
+	DmaDone = false;
+	TdrFull = false;
+	Shifting = false;
+}
+
+void HostUsartRun( uint32_t mainUs )
+{
+	uint64_t remaining = (uint64_t)mainUs * 1000;
+	uint64_t step = 0;
+
+	while ( true )
+	{
+		if ( TakeIrq() == true )
+		{
+			continue;
+		}
+		if ( remaining == 0 )
+		{
+			break;
+		}
+		step = remaining;
+		if ( Shifting == true && ShiftEnd - Now < step )
+		{
+			step = ShiftEnd - Now;
+		}
+		Advance( Now + step );
+		remaining -= step;
+	}
+}
+
+void HostUsartRunUntil( uint32_t us )
+{
+	uint64_t target = (uint64_t)us * 1000;
+
+	while ( true )
+	{
+		if ( TakeIrq() == true )
+		{
+			continue;
+		}
+		if ( Now >= target )
+		{
+			break;
+		}
+		Advance( ( Shifting == true && ShiftEnd < target ) ? ShiftEnd : target );
+	}
+}
+
+/*
+ * HAL functions called by uart.c
+ */
+HAL_StatusTypeDef HAL_UART_Init( UART_HandleTypeDef *huart )
+{
+	Handle = huart;
+	huart->gState = HAL_UART_STATE_READY;
+	huart->RxState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size )
+{
+	if ( huart->gState != HAL_UART_STATE_READY )
+	{
+		return HAL_BUSY;
+	}
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	TxPtr = pData;
+	TxCount = Size;
+	TxByDma = false;
+	huart->Instance->CR1 |= USART_CR1_TXEIE;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size )
+{
+	if ( huart->gState != HAL_UART_STATE_READY )
+	{
+		return HAL_BUSY;
+	}
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	TxPtr = pData;
+	TxCount = Size;
+	TxByDma = true;
+	HostUsart.DmaStarts++;
+	huart->Instance->CR3 |= USART_CR3_DMAT;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size )
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA( UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size )
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive( UART_HandleTypeDef *huart )
+{
+	return HAL_OK;
+}
+
+/*
+ * TXE writes the next byte of HAL_UART_Transmit_IT(), TC ends the transfer
+ */
+void HAL_UART_IRQHandler( UART_HandleTypeDef *huart )
+{
+	if ( ( huart->Instance->CR1 & USART_CR1_TXEIE ) != 0 && TdrFull == false )
+	{
+		if ( TxCount > 0 )
+		{
+			Tdr = *TxPtr++;
+			TdrFull = true;
+			TxCount--;
+		}
+		if ( TxCount == 0 )
+		{
+			huart->Instance->CR1 &= ~USART_CR1_TXEIE;
+			huart->Instance->CR1 |= USART_CR1_TCIE;
+		}
+		return;
+	}
+	if ( ( huart->Instance->CR1 & USART_CR1_TCIE ) != 0 && TdrFull == false && Shifting == false )
+	{
+		huart->Instance->CR1 &= ~USART_CR1_TCIE;
+		huart->gState = HAL_UART_STATE_READY;
+		HAL_UART_TxCpltCallback( huart );
+	}
+}
+
+HAL_StatusTypeDef HAL_DMA_Init( DMA_HandleTypeDef *hdma )
+{
+	return HAL_OK;
+}
+
+/*
+ * Transfer complete of the Tx channel, the TC interrupt ends the transfer
+ */
+void HAL_DMA_IRQHandler( DMA_HandleTypeDef *hdma )
+{
+	if ( Handle != NULL && hdma == Handle->hdmatx && DmaDone == true )
+	{
+		DmaDone = false;
+		TxByDma = false;
+		Handle->Instance->CR3 &= ~USART_CR3_DMAT;
+		Handle->Instance->CR1 |= USART_CR1_TCIE;
+	}
+}
+
+void HAL_NVIC_SetPriority( IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority )
+{
+}
+
+void HAL_NVIC_EnableIRQ( IRQn_Type IRQn )
+{
+}
+
+void GpioInit( Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, PinTypes type, uint32_t value )
+{
+	obj->pin = pin;
+}
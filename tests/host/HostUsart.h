@@ -0,0 +1,70 @@
+/**************************************************************************************
+ *
+ * HostUsart.h
+ *
+ * USART1 and its DMA channels simulated for LoRaEz/uart.c, on a clock in us.
+ * uart.c is built with this header included first: its registers are host variables
+ * and the HAL functions it calls are the ones of HostUsart.c. A byte takes ten bit times
+ * on the wire, every interrupt takes HOST_USART_ISR_US of CPU time.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#ifndef HOSTUSART_H_
+#define HOSTUSART_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32l0xx.h"
+
+/*!
+ * Interrupt entry, HAL handler, callback and return, about 160 cycles at 32 MHz
+ */
+#define HOST_USART_ISR_US  5
+
+extern USART_TypeDef HostUsart1;
+extern DMA_Channel_TypeDef HostDma1Channel2;
+extern DMA_Channel_TypeDef HostDma1Channel3;
+extern RCC_TypeDef HostRcc;
+
+#undef USART1
+#undef DMA1_Channel2
+#undef DMA1_Channel3
+#undef RCC
+#define USART1         ( &HostUsart1 )
+#define DMA1_Channel2  ( &HostDma1Channel2 )
+#define DMA1_Channel3  ( &HostDma1Channel3 )
+#define RCC            ( &HostRcc )
+
+typedef struct
+{
+	uint32_t Us;                   // time now
+	uint32_t Baudrate;
+	uint32_t TxBytes;              // bytes out of the shift register
+	uint32_t Irqs;                 // interrupts taken
+	uint32_t IrqUs;                // CPU time in interrupts
+	uint32_t DmaStarts;
+}HostUsart_t;
+
+extern HostUsart_t HostUsart;
+
+/*!
+ * Bytes sent on the wire are passed to this hook, NULL to drop them
+ */
+extern void ( *HostUsartTxHook )( uint8_t data );
+
+void HostUsartInit( uint32_t baudrate );
+
+/*!
+ * Main loop runs for mainUs of CPU time, the interrupts take the CPU when they come
+ */
+void HostUsartRun( uint32_t mainUs );
+
+/*!
+ * Idle until the time given, the interrupts run
+ */
+void HostUsartRunUntil( uint32_t us );
+
+#endif /* HOSTUSART_H_ */
@@ -0,0 +1,147 @@
+/**************************************************************************************
+ *
+ * TestAdr.c
+ *
+ * SF adapted to a peer stays within the SFs the peers scan, and the Tx parameters of the
+ * peer apply to its frames only. A LINK_ADR_CMD out of the SFs scanned or of the power
+ * range is ignored.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+#include "LoRaLinkAdr.h"
+
+#define PANID      0x0102
+#define NODE_ADDR  0x12
+#define GW_ADDR    0xFE
+#define PEER_ADDR  0x34
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint32_t TxSf = 0;
+static int8_t TxPower = 0;
+
+/*
+ * LoRaLinkSend() spins until TxDone, the frame is over at once
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	TxSf = HostRadio.SFValue;
+	TxPower = HostRadio.TxPower;
+	HostRunUntil( HostTime + timeOnAir );
+}
+
+/*
+ * Frames of a peer heard with an SNR, ADR evaluates each window of them
+ */
+static void Hear( uint8_t srcAddr, int8_t snr, uint8_t num )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	uint8_t payload[20];
+	uint8_t frame[64];
+	uint8_t len = 0;
+
+	memset( payload, srcAddr, sizeof(payload) );
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+		len = HostRadioFrame( frame, PANID, NODE_ADDR, srcAddr, MQTT_SN, payload, sizeof(payload) );
+		CHECK( HostRadioReceive( frame, len, -60, snr ) == true );
+		CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK && pkt.SourceAddr == srcAddr );
+	}
+}
+
+/*
+ * LINK_ADR_CMD of a peer, consumed by the link
+ */
+static void Command( uint8_t srcAddr, uint8_t sfValue, int8_t power )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	uint8_t payload[2] = { sfValue, (uint8_t)power };
+	uint8_t frame[64];
+	uint8_t len = 0;
+
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	len = HostRadioFrame( frame, PANID, NODE_ADDR, srcAddr, LINK_ADR_CMD, payload, sizeof(payload) );
+	CHECK( HostRadioReceive( frame, len, -60, 0 ) == true );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+}
+
+static uint32_t Send( uint8_t destAddr )
+{
+	uint8_t payload[10] = { 0 };
+
+	TxSf = 0;
+	CHECK( LoRaLinkSend( destAddr, MQTT_SN, payload, sizeof(payload), 5000 ) == LORALINK_STATUS_OK );
+	return TxSf;
+}
+
+int main( void )
+{
+	uint8_t scan[2] = { SF_8, SF_9 };
+	uint8_t other = SF_10;
+	uint8_t maxDefault = 0;
+	uint32_t toaDefault = 0;
+
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioTxHook = OnTx;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, 40, 46, SF_9, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+	maxDefault = LoRaLinkGetMaxPayloadLength( LORALINK_MULTICAST_ADDR );
+	toaDefault = LoRaLinkGetTimeOnAir( 20 );
+
+	// Peers not scanning the default SF would miss the frames of a peer not adapted yet
+	CHECK( LoRaLinkSetAdr( true, 0, &other, 1 ) == LORALINK_STATUS_DATARATE_INVALID );
+	CHECK( LoRaLinkSetAdr( true, 0, NULL, 0 ) == LORALINK_STATUS_PARAMETER_INVALID );
+	Hear( GW_ADDR, 10, 8 );
+	CHECK( Send( GW_ADDR ) == SF_9 );
+
+	// A strong gateway goes down to SF8, SF7 is not scanned
+	CHECK( LoRaLinkSetAdr( true, 0, scan, sizeof(scan) ) == LORALINK_STATUS_OK );
+	Hear( GW_ADDR, 10, 16 );
+	CHECK( Send( GW_ADDR ) == SF_8 );
+	CHECK( LoRaLinkGetMaxPayloadLength( GW_ADDR ) >= maxDefault );
+
+	// A weak one stays at SF9, the highest SF scanned
+	Hear( PEER_ADDR, -20, 16 );
+	CHECK( Send( PEER_ADDR ) == SF_9 );
+
+	// The SF of the last destination is not left behind
+	CHECK( Send( GW_ADDR ) == SF_8 );
+	CHECK( LoRaLinkGetMaxPayloadLength( LORALINK_MULTICAST_ADDR ) == maxDefault );
+	CHECK( LoRaLinkGetMaxPayloadLength( PEER_ADDR ) == maxDefault );
+	CHECK( LoRaLinkGetTimeOnAir( 20 ) == toaDefault );
+	CHECK( Send( LORALINK_MULTICAST_ADDR ) == SF_9 );
+	CHECK( TxPower == 13 );
+
+	// The weak peer asks for SF8 at 5 dBm
+	Command( PEER_ADDR, SF_8, 5 );
+	CHECK( Send( PEER_ADDR ) == SF_8 && TxPower == 5 );
+
+	// SFs not scanned and powers out of 1 to 13 dBm are ignored, the other value too
+	Command( PEER_ADDR, SF_10, 3 );
+	CHECK( Send( PEER_ADDR ) == SF_8 && TxPower == 5 );
+	Command( PEER_ADDR, SF_7, LORALINK_ADR_POWER_KEEP );
+	CHECK( Send( PEER_ADDR ) == SF_8 && TxPower == 5 );
+	Command( PEER_ADDR, SF_9, 20 );
+	CHECK( Send( PEER_ADDR ) == SF_8 && TxPower == 5 );
+	Command( PEER_ADDR, LORALINK_ADR_SF_KEEP, 0 );
+	CHECK( Send( PEER_ADDR ) == SF_8 && TxPower == 5 );
+
+	// Either one alone
+	Command( PEER_ADDR, SF_9, LORALINK_ADR_POWER_KEEP );
+	CHECK( Send( PEER_ADDR ) == SF_9 && TxPower == 5 );
+	Command( PEER_ADDR, LORALINK_ADR_SF_KEEP, 13 );
+	CHECK( Send( PEER_ADDR ) == SF_9 && TxPower == 13 );
+
+	printf( "gateway at SF%u, weak peer at SF%u, default max payload %u\n", SF_8, SF_9, maxDefault );
+	return HostResult( "TestAdr" );
+}
@@ -0,0 +1,142 @@
+/**************************************************************************************
+ *
+ * TestAggregate.c
+ *
+ * Airtime of small messages sent each in its own frame by LoRaLinkSend() and queued
+ * by LoRaLinkAggregate() into LINK_AGGREGATE frames of 2 and 4. The frames on the air
+ * are then received by the gateway, which has to get every message back in order.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+
+#define PANID        0x0102
+#define NODE_ADDR    0x12
+#define GW_ADDR      0xFE
+#define UPLINK_CH    40
+#define DWNLINK_CH   46
+#define MESSAGES     40
+#define MSG_LEN      10
+#define MAX_DELAY    60000
+#define SEND_TIMEOUT 5000
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint8_t Frames[MESSAGES][LORA_PHY_MAXPAYLOAD];
+static uint8_t FrameLen[MESSAGES];
+static uint32_t TxFrames = 0;
+static uint32_t Airtime = 0;
+
+/*
+ * LoRaLinkSend() spins until TxDone, the frame is over at once
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	if ( TxFrames < MESSAGES )
+	{
+		memcpy( Frames[TxFrames], buffer, size );
+		FrameLen[TxFrames] = size;
+	}
+	TxFrames++;
+	Airtime += timeOnAir;
+	HostRunUntil( HostTime + timeOnAir );
+}
+
+static void Init( uint8_t devAddr, LoRaLinkSf_t sf )
+{
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioTxHook = OnTx;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, devAddr, 0x55, UPLINK_CH, DWNLINK_CH, sf, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+}
+
+static void Fill( uint8_t* payload, uint32_t n )
+{
+	for ( uint8_t i = 0; i < MSG_LEN; i++ )
+	{
+		payload[i] = (uint8_t)( n * 7 + i );
+	}
+}
+
+/*
+ * MESSAGES messages in groups of num, returns the airtime of a message in 0.1 ms
+ */
+static uint32_t Run( LoRaLinkSf_t sf, uint8_t num )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	uint8_t payload[MSG_LEN];
+	uint32_t received = 0;
+	uint32_t errors = 0;
+
+	Init( NODE_ADDR, sf );
+	TxFrames = 0;
+	Airtime = 0;
+	for ( uint32_t n = 0; n < MESSAGES; n++ )
+	{
+		Fill( payload, n );
+		if ( num == 1 )
+		{
+			CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, payload, MSG_LEN, SEND_TIMEOUT ) == LORALINK_STATUS_OK );
+			continue;
+		}
+		CHECK( LoRaLinkAggregate( GW_ADDR, MQTT_SN, payload, MSG_LEN, MAX_DELAY, SEND_TIMEOUT ) == LORALINK_STATUS_OK );
+		if ( n % num == num - 1 )
+		{
+			CHECK( LoRaLinkAggregateFlush( SEND_TIMEOUT ) == LORALINK_STATUS_OK );
+		}
+	}
+	CHECK( TxFrames == MESSAGES / num );
+
+	// The gateway gets the messages one by one
+	Init( GW_ADDR, sf );
+	for ( uint32_t f = 0; f < TxFrames; f++ )
+	{
+		CHECK( LoRaLinkRecvPoll( &pkt, SEND_TIMEOUT ) == LORALINK_STATUS_BUSY );
+		CHECK( HostRadioReceive( Frames[f], FrameLen[f], -60, 10 ) == true );
+		for ( uint8_t i = 0; i < num; i++ )
+		{
+			if ( LoRaLinkRecvPoll( &pkt, SEND_TIMEOUT ) != LORALINK_STATUS_OK )
+			{
+				errors++;
+				break;
+			}
+			Fill( payload, received++ );
+			if ( pkt.SourceAddr != NODE_ADDR || pkt.FRMPayloadType != MQTT_SN || pkt.FRMPayloadSize != MSG_LEN ||
+			     memcmp( pkt.FRMPayload, payload, MSG_LEN ) != 0 )
+			{
+				errors++;
+			}
+		}
+	}
+	CHECK( received == MESSAGES && errors == 0 );
+	return Airtime * 10 / MESSAGES;
+}
+
+int main( void )
+{
+	LoRaLinkSf_t sfs[] = { SF_7, SF_9 };
+	uint32_t single = 0;
+	uint32_t two = 0;
+	uint32_t four = 0;
+
+	printf( "airtime of a %u bytes message   single       2 in a frame       4 in a frame\n", MSG_LEN );
+	for ( uint8_t s = 0; s < sizeof(sfs) / sizeof(sfs[0]); s++ )
+	{
+		single = Run( sfs[s], 1 );
+		two = Run( sfs[s], 2 );
+		four = Run( sfs[s], 4 );
+		printf( "SF%u                       %5u.%u ms   %5u.%u ms %3u%%   %5u.%u ms %3u%%\n", sfs[s],
+		        single / 10, single % 10, two / 10, two % 10, 100 - two * 100 / single,
+		        four / 10, four % 10, 100 - four * 100 / single );
+		CHECK( four < two && two < single );
+	}
+	return HostResult( "TestAggregate" );
+}
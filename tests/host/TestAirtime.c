@@ -0,0 +1,170 @@
+/**************************************************************************************
+ *
+ * TestAirtime.c
+ *
+ * Duty cycle of a dwell time 1 station kept by the airtime ledger: bursts go out back to
+ * back until the budget of the window is spent, no window carries more than the budget,
+ * and the channels of a Tx channel plan share the budget.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+#include "LoRaLinkAirtime.h"
+
+#define DUTY_CYCLE    10
+#define BUDGET        ( LORALINK_DUTYCYCLE_WINDOW / 100 * DUTY_CYCLE )
+#define FRAME_TOA     400
+#define FRAME_GAP     50
+#define BURST_FRAMES  3000
+#define RANDOM_FRAMES 20000
+#define PLAN_WINDOW   60000
+#define PANID         0x0102
+#define NODE_ADDR     0x12
+#define GW_ADDR       0xFE
+
+extern void LoRaLinkInitilize( void );
+
+static TimerTime_t Start[RANDOM_FRAMES];
+static uint32_t Toa[RANDOM_FRAMES];
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint32_t PlanFreq[3];
+static uint32_t PlanFrames[3];
+static uint32_t PlanAirtime = 0;
+static uint32_t Senses = 0;
+
+/*
+ * Frames sent back to back, the first deferral comes when the budget is spent
+ */
+static void Burst( void )
+{
+	TimerTime_t delay = 0;
+	uint32_t firstDeferral = 0;
+
+	HostReset( 1000 );
+	LoRaLinkAirtimeInit( LORALINK_DUTYCYCLE_WINDOW );
+	for ( uint32_t n = 0; n < BURST_FRAMES; n++ )
+	{
+		delay = LoRaLinkAirtimeGetTxDelay( DUTY_CYCLE, FRAME_TOA );
+		if ( delay > 0 && firstDeferral == 0 )
+		{
+			firstDeferral = n;
+			CHECK( LoRaLinkAirtimeGetRemaining( DUTY_CYCLE ) < FRAME_TOA );
+			printf( "%u frames of %u ms back to back, then wait %u ms\n", n, FRAME_TOA, delay );
+		}
+		HostTime += delay + FRAME_TOA;
+		LoRaLinkAirtimeAdd( FRAME_TOA );
+		HostTime += FRAME_GAP;
+	}
+	CHECK( firstDeferral == BUDGET / FRAME_TOA );
+	printf( "%u frames in %u s, duty %.2f%%; a gap of %u ms after each frame took %u s\n",
+	        BURST_FRAMES, ( HostTime - 1000 ) / 1000, BURST_FRAMES * FRAME_TOA * 100.0 / ( HostTime - 1000 ),
+	        ( 100 / DUTY_CYCLE - 1 ) * FRAME_TOA, BURST_FRAMES * ( 100 / DUTY_CYCLE ) * FRAME_TOA / 1000 );
+}
+
+/*
+ * Random frames with rare long pauses, no window of an hour may hold more than the budget
+ */
+static void Random( void )
+{
+	uint32_t maxWindow = 0;
+	uint32_t sum = 0;
+
+	HostReset( 1000 );
+	LoRaLinkAirtimeInit( LORALINK_DUTYCYCLE_WINDOW );
+	srand( 1 );
+	for ( int32_t n = 0; n < RANDOM_FRAMES; n++ )
+	{
+		Toa[n] = 50 + rand() % 400;
+		HostTime += LoRaLinkAirtimeGetTxDelay( DUTY_CYCLE, Toa[n] );
+		Start[n] = HostTime;
+		HostTime += Toa[n];
+		LoRaLinkAirtimeAdd( Toa[n] );
+		HostTime += ( rand() % 2000 == 0 ) ? rand() % 600000 : FRAME_GAP;
+
+		sum = 0;
+		for ( int32_t i = n; i >= 0 && Start[n] + Toa[n] - Start[i] < LORALINK_DUTYCYCLE_WINDOW; i-- )
+		{
+			sum += Toa[i];
+		}
+		if ( sum > maxWindow )
+		{
+			maxWindow = sum;
+		}
+	}
+	CHECK( maxWindow <= BUDGET );
+	printf( "max airtime in an hour ending at a frame: %u ms of %u, %u frames in %u s\n",
+	        maxWindow, BUDGET, RANDOM_FRAMES, HostTime / 1000 );
+}
+
+/*
+ * LoRaLinkSend() spins until TxDone, the frame is over at once
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	for ( uint8_t i = 0; i < 3; i++ )
+	{
+		if ( PlanFreq[i] == HostRadio.Frequency )
+		{
+			PlanFrames[i]++;
+		}
+	}
+	PlanAirtime += timeOnAir;
+	HostRunUntil( HostTime + timeOnAir );
+}
+
+/*
+ * Channel in use busy at every other frame, the next one of the plan is free
+ */
+static bool OnSense( uint32_t frequency )
+{
+	return Senses++ % 2 == 0;
+}
+
+/*
+ * Frames rotate through three channels, the station stops at one budget for all of them
+ */
+static void Plan( void )
+{
+	uint8_t channels[3] = { 40, 41, 42 };
+	uint8_t payload[20] = { 0 };
+	LoRaLinkChannel_t stats[3];
+	uint32_t frames = 0;
+
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioTxHook = OnTx;
+	HostRadioBusyHook = OnSense;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, 40, 46, SF_9, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkSetChannelPlan( channels, sizeof(channels) ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkGetChannelStats( stats, 3 ) == 3 );
+	for ( uint8_t i = 0; i < 3; i++ )
+	{
+		PlanFreq[i] = stats[i].Frequency;
+	}
+	LoRaLinkSetDutyCycleWindow( PLAN_WINDOW );
+
+	while ( LoRaLinkGetTxDelay( sizeof(payload) ) == 0 )
+	{
+		CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, payload, sizeof(payload), 5000 ) == LORALINK_STATUS_OK );
+		frames++;
+	}
+	CHECK( PlanFrames[0] > 0 && PlanFrames[1] > 0 && PlanFrames[2] > 0 && PlanAirtime <= PLAN_WINDOW / 100 * DUTY_CYCLE );
+	CHECK( PlanAirtime + LoRaLinkGetTimeOnAir( sizeof(payload) ) > PLAN_WINDOW / 100 * DUTY_CYCLE );
+	CHECK( LoRaLinkGetAirtimeBudget() < LoRaLinkGetTimeOnAir( sizeof(payload) ) );
+	printf( "plan of 3 channels: %u frames ( %u, %u, %u ), %u ms of a %u ms budget\n", frames,
+	        PlanFrames[0], PlanFrames[1], PlanFrames[2], PlanAirtime, PLAN_WINDOW / 100 * DUTY_CYCLE );
+}
+
+int main( void )
+{
+	Burst();
+	Random();
+	Plan();
+	return HostResult( "TestAirtime" );
+}
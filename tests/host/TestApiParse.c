@@ -0,0 +1,186 @@
+/**************************************************************************************
+ *
+ * TestApiParse.c
+ *
+ * Host frames parsed by the TX modem: in place in the DMA buffer and byte by byte without
+ * DMA, with the time each path takes on the host, and the resync on the next frame
+ * delimiter after the DMA wrote over bytes not read yet. A frame to the host waits for
+ * room in the UART Tx FIFO for LORALINK_API_TX_WAIT ms at most.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include <time.h>
+#include "HostStub.h"
+#include "LoRaLinkApi.h"
+#include "LoRaLinkStats.h"
+
+#define BENCH_FRAMES   600000
+#define BATCH_FRAMES   64
+#define GW_ADDR        0xFE
+
+static LoRaLinkApiReadParameters_t Para;
+
+static double Seconds( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint16_t Escape( uint8_t* frame, uint16_t pos, uint8_t c )
+{
+	if ( c == 0x7E || c == 0x7D )
+	{
+		frame[pos++] = 0x7D;
+		c ^= 0x20;
+	}
+	frame[pos++] = c;
+	return pos;
+}
+
+/*
+ * FRAME_DLMT Len(2) DestAddr(1) PayloadType(1) Payload Checksum(1), escaped
+ */
+static uint16_t Frame( uint8_t* frame, uint8_t seed, uint8_t len )
+{
+	uint8_t body[2 + 255];
+	uint8_t sum = 0;
+	uint16_t pos = 0;
+
+	body[0] = GW_ADDR;
+	body[1] = MQTT_SN;
+	for ( uint8_t i = 0; i < len; i++ )
+	{
+		// Delimiter and escape bytes in the payload
+		body[2 + i] = (uint8_t)( seed + i * 0x3F );
+	}
+	frame[pos++] = 0x7E;
+	pos = Escape( frame, pos, 0 );
+	pos = Escape( frame, pos, len + 3 );
+	for ( uint16_t i = 0; i < len + 2; i++ )
+	{
+		sum += body[i];
+		pos = Escape( frame, pos, body[i] );
+	}
+	return Escape( frame, pos, 0xFF - sum );
+}
+
+static bool IsFrame( LoRaLinkApi_t* api, uint8_t seed, uint8_t len )
+{
+	if ( api->DestinationAddr != GW_ADDR || api->PayloadType != MQTT_SN || api->PayloadLen != len )
+	{
+		return false;
+	}
+	for ( uint8_t i = 0; i < len; i++ )
+	{
+		if ( api->Payload[i] != (uint8_t)( seed + i * 0x3F ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Frames of 30 and 60 bytes written by batches, each taken by LoRaLinkApiRead()
+ */
+static double Parse( bool dma, uint32_t* errors )
+{
+	static LoRaLinkApi_t api;
+	uint8_t frame[2 * 300];
+	uint32_t sent = 0;
+	uint32_t got = 0;
+	double t0 = 0;
+	double t = 0;
+
+	HostUartClear();
+	HostUartDma = dma;
+	*errors = 0;
+	while ( sent < BENCH_FRAMES )
+	{
+		for ( uint32_t i = 0; i < BATCH_FRAMES; i++, sent++ )
+		{
+			HostUartWrite( frame, Frame( frame, (uint8_t)sent, sent % 2 ? 60 : 30 ) );
+		}
+		t0 = Seconds();
+		while ( LoRaLinkApiRead( &api, &Para ) == true )
+		{
+			if ( IsFrame( &api, (uint8_t)got, got % 2 ? 60 : 30 ) == false )
+			{
+				( *errors )++;
+			}
+			got++;
+		}
+		t += Seconds() - t0;
+	}
+	CHECK( got == sent );
+	return t * 1e9 / sent;
+}
+
+int main( void )
+{
+	static LoRaLinkApi_t api;
+	uint8_t frame[2 * 300];
+	uint8_t junk[300];
+	uint16_t len = 0;
+	uint32_t errors = 0;
+	uint32_t overruns = 0;
+	uint32_t dropped = 0;
+	TimerTime_t start = 0;
+	double inPlace = 0;
+	double perByte = 0;
+
+	HostReset( 1000 );
+
+	inPlace = Parse( true, &errors );
+	CHECK( errors == 0 );
+	perByte = Parse( false, &errors );
+	CHECK( errors == 0 );
+	printf( "%u frames of 30/60 bytes: in place %.0f ns/frame, byte by byte %.0f ns/frame\n",
+	        BENCH_FRAMES, inPlace, perByte );
+
+	// Half of a frame is parsed, then the host sends more than the DMA buffer holds
+	HostUartClear();
+	HostUartDmaSize = 256;
+	overruns = LoRaLinkStats.Counters[LORALINK_STATS_API_RX_OVERRUN];
+	len = Frame( frame, 1, 60 );
+	HostUartWrite( frame, len / 2 );
+	CHECK( LoRaLinkApiRead( &api, &Para ) == false );
+	memset( junk, 0x55, sizeof(junk) );
+	HostUartWrite( junk, sizeof(junk) );
+	CHECK( LoRaLinkApiRead( &api, &Para ) == false );
+	CHECK( LoRaLinkStats.Counters[LORALINK_STATS_API_RX_OVERRUN] == overruns + 1 );
+
+	// The bytes go on in the middle of a frame, nothing is taken before the next delimiter
+	len = Frame( frame, 2, 60 );
+	HostUartWrite( frame + len - 20, 20 );
+	len = Frame( frame, 3, 30 );
+	HostUartWrite( frame, len );
+	CHECK( LoRaLinkApiRead( &api, &Para ) == true && IsFrame( &api, 3, 30 ) == true );
+	CHECK( LoRaLinkApiRead( &api, &Para ) == false );
+
+	// The Tx FIFO drains after a few ms, the response goes out late
+	HostUartClear();
+	memset( &api, 0, sizeof(api) );
+	dropped = LoRaLinkStats.Counters[LORALINK_STATS_API_TX_DROPPED];
+	start = HostTime;
+	HostUartBusy = 5;
+	LoRaLinkApiWriteResp( API_RSP_ACK, &api );
+	CHECK( HostUartTxLen > 0 && HostTime - start < LORALINK_API_TX_WAIT );
+
+	// It never does, the response is dropped and counted
+	HostUartClear();
+	start = HostTime;
+	HostUartBusy = 0xFFFFFFFF;
+	LoRaLinkApiWriteResp( API_RSP_ACK, &api );
+	CHECK( HostUartTxLen == 0 && HostTime - start >= LORALINK_API_TX_WAIT );
+	CHECK( LoRaLinkStats.Counters[LORALINK_STATS_API_TX_DROPPED] == dropped + 1 );
+	HostUartBusy = 0;
+
+	return HostResult( "TestApiParse" );
+}
@@ -0,0 +1,197 @@
+/**************************************************************************************
+ *
+ * TestCadScan.c
+ *
+ * Capture of isolated frames by the Rx modem scanning SFs by CAD. A CAD finds a preamble
+ * when it ends with 3 upchirps still to come, the radio then receives at that SF.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include <setjmp.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+
+#define PANID         0x0102
+#define GW_ADDR       0xFE
+#define FRAMES        600
+#define PAYLOAD_LEN   20
+#define LOCK_SYMBOLS  3
+#define CAD_SYMBOLS   2
+#define FRAME_PERIOD  1000
+
+extern void LoRaLinkInitilize( void );
+extern volatile LoRaLinkDeviceStatus_t DeviceStatus;
+
+typedef struct
+{
+	const char* Name;
+	uint8_t Num;
+	uint8_t SFValue[LORALINK_MAX_SCAN_SF];
+}ScanSet_t;
+
+static const ScanSet_t Sets[] = {
+	{ "7",       1, { SF_7 } },
+	{ "7-8",     2, { SF_7, SF_8 } },
+	{ "7-9",     3, { SF_7, SF_8, SF_9 } },
+	{ "7-10",    4, { SF_7, SF_8, SF_9, SF_10 } },
+	{ "7,8,7,9", 4, { SF_7, SF_8, SF_7, SF_9 } },
+};
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static jmp_buf Done;
+static const ScanSet_t* Set = NULL;
+static uint16_t Preamble = 0;
+static uint32_t Sent = 0;
+static uint32_t Captured[SF_12 + 1];
+static uint32_t Offered[SF_12 + 1];
+static uint8_t FrameSf = 0;
+static TimerTime_t FrameStart = 0;
+static TimerTime_t FrameEnd = 0;
+
+static uint32_t SymbolTime( uint8_t sf )
+{
+	uint32_t t = ( 1UL << sf ) / 125;
+
+	return t > 0 ? t : 1;
+}
+
+/*
+ * Next frame of a node at the next SF of the set, at a random phase of the scan
+ */
+static void NextFrame( void )
+{
+	FrameSf = Set->SFValue[Sent % Set->Num];
+	FrameStart = 2000 + Sent * FRAME_PERIOD + rand() % ( FRAME_PERIOD / 2 );
+	FrameEnd = FrameStart + HostTimeOnAir( 0, FrameSf, 1, Preamble, false, true, LORALINK_HDR_LEN + PAYLOAD_LEN + LORALINK_MIC_LEN );
+}
+
+static bool CadDetects( uint32_t sfValue )
+{
+	TimerTime_t cadStart = HostTime - CAD_SYMBOLS * SymbolTime( sfValue );
+
+	if ( sfValue == FrameSf && (int32_t)( cadStart - FrameStart ) >= 0 &&
+	     (int32_t)( HostTime - ( FrameStart + ( Preamble - LOCK_SYMBOLS ) * SymbolTime( sfValue ) ) ) <= 0 )
+	{
+		HostRadio.LockUntil = FrameEnd;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * A pass of the main loop, the clock moves on only while the modem sleeps
+ */
+static void Poll( void )
+{
+	TimerTime_t timer = 0;
+	uint8_t payload[PAYLOAD_LEN];
+	uint8_t frame[64];
+	uint8_t len = 0;
+
+	if ( DeviceStatus != DEVICE_STATE_SLEEP )
+	{
+		return;
+	}
+	if ( Sent == FRAMES )
+	{
+		longjmp( Done, 1 );
+	}
+	if ( HostNextTimer( &timer ) == true && (int32_t)( timer - FrameEnd ) < 0 )
+	{
+		HostRunNext();
+		return;
+	}
+
+	HostRunUntil( FrameEnd );
+	memset( payload, Sent & 0xFF, sizeof(payload) );
+	len = HostRadioFrame( frame, PANID, GW_ADDR, 1, MQTT_SN, payload, sizeof(payload) );
+	Offered[FrameSf]++;
+	if ( HostRadio.State == RF_RX_RUNNING && HostRadio.SFValue == FrameSf &&
+	     ( Set->Num == 1 || (int32_t)( HostRadio.RxSince - FrameStart ) >= 0 ) &&
+	     HostRadioReceive( frame, len, -80, 5 ) == true )
+	{
+		Captured[FrameSf]++;
+	}
+	Sent++;
+	NextFrame();
+}
+
+/*
+ * Mean capture over the SFs of the set
+ */
+static double Run( const ScanSet_t* set, uint16_t preamble )
+{
+	LoRaLinkPhyProfile_t phy = LORALINK_PHY_STANDARD;
+	LoRaLinkStats_t link = { 0 };
+	double capture = 0;
+	uint8_t num = 0;
+
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioCadHook = CadDetects;
+	LoRaLinkInitilize();
+	Set = set;
+	Preamble = preamble;
+	phy.PreambleLen = preamble;
+	Sent = 0;
+	memset( Captured, 0, sizeof(Captured) );
+	memset( Offered, 0, sizeof(Offered) );
+	srand( 1 );
+	NextFrame();
+	CHECK( LoRaLinkSetRxScan( (uint8_t*)set->SFValue, set->Num ) == LORALINK_STATUS_OK );
+
+	HostUartPollHook = Poll;
+	if ( setjmp( Done ) == 0 )
+	{
+		LoRaLinkUart( Key, PANID, GW_ADDR, LORALINK_UART_RX, 0x55, 40, 46, set->SFValue[0], &phy );
+	}
+	HostUartPollHook = NULL;
+
+	LoRaLinkGetStats( &link );
+	CHECK( link.Counters[LORALINK_STATS_RX_FRAMES] == link.Counters[LORALINK_STATS_RX_CAD_DETECTED] || set->Num == 1 );
+
+	for ( uint8_t sf = SF_7; sf <= SF_12; sf++ )
+	{
+		if ( Offered[sf] > 0 )
+		{
+			capture += (double)Captured[sf] / Offered[sf];
+			num++;
+		}
+	}
+	return capture / num;
+}
+
+int main( void )
+{
+	uint16_t preambles[3] = { 8, 12, 16 };
+	double capture[3] = { 0 };
+
+	printf( "SFs scanned   cycle    preamble 8     12     16\n" );
+	for ( uint8_t i = 0; i < sizeof(Sets) / sizeof(Sets[0]); i++ )
+	{
+		for ( uint8_t p = 0; p < 3; p++ )
+		{
+			capture[p] = Run( &Sets[i], preambles[p] );
+		}
+		printf( "%-10s  %4u ms       %8.2f   %5.2f  %5.2f\n", Sets[i].Name, LoRaLinkGetScanCycle(),
+		        capture[0], capture[1], capture[2] );
+
+		if ( Sets[i].Num == 1 )
+		{
+			// Rx continuous without a scan
+			CHECK( capture[0] == 1.0 && capture[1] == 1.0 && capture[2] == 1.0 );
+		}
+		else
+		{
+			// A longer preamble is caught more often, two adjacent SFs are caught with 16 symbols
+			CHECK( capture[0] <= capture[1] && capture[1] <= capture[2] );
+			CHECK( Sets[i].Num > 2 || capture[2] >= 0.99 );
+		}
+	}
+	return HostResult( "TestCadScan" );
+}
@@ -0,0 +1,289 @@
+/**************************************************************************************
+ *
+ * TestCarrierSense.c
+ *
+ * Time from LoRaLinkSend() to the start of the frame for each carrier sense method,
+ * RSSI in FSK mode and CAD followed by RSSI. The driver runs on a simulated SX1276:
+ * its registers are read and written at SPI_BYTE_US per byte, CAD is over after
+ * (2^SF + 32) / BW and the RSSI is that of a free or of a busy channel. Both methods
+ * have to find the busy channel, LoRaLinkGetTxOverhead() reports the same time in ms.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "LoRaLink.h"
+#include "sx1276.h"
+#include "sx1276-device.h"
+#include "gpio.h"
+#include "spi.h"
+
+#define SPI_BYTE_US  2        // 8 MHz SCK and SpiInOut() polling the flags, each byte
+#define PANID        0x0102
+#define NODE_ADDR    0x12
+#define GW_ADDR      0xFE
+#define UPLINK_CH    40
+#define DWNLINK_CH   46
+#define FRAMES       50
+#define FRAME_GAP    5000
+#define RSSI_FREE    -120
+#define RSSI_BUSY    -60
+#define RSSI_OFFSET  -157     // RSSI_OFFSET_HF of the driver, 920 MHz
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+
+/*
+ * Simulated SX1276, the clock in us is HostTime and Frac
+ */
+static uint8_t Regs[0x80];
+static uint32_t Frac = 0;
+static bool Select = false;
+static bool AddrByte = false;
+static bool WriteAccess = false;
+static uint8_t Addr = 0;
+static bool Busy = false;
+static bool CadRunning = false;
+static uint64_t CadEnd = 0;
+static uint64_t TxStart = 0;
+static uint32_t Writes = 0;
+static uint32_t TxWrites = 0;
+static DioIrqHandler** Dio = NULL;
+static bool TxPending = false;
+
+static uint64_t NowUs( void )
+{
+	return (uint64_t)HostTime * 1000 + Frac;
+}
+
+static bool LoRaMode( void )
+{
+	return ( Regs[REG_OPMODE] & RFLR_OPMODE_LONGRANGEMODE_ON ) != 0;
+}
+
+static uint32_t CadUs( void )
+{
+	uint32_t sf = Regs[REG_LR_MODEMCONFIG2] >> 4;
+	uint32_t bw = 125000UL << ( ( Regs[REG_LR_MODEMCONFIG1] >> 4 ) - 7 );
+
+	return (uint32_t)( ( ( 1ULL << sf ) + 32 ) * 1000000ULL / bw );
+}
+
+static void OnMode( void )
+{
+	uint8_t mode = Regs[REG_OPMODE] & ~RFLR_OPMODE_MASK;
+
+	if ( LoRaMode() == false )
+	{
+		return;
+	}
+	if ( mode == RFLR_OPMODE_CAD )
+	{
+		CadEnd = NowUs() + CadUs();
+		CadRunning = true;
+	}
+	else if ( mode == RFLR_OPMODE_TRANSMITTER )
+	{
+		TxStart = NowUs();
+		TxWrites = Writes;
+		TxPending = true;
+	}
+}
+
+static void RegWrite( uint8_t addr, uint8_t data )
+{
+	if ( addr == REG_FIFO )
+	{
+		return;
+	}
+	if ( addr == REG_LR_IRQFLAGS && LoRaMode() == true )
+	{
+		Regs[addr] &= ~data;
+		return;
+	}
+	Regs[addr] = data;
+	if ( addr == REG_OPMODE )
+	{
+		OnMode();
+	}
+}
+
+static uint8_t RegRead( uint8_t addr )
+{
+	int16_t rssi = Busy ? RSSI_BUSY : RSSI_FREE;
+
+	if ( LoRaMode() == false )
+	{
+		return addr == REG_RSSIVALUE ? (uint8_t)( -rssi * 2 ) : Regs[addr];
+	}
+	if ( addr == REG_LR_IRQFLAGS && CadRunning == true && NowUs() >= CadEnd )
+	{
+		CadRunning = false;
+		Regs[addr] |= RFLR_IRQFLAGS_CADDONE | ( Busy ? RFLR_IRQFLAGS_CADDETECTED : 0 );
+	}
+	return addr == REG_LR_RSSIVALUE ? (uint8_t)( rssi - RSSI_OFFSET ) : Regs[addr];
+}
+
+/*
+ * Board functions of the driver
+ */
+uint16_t SpiInOut( Spi_t *obj, uint16_t outData )
+{
+	uint8_t data = 0;
+
+	Frac += SPI_BYTE_US;
+	while ( Frac >= 1000 )
+	{
+		Frac -= 1000;
+		HostTime++;
+	}
+	if ( Select == false )
+	{
+		return 0;
+	}
+	if ( AddrByte == true )
+	{
+		AddrByte = false;
+		Addr = outData & 0x7F;
+		WriteAccess = ( outData & 0x80 ) != 0;
+		return 0;
+	}
+	if ( WriteAccess == true )
+	{
+		Writes++;
+		RegWrite( Addr, outData );
+	}
+	else
+	{
+		data = RegRead( Addr );
+	}
+	if ( Addr != REG_FIFO )
+	{
+		Addr = ( Addr + 1 ) & 0x7F;
+	}
+	return data;
+}
+
+void GpioWrite( Gpio_t *obj, uint32_t value )
+{
+	if ( obj == &SX1276.Spi.Nss )
+	{
+		Select = ( value == 0 );
+		AddrByte = Select;
+	}
+
+	// LoRaLinkSend() spins until TxDone, it comes at once as the frame is not timed here
+	if ( Select == false && TxPending == true )
+	{
+		TxPending = false;
+		Regs[REG_LR_IRQFLAGS] |= RFLR_IRQFLAGS_TXDONE;
+		Dio[0]( NULL );
+	}
+}
+
+void SX1276IoIrqInit( DioIrqHandler **irqHandlers )
+{
+	Dio = irqHandlers;
+}
+
+void SX1276Reset( void )
+{
+	memset( Regs, 0, sizeof(Regs) );
+	Regs[REG_OPMODE] = RF_OPMODE_STANDBY;
+}
+
+void SX1276SetRfTxPower( int8_t power )
+{
+}
+
+void SX1276SetAntSwLowPower( bool status )
+{
+}
+
+void SX1276SetAntSw( uint8_t opMode )
+{
+}
+
+void SX1276SetDeviceTcxo( uint8_t state )
+{
+}
+
+typedef struct
+{
+	uint32_t PreTxUs;      // LoRaLinkSend() to the Tx mode, mean of the frames
+	uint32_t Writes;       // registers written in the meantime, for each frame
+	LoRaLinkTxOverhead_t Overhead;
+}Result_t;
+
+/*
+ * Frames on a free channel, then a frame on a busy one
+ */
+static void Run( LoRaLinkCarrierSenseMethod_t method, Result_t* result )
+{
+	LoRaLinkCarrierSense_t cs = { method, -83, 5 };
+	LoRaLinkStats_t stats = { 0 };
+	uint8_t payload[20] = { 0 };
+	uint64_t start = 0;
+	uint32_t writes = 0;
+	uint64_t preTx = 0;
+	uint32_t regs = 0;
+
+	HostReset( 1000 );
+	Frac = 0;
+	Busy = false;
+	CadRunning = false;
+	TxPending = false;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, UPLINK_CH, DWNLINK_CH, SF_9, 13, &cs, NULL ) == LORALINK_STATUS_OK );
+
+	for ( uint32_t n = 0; n < FRAMES; n++ )
+	{
+		HostRunUntil( HostTime + FRAME_GAP );
+		start = NowUs();
+		writes = Writes;
+		TxStart = 0;
+		CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, payload, sizeof(payload), 2000 ) == LORALINK_STATUS_OK );
+		CHECK( TxStart > start );
+		preTx += TxStart - start;
+		regs += TxWrites - writes;
+	}
+	LoRaLinkGetTxOverhead( &result->Overhead );
+	result->PreTxUs = preTx / FRAMES;
+	result->Writes = regs / FRAMES;
+
+	// A LoRa frame on the channel is found by the RSSI as by CAD
+	HostRunUntil( HostTime + FRAME_GAP );
+	Busy = true;
+	TxStart = 0;
+	CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, payload, sizeof(payload), 2000 ) == LORALINK_STATUS_CHANNEL_NOT_FREE );
+	CHECK( TxStart == 0 );
+	LoRaLinkGetStats( &stats );
+	CHECK( stats.Counters[LORALINK_STATS_TX_LBT_BUSY] > 0 );
+}
+
+int main( void )
+{
+	Result_t rssi = { 0 };
+	Result_t cad = { 0 };
+
+	Run( LORALINK_CS_RSSI, &rssi );
+	Run( LORALINK_CS_CAD_RSSI, &cad );
+
+	printf( "carrier sense 5 ms at SF9    pre-Tx us  registers   TxOverhead: frames  mean ms  max ms\n" );
+	printf( "RSSI (FSK)                   %9u  %9u   %18u  %7u  %6u\n", rssi.PreTxUs, rssi.Writes,
+	        rssi.Overhead.TxCount, rssi.Overhead.TotalTime / rssi.Overhead.TxCount, rssi.Overhead.MaxTime );
+	printf( "CAD + RSSI                   %9u  %9u   %18u  %7u  %6u\n", cad.PreTxUs, cad.Writes,
+	        cad.Overhead.TxCount, cad.Overhead.TotalTime / cad.Overhead.TxCount, cad.Overhead.MaxTime );
+
+	// Both sense for 5 ms, CAD saves the FSK receiver start and the Tx configuration after it
+	CHECK( rssi.Overhead.TxCount == FRAMES && cad.Overhead.TxCount == FRAMES );
+	// 5 ms of a timer in ms
+	CHECK( cad.PreTxUs >= 4000 && cad.PreTxUs < rssi.PreTxUs );
+	CHECK( cad.Writes < rssi.Writes );
+	CHECK( cad.Overhead.TotalTime <= rssi.Overhead.TotalTime );
+	return HostResult( "TestCarrierSense" );
+}
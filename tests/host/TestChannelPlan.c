@@ -0,0 +1,226 @@
+/**************************************************************************************
+ *
+ * TestChannelPlan.c
+ *
+ * Uplink channel plan of a node over channels loaded by other stations: the latency
+ * from LoRaLinkSend() to the start of the frame and the rate of the frames which found
+ * every channel busy, for a plan of one and of three channels. The gateway has one RX
+ * modem per channel of the plan, the node keeps listening on its downlink channel and
+ * a modem refuses a plan.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <setjmp.h>
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+
+#define PANID        0x0102
+#define NODE_ADDR    0x12
+#define GW_ADDR      0xFE
+#define UPLINK_CH    40
+#define DWNLINK_CH   46
+#define FRAMES       500
+#define FRAME_GAP    3000
+#define SEND_TIMEOUT 2000
+#define BUSY_TOA     400      // frames of the other stations
+#define CHANNELS     3
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint32_t Frequency[CHANNELS];
+static TimerTime_t Until[CHANNELS];
+static bool Busy[CHANNELS];
+static uint32_t LoadPercent = 0;
+static uint32_t Random = 1;
+static TimerTime_t TxStart = 0;
+static uint32_t TxFrequency = 0;
+static uint32_t Heard[CHANNELS];
+static jmp_buf Done;
+
+static uint32_t Rand( uint32_t range )
+{
+	Random = Random * 1103515245UL + 12345UL;
+	return ( Random >> 16 ) % range;
+}
+
+/*
+ * Each channel carries frames of BUSY_TOA ms with random gaps, busy LoadPercent of the time
+ */
+static bool OnSense( uint32_t frequency )
+{
+	for ( uint8_t i = 0; i < CHANNELS; i++ )
+	{
+		if ( Frequency[i] != frequency )
+		{
+			continue;
+		}
+		while ( (int32_t)( HostTime - Until[i] ) >= 0 )
+		{
+			Busy[i] = !Busy[i];
+			Until[i] += Busy[i] ? BUSY_TOA : 1 + Rand( 2 * BUSY_TOA * ( 100 - LoadPercent ) / LoadPercent );
+		}
+		return Busy[i];
+	}
+	return false;
+}
+
+/*
+ * LoRaLinkSend() spins until TxDone, the frame is over at once.
+ * The RX modem of the gateway on the channel of the frame hears it.
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	TxStart = HostTime;
+	TxFrequency = HostRadio.Frequency;
+	for ( uint8_t i = 0; i < CHANNELS; i++ )
+	{
+		if ( Frequency[i] == HostRadio.Frequency )
+		{
+			Heard[i]++;
+		}
+	}
+	HostRunUntil( HostTime + timeOnAir );
+}
+
+static void Init( void )
+{
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioTxHook = OnTx;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, UPLINK_CH, DWNLINK_CH, SF_9, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+}
+
+/*
+ * Frequency the node listens on after a frame
+ */
+static uint32_t RxFrequency( void )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	LoRaLinkStatus_t rc;
+	uint32_t freq = 0;
+
+	while ( ( rc = LoRaLinkRecvPoll( &pkt, 100 ) ) == LORALINK_STATUS_BUSY )
+	{
+		if ( HostRadio.State == RF_RX_RUNNING )
+		{
+			freq = HostRadio.Frequency;
+		}
+		CHECK( HostRunNext() == true );
+	}
+	CHECK( rc == LORALINK_STATUS_RX_TIMEOUT );
+	return freq;
+}
+
+/*
+ * Frames of a node over the loaded channels, returns the mean latency in ms
+ */
+static uint32_t Run( uint8_t num, uint32_t load, uint32_t* nfcRate, uint32_t* lost )
+{
+	uint8_t channels[CHANNELS] = { UPLINK_CH, UPLINK_CH + 1, UPLINK_CH + 2 };
+	uint8_t payload[20] = { 0 };
+	LoRaLinkChannel_t stats[CHANNELS];
+	LoRaLinkStats_t link = { 0 };
+	LoRaLinkStatus_t rc;
+	uint32_t rxFreq = 0;
+	uint32_t latency = 0;
+	uint32_t sent = 0;
+	TimerTime_t start = 0;
+
+	Init();
+	HostRadioBusyHook = OnSense;
+	rxFreq = RxFrequency();
+	CHECK( LoRaLinkSetChannelPlan( channels, num ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkGetChannelStats( stats, CHANNELS ) == num );
+	for ( uint8_t i = 0; i < CHANNELS; i++ )
+	{
+		Frequency[i] = i < num ? stats[i].Frequency : 0;
+		Until[i] = HostTime;
+		Busy[i] = true;
+		Heard[i] = 0;
+	}
+	LoadPercent = load;
+	Random = 1;
+	*lost = 0;
+
+	for ( uint32_t n = 0; n < FRAMES; n++ )
+	{
+		HostRunUntil( HostTime + FRAME_GAP + Rand( FRAME_GAP ) );
+		start = HostTime;
+		TxFrequency = 0;
+		rc = LoRaLinkSend( GW_ADDR, MQTT_SN, payload, sizeof(payload), SEND_TIMEOUT );
+		if ( rc == LORALINK_STATUS_OK )
+		{
+			latency += TxStart - start;
+			sent++;
+			// Only the channels of the plan have an RX modem
+			CHECK( TxFrequency != 0 && ( TxFrequency == Frequency[0] || TxFrequency == Frequency[1] || TxFrequency == Frequency[2] ) );
+		}
+		else
+		{
+			CHECK( rc == LORALINK_STATUS_CHANNEL_NOT_FREE );
+			( *lost )++;
+		}
+
+		// The downlink reaches the node on the same channel whatever channel the uplink took
+		if ( n % 50 == 0 )
+		{
+			CHECK( RxFrequency() == rxFreq );
+		}
+	}
+
+	LoRaLinkGetStats( &link );
+	*nfcRate = link.Counters[LORALINK_STATS_TX_NO_FREE_CH] * 100 / FRAMES;
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		CHECK( Heard[i] > 0 );
+	}
+	return sent > 0 ? latency / sent : 0;
+}
+
+/*
+ * The TX modem leaves its main loop at once
+ */
+static void Poll( void )
+{
+	longjmp( Done, 1 );
+}
+
+int main( void )
+{
+	uint8_t channels[CHANNELS] = { UPLINK_CH, UPLINK_CH + 1, UPLINK_CH + 2 };
+	uint32_t loads[] = { 10, 30, 50, 70 };
+	uint32_t latency[2] = { 0 };
+	uint32_t nfc[2] = { 0 };
+	uint32_t lost[2] = { 0 };
+
+	// A modem sends on the channel its peers listen on
+	Init();
+	HostUartPollHook = Poll;
+	if ( setjmp( Done ) == 0 )
+	{
+		LoRaLinkUart( Key, PANID, GW_ADDR, LORALINK_UART_TX, 0x55, UPLINK_CH, DWNLINK_CH, SF_9, NULL );
+	}
+	HostUartPollHook = NULL;
+	CHECK( LoRaLinkSetChannelPlan( channels, CHANNELS ) == LORALINK_STATUS_ERROR );
+
+	// NFC: carrier senses which found every channel busy, per 100 frames; lost: not sent in SEND_TIMEOUT
+	printf( "load   1 channel: latency  NFC  lost   3 channels: latency  NFC  lost\n" );
+	for ( uint8_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++ )
+	{
+		latency[0] = Run( 1, loads[l], &nfc[0], &lost[0] );
+		latency[1] = Run( CHANNELS, loads[l], &nfc[1], &lost[1] );
+		printf( "%3u%%             %5u ms %3u%% %5u             %5u ms %3u%% %5u\n", loads[l],
+		        latency[0], nfc[0], lost[0], latency[1], nfc[1], lost[1] );
+
+		// A busy channel costs a carrier sense on the next one instead of a back off
+		CHECK( latency[1] < latency[0] && nfc[1] < nfc[0] && lost[1] <= lost[0] );
+	}
+	return HostResult( "TestChannelPlan" );
+}
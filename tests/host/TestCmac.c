@@ -0,0 +1,338 @@
+/**************************************************************************************
+ *
+ * TestCmac.c
+ *
+ * The MIC is verified by feeding B0 and the received frame to the CMAC in two updates,
+ * it has to be the CMAC of the contiguous B0 + frame. Received frames are checked
+ * against the path before the key schedule was kept: VerifyCmacB0() on a copy of
+ * B0 + frame and a key expanded for each CMAC and each keystream block. Both paths
+ * have to give the same MIC, accept the same frames and decrypt the same payload.
+ * For each frame the key expansions and AES blocks are counted and the time on the
+ * host, the best of TRIALS, is printed.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include <time.h>
+#include "HostStub.h"
+#include "cmac.h"
+#include "LoRaLink.h"
+#include "LoRaLinkCrypto.h"
+#include "LoRaLinkApi.h"
+
+#define FRAMES   20000
+#define ROUNDS   4000
+#define TRIALS   5
+
+/*
+ * RFC 4493 examples
+ */
+static const uint8_t Rfc4493Key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t Rfc4493Msg[40] = { 0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                                        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+                                        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11 };
+static const uint8_t Rfc4493Mac[3][16] = {
+	{ 0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46 },
+	{ 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c },
+	{ 0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27 } };
+
+static AES_CMAC_CTX Ctx;
+
+static void Cmac( const uint8_t* first, uint32_t firstLen, const uint8_t* second, uint32_t secondLen, uint8_t* mac )
+{
+	AES_CMAC_Reset( &Ctx );
+	AES_CMAC_Update( &Ctx, first, firstLen );
+	if ( secondLen > 0 )
+	{
+		AES_CMAC_Update( &Ctx, second, secondLen );
+	}
+	AES_CMAC_Final( mac, &Ctx );
+}
+
+/*
+ * AES of the CMAC and of the keystream, counted by the linker wrappers
+ */
+static uint32_t KeyExpansions = 0;
+static uint32_t AesBlocks = 0;
+
+return_type __real_aes_set_key( const uint8_t key[], length_type keylen, aes_context ctx[1] );
+return_type __real_aes_encrypt( const uint8_t in[N_BLOCK], uint8_t out[N_BLOCK], const aes_context ctx[1] );
+
+return_type __wrap_aes_set_key( const uint8_t key[], length_type keylen, aes_context ctx[1] )
+{
+	KeyExpansions++;
+	return __real_aes_set_key( key, keylen, ctx );
+}
+
+return_type __wrap_aes_encrypt( const uint8_t in[N_BLOCK], uint8_t out[N_BLOCK], const aes_context ctx[1] )
+{
+	AesBlocks++;
+	return __real_aes_encrypt( in, out, ctx );
+}
+
+/*
+ * Rx path before the key schedule was kept, as in LoRaLinkCrypto.c then
+ */
+static uint8_t BaselineKey[16];
+
+static uint32_t BaselineCmacB0( uint8_t* msg, uint16_t len, uint16_t panId, uint8_t destAddr, uint8_t srcAddr, uint8_t plType )
+{
+	uint8_t micBuff[16 + 256] = { 0x49, 0, 0, 0, 0, len & 0xFF, panId & 0xFF, panId >> 8, 0, 0, destAddr, 0, 0, 0, srcAddr, plType };
+	uint8_t mac[16];
+
+	memcpy( micBuff + 16, msg, len );
+	AES_CMAC_Init( &Ctx );
+	AES_CMAC_SetKey( &Ctx, BaselineKey );
+	AES_CMAC_Update( &Ctx, micBuff, 16 + len );
+	AES_CMAC_Final( mac, &Ctx );
+	return (uint32_t)mac[3] << 24 | (uint32_t)mac[2] << 16 | (uint32_t)mac[1] << 8 | mac[0];
+}
+
+static void BaselinePayloadEncrypt( uint8_t* buffer, int16_t size, uint16_t panId, uint8_t destAddr, uint8_t srcAddr, uint8_t plType )
+{
+	static aes_context aes;
+	uint8_t aBlock[16] = { 0x01, 0, 0, 0, 0, panId & 0xFF, panId >> 8, 0, 0, destAddr, 0, 0, 0, srcAddr, 0, plType };
+	uint8_t sBlock[16];
+
+	for ( uint8_t index = 0; size > 0; index += 16, size -= 16 )
+	{
+		memset( aes.ksch, 0, sizeof(aes.ksch) );
+		aes_set_key( BaselineKey, 16, &aes );
+		aes_encrypt( aBlock, sBlock, &aes );
+		for ( uint8_t i = 0; i < ( ( size > 16 ) ? 16 : size ); i++ )
+		{
+			buffer[index + i] ^= sBlock[i];
+		}
+	}
+}
+
+static bool BaselineUnsecure( LoRaLinkPacket_t* pkt )
+{
+	if ( BaselineCmacB0( pkt->Buffer, pkt->BufSize - LORALINK_MIC_LEN, pkt->PanId, pkt->DestAddr, pkt->SourceAddr, pkt->FRMPayloadType ) != pkt->MIC )
+	{
+		return false;
+	}
+	BaselinePayloadEncrypt( pkt->FRMPayload, pkt->FRMPayloadSize, pkt->PanId, pkt->DestAddr, pkt->SourceAddr, pkt->FRMPayloadType );
+	return true;
+}
+
+static double Seconds( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Secure( LoRaLinkPacket_t* pkt, uint8_t* frame, uint8_t* payload, uint8_t len )
+{
+	memset( pkt, 0, sizeof(LoRaLinkPacket_t) );
+	pkt->Buffer = frame;
+	pkt->PanId = 0x0102;
+	pkt->DestAddr = 0x12;
+	pkt->SourceAddr = 0xFE;
+	pkt->FRMPayloadType = MQTT_SN;
+	pkt->FRMPayload = payload;
+	pkt->FRMPayloadSize = len;
+	LoRaLinkSerializeData( pkt );
+	pkt->FRMPayload = frame + LORALINK_HDR_LEN;
+	LoRaLinkCryptoSecureMessage( pkt );
+}
+
+typedef struct
+{
+	double Ns;
+	uint32_t KeyExpansions;
+	uint32_t AesBlocks;
+}Cost_t;
+
+/*
+ * A received frame copied, parsed and unsecured ROUNDS times, the cost of a frame
+ */
+static void Unsecure( uint8_t* frame, uint8_t size, bool baseline, Cost_t* cost )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	uint8_t work[256];
+	uint32_t accepted = 0;
+	double t0 = Seconds();
+	double ns = 0;
+
+	KeyExpansions = 0;
+	AesBlocks = 0;
+	for ( uint32_t n = 0; n < ROUNDS; n++ )
+	{
+		memcpy( work, frame, size );
+		RxDoneParams_t rx = { .Payload = work, .Size = size };
+		LoRaLinkApiGetRxData( &pkt, &rx );
+		if ( baseline == true )
+		{
+			accepted += BaselineUnsecure( &pkt );
+		}
+		else
+		{
+			accepted += LoRaLinkCryptoUnsecureMessage( &pkt ) == LORALINK_CRYPTO_SUCCESS;
+		}
+	}
+	ns = ( Seconds() - t0 ) * 1e9 / ROUNDS;
+	CHECK( accepted == ROUNDS );
+	if ( cost->Ns == 0 || ns < cost->Ns )
+	{
+		cost->Ns = ns;
+	}
+	cost->KeyExpansions = KeyExpansions / ROUNDS;
+	cost->AesBlocks = AesBlocks / ROUNDS;
+}
+
+int main( void )
+{
+	uint8_t buf[16 + 256];
+	uint8_t whole[16];
+	uint8_t split[16];
+	uint8_t key[16];
+	uint32_t lens[3] = { 0, 16, 40 };
+	uint32_t mismatch = 0;
+	uint32_t len = 0;
+
+	AES_CMAC_Init( &Ctx );
+	AES_CMAC_SetKey( &Ctx, Rfc4493Key );
+	for ( uint8_t i = 0; i < 3; i++ )
+	{
+		Cmac( Rfc4493Msg, lens[i], NULL, 0, whole );
+		CHECK( memcmp( whole, Rfc4493Mac[i], 16 ) == 0 );
+	}
+
+	srand( 1 );
+	for ( uint8_t i = 0; i < 16; i++ )
+	{
+		key[i] = rand();
+	}
+	AES_CMAC_SetKey( &Ctx, key );
+	for ( uint32_t n = 0; n < FRAMES; n++ )
+	{
+		len = rand() % 257;
+		for ( uint32_t i = 0; i < 16 + len; i++ )
+		{
+			buf[i] = rand();
+		}
+		Cmac( buf, 16 + len, NULL, 0, whole );
+		Cmac( buf, 16, buf + 16, len, split );
+		mismatch += memcmp( whole, split, 16 ) != 0;
+	}
+	CHECK( mismatch == 0 );
+	printf( "%u random frames of 0..256 bytes, %u mismatches\n", FRAMES, mismatch );
+
+	// Whole path of LoRaLink: a frame secured is accepted, a flipped bit in any byte is not
+	{
+		LoRaLinkPacket_t pkt = { 0 };
+		uint8_t frame[64];
+		uint8_t payload[20] = { 0 };
+		uint32_t rejected = 0;
+
+		LoRaLinkCryptoSetKey( key );
+		for ( uint8_t i = 0; i <= LORALINK_HDR_LEN + sizeof(payload) + LORALINK_MIC_LEN; i++ )
+		{
+			pkt.Buffer = frame;
+			pkt.PanId = 0x0102;
+			pkt.DestAddr = 0x12;
+			pkt.SourceAddr = 0xFE;
+			pkt.FRMPayloadType = MQTT_SN;
+			pkt.FRMPayload = payload;
+			pkt.FRMPayloadSize = sizeof(payload);
+			LoRaLinkSerializeData( &pkt );
+			pkt.FRMPayload = frame + LORALINK_HDR_LEN;
+			LoRaLinkCryptoSecureMessage( &pkt );
+			if ( i > 0 )
+			{
+				frame[i - 1] ^= 0x10;
+			}
+
+			RxDoneParams_t rx = { .Payload = frame, .Size = pkt.BufSize };
+			LoRaLinkApiGetRxData( &pkt, &rx );
+			if ( LoRaLinkCryptoUnsecureMessage( &pkt ) != LORALINK_CRYPTO_SUCCESS )
+			{
+				rejected++;
+			}
+			else
+			{
+				CHECK( i == 0 && memcmp( pkt.FRMPayload, payload, sizeof(payload) ) == 0 );
+			}
+		}
+		CHECK( rejected == LORALINK_HDR_LEN + sizeof(payload) + LORALINK_MIC_LEN );
+	}
+
+	// Same MIC, frames accepted and payload as the path before, flipped bits included
+	{
+		LoRaLinkPacket_t pkt = { 0 };
+		LoRaLinkPacket_t ref = { 0 };
+		uint8_t frame[256];
+		uint8_t copy[256];
+		uint8_t payload[244];
+		uint8_t sizes[3] = { 16, 64, 244 };
+		uint8_t len = 0;
+		uint32_t differ = 0;
+		uint32_t accepted = 0;
+		Cost_t kept[3] = { { 0 } };
+		Cost_t base[3] = { { 0 } };
+
+		memcpy( BaselineKey, key, 16 );
+		for ( uint32_t n = 0; n < FRAMES; n++ )
+		{
+			len = 1 + rand() % sizeof(payload);
+			for ( uint8_t i = 0; i < len; i++ )
+			{
+				payload[i] = rand();
+			}
+			Secure( &pkt, frame, payload, len );
+			differ += BaselineCmacB0( frame, pkt.BufSize - LORALINK_MIC_LEN, pkt.PanId, pkt.DestAddr, pkt.SourceAddr, pkt.FRMPayloadType ) != pkt.MIC;
+			if ( n % 2 == 1 )
+			{
+				frame[rand() % pkt.BufSize] ^= 1 << ( rand() % 8 );
+			}
+
+			memcpy( copy, frame, pkt.BufSize );
+			RxDoneParams_t rx = { .Payload = frame, .Size = pkt.BufSize };
+			RxDoneParams_t rxRef = { .Payload = copy, .Size = pkt.BufSize };
+			LoRaLinkApiGetRxData( &pkt, &rx );
+			LoRaLinkApiGetRxData( &ref, &rxRef );
+			if ( ( LoRaLinkCryptoUnsecureMessage( &pkt ) == LORALINK_CRYPTO_SUCCESS ) != BaselineUnsecure( &ref ) )
+			{
+				differ++;
+			}
+			else if ( memcmp( frame, copy, pkt.BufSize ) == 0 && memcmp( pkt.FRMPayload, payload, len ) == 0 )
+			{
+				accepted++;
+			}
+		}
+		CHECK( differ == 0 && accepted >= FRAMES / 2 );
+		printf( "%u frames of 1..244 bytes against VerifyCmacB0() before: %u accepted, %u differ\n", FRAMES, accepted, differ );
+
+		// Rx of a frame: copy, parse, MIC and payload decryption
+		for ( uint8_t i = 0; i < 3; i++ )
+		{
+			for ( uint8_t j = 0; j < sizes[i]; j++ )
+			{
+				payload[j] = rand();
+			}
+			Secure( &pkt, frame, payload, sizes[i] );
+			for ( uint8_t t = 0; t < TRIALS; t++ )
+			{
+				Unsecure( frame, pkt.BufSize, true, &base[i] );
+				Unsecure( frame, pkt.BufSize, false, &kept[i] );
+			}
+		}
+		printf( "payload   key expanded for each CMAC and block: ns  keys  AES     kept: ns  keys  AES\n" );
+		for ( uint8_t i = 0; i < 3; i++ )
+		{
+			printf( "%7u %43.0f %5u %4u %12.0f %5u %4u\n", sizes[i], base[i].Ns, base[i].KeyExpansions, base[i].AesBlocks,
+			        kept[i].Ns, kept[i].KeyExpansions, kept[i].AesBlocks );
+
+			// One expansion for the CMAC and one for each keystream block are gone, the CMAC subkeys with them
+			CHECK( base[i].KeyExpansions == 1 + ( sizes[i] + 15 ) / 16 && kept[i].KeyExpansions == 0 );
+			CHECK( kept[i].AesBlocks == base[i].AesBlocks - 1 );
+		}
+	}
+	return HostResult( "TestCmac" );
+}
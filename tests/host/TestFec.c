@@ -0,0 +1,204 @@
+/**************************************************************************************
+ *
+ * TestFec.c
+ *
+ * FEC parity group of each destination, set by LoRaLinkSetFec() and by API_REQ_FEC,
+ * and the delivery ratio and throughput of fragmented messages over a lossy channel
+ * without retransmission for each group size.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+#include "LoRaLinkApi.h"
+#include "LoRaLinkCrypto.h"
+#include "LoRaLinkFrag.h"
+
+#define PANID      0x0102
+#define NODE_ADDR  0x12
+#define GW_ADDR    0xFE
+#define PEER_ADDR  0x34
+#define MSG_LEN    200
+#define MESSAGES   200
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint32_t LossPercent = 0;
+static uint32_t Random = 1;
+static uint8_t TxType = 0;
+static uint32_t TxAirtime = 0;
+static uint32_t Delivered = 0;
+
+static bool Lost( void )
+{
+	Random = Random * 1103515245UL + 12345UL;
+	return ( ( Random >> 16 ) % 100 ) < LossPercent;
+}
+
+/*
+ * LoRaLinkSend() spins until TxDone, the frame is over at once.
+ * The frames the channel does not lose are reassembled as by the receiver.
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	LoRaLinkFragRx_t* msg = NULL;
+	uint8_t frame[LORA_PHY_MAXPAYLOAD];
+	RxDoneParams_t rx = { .Payload = frame, .Size = size };
+
+	memcpy( frame, buffer, size );
+	LoRaLinkApiGetRxData( &pkt, &rx );
+	CHECK( LoRaLinkCryptoUnsecureMessage( &pkt ) == LORALINK_CRYPTO_SUCCESS );
+	TxType = pkt.FRMPayloadType;
+	TxAirtime += timeOnAir;
+
+	if ( Lost() == false && ( TxType == LINK_FRAGMENT || TxType == LINK_FRAGMENT_FEC ) )
+	{
+		msg = LoRaLinkFragAdd( NODE_ADDR, TxType, pkt.FRMPayload, pkt.FRMPayloadSize );
+		if ( msg != NULL && msg->Len == MSG_LEN + 1 )
+		{
+			Delivered++;
+		}
+	}
+	HostRunUntil( HostTime + timeOnAir );
+}
+
+static void Init( void )
+{
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioTxHook = OnTx;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, 40, 46, SF_9, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+}
+
+static uint8_t Send( uint8_t destAddr, uint8_t len )
+{
+	uint8_t payload[MSG_LEN] = { 0 };
+
+	TxType = 0;
+	CHECK( LoRaLinkSend( destAddr, MQTT_SN, payload, len, 5000 ) == LORALINK_STATUS_OK );
+	return TxType;
+}
+
+/*
+ * API_REQ_FEC from the host, returns the API_RSP_FEC payload
+ */
+static bool Request( uint8_t destAddr, uint8_t group, uint8_t* rsp )
+{
+	uint8_t body[4] = { 0, API_REQ_FEC, destAddr, group };
+	uint8_t frame[16];
+	uint8_t sum = 0;
+	uint8_t len = 0;
+
+	frame[len++] = 0x7E;
+	frame[len++] = 0;
+	frame[len++] = sizeof(body) + 1;
+	for ( uint8_t i = 0; i < sizeof(body); i++ )
+	{
+		sum += body[i];
+		frame[len++] = body[i];
+	}
+	frame[len++] = 0xFF - sum;
+
+	HostUartClear();
+	HostUartWrite( frame, len );
+	LoRaLinkApiPoll();
+
+	// FRAME_DLMT Len(2) SrcAddr(1) Rssi(2) Snr(2) PayloadType(1) Payload Checksum(1)
+	if ( HostUartTxLen != 1 + 2 + 6 + LORALINK_API_FEC_LEN + 1 || HostUartTx[8] != API_RSP_FEC )
+	{
+		return false;
+	}
+	memcpy( rsp, HostUartTx + 9, LORALINK_API_FEC_LEN );
+	return true;
+}
+
+/*
+ * Messages over the lossy channel, returns the ratio delivered in %
+ */
+static uint32_t Bench( uint8_t group, uint32_t loss, uint32_t* throughput )
+{
+	uint8_t payload[MSG_LEN];
+
+	Init();
+	CHECK( LoRaLinkSetFec( GW_ADDR, group ) == LORALINK_STATUS_OK );
+	LossPercent = loss;
+	Random = 1;
+	TxAirtime = 0;
+	Delivered = 0;
+
+	memset( payload, 0xA5, sizeof(payload) );
+	for ( uint32_t n = 0; n < MESSAGES; n++ )
+	{
+		CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, payload, sizeof(payload), 5000 ) == LORALINK_STATUS_OK );
+	}
+	// Delivered bits for each second on the air
+	*throughput = (uint32_t)( (uint64_t)Delivered * MSG_LEN * 8 * 1000 / TxAirtime );
+	return Delivered * 100 / MESSAGES;
+}
+
+int main( void )
+{
+	uint8_t groups[] = { 0, 4, 2 };
+	uint32_t losses[] = { 0, 5, 10, 20 };
+	uint32_t ratio[3][4] = { { 0 } };
+	uint32_t throughput = 0;
+	uint8_t rsp[LORALINK_API_FEC_LEN] = { 0 };
+
+	Init();
+
+	// A group for each destination, the others take the multicast one
+	CHECK( LoRaLinkGetFec( PEER_ADDR ) == 0 );
+	CHECK( LoRaLinkSetFec( PEER_ADDR, 2 ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkGetFec( PEER_ADDR ) == 2 && LoRaLinkGetFec( GW_ADDR ) == 0 );
+	CHECK( Send( PEER_ADDR, 20 ) == LINK_FRAGMENT_FEC );
+	CHECK( Send( GW_ADDR, 20 ) == MQTT_SN );
+	CHECK( LoRaLinkSetFec( LORALINK_MULTICAST_ADDR, 3 ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkGetFec( PEER_ADDR ) == 2 && LoRaLinkGetFec( GW_ADDR ) == 3 );
+	CHECK( Send( GW_ADDR, 20 ) == LINK_FRAGMENT_FEC );
+
+	// No room for a destination more, the last one goes back to the multicast group
+	for ( uint8_t i = 1; i < LORALINK_FEC_DESTS; i++ )
+	{
+		CHECK( LoRaLinkSetFec( PEER_ADDR + i, 0 ) == LORALINK_STATUS_OK );
+	}
+	CHECK( LoRaLinkSetFec( GW_ADDR, 0 ) == LORALINK_STATUS_PARAMETER_INVALID );
+	CHECK( LoRaLinkGetFec( GW_ADDR ) == 3 );
+	CHECK( LoRaLinkSetFec( PEER_ADDR + 1, 3 ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkSetFec( GW_ADDR, 0 ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkGetFec( GW_ADDR ) == 0 && LoRaLinkGetFec( PEER_ADDR + 1 ) == 3 );
+
+	// The host of the TX modem sets and reads the group of a destination
+	Init();
+	CHECK( Request( PEER_ADDR, 4, rsp ) == true && rsp[0] == PEER_ADDR && rsp[1] == 4 );
+	CHECK( LoRaLinkGetFec( PEER_ADDR ) == 4 && LoRaLinkGetFec( GW_ADDR ) == 0 );
+	CHECK( Request( PEER_ADDR, 0xFF, rsp ) == true && rsp[1] == 4 );
+	CHECK( Request( LORALINK_MULTICAST_ADDR, 2, rsp ) == true && rsp[1] == 2 );
+	CHECK( LoRaLinkGetFec( GW_ADDR ) == 2 );
+
+	for ( uint8_t g = 0; g < sizeof(groups); g++ )
+	{
+		printf( "group %u:", groups[g] );
+		for ( uint8_t l = 0; l < sizeof(losses) / sizeof(losses[0]); l++ )
+		{
+			ratio[g][l] = Bench( groups[g], losses[l], &throughput );
+			printf( "  loss %2u%% delivered %3u%% %4u bit/s", losses[l], ratio[g][l], throughput );
+		}
+		printf( "\n" );
+	}
+
+	// Parity costs airtime but no message on a clean channel, and saves messages on a lossy one
+	CHECK( ratio[0][0] == 100 && ratio[1][0] == 100 && ratio[2][0] == 100 );
+	for ( uint8_t l = 1; l < sizeof(losses) / sizeof(losses[0]); l++ )
+	{
+		CHECK( ratio[2][l] > ratio[0][l] );
+	}
+	return HostResult( "TestFec" );
+}
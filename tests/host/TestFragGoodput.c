@@ -0,0 +1,164 @@
+/**************************************************************************************
+ *
+ * TestFragGoodput.c
+ *
+ * Fragmented messages over a lossy channel: the receiver requests the lost fragments
+ * with LINK_FRAGMENT_NACK and LoRaLinkRecvPoll() sends them again without blocking,
+ * the goodput is printed for each loss rate.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+#include "LoRaLinkApi.h"
+#include "LoRaLinkCrypto.h"
+#include "LoRaLinkFrag.h"
+#include "utilities.h"
+
+#define PANID      0x0102
+#define NODE_ADDR  0x12
+#define GW_ADDR    0xFE
+#define MSG_LEN    240
+#define MESSAGES   20
+#define MAX_ROUNDS 8
+#define RX_TIMEOUT 1000
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint32_t LossPercent = 0;
+static uint32_t Random = 1;
+static uint8_t Seq = 0;
+static uint8_t Count = 0;
+static uint32_t Received = 0;
+static uint32_t TxFrames = 0;
+static bool TxBlocking = false;
+
+static bool Lost( void )
+{
+	Random = Random * 1103515245UL + 12345UL;
+	return ( ( Random >> 16 ) % 100 ) < LossPercent;
+}
+
+/*
+ * Fragment on the air, the receiver takes it unless the channel loses it.
+ * LoRaLinkSend() spins until TxDone, the frame is over at once. For LoRaLinkRecvPoll()
+ * the clock is not moved, the TxDone timer ends the frame.
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	uint8_t frame[LORA_PHY_MAXPAYLOAD];
+	RxDoneParams_t rx = { .Payload = frame, .Size = size };
+
+	TxFrames++;
+	memcpy( frame, buffer, size );
+	LoRaLinkApiGetRxData( &pkt, &rx );
+	CHECK( LoRaLinkCryptoUnsecureMessage( &pkt ) == LORALINK_CRYPTO_SUCCESS );
+	CHECK( pkt.FRMPayloadType == LINK_FRAGMENT );
+	Seq = pkt.FRMPayload[0];
+	Count = pkt.FRMPayload[2];
+	if ( Lost() == false )
+	{
+		Received |= 1UL << pkt.FRMPayload[1];
+	}
+	if ( TxBlocking == true )
+	{
+		HostRunUntil( HostTime + timeOnAir );
+	}
+}
+
+static uint32_t Missing( void )
+{
+	return ~Received & ( ( Count >= 32 ) ? 0xFFFFFFFFUL : ( ( 1UL << Count ) - 1 ) );
+}
+
+/*
+ * One message, NACKed until all its fragments are received.
+ * Returns the number of LoRaLinkRecvPoll() calls returned while a fragment was on the air.
+ */
+static uint32_t SendMessage( uint8_t* msg, bool* complete )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	LoRaLinkStatus_t rc;
+	uint8_t nack[LORALINK_FRAG_NACK_LEN];
+	uint8_t frame[64];
+	uint8_t len = 0;
+	uint32_t txBusy = 0;
+
+	Received = 0;
+	TxBlocking = true;
+	CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, msg, MSG_LEN, 5000 ) == LORALINK_STATUS_OK );
+	TxBlocking = false;
+
+	for ( uint8_t round = 0; round < MAX_ROUNDS && Missing() != 0; round++ )
+	{
+		CHECK( LoRaLinkRecvPoll( &pkt, RX_TIMEOUT ) == LORALINK_STATUS_BUSY );
+		nack[0] = Seq;
+		setUint32( nack + 1, Missing() );
+		len = HostRadioFrame( frame, PANID, NODE_ADDR, GW_ADDR, LINK_FRAGMENT_NACK, nack, sizeof(nack) );
+		HostRunUntil( HostTime + LoRaLinkGetTimeOnAir( sizeof(nack) ) );
+		CHECK( HostRadioReceive( frame, len, -80, 5 ) == true );
+
+		// Missing fragments go out, then Rx runs until the timeout
+		while ( ( rc = LoRaLinkRecvPoll( &pkt, RX_TIMEOUT ) ) == LORALINK_STATUS_BUSY )
+		{
+			if ( HostRadio.State == RF_TX_RUNNING )
+			{
+				txBusy++;
+			}
+			CHECK( HostRunNext() == true );
+		}
+		CHECK( rc == LORALINK_STATUS_RX_TIMEOUT );
+	}
+	*complete = ( Missing() == 0 );
+	return txBusy;
+}
+
+int main( void )
+{
+	uint32_t lossRates[] = { 0, 10, 20, 30 };
+	uint8_t msg[MSG_LEN];
+
+	memset( msg, 0x5A, sizeof(msg) );
+	for ( uint8_t i = 0; i < sizeof(lossRates) / sizeof(lossRates[0]); i++ )
+	{
+		TimerTime_t start = 0;
+		uint32_t delivered = 0;
+		uint32_t txBusy = 0;
+		uint32_t elapsed = 0;
+		bool complete = false;
+
+		HostReset( 1000 );
+		HostRadioInit();
+		HostRadioTxHook = OnTx;
+		LoRaLinkInitilize();
+		CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, 40, 46, SF_9, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+		LossPercent = lossRates[i];
+		TxFrames = 0;
+		start = HostTime;
+
+		for ( uint8_t n = 0; n < MESSAGES; n++ )
+		{
+			txBusy += SendMessage( msg, &complete );
+			delivered += complete ? 1 : 0;
+		}
+		elapsed = HostTime - start;
+
+		CHECK( delivered == MESSAGES );
+		if ( LossPercent > 0 )
+		{
+			// LoRaLinkRecvPoll() returned while the fragments sent again were on the air
+			CHECK( txBusy > 0 );
+		}
+		printf( "loss %2u%%: %u/%u messages of %u bytes in %u fragments (%u frames), goodput %u bit/s\n",
+		        LossPercent, delivered, MESSAGES, MSG_LEN, Count, TxFrames,
+		        (uint32_t)( (uint64_t)delivered * MSG_LEN * 8 * 1000 / elapsed ) );
+	}
+	return HostResult( "TestFragGoodput" );
+}
@@ -0,0 +1,218 @@
+/**************************************************************************************
+ *
+ * TestHostLoopback.c
+ *
+ * Host/LoRaLinkHost.c against the TX modem API code over a pseudo terminal. A child
+ * process runs LoRaLinkApi.c on the master side and loops every message back as a
+ * received frame, the host sends and receives on the slave side. Frames with the
+ * largest payload check the 299 bytes Rx frame, the throughput of the plain and the
+ * sequenced link is printed. On the sequenced link the child corrupts a byte of every
+ * CORRUPT_EVERY writes in both directions: every message has to come back once and in
+ * order, the modem resending its frames the host did not acknowledge.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "HostStub.h"
+#include "LoRaLinkApi.h"
+#include "LoRaLinkStats.h"
+#include "LoRaLinkHost.h"
+#include "utilities.h"
+
+#define GW_ADDR      0xFE
+#define NODE_ADDR    0x12
+#define MESSAGES     2000
+#define IN_FLIGHT    3        // 2 frames from the modem each, those of IN_FLIGHT + 1 fit its resend window
+#define MSG_LEN      LORALINK_HOST_MAXPAYLOAD
+#define TIMEOUT      1000
+#define CORRUPT_EVERY 37
+#define STATS_COUNTERS 7      // Index Version Elapsed(4) Count, then the counters
+
+static double Seconds( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Corrupt( uint8_t* buf, ssize_t len )
+{
+	static uint32_t writes = 0;
+
+	if ( ++writes % CORRUPT_EVERY == 0 )
+	{
+		buf[len / 2] ^= 0x04;
+	}
+}
+
+static void Fill( uint8_t* payload, uint16_t seq )
+{
+	for ( uint16_t i = 0; i < MSG_LEN; i++ )
+	{
+		// Frame delimiter and escape bytes in the payload
+		payload[i] = (uint8_t)( seq + i * 0x3F );
+	}
+}
+
+/*
+ * TX modem: the UART of the stub is bridged to the pty, each message comes back
+ * from NODE_ADDR as if the radio had received it. The modem time is the real one
+ * for its retransmissions.
+ */
+static void Modem( int fd )
+{
+	static LoRaLinkApi_t api;
+	LoRaLinkApiReadParameters_t para = { 0 };
+	LoRaLinkPacket_t pkt = { 0 };
+	LoRaLinkRxMeta_t meta = { 0 };
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	uint8_t buf[512];
+	ssize_t n = 0;
+	uint16_t room = 0;
+	uint32_t looped = 0;
+	double t0 = Seconds();
+
+	HostReset( 1000 );
+	while ( true )
+	{
+		HostRunUntil( 1000 + (TimerTime_t)( ( Seconds() - t0 ) * 1000 ) );
+		room = HOST_UART_BUF_LEN - ( HostUartRxTail - HostUartRxHead );
+		if ( poll( &pfd, 1, 1 ) > 0 && ( n = read( fd, buf, MIN( sizeof(buf), room ) ) ) > 0 )
+		{
+			if ( looped >= MESSAGES )
+			{
+				Corrupt( buf, n );
+			}
+			HostUartWrite( buf, n );
+		}
+
+		para.Available = false;
+		if ( LoRaLinkApiRead( &api, &para ) == true && para.Available == true )
+		{
+			pkt.PanId = api.PanId;
+			pkt.DestAddr = GW_ADDR;
+			pkt.SourceAddr = NODE_ADDR;
+			pkt.Rssi = -60;
+			pkt.Snr = 5;
+			pkt.FRMPayloadType = api.PayloadType;
+			pkt.FRMPayload = api.Payload;
+			pkt.FRMPayloadSize = api.PayloadLen;
+			meta.Counter++;
+			LoRaLinkApiWriteRx( &pkt, &meta );
+			LoRaLinkApiWriteResp( API_RSP_ACK, &api );
+			looped += ( api.PayloadType == MQTT_SN );
+		}
+
+		if ( HostUartTxLen > 0 )
+		{
+			if ( looped > MESSAGES )
+			{
+				Corrupt( HostUartTx, HostUartTxLen );
+			}
+			CHECK( write( fd, HostUartTx, HostUartTxLen ) == HostUartTxLen );
+			HostUartTxLen = 0;
+		}
+	}
+}
+
+/*
+ * Messages sent IN_FLIGHT at a time until all came back, returns bytes/s of payload
+ */
+static double Loopback( LoRaLinkHost_t* host )
+{
+	static LoRaLinkHostFrame_t frame;
+	uint8_t payload[MSG_LEN];
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint32_t errors = 0;
+	double t0 = Seconds();
+	int rc = 0;
+
+	while ( received < MESSAGES && Seconds() - t0 < 30 )
+	{
+		if ( sent < MESSAGES && sent - received < IN_FLIGHT )
+		{
+			Fill( payload, sent );
+			if ( LoRaLinkHostSend( host, NODE_ADDR, MQTT_SN, payload, MSG_LEN ) == 0 )
+			{
+				sent++;
+			}
+		}
+		rc = LoRaLinkHostPoll( host, &frame, sent - received < IN_FLIGHT ? 0 : 10 );
+		if ( rc < 0 )
+		{
+			break;
+		}
+		if ( rc == 1 && frame.PayloadType == MQTT_SN )
+		{
+			Fill( payload, received );
+			if ( frame.Extended == false || frame.SourceAddr != NODE_ADDR || frame.PayloadLen != MSG_LEN ||
+			     memcmp( frame.Payload, payload, MSG_LEN ) != 0 )
+			{
+				errors++;
+			}
+			received++;
+		}
+	}
+	CHECK( rc >= 0 && received == MESSAGES && errors == 0 );
+	return (double)received * MSG_LEN / ( Seconds() - t0 );
+}
+
+int main( void )
+{
+	static LoRaLinkHost_t host;
+	static LoRaLinkHostFrame_t stats;
+	uint8_t* resent = stats.Payload + STATS_COUNTERS + LORALINK_STATS_API_TX_RESENT * 4;
+	uint8_t* givenUp = stats.Payload + STATS_COUNTERS + LORALINK_STATS_API_TX_GIVEN_UP * 4;
+	double plain = 0;
+	double sequenced = 0;
+	pid_t modem = 0;
+	int fd = -1;
+
+	fd = posix_openpt( O_RDWR | O_NOCTTY );
+	CHECK( fd >= 0 && grantpt( fd ) == 0 && unlockpt( fd ) == 0 );
+	CHECK( LoRaLinkHostOpen( &host, ptsname( fd ), 115200 ) == 0 );
+
+	modem = fork();
+	if ( modem == 0 )
+	{
+		LoRaLinkHostClose( &host );
+		Modem( fd );
+		exit( 0 );
+	}
+
+	// Every Rx frame with its metadata, 299 bytes with the largest payload
+	CHECK( LoRaLinkHostSetRxFormat( &host, LORALINK_HOST_RX_FORMAT_EXT, TIMEOUT ) == LORALINK_HOST_RX_FORMAT_EXT );
+	plain = Loopback( &host );
+	CHECK( host.RxErrors == 0 && host.RxLost == 0 );
+
+	CHECK( LoRaLinkHostSetMode( &host, 921600, LORALINK_HOST_MODE_SEQUENCED, TIMEOUT ) == 0 );
+	sequenced = Loopback( &host );
+	CHECK( LoRaLinkHostGetStats( &host, 0, 0, &stats, TIMEOUT ) == 0 );
+
+	printf( "%u messages of %u bytes looped back: plain %.0f bytes/s, sequenced %.0f bytes/s\n",
+	        MESSAGES, MSG_LEN, plain, sequenced );
+	printf( "sequenced, 1 of %u writes corrupted: host %u retransmits, modem %u resent, %u given up, "
+	        "host %u errors, %u discarded, %u lost\n", CORRUPT_EVERY, host.Retransmits, getUint32( resent ),
+	        getUint32( givenUp ), host.RxErrors, host.RxDiscarded, host.RxLost );
+	// Corrupted frames both ways, none lost
+	CHECK( host.RxErrors > 0 && host.Retransmits > 0 && getUint32( resent ) > 0 );
+	CHECK( host.RxLost == 0 && getUint32( givenUp ) == 0 );
+
+	kill( modem, SIGTERM );
+	waitpid( modem, NULL, 0 );
+	LoRaLinkHostClose( &host );
+	close( fd );
+	return HostResult( "TestHostLoopback" );
+}
@@ -0,0 +1,95 @@
+/**************************************************************************************
+ *
+ * TestImplicit.c
+ *
+ * Implicit header PHY profile: every frame is FixedLen long, shorter payloads are padded
+ * and longer ones fragmented, the padding is not passed up on reception.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+
+#define PANID      0x0102
+#define NODE_ADDR  0x12
+#define GW_ADDR    0xFE
+#define FIXED_LEN  24
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static uint32_t TxFrames = 0;
+static uint32_t TxOddSize = 0;
+
+/*
+ * LoRaLinkSend() spins until TxDone, the frame is over at once
+ */
+static void OnTx( uint8_t* buffer, uint8_t size, uint32_t timeOnAir )
+{
+	TxFrames++;
+	if ( size != FIXED_LEN + LORALINK_HDR_LEN + LORALINK_MIC_LEN || HostRadio.ImplicitHeader == false )
+	{
+		TxOddSize++;
+	}
+	HostRunUntil( HostTime + timeOnAir );
+}
+
+static void Send( uint8_t len )
+{
+	uint8_t payload[64];
+
+	memset( payload, len, sizeof(payload) );
+	CHECK( LoRaLinkSend( GW_ADDR, MQTT_SN, payload, len, 5000 ) == LORALINK_STATUS_OK );
+}
+
+int main( void )
+{
+	LoRaLinkPhyProfile_t phy = LORALINK_PHY_IMPLICIT( FIXED_LEN );
+	LoRaLinkPhyProfile_t tiny = LORALINK_PHY_IMPLICIT( 3 );
+	LoRaLinkPacket_t pkt = { 0 };
+	uint8_t payload[FIXED_LEN] = { 0 };
+	uint8_t frame[64];
+	uint8_t len = 0;
+	uint32_t frames = 0;
+
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadioTxHook = OnTx;
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, 40, 46, SF_9, 13, NULL, &phy ) == LORALINK_STATUS_OK );
+	CHECK( LoRaLinkSetPhyProfile( &tiny ) == LORALINK_STATUS_PARAMETER_INVALID );
+
+	// Any length takes the time on air of FixedLen
+	CHECK( LoRaLinkGetMaxPayloadLength( GW_ADDR ) == FIXED_LEN - LORALINK_AGGREGATE_SUBHDR_LEN );
+	CHECK( LoRaLinkGetTimeOnAir( 1 ) == LoRaLinkGetTimeOnAir( FIXED_LEN ) );
+
+	// Short payloads in one padded frame
+	Send( 1 );
+	Send( 10 );
+	Send( FIXED_LEN - LORALINK_AGGREGATE_SUBHDR_LEN );
+	CHECK( TxFrames == 3 && TxOddSize == 0 );
+
+	// Longer ones in fragments of FixedLen
+	frames = TxFrames;
+	Send( 40 );
+	CHECK( TxFrames - frames > 1 && TxOddSize == 0 );
+	printf( "fixed length %u: 40 bytes in %u frames\n", FIXED_LEN, TxFrames - frames );
+
+	// A padded frame of the gateway gives one message
+	payload[0] = 10;
+	payload[1] = MQTT_SN;
+	memset( payload + LORALINK_AGGREGATE_SUBHDR_LEN, 0x5A, 10 );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	len = HostRadioFrame( frame, PANID, NODE_ADDR, GW_ADDR, LINK_AGGREGATE, payload, sizeof(payload) );
+	CHECK( HostRadioReceive( frame, len, -60, 10 ) == true );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK );
+	CHECK( pkt.FRMPayloadType == MQTT_SN && pkt.FRMPayloadSize == 10 && pkt.FRMPayload[9] == 0x5A );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+
+	return HostResult( "TestImplicit" );
+}
@@ -0,0 +1,605 @@
+/**************************************************************************************
+ *
+ * TestPublish.c
+ *
+ * PUBLISH window of the MQTT-SN client over a half duplex link. The node sends the ready
+ * messages of the window in LINK_AGGREGATE frames and listens once for the responses.
+ * The gateway answers when the channel is free, the responses it has by then go in one
+ * LINK_AGGREGATE frame; the node hears a frame only if it listens for the whole of it.
+ * One channel at SF9/125 kHz, gateway and broker take 500 ms.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "MQTTSNClient.h"
+#include "MQTTSNPublish.h"
+#include "MQTTSNSubscribe.h"
+#include "MQTTSNRegister.h"
+#include "MQTTSNOffline.h"
+#include "LoRaLink.h"
+#include "utilities.h"
+#include "device.h"
+
+#define MAX_PAYLOAD   244
+#define GW_TURN       500
+#define MAX_RESP      32
+#define MAX_MSGS      ( MAX_PAYLOAD / ( LORALINK_AGGREGATE_SUBHDR_LEN + 2 ) )
+#define PUMP_LIMIT    100000
+
+typedef struct
+{
+	uint8_t Msg[16];
+	TimerTime_t Ready;       // gateway has the response
+	TimerTime_t Start;       // on air, 0 while waiting for the channel
+	TimerTime_t End;
+	uint32_t Frame;          // responses of a frame have the same number
+	bool Heard;              // the node listens from the start
+}Response_t;
+
+static uint8_t TxBuffer[256];
+static uint8_t RxMsg[16];
+static Response_t Resp[MAX_RESP];
+static uint8_t RespNum = 0;
+static uint32_t RespFrames = 0;
+static uint32_t RxFrame = 0;      // frame of the last response returned
+static TimerTime_t ChanFree = 0;
+static bool Listening = false;
+static TimerTime_t ListenStart = 0;
+static TimerTime_t ListenEnd = 0;
+static uint32_t RxOnTime = 0;
+static uint32_t Sent[32];
+static uint32_t DupSent = 0;
+static uint32_t LostAcks = 0;
+static uint32_t PubCount = 0;
+static uint32_t TxFrames = 0;
+static uint8_t AggBuffer[MAX_PAYLOAD];   // messages held for one frame, MQTT-SN length first
+static uint8_t AggLen = 0;
+static uint8_t AggCount = 0;
+static uint32_t AggFrames = 0;
+static uint8_t AggTypes[2];       // first two messages of the last shared frame
+static bool Reply = false;        // OnPublish publishes a reply
+static int32_t DropNth = -1;        // the gateway misses this PUBLISH
+static uint32_t DropRate = 0;       // and 1 of DropRate PUBLISHes at random
+
+static uint32_t Done = 0;
+static MQTTSNState_t DoneState = MQTTSN_STATE_OK;
+static uint32_t Queued = 0;
+static uint32_t ToQueue = 0;
+static uint8_t Data[16];
+
+static void OnDone( MQTTSNHandle_t handle, MQTTSNState_t state );
+
+static void OnPublish( Payload_t* payload )
+{
+	if ( Reply == true )
+	{
+		PublishRowdataByNameAsync( (uint8_t*)"pub/x", Data, sizeof(Data), QOS_1, false, OnDone );
+	}
+}
+
+SUBSCRIBE_LIST = {
+	SUB( (uint8_t*)"sub/a", OnPublish, QOS_1 ),
+	END_OF_SUBSCRIBE_LIST
+};
+
+/*
+ * Time on air of a frame with len bytes of payload: SF9/125 kHz, CR 4/5, preamble of
+ * 8 symbols, explicit header and CRC. 12.25 + 8 + 5 * ceil( ( 8 * PL + 8 ) / 36 ) symbols
+ * of 4.096 ms.
+ */
+static uint32_t Airtime( uint16_t len )
+{
+	uint32_t pl = len + LORALINK_HDR_LEN + LORALINK_MIC_LEN;
+	uint32_t quarters = 49 + 4 * ( 8 + 5 * ( ( 8 * pl + 8 + 35 ) / 36 ) );
+
+	return ( quarters * 4096 + 3999 ) / 4000;
+}
+
+/*
+ * Responses of the gateway take the channel in turn, those ready share the frame
+ */
+static void LinkRun( void )
+{
+	TimerTime_t start = 0;
+	uint16_t len = 0;
+	uint8_t num = 0;
+
+	for ( uint8_t i = 0; i < RespNum; i += num )
+	{
+		num = 1;
+		if ( Resp[i].Start != 0 )
+		{
+			continue;
+		}
+		start = Resp[i].Ready > ChanFree ? Resp[i].Ready : ChanFree;
+		if ( (int32_t)( start - HostTime ) > 0 )
+		{
+			return;
+		}
+		len = Resp[i].Msg[0];
+		while ( i + num < RespNum && (int32_t)( Resp[i + num].Ready - start ) <= 0 &&
+		        len + ( num + 1 ) * LORALINK_AGGREGATE_SUBHDR_LEN + Resp[i + num].Msg[0] <= MAX_PAYLOAD )
+		{
+			len += Resp[i + num++].Msg[0];
+		}
+		len += num > 1 ? num * LORALINK_AGGREGATE_SUBHDR_LEN : 0;
+
+		RespFrames++;
+		for ( uint8_t j = i; j < i + num; j++ )
+		{
+			Resp[j].Start = start;
+			Resp[j].End = start + Airtime( len );
+			Resp[j].Frame = RespFrames;
+			Resp[j].Heard = Listening == true && (int32_t)( start - ListenStart ) >= 0;
+		}
+		ChanFree = Resp[i].End;
+	}
+}
+
+/*
+ * Node leaves Rx, a response on air is lost
+ */
+static void StopListening( void )
+{
+	for ( uint8_t i = 0; i < RespNum; i++ )
+	{
+		if ( Resp[i].Start != 0 && (int32_t)( Resp[i].End - HostTime ) > 0 )
+		{
+			Resp[i].Heard = false;
+		}
+	}
+	if ( Listening == true )
+	{
+		RxOnTime += HostTime - ListenStart;
+	}
+	Listening = false;
+}
+
+static void Respond( const uint8_t* msg, TimerTime_t ready )
+{
+	if ( RespNum < MAX_RESP )
+	{
+		memcpy( Resp[RespNum].Msg, msg, msg[0] );
+		Resp[RespNum].Ready = ready;
+		Resp[RespNum].Start = 0;
+		RespNum++;
+	}
+}
+
+static void Gateway( const uint8_t* b, TimerTime_t rxEnd )
+{
+	uint8_t r[16];
+
+	switch ( b[1] )
+	{
+	case MQTTSN_TYPE_SEARCHGW:
+		r[0] = 3; r[1] = MQTTSN_TYPE_GWINFO; r[2] = 1;
+		break;
+	case MQTTSN_TYPE_CONNECT:
+		r[0] = 3; r[1] = MQTTSN_TYPE_CONNACK; r[2] = 0;
+		break;
+	case MQTTSN_TYPE_REGISTER:
+		r[0] = 7; r[1] = MQTTSN_TYPE_REGACK; setUint16( r + 2, 0x0100 + b[6] ); memcpy( r + 4, b + 4, 2 ); r[6] = 0;
+		break;
+	case MQTTSN_TYPE_SUBSCRIBE:
+		r[0] = 8; r[1] = MQTTSN_TYPE_SUBACK; r[2] = b[2] & 0x60; setUint16( r + 3, 0x0202 ); memcpy( r + 5, b + 3, 2 ); r[7] = 0;
+		break;
+	case MQTTSN_TYPE_PUBLISH:
+		if ( (int32_t)PubCount++ == DropNth || ( DropRate > 0 && rand() % DropRate == 0 ) )
+		{
+			return;
+		}
+		if ( ( b[2] & 0x60 ) == QOS_1 )
+		{
+			r[0] = 7; r[1] = MQTTSN_TYPE_PUBACK; memcpy( r + 2, b + 3, 2 ); memcpy( r + 4, b + 5, 2 ); r[6] = 0;
+		}
+		else if ( ( b[2] & 0x60 ) == QOS_2 )
+		{
+			r[0] = 4; r[1] = MQTTSN_TYPE_PUBREC; memcpy( r + 2, b + 5, 2 );
+		}
+		else
+		{
+			return;
+		}
+		break;
+	case MQTTSN_TYPE_PUBREL:
+		r[0] = 4; r[1] = MQTTSN_TYPE_PUBCOMP; memcpy( r + 2, b + 2, 2 );
+		break;
+	case MQTTSN_TYPE_PINGREQ:
+		r[0] = 2; r[1] = MQTTSN_TYPE_PINGRESP;
+		break;
+	default:
+		return;
+	}
+	Respond( r, rxEnd + GW_TURN );
+}
+
+/*
+ * Node takes the channel for one frame of num messages
+ */
+static void SendFrame( uint8_t** msgs, uint8_t num )
+{
+	TimerTime_t start = 0;
+	uint16_t len = 0;
+
+	LinkRun();
+	StopListening();
+
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		len += msgs[i][0] + ( num > 1 ? LORALINK_AGGREGATE_SUBHDR_LEN : 0 );
+	}
+
+	// Carrier sense defers behind a response on air
+	start = (int32_t)( ChanFree - HostTime ) > 0 ? ChanFree : HostTime;
+	ChanFree = start + Airtime( len );
+	TxFrames++;
+	for ( uint8_t i = 0; i < num; i++ )
+	{
+		Sent[msgs[i][1]]++;
+		if ( msgs[i][1] == MQTTSN_TYPE_PUBLISH && ( msgs[i][2] & MQTTSN_FLAG_DUP ) )
+		{
+			DupSent++;
+		}
+		Gateway( msgs[i], ChanFree );
+	}
+	if ( num > 1 )
+	{
+		AggFrames++;
+		AggTypes[0] = msgs[0][1];
+		AggTypes[1] = msgs[1][1];
+	}
+	HostRunUntil( ChanFree );
+}
+
+/*
+ * LoRaLink.h
+ */
+LoRaLinkStatus_t LoRaLinkSend( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t timeout )
+{
+	SendFrame( &buffer, 1 );
+	return LORALINK_STATUS_OK;
+}
+
+LoRaLinkStatus_t LoRaLinkAggregateFlush( uint32_t timeout )
+{
+	uint8_t* msgs[MAX_MSGS];
+
+	for ( uint8_t i = 0, pos = 0; i < AggCount; pos += AggBuffer[pos], i++ )
+	{
+		msgs[i] = AggBuffer + pos;
+	}
+	if ( AggCount > 0 )
+	{
+		SendFrame( msgs, AggCount );
+	}
+	LoRaLinkAggregateClear();
+	return LORALINK_STATUS_OK;
+}
+
+bool LoRaLinkAggregateFits( uint8_t destAddr, uint8_t buffLen )
+{
+	return AggCount > 0 && AggLen + ( AggCount + 1 ) * LORALINK_AGGREGATE_SUBHDR_LEN + buffLen <= MAX_PAYLOAD;
+}
+
+LoRaLinkStatus_t LoRaLinkAggregate( uint8_t destAddr, uint8_t payloadType, uint8_t* buffer, uint8_t buffLen, uint32_t maxDelay, uint32_t timeout )
+{
+	if ( AggCount > 0 && LoRaLinkAggregateFits( destAddr, buffLen ) == false )
+	{
+		LoRaLinkAggregateFlush( timeout );
+	}
+	memcpy( AggBuffer + AggLen, buffer, buffLen );
+	AggLen += buffLen;
+	AggCount++;
+	return maxDelay == 0 ? LoRaLinkAggregateFlush( timeout ) : LORALINK_STATUS_OK;
+}
+
+void LoRaLinkAggregateClear( void )
+{
+	AggCount = 0;
+	AggLen = 0;
+}
+
+LoRaLinkStatus_t LoRaLinkRecvPoll( LoRaLinkPacket_t* pkt, uint32_t timeout )
+{
+	if ( Listening == false )
+	{
+		Listening = true;
+		ListenStart = HostTime;
+		ListenEnd = HostTime + timeout;
+	}
+	LinkRun();
+
+	while ( RespNum > 0 && Resp[0].Start != 0 && (int32_t)( Resp[0].End - HostTime ) <= 0 )
+	{
+		bool heard = Resp[0].Heard;
+
+		RxFrame = Resp[0].Frame;
+		memcpy( RxMsg, Resp[0].Msg, Resp[0].Msg[0] );
+		memmove( Resp, Resp + 1, sizeof(Resp[0]) * --RespNum );
+		if ( heard == true )
+		{
+			StopListening();
+			pkt->FRMPayloadType = MQTT_SN;
+			pkt->FRMPayload = RxMsg;
+			pkt->FRMPayloadSize = RxMsg[0];
+			return LORALINK_STATUS_OK;
+		}
+		LostAcks++;
+	}
+	if ( (int32_t)( HostTime - ListenEnd ) >= 0 )
+	{
+		StopListening();
+		return LORALINK_STATUS_RX_TIMEOUT;
+	}
+	return LORALINK_STATUS_BUSY;
+}
+
+bool LoRaLinkRecvPending( void )
+{
+	return RespNum > 0 && Resp[0].Frame == RxFrame && Resp[0].Heard == true && (int32_t)( Resp[0].End - HostTime ) <= 0;
+}
+
+uint8_t* LoRaLinkGetTxPayloadBuffer( void )
+{
+	return TxBuffer;
+}
+
+uint8_t LoRaLinkGetMaxPayloadLength( uint8_t destAddr )
+{
+	return MAX_PAYLOAD;
+}
+
+uint8_t LoRaLinkGetSourceAddr( void )
+{
+	return 0x12;
+}
+
+LoRaLinkPacket_t* LoRaLinkClearPacket( LoRaLinkPacket_t* pkt )
+{
+	memset( pkt, 0, sizeof(LoRaLinkPacket_t) );
+	return pkt;
+}
+
+uint32_t LoRaLinkGetTimeOnAir( uint8_t payloadLen )
+{
+	return Airtime( payloadLen );
+}
+
+uint32_t LoRaLinkGetAirtimeBudget( void )
+{
+	return LORALINK_AIRTIME_UNLIMITED;
+}
+
+TimerTime_t LoRaLinkGetTxDelay( uint8_t payloadLen )
+{
+	return 0;
+}
+
+/*
+ * MCU sleeps until the next response, the end of the Rx window or a timer
+ */
+static void Idle( void )
+{
+	TimerTime_t next = HostTime + 3600000;
+	TimerTime_t t = 0;
+
+	LinkRun();
+	if ( Listening == true && (int32_t)( ListenEnd - next ) < 0 )
+	{
+		next = ListenEnd;
+	}
+	for ( uint8_t i = 0; i < RespNum; i++ )
+	{
+		t = Resp[i].Start != 0 ? Resp[i].End : ( Resp[i].Ready > ChanFree ? Resp[i].Ready : ChanFree );
+		if ( (int32_t)( t - next ) < 0 )
+		{
+			next = t;
+		}
+	}
+	if ( HostNextTimer( &t ) == true && (int32_t)( t - next ) < 0 )
+	{
+		next = t;
+	}
+	HostRunUntil( (int32_t)( next - HostTime ) > 0 ? next : HostTime );
+}
+
+static void OnDone( MQTTSNHandle_t handle, MQTTSNState_t state )
+{
+	Done++;
+	DoneState = state;
+}
+
+static void Pump( void )
+{
+	for ( uint32_t n = 0; MQTTSNClientIsIdle() == false && n < PUMP_LIMIT; n++ )
+	{
+		MQTTSNClientProcess();
+		if ( MQTTSNClientIsIdle() == false )
+		{
+			DeviceLowPowerHandler();
+		}
+	}
+}
+
+static MQTTSNHandle_t Publish( const char* topic, MQTTSNQos_t qos )
+{
+	return PublishRowdataByNameAsync( (uint8_t*)topic, Data, sizeof(Data), qos, false, OnDone );
+}
+
+/*
+ * The task queues the messages once, the completion callbacks queue the rest
+ */
+static void OnQueued( MQTTSNHandle_t handle, MQTTSNState_t state );
+
+static void QueueMore( void )
+{
+	while ( Queued < ToQueue && PublishRowdataByNameAsync( (uint8_t*)"pub/x", Data, sizeof(Data), QOS_1, false, OnQueued ) != 0 )
+	{
+		Queued++;
+	}
+}
+
+static void OnQueued( MQTTSNHandle_t handle, MQTTSNState_t state )
+{
+	CHECK( state == MQTTSN_STATE_OK );
+	Done++;
+	QueueMore();
+}
+
+static void Throughput( uint32_t dropRate )
+{
+	TimerTime_t t0 = 0;
+	uint32_t wakeups = 0;
+	uint32_t frames = 0;
+	uint32_t lost = 0;
+	double perMsg = 0;
+	double last = 0;
+
+	if ( dropRate > 0 )
+	{
+		printf( "window %u, 1 of %u PUBLISHes missed by the gateway\n", MQTTSN_MAX_INFLIGHT, dropRate );
+	}
+	else
+	{
+		printf( "window %u, every PUBLISH answered\n", MQTTSN_MAX_INFLIGHT );
+	}
+	DropRate = dropRate;
+	srand( 1 );
+	for ( uint32_t n = 1; n <= 16; n *= 2 )
+	{
+		Pump();
+		t0 = HostTime;
+		wakeups = HostIdleCount;
+		lost = LostAcks;
+		frames = TxFrames;
+		RxOnTime = 0;
+		DupSent = 0;
+		Done = 0;
+		Queued = 0;
+		ToQueue = n;
+		QueueMore();
+		while ( Done < n )
+		{
+			MQTTSNClientProcess();
+			if ( Done < n )
+			{
+				DeviceLowPowerHandler();
+			}
+		}
+		perMsg = (double)( HostIdleCount - wakeups ) / n;
+		printf( "  %2u msgs: %6u ms, %5u ms/msg, Rx on %5u ms/msg, %2u frames, wake ups/msg %.2f, DUP %u, responses lost %u\n",
+		        n, HostTime - t0, ( HostTime - t0 ) / n, RxOnTime / n, TxFrames - frames, perMsg, DupSent, LostAcks - lost );
+		CHECK( LostAcks == lost );
+		CHECK( dropRate > 0 || DupSent == 0 );
+		if ( dropRate == 0 && n > 1 )
+		{
+			// The window is sent in one wake up, its responses are heard in the next one
+			CHECK( n <= MQTTSN_MAX_INFLIGHT ? perMsg < last : perMsg <= last );
+		}
+		last = perMsg;
+	}
+	DropRate = 0;
+}
+
+int main( void )
+{
+	MQTTSNConf_t conf = { 0 };
+	MQTTSNHandle_t handles[MQTTSN_MAX_INFLIGHT];
+	uint32_t pubs = 0;
+	uint32_t regs = 0;
+
+	HostReset( 1000 );
+	HostIdleHook = Idle;
+	memset( Data, 0x55, sizeof(Data) );
+	conf.clientId = "host";
+	conf.willTopic = "";
+	conf.willMsg = "";
+	conf.keepAlive = 300;
+	conf.cleanSession = true;
+	MQTTSNClientInit( &conf );
+
+	// Connect, REGISTER and PUBLISH from a lost gateway
+	Done = 0;
+	CHECK( Publish( "pub/x", QOS_1 ) != 0 );
+	Pump();
+	CHECK( Done == 1 && DoneState == MQTTSN_STATE_OK );
+
+	// A full window rejects a new message, every response is heard
+	Done = 0;
+	pubs = Sent[MQTTSN_TYPE_PUBLISH];
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		handles[i] = Publish( "pub/x", QOS_1 );
+		CHECK( handles[i] != 0 );
+	}
+	CHECK( Publish( "pub/x", QOS_1 ) == 0 && IsMaxFlight() == true );
+	Pump();
+	CHECK( Done == MQTTSN_MAX_INFLIGHT && DoneState == MQTTSN_STATE_OK );
+	CHECK( Sent[MQTTSN_TYPE_PUBLISH] == pubs + MQTTSN_MAX_INFLIGHT && LostAcks == 0 );
+
+	// The gateway misses the 2nd PUBLISH, it is sent again with DUP after the others
+	Done = 0;
+	DupSent = 0;
+	PubCount = 0;
+	DropNth = 1;
+	for ( uint8_t i = 0; i < 3; i++ )
+	{
+		Publish( "pub/x", QOS_1 );
+	}
+	Pump();
+	DropNth = -1;
+	CHECK( Done == 3 && DoneState == MQTTSN_STATE_OK && DupSent == 1 && LostAcks == 0 );
+
+	// QoS 2, 1 and 0 together
+	Done = 0;
+	Publish( "pub/x", QOS_2 );
+	Publish( "pub/x", QOS_1 );
+	Publish( "pub/x", QOS_0 );
+	Pump();
+	CHECK( Done == 3 && MQTTSNClientIsIdle() == true && LostAcks == 0 );
+
+	// Two new topics registered in turn
+	Done = 0;
+	regs = Sent[MQTTSN_TYPE_REGISTER];
+	Publish( "pub/n1", QOS_1 );
+	Publish( "pub/n2", QOS_1 );
+	Publish( "pub/n1", QOS_1 );
+	Pump();
+	CHECK( Done == 3 && DoneState == MQTTSN_STATE_OK && Sent[MQTTSN_TYPE_REGISTER] == regs + 2 );
+
+	// A blocking publish waits for a free entry
+	for ( uint8_t i = 0; i < MQTTSN_MAX_INFLIGHT; i++ )
+	{
+		Publish( "pub/x", QOS_1 );
+	}
+	CHECK( PublishRowdataByName( (uint8_t*)"pub/x", Data, sizeof(Data), QOS_1, false ) == MQTTSN_STATE_OK );
+	Pump();
+	CHECK( LostAcks == 0 && GetOfflineCount() == 0 );
+
+	// A PUBLISH of the gateway, the reply of OnPublish goes in the frame of the PUBACK
+	Done = 0;
+	CHECK( SubscribeByNameAsync( (uint8_t*)"sub/a", OnPublish, QOS_1, OnDone ) != 0 );
+	Pump();
+	CHECK( Done == 1 && DoneState == MQTTSN_STATE_OK );
+	Done = 0;
+	Reply = true;
+	AggFrames = 0;
+	pubs = Sent[MQTTSN_TYPE_PUBLISH];
+	MQTTSNWaitResponse( MQTTSN_TYPE_PUBLISH );
+	Respond( (uint8_t[]){ 11, MQTTSN_TYPE_PUBLISH, QOS_1, 0x02, 0x02, 0x40, 0x01, 1, 2, 3, 4 }, HostTime );
+	Pump();
+	Reply = false;
+	CHECK( Done == 1 && DoneState == MQTTSN_STATE_OK && Sent[MQTTSN_TYPE_PUBLISH] == pubs + 1 );
+	CHECK( AggFrames == 1 && AggTypes[0] == MQTTSN_TYPE_PUBACK && AggTypes[1] == MQTTSN_TYPE_PUBLISH );
+	CHECK( LostAcks == 0 );
+
+	Throughput( 0 );
+	Throughput( 8 );
+	CHECK( GetOfflineCount() == 0 );
+	return HostResult( "TestPublish" );
+}
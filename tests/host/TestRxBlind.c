@@ -0,0 +1,188 @@
+/**************************************************************************************
+ *
+ * TestRxBlind.c
+ *
+ * Back-to-back uplinks into the Rx modem. A frame is received when the radio listens
+ * from at most 4 preamble symbols after the preamble starts. The gateway Rx is run
+ * against the restart path LoRaLink.c took before it: sleep after each frame, then
+ * RX_INIT, SetRxConfig() and SX1276SetRx(). The simulated radio charges CONFIG_US for
+ * the Rx configuration and WAKEUP_US for the TCXO after the sleep, the CPU time of the
+ * modem is not counted.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include <setjmp.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+
+#define PANID         0x0102
+#define GW_ADDR       0xFE
+#define FRAMES        1000
+#define PAYLOAD_LEN   20
+#define LOCK_SYMBOLS  4
+
+#define CONFIG_US     600
+#define WAKEUP_US     5000
+
+extern void LoRaLinkInitilize( void );
+extern volatile LoRaLinkDeviceStatus_t DeviceStatus;
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+static jmp_buf Done;
+static uint32_t Sent = 0;
+static uint32_t Lost = 0;
+static uint32_t TimeOnAir = 0;
+static uint32_t Gap = 0;
+static TimerTime_t FirstStart = 0;
+static uint32_t LockTime = 0;
+static bool Restart = false;
+static TimerTime_t FrameEnd = 0;
+static TimerTime_t RxSince = 0;
+static uint32_t Blind = 0;
+
+/*
+ * The restart path: LoRaLink.c takes the radio for idle after each frame as before the
+ * gateway Rx, it sleeps the radio and sets Rx up again
+ */
+RadioState_t __real_SX1276GetStatus( void );
+RadioState_t __wrap_SX1276GetStatus( void )
+{
+	RadioState_t state = __real_SX1276GetStatus();
+
+	return ( Restart == true && state == RF_RX_RUNNING ) ? RF_IDLE : state;
+}
+
+/*
+ * A pass of the main loop, the clock moves on only while the modem sleeps
+ */
+static void Poll( void )
+{
+	TimerTime_t start = FirstStart + Sent * ( TimeOnAir + Gap );
+	TimerTime_t timer = 0;
+	uint8_t payload[PAYLOAD_LEN];
+	uint8_t frame[64];
+	uint8_t len = 0;
+
+	if ( DeviceStatus != DEVICE_STATE_SLEEP )
+	{
+		return;
+	}
+	if ( HostRadio.RxSince != RxSince )
+	{
+		// Rx set up again after the last frame
+		RxSince = HostRadio.RxSince;
+		Blind += Sent > 0 ? RxSince - FrameEnd : 0;
+	}
+	if ( Sent == FRAMES )
+	{
+		longjmp( Done, 1 );
+	}
+	if ( HostNextTimer( &timer ) == true && (int32_t)( timer - ( start + TimeOnAir ) ) < 0 )
+	{
+		HostRunNext();
+		return;
+	}
+
+	HostRunUntil( start + TimeOnAir );
+	memset( payload, Sent & 0xFF, sizeof(payload) );
+	payload[0] = Sent >> 8;
+	len = HostRadioFrame( frame, PANID, GW_ADDR, 1 + Sent % 8, MQTT_SN, payload, sizeof(payload) );
+	if ( HostRadio.State != RF_RX_RUNNING || (int32_t)( HostRadio.RxSince - ( start + LockTime ) ) > 0 ||
+	     HostRadioReceive( frame, len, -70, 7 ) == false )
+	{
+		Lost++;
+	}
+	else
+	{
+		FrameEnd = HostTime;
+	}
+	Sent++;
+}
+
+typedef struct
+{
+	uint32_t Lost;
+	uint32_t Blind;       // ms from the end of a frame to the receiver listening again
+	uint32_t Restarts;    // SX1276SetRx() after the first one
+	uint32_t Received;
+	uint32_t QueueRestarts;   // by LoRaLinkGetRxQueueStats()
+	uint32_t QueueBlind;
+}Result_t;
+
+static void Run( LoRaLinkSf_t sf, uint32_t gap, bool restart, Result_t* result )
+{
+	LoRaLinkRxQueueStats_t before = { 0 };
+	LoRaLinkRxQueueStats_t stats = { 0 };
+
+	HostReset( 1000 );
+	HostRadioInit();
+	HostRadio.ConfigUs = CONFIG_US;
+	HostRadio.WakeUpUs = WAKEUP_US;
+	LoRaLinkInitilize();
+	Restart = restart;
+	Gap = gap;
+	Sent = 0;
+	Lost = 0;
+	Blind = 0;
+	RxSince = 0;
+	FirstStart = 2000;
+	LoRaLinkGetRxQueueStats( &before );
+	HostUartPollHook = Poll;
+	if ( setjmp( Done ) == 0 )
+	{
+		LoRaLinkUart( Key, PANID, GW_ADDR, LORALINK_UART_RX, 0x55, 40, 46, sf, NULL );
+	}
+	HostUartPollHook = NULL;
+	Restart = false;
+
+	LoRaLinkGetRxQueueStats( &stats );
+	CHECK( stats.Overflow == before.Overflow );
+	result->Lost = Lost;
+	result->Blind = Blind;
+	result->Restarts = HostRadio.RxStarts - 1;
+	result->Received = stats.Received - before.Received;
+	result->QueueRestarts = stats.Restarts - before.Restarts;
+	result->QueueBlind = stats.BlindTime - before.BlindTime;
+}
+
+int main( void )
+{
+	LoRaLinkStats_t link = { 0 };
+	uint32_t setup = ( CONFIG_US + WAKEUP_US + 999 ) / 1000;
+	Result_t gw = { 0 };
+	Result_t rs = { 0 };
+	uint32_t gaps[3] = { 0, 1, 2 };
+
+	for ( uint8_t sf = SF_7; sf <= SF_9; sf++ )
+	{
+		TimeOnAir = HostTimeOnAir( 0, sf, 1, 8, false, true, LORALINK_HDR_LEN + PAYLOAD_LEN + LORALINK_MIC_LEN );
+		LockTime = LOCK_SYMBOLS * ( 1UL << sf ) / 125;
+		printf( "SF%u airtime %u ms, lock limit %u ms          lost   blind ms  restarts\n", sf, TimeOnAir, LockTime );
+
+		for ( uint8_t g = 0; g < 3; g++ )
+		{
+			Run( sf, gaps[g], true, &rs );
+			Run( sf, gaps[g], false, &gw );
+			LoRaLinkGetStats( &link );
+
+			printf( "  gap %u ms  sleep and restart Rx   %5.1f%%  %9u  %8u\n", gaps[g], 100.0 * rs.Lost / FRAMES, rs.Blind, rs.Restarts );
+			printf( "            gateway Rx             %5.1f%%  %9u  %8u\n", 100.0 * gw.Lost / FRAMES, gw.Blind, gw.Restarts );
+
+			// Every frame received, the radio never left Rx
+			CHECK( gw.Lost == 0 && gw.Received == FRAMES && gw.Restarts == 0 && gw.Blind == 0 );
+			CHECK( link.Counters[LORALINK_STATS_RX_FRAMES] == FRAMES );
+			CHECK( gw.QueueRestarts == 0 && gw.QueueBlind == 0 );
+
+			// A restart for each frame received, the next one is lost when the setup outlasts the gap and 4 symbols
+			CHECK( rs.Received == FRAMES - rs.Lost && rs.Restarts == rs.Received && rs.QueueRestarts == rs.Received );
+			CHECK( rs.Blind == rs.Restarts * setup );
+			CHECK( ( rs.Lost > 0 ) == ( setup > gaps[g] + LockTime ) );
+		}
+	}
+	return HostResult( "TestRxBlind" );
+}
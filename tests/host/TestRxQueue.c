@@ -0,0 +1,105 @@
+/**************************************************************************************
+ *
+ * TestRxQueue.c
+ *
+ * Frames received while the main loop is busy wait in the Rx queue, in order and intact.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "LoRaLink.h"
+
+#define PANID      0x0102
+#define NODE_ADDR  0x12
+#define GW_ADDR    0xFE
+
+extern void LoRaLinkInitilize( void );
+
+static uint8_t Key[16] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38 };
+
+/*
+ * Frame number n from the gateway, 20 bytes of n
+ */
+static bool Receive( uint8_t n )
+{
+	uint8_t payload[20];
+	uint8_t frame[64];
+	uint8_t len = 0;
+
+	memset( payload, n, sizeof(payload) );
+	len = HostRadioFrame( frame, PANID, NODE_ADDR, GW_ADDR, MQTT_SN, payload, sizeof(payload) );
+	return HostRadioReceive( frame, len, -60 - n, 5 );
+}
+
+static bool IsFrame( LoRaLinkPacket_t* pkt, uint8_t n )
+{
+	uint8_t payload[20];
+
+	memset( payload, n, sizeof(payload) );
+	return pkt->FRMPayloadSize == sizeof(payload) && memcmp( pkt->FRMPayload, payload, sizeof(payload) ) == 0 &&
+	       pkt->SourceAddr == GW_ADDR && (int16_t)pkt->Rssi == -60 - n;
+}
+
+int main( void )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	LoRaLinkRxQueueStats_t stats = { 0 };
+	LoRaLinkStats_t link = { 0 };
+	uint8_t shortFrame[5] = { 0x01, 0x02, NODE_ADDR, GW_ADDR, MQTT_SN };
+
+	HostReset( 1000 );
+	HostRadioInit();
+	LoRaLinkInitilize();
+	CHECK( LoRaLinkDeviceInit( Key, PANID, NODE_ADDR, 0x55, 40, 46, SF_9, 13, NULL, NULL ) == LORALINK_STATUS_OK );
+
+	// Three frames back to back before the main loop takes the first
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	CHECK( Receive( 1 ) && Receive( 2 ) && Receive( 3 ) );
+	for ( uint8_t n = 1; n <= 3; n++ )
+	{
+		CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK && IsFrame( &pkt, n ) );
+	}
+	LoRaLinkGetRxQueueStats( &stats );
+	CHECK( stats.Received == 3 && stats.Overflow == 0 && stats.HighWater == 3 );
+
+	// A full queue drops the newest frames and counts them
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	for ( uint8_t n = 4; n < 4 + LORALINK_RX_QUEUE_DEPTH + 2; n++ )
+	{
+		Receive( n );
+	}
+	for ( uint8_t n = 4; n < 4 + LORALINK_RX_QUEUE_DEPTH; n++ )
+	{
+		CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK && IsFrame( &pkt, n ) );
+	}
+	LoRaLinkGetRxQueueStats( &stats );
+	CHECK( stats.Overflow == 2 && stats.HighWater == LORALINK_RX_QUEUE_DEPTH );
+
+	// A frame shorter than the header and the MIC is dropped, the wait goes on until the timeout
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	HostRadioReceive( shortFrame, sizeof(shortFrame), -60, 5 );
+	CHECK( LoRaLinkRecvPacket( &pkt, 5000 ) == LORALINK_STATUS_RX_TIMEOUT );
+	LoRaLinkGetStats( &link );
+	CHECK( link.Counters[LORALINK_STATS_RX_MALFORMED] == 1 && link.Counters[LORALINK_STATS_RX_FRAMES] == 3 + LORALINK_RX_QUEUE_DEPTH );
+
+	// A frame heard twice is dropped, or delivered and counted when flagged
+	LoRaLinkSetDupFilter( LORALINK_DUP_DROP, 40000 );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	CHECK( Receive( 50 ) && Receive( 50 ) );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK && IsFrame( &pkt, 50 ) );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_BUSY );
+	LoRaLinkSetDupFilter( LORALINK_DUP_FLAG, 40000 );
+	CHECK( Receive( 51 ) && Receive( 51 ) );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK && IsFrame( &pkt, 51 ) );
+	CHECK( LoRaLinkRecvPoll( &pkt, 5000 ) == LORALINK_STATUS_OK && IsFrame( &pkt, 51 ) );
+	LoRaLinkGetStats( &link );
+	CHECK( link.Counters[LORALINK_STATS_RX_DUP_HIT] == 2 );
+
+	printf( "received %u, overflow %u, high water %u of %u\n", stats.Received, stats.Overflow, stats.HighWater, stats.Depth );
+	return HostResult( "TestRxQueue" );
+}
@@ -0,0 +1,119 @@
+/**************************************************************************************
+ *
+ * TestTimeOnAir.c
+ *
+ * SX1276GetLoRaTimeOnAir() of the driver against the floating point formula it replaced,
+ * bit for bit over every modem setting and length, and the time both take on the host.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <time.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "sx1276.h"
+#include "sx1276-device.h"
+#include "gpio.h"
+#include "spi.h"
+
+#define BENCH_ROUNDS   20
+
+/*
+ * Board functions of the driver, no register is read in the test
+ */
+uint16_t SpiInOut( Spi_t *obj, uint16_t outData )
+{
+	return 0;
+}
+
+void GpioWrite( Gpio_t *obj, uint32_t value )
+{
+}
+
+void SX1276IoIrqInit( DioIrqHandler **irqHandlers )
+{
+}
+
+void SX1276Reset( void )
+{
+}
+
+void SX1276SetRfTxPower( int8_t power )
+{
+}
+
+void SX1276SetAntSwLowPower( bool status )
+{
+}
+
+void SX1276SetAntSw( uint8_t opMode )
+{
+}
+
+void SX1276SetDeviceTcxo( uint8_t state )
+{
+}
+
+static double Seconds( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( void )
+{
+	uint32_t cases = 0;
+	uint32_t mismatch = 0;
+	uint32_t toa = 0;
+	uint32_t ref = 0;
+	volatile uint32_t sink = 0;
+	double t0 = 0;
+	double tInt = 0;
+	double tDouble = 0;
+
+	for ( uint32_t bw = 0; bw < 3; bw++ )
+	for ( uint32_t sf = 6; sf <= 12; sf++ )
+	for ( uint8_t cr = 1; cr <= 4; cr++ )
+	for ( uint16_t pre = 4; pre <= 16; pre++ )
+	for ( uint8_t fix = 0; fix < 2; fix++ )
+	for ( uint8_t crc = 0; crc < 2; crc++ )
+	for ( uint16_t len = 0; len < 256; len++ )
+	{
+		toa = SX1276GetLoRaTimeOnAir( bw, sf, cr, pre, fix, crc, len );
+		ref = HostTimeOnAir( bw, sf, cr, pre, fix, crc, len );
+		if ( toa != ref && mismatch++ < 5 )
+		{
+			printf( "BW%u SF%u CR%u preamble %u fix %u crc %u length %u: %u, formula %u\n",
+			        bw, sf, cr, pre, fix, crc, len, toa, ref );
+		}
+		cases++;
+	}
+	CHECK( cases == 1118208 && mismatch == 0 );
+	printf( "%u cases, %u mismatches\n", cases, mismatch );
+
+	// 125 kHz, SF7..12, CR 4/5, 8 symbols, explicit header, CRC, lengths 0..255
+	t0 = Seconds();
+	for ( uint32_t n = 0; n < BENCH_ROUNDS; n++ )
+	for ( uint32_t sf = 7; sf <= 12; sf++ )
+	for ( uint16_t len = 0; len < 256; len++ )
+	{
+		sink += SX1276GetLoRaTimeOnAir( 0, sf, 1, 8, false, true, len );
+	}
+	tInt = Seconds() - t0;
+	t0 = Seconds();
+	for ( uint32_t n = 0; n < BENCH_ROUNDS; n++ )
+	for ( uint32_t sf = 7; sf <= 12; sf++ )
+	for ( uint16_t len = 0; len < 256; len++ )
+	{
+		sink += HostTimeOnAir( 0, sf, 1, 8, false, true, len );
+	}
+	tDouble = Seconds() - t0;
+	printf( "host: integer %.1f ns, double %.1f ns per call (the host has an FPU, the Cortex-M0+ does not)\n",
+	        tInt * 1e9 / ( BENCH_ROUNDS * 6 * 256 ), tDouble * 1e9 / ( BENCH_ROUNDS * 6 * 256 ) );
+
+	return HostResult( "TestTimeOnAir" );
+}
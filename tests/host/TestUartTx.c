@@ -0,0 +1,157 @@
+/**************************************************************************************
+ *
+ * TestUartTx.c
+ *
+ * Rx frames of the RX modem to the host through LoRaEz/uart.c on a simulated USART1,
+ * a byte by each TC interrupt as before and by DMA. For each payload and baudrate:
+ * the latency from RxDone to the last byte of the API frame on the wire, the radio
+ * blind time from RxDone to the re-armed receiver, and the interrupts per frame.
+ * The blind time is CPU time of the main loop, stretched by the interrupts which
+ * come meanwhile, STAGE_US and REARM_US are its parts before and after the frame is
+ * queued to the UART.
+ *
+ * copyright Revised BSD License, see section \ref LICENSE
+ *
+ * copyright (c) 2020, Tomoaki Yamaguchi   tomoaki@tomy-tech.com
+ *
+ **************************************************************************************/
+#include <string.h>
+#include "HostStub.h"
+#include "HostRadio.h"
+#include "HostUsart.h"
+#include "LoRaLinkApi.h"
+#include "uart.h"
+#include "fifo.h"
+#include "device-config.h"
+
+#define FRAMES     50
+#define STAGE_US   100      // RxDone, the frame decoded and escaped into the staging buffer
+#define REARM_US   300      // Rx configuration and SX1276SetRx() over SPI
+
+Uart_t Uart;
+
+static uint8_t TxBuffer[2048];
+static uint8_t RxBuffer[1024];
+static uint32_t FrameEnd[FRAMES];
+static uint32_t RxDone[FRAMES];
+static uint32_t Latency = 0;
+static uint32_t Done = 0;
+static uint32_t Hash = 0;
+
+typedef struct
+{
+	uint32_t Latency;    // us, mean of the frames
+	uint32_t Blind;      // us, mean of the frames
+	uint32_t Irqs;       // for each frame
+	uint32_t Bytes;
+	uint32_t Hash;
+}Result_t;
+
+/*
+ * Byte on the wire, the last one of a frame ends its latency
+ */
+static void OnByte( uint8_t data )
+{
+	Hash = Hash * 31 + data;
+	if ( Done < FRAMES && HostUsart.TxBytes == FrameEnd[Done] )
+	{
+		Latency += HostUsart.Us - RxDone[Done];
+		Done++;
+	}
+}
+
+static uint16_t Queued( void )
+{
+	return ( Uart.FifoTx.End + Uart.FifoTx.Size - Uart.FifoTx.Begin ) % Uart.FifoTx.Size;
+}
+
+/*
+ * Frames back to back at SF7, each one as soon as the previous one is on the air
+ */
+static void Run( uint8_t len, uint32_t baudrate, bool dma, Result_t* result )
+{
+	LoRaLinkPacket_t pkt = { 0 };
+	LoRaLinkRxMeta_t meta = { 0 };
+	uint8_t payload[LORA_PHY_MAXPAYLOAD];
+	uint32_t toa = HostTimeOnAir( 0, 7, 1, 8, false, true, len + 9 ) * 1000;
+	uint32_t bytes = 0;
+	uint32_t blind = 0;
+	uint16_t before = 0;
+
+	HostReset( 1000 );
+	HostUsartInit( baudrate );
+	HostUsartTxHook = OnByte;
+	FifoInit( &Uart.FifoTx, TxBuffer, sizeof(TxBuffer) );
+	FifoInit( &Uart.FifoRx, RxBuffer, sizeof(RxBuffer) );
+	UartDeInit( &Uart );
+	UartInit( &Uart, UART_1, UART1_TX, UART1_RX );
+	UartConfig( &Uart, RX_TX, baudrate, UART_8_BIT, UART_1_STOP_BIT, NO_PARITY, NO_FLOW_CTRL );
+	if ( dma == true )
+	{
+		CHECK( UartStartTxDma() == 0 );
+	}
+	Latency = 0;
+	Done = 0;
+	Hash = 0;
+
+	pkt.PanId = 0x0102;
+	pkt.DestAddr = 0xFE;
+	pkt.SourceAddr = 0x12;
+	pkt.Rssi = -80;
+	pkt.Snr = 5;
+	pkt.FRMPayloadType = MQTT_SN;
+	pkt.FRMPayload = payload;
+	pkt.FRMPayloadSize = len;
+
+	for ( uint32_t n = 0; n < FRAMES; n++ )
+	{
+		// Frame delimiter and escape bytes in the payload
+		for ( uint8_t i = 0; i < len; i++ )
+		{
+			payload[i] = (uint8_t)( n + i * 0x3F );
+		}
+		RxDone[n] = HostUsart.Us;
+		HostUsartRun( STAGE_US );
+		before = Queued();
+		meta.Counter = n;
+		LoRaLinkApiWriteRx( &pkt, &meta );
+		bytes += Queued() - before;
+		FrameEnd[n] = bytes;
+		HostUsartRun( REARM_US );
+		blind += HostUsart.Us - RxDone[n];
+		HostUsartRunUntil( RxDone[n] + toa );
+	}
+	HostUsartRunUntil( HostUsart.Us + 100000 );
+
+	CHECK( Done == FRAMES && HostUsart.TxBytes == bytes );
+	result->Latency = Latency / FRAMES;
+	result->Blind = blind / FRAMES;
+	result->Irqs = HostUsart.Irqs / FRAMES;
+	result->Bytes = bytes / FRAMES;
+	result->Hash = Hash;
+}
+
+int main( void )
+{
+	uint8_t lens[] = { 16, 64, 244 };
+	uint32_t bauds[] = { 115200, 921600 };
+	Result_t it = { 0 };
+	Result_t dma = { 0 };
+
+	printf( "payload    baud  bytes   latency us: TC    DMA   blind us: TC   DMA   irqs/frame: TC   DMA\n" );
+	for ( uint8_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++ )
+	{
+		for ( uint8_t l = 0; l < sizeof(lens); l++ )
+		{
+			Run( lens[l], bauds[b], false, &it );
+			Run( lens[l], bauds[b], true, &dma );
+			printf( "%7u %7u %6u %15u %6u %12u %5u %15u %5u\n", lens[l], bauds[b], it.Bytes,
+			        it.Latency, dma.Latency, it.Blind, dma.Blind, it.Irqs, dma.Irqs );
+
+			// Same bytes on the wire, without a gap between them and without an interrupt for each
+			CHECK( it.Bytes == dma.Bytes && it.Hash == dma.Hash );
+			CHECK( dma.Latency < it.Latency && dma.Blind <= it.Blind && dma.Irqs <= 2 );
+		}
+	}
+	return HostResult( "TestUartTx" );
+}